@@ -0,0 +1,548 @@
+// Generated by isagen from src/isa.tbl; edit the table instead
+#include <stdio.h>
+#include "isa.h"
+
+const IsaInfo isa_info[NUM_OPS] = {
+    [OP_INVALID] = { "invalid", 0, 0, FORMAT_NONE, 0 },
+    [OP_LUI] = { "lui", 0x00000037, 0x0000007f, FORMAT_U, ISA_WRITES_RD },
+    [OP_AUIPC] = { "auipc", 0x00000017, 0x0000007f, FORMAT_U, ISA_WRITES_RD },
+    [OP_JAL] = { "jal", 0x0000006f, 0x0000007f, FORMAT_J, ISA_JUMP | ISA_WRITES_RD },
+    [OP_JALR] = { "jalr", 0x00000067, 0x0000707f, FORMAT_JALR, ISA_JUMP | ISA_WRITES_RD },
+    [OP_BEQ] = { "beq", 0x00000063, 0x0000707f, FORMAT_B, ISA_BRANCH },
+    [OP_BNE] = { "bne", 0x00001063, 0x0000707f, FORMAT_B, ISA_BRANCH },
+    [OP_BLT] = { "blt", 0x00004063, 0x0000707f, FORMAT_B, ISA_BRANCH },
+    [OP_BGE] = { "bge", 0x00005063, 0x0000707f, FORMAT_B, ISA_BRANCH },
+    [OP_BLTU] = { "bltu", 0x00006063, 0x0000707f, FORMAT_B, ISA_BRANCH },
+    [OP_BGEU] = { "bgeu", 0x00007063, 0x0000707f, FORMAT_B, ISA_BRANCH },
+    [OP_LB] = { "lb", 0x00000003, 0x0000707f, FORMAT_LOAD, ISA_LOAD | ISA_WRITES_RD },
+    [OP_LH] = { "lh", 0x00001003, 0x0000707f, FORMAT_LOAD, ISA_LOAD | ISA_WRITES_RD },
+    [OP_LW] = { "lw", 0x00002003, 0x0000707f, FORMAT_LOAD, ISA_LOAD | ISA_WRITES_RD },
+    [OP_LD] = { "ld", 0x00003003, 0x0000707f, FORMAT_LOAD, ISA_LOAD | ISA_WRITES_RD },
+    [OP_LBU] = { "lbu", 0x00004003, 0x0000707f, FORMAT_LOAD, ISA_LOAD | ISA_WRITES_RD },
+    [OP_LHU] = { "lhu", 0x00005003, 0x0000707f, FORMAT_LOAD, ISA_LOAD | ISA_WRITES_RD },
+    [OP_LWU] = { "lwu", 0x00006003, 0x0000707f, FORMAT_LOAD, ISA_LOAD | ISA_WRITES_RD },
+    [OP_SB] = { "sb", 0x00000023, 0x0000707f, FORMAT_S, ISA_STORE },
+    [OP_SH] = { "sh", 0x00001023, 0x0000707f, FORMAT_S, ISA_STORE },
+    [OP_SW] = { "sw", 0x00002023, 0x0000707f, FORMAT_S, ISA_STORE },
+    [OP_SD] = { "sd", 0x00003023, 0x0000707f, FORMAT_S, ISA_STORE },
+    [OP_ADDI] = { "addi", 0x00000013, 0x0000707f, FORMAT_I, ISA_WRITES_RD },
+    [OP_SLTI] = { "slti", 0x00002013, 0x0000707f, FORMAT_I, ISA_WRITES_RD },
+    [OP_SLTIU] = { "sltiu", 0x00003013, 0x0000707f, FORMAT_I, ISA_WRITES_RD },
+    [OP_XORI] = { "xori", 0x00004013, 0x0000707f, FORMAT_I, ISA_WRITES_RD },
+    [OP_ORI] = { "ori", 0x00006013, 0x0000707f, FORMAT_I, ISA_WRITES_RD },
+    [OP_ANDI] = { "andi", 0x00007013, 0x0000707f, FORMAT_I, ISA_WRITES_RD },
+    [OP_SLLI] = { "slli", 0x00001013, 0xfc00707f, FORMAT_SHIFT, ISA_WRITES_RD },
+    [OP_SRLI] = { "srli", 0x00005013, 0xfc00707f, FORMAT_SHIFT, ISA_WRITES_RD },
+    [OP_SRAI] = { "srai", 0x40005013, 0xfc00707f, FORMAT_SHIFT, ISA_WRITES_RD },
+    [OP_ADD] = { "add", 0x00000033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_SUB] = { "sub", 0x40000033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_SLL] = { "sll", 0x00001033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_SLT] = { "slt", 0x00002033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_SLTU] = { "sltu", 0x00003033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_XOR] = { "xor", 0x00004033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_SRL] = { "srl", 0x00005033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_SRA] = { "sra", 0x40005033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_OR] = { "or", 0x00006033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_AND] = { "and", 0x00007033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_ADDIW] = { "addiw", 0x0000001b, 0x0000707f, FORMAT_I, ISA_WRITES_RD },
+    [OP_SLLIW] = { "slliw", 0x0000101b, 0xfe00707f, FORMAT_SHIFT, ISA_WRITES_RD },
+    [OP_SRLIW] = { "srliw", 0x0000501b, 0xfe00707f, FORMAT_SHIFT, ISA_WRITES_RD },
+    [OP_SRAIW] = { "sraiw", 0x4000501b, 0xfe00707f, FORMAT_SHIFT, ISA_WRITES_RD },
+    [OP_ADDW] = { "addw", 0x0000003b, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_SUBW] = { "subw", 0x4000003b, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_SLLW] = { "sllw", 0x0000103b, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_SRLW] = { "srlw", 0x0000503b, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_SRAW] = { "sraw", 0x4000503b, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_FENCE] = { "fence", 0x0000000f, 0x0000707f, FORMAT_NONE, 0 },
+    [OP_MUL] = { "mul", 0x02000033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_MULH] = { "mulh", 0x02001033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_MULHSU] = { "mulhsu", 0x02002033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_MULHU] = { "mulhu", 0x02003033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_DIV] = { "div", 0x02004033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_DIVU] = { "divu", 0x02005033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_REM] = { "rem", 0x02006033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_REMU] = { "remu", 0x02007033, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_MULW] = { "mulw", 0x0200003b, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_DIVW] = { "divw", 0x0200403b, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_DIVUW] = { "divuw", 0x0200503b, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_REMW] = { "remw", 0x0200603b, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_REMUW] = { "remuw", 0x0200703b, 0xfe00707f, FORMAT_R, ISA_WRITES_RD },
+    [OP_LR_W] = { "lr.w", 0x1000202f, 0xf9f0707f, FORMAT_LR, ISA_LOAD | ISA_WRITES_RD },
+    [OP_SC_W] = { "sc.w", 0x1800202f, 0xf800707f, FORMAT_AMO, ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOSWAP_W] = { "amoswap.w", 0x0800202f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOADD_W] = { "amoadd.w", 0x0000202f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOXOR_W] = { "amoxor.w", 0x2000202f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOAND_W] = { "amoand.w", 0x6000202f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOOR_W] = { "amoor.w", 0x4000202f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOMIN_W] = { "amomin.w", 0x8000202f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOMAX_W] = { "amomax.w", 0xa000202f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOMINU_W] = { "amominu.w", 0xc000202f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOMAXU_W] = { "amomaxu.w", 0xe000202f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_LR_D] = { "lr.d", 0x1000302f, 0xf9f0707f, FORMAT_LR, ISA_LOAD | ISA_WRITES_RD },
+    [OP_SC_D] = { "sc.d", 0x1800302f, 0xf800707f, FORMAT_AMO, ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOSWAP_D] = { "amoswap.d", 0x0800302f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOADD_D] = { "amoadd.d", 0x0000302f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOXOR_D] = { "amoxor.d", 0x2000302f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOAND_D] = { "amoand.d", 0x6000302f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOOR_D] = { "amoor.d", 0x4000302f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOMIN_D] = { "amomin.d", 0x8000302f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOMAX_D] = { "amomax.d", 0xa000302f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOMINU_D] = { "amominu.d", 0xc000302f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_AMOMAXU_D] = { "amomaxu.d", 0xe000302f, 0xf800707f, FORMAT_AMO, ISA_LOAD | ISA_STORE | ISA_WRITES_RD },
+    [OP_CSRRW] = { "csrrw", 0x00001073, 0x0000707f, FORMAT_CSR, ISA_SYSTEM | ISA_WRITES_RD },
+    [OP_CSRRS] = { "csrrs", 0x00002073, 0x0000707f, FORMAT_CSR, ISA_SYSTEM | ISA_WRITES_RD },
+    [OP_CSRRC] = { "csrrc", 0x00003073, 0x0000707f, FORMAT_CSR, ISA_SYSTEM | ISA_WRITES_RD },
+    [OP_CSRRWI] = { "csrrwi", 0x00005073, 0x0000707f, FORMAT_CSRI, ISA_SYSTEM | ISA_WRITES_RD },
+    [OP_CSRRSI] = { "csrrsi", 0x00006073, 0x0000707f, FORMAT_CSRI, ISA_SYSTEM | ISA_WRITES_RD },
+    [OP_CSRRCI] = { "csrrci", 0x00007073, 0x0000707f, FORMAT_CSRI, ISA_SYSTEM | ISA_WRITES_RD },
+    [OP_ECALL] = { "ecall", 0x00000073, 0xffffffff, FORMAT_NONE, ISA_SYSTEM },
+    [OP_EBREAK] = { "ebreak", 0x00100073, 0xffffffff, FORMAT_NONE, ISA_SYSTEM },
+    [OP_MRET] = { "mret", 0x30200073, 0xffffffff, FORMAT_NONE, ISA_SYSTEM },
+};
+
+Op decode_op(uint32_t raw_instr) {
+    switch (raw_instr & 0x7f) {
+        case 0x3:
+            switch ((raw_instr >> 12) & 0x7) {
+                case 0x0:
+                    return OP_LB;
+                case 0x1:
+                    return OP_LH;
+                case 0x2:
+                    return OP_LW;
+                case 0x3:
+                    return OP_LD;
+                case 0x4:
+                    return OP_LBU;
+                case 0x5:
+                    return OP_LHU;
+                case 0x6:
+                    return OP_LWU;
+                default:
+                    return OP_INVALID;
+            }
+        case 0xf:
+            return (raw_instr & 0x00007000) == 0x00000000 ? OP_FENCE : OP_INVALID;
+        case 0x13:
+            switch ((raw_instr >> 12) & 0x7) {
+                case 0x0:
+                    return OP_ADDI;
+                case 0x1:
+                    return (raw_instr & 0xfc000000) == 0x00000000 ? OP_SLLI : OP_INVALID;
+                case 0x2:
+                    return OP_SLTI;
+                case 0x3:
+                    return OP_SLTIU;
+                case 0x4:
+                    return OP_XORI;
+                case 0x5:
+                    switch ((raw_instr >> 26) & 0x3f) {
+                        case 0x0:
+                            return OP_SRLI;
+                        case 0x10:
+                            return OP_SRAI;
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x6:
+                    return OP_ORI;
+                case 0x7:
+                    return OP_ANDI;
+                default:
+                    return OP_INVALID;
+            }
+        case 0x17:
+            return OP_AUIPC;
+        case 0x1b:
+            switch ((raw_instr >> 12) & 0x7) {
+                case 0x0:
+                    return OP_ADDIW;
+                case 0x1:
+                    return (raw_instr & 0xfe000000) == 0x00000000 ? OP_SLLIW : OP_INVALID;
+                case 0x5:
+                    switch ((raw_instr >> 25) & 0x7f) {
+                        case 0x0:
+                            return OP_SRLIW;
+                        case 0x20:
+                            return OP_SRAIW;
+                        default:
+                            return OP_INVALID;
+                    }
+                default:
+                    return OP_INVALID;
+            }
+        case 0x23:
+            switch ((raw_instr >> 12) & 0x7) {
+                case 0x0:
+                    return OP_SB;
+                case 0x1:
+                    return OP_SH;
+                case 0x2:
+                    return OP_SW;
+                case 0x3:
+                    return OP_SD;
+                default:
+                    return OP_INVALID;
+            }
+        case 0x2f:
+            switch ((raw_instr >> 12) & 0x7) {
+                case 0x2:
+                    switch ((raw_instr >> 27) & 0x1f) {
+                        case 0x0:
+                            return OP_AMOADD_W;
+                        case 0x1:
+                            return OP_AMOSWAP_W;
+                        case 0x2:
+                            return (raw_instr & 0x01f00000) == 0x00000000 ? OP_LR_W : OP_INVALID;
+                        case 0x3:
+                            return OP_SC_W;
+                        case 0x4:
+                            return OP_AMOXOR_W;
+                        case 0x8:
+                            return OP_AMOOR_W;
+                        case 0xc:
+                            return OP_AMOAND_W;
+                        case 0x10:
+                            return OP_AMOMIN_W;
+                        case 0x14:
+                            return OP_AMOMAX_W;
+                        case 0x18:
+                            return OP_AMOMINU_W;
+                        case 0x1c:
+                            return OP_AMOMAXU_W;
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x3:
+                    switch ((raw_instr >> 27) & 0x1f) {
+                        case 0x0:
+                            return OP_AMOADD_D;
+                        case 0x1:
+                            return OP_AMOSWAP_D;
+                        case 0x2:
+                            return (raw_instr & 0x01f00000) == 0x00000000 ? OP_LR_D : OP_INVALID;
+                        case 0x3:
+                            return OP_SC_D;
+                        case 0x4:
+                            return OP_AMOXOR_D;
+                        case 0x8:
+                            return OP_AMOOR_D;
+                        case 0xc:
+                            return OP_AMOAND_D;
+                        case 0x10:
+                            return OP_AMOMIN_D;
+                        case 0x14:
+                            return OP_AMOMAX_D;
+                        case 0x18:
+                            return OP_AMOMINU_D;
+                        case 0x1c:
+                            return OP_AMOMAXU_D;
+                        default:
+                            return OP_INVALID;
+                    }
+                default:
+                    return OP_INVALID;
+            }
+        case 0x33:
+            switch ((raw_instr >> 12) & 0x7) {
+                case 0x0:
+                    switch ((raw_instr >> 25) & 0x7f) {
+                        case 0x0:
+                            return OP_ADD;
+                        case 0x1:
+                            return OP_MUL;
+                        case 0x20:
+                            return OP_SUB;
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x1:
+                    switch ((raw_instr >> 25) & 0x7f) {
+                        case 0x0:
+                            return OP_SLL;
+                        case 0x1:
+                            return OP_MULH;
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x2:
+                    switch ((raw_instr >> 25) & 0x7f) {
+                        case 0x0:
+                            return OP_SLT;
+                        case 0x1:
+                            return OP_MULHSU;
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x3:
+                    switch ((raw_instr >> 25) & 0x7f) {
+                        case 0x0:
+                            return OP_SLTU;
+                        case 0x1:
+                            return OP_MULHU;
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x4:
+                    switch ((raw_instr >> 25) & 0x7f) {
+                        case 0x0:
+                            return OP_XOR;
+                        case 0x1:
+                            return OP_DIV;
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x5:
+                    switch ((raw_instr >> 25) & 0x7f) {
+                        case 0x0:
+                            return OP_SRL;
+                        case 0x1:
+                            return OP_DIVU;
+                        case 0x20:
+                            return OP_SRA;
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x6:
+                    switch ((raw_instr >> 25) & 0x7f) {
+                        case 0x0:
+                            return OP_OR;
+                        case 0x1:
+                            return OP_REM;
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x7:
+                    switch ((raw_instr >> 25) & 0x7f) {
+                        case 0x0:
+                            return OP_AND;
+                        case 0x1:
+                            return OP_REMU;
+                        default:
+                            return OP_INVALID;
+                    }
+                default:
+                    return OP_INVALID;
+            }
+        case 0x37:
+            return OP_LUI;
+        case 0x3b:
+            switch ((raw_instr >> 12) & 0x7) {
+                case 0x0:
+                    switch ((raw_instr >> 25) & 0x7f) {
+                        case 0x0:
+                            return OP_ADDW;
+                        case 0x1:
+                            return OP_MULW;
+                        case 0x20:
+                            return OP_SUBW;
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x1:
+                    return (raw_instr & 0xfe000000) == 0x00000000 ? OP_SLLW : OP_INVALID;
+                case 0x4:
+                    return (raw_instr & 0xfe000000) == 0x02000000 ? OP_DIVW : OP_INVALID;
+                case 0x5:
+                    switch ((raw_instr >> 25) & 0x7f) {
+                        case 0x0:
+                            return OP_SRLW;
+                        case 0x1:
+                            return OP_DIVUW;
+                        case 0x20:
+                            return OP_SRAW;
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x6:
+                    return (raw_instr & 0xfe000000) == 0x02000000 ? OP_REMW : OP_INVALID;
+                case 0x7:
+                    return (raw_instr & 0xfe000000) == 0x02000000 ? OP_REMUW : OP_INVALID;
+                default:
+                    return OP_INVALID;
+            }
+        case 0x63:
+            switch ((raw_instr >> 12) & 0x7) {
+                case 0x0:
+                    return OP_BEQ;
+                case 0x1:
+                    return OP_BNE;
+                case 0x4:
+                    return OP_BLT;
+                case 0x5:
+                    return OP_BGE;
+                case 0x6:
+                    return OP_BLTU;
+                case 0x7:
+                    return OP_BGEU;
+                default:
+                    return OP_INVALID;
+            }
+        case 0x67:
+            return (raw_instr & 0x00007000) == 0x00000000 ? OP_JALR : OP_INVALID;
+        case 0x6f:
+            return OP_JAL;
+        case 0x73:
+            switch ((raw_instr >> 12) & 0x7) {
+                case 0x0:
+                    switch ((raw_instr >> 7) & 0x1f) {
+                        case 0x0:
+                            switch ((raw_instr >> 15) & 0x1ffff) {
+                                case 0x0:
+                                    return OP_ECALL;
+                                case 0x20:
+                                    return OP_EBREAK;
+                                case 0x6040:
+                                    return OP_MRET;
+                                default:
+                                    return OP_INVALID;
+                            }
+                        default:
+                            return OP_INVALID;
+                    }
+                case 0x1:
+                    return OP_CSRRW;
+                case 0x2:
+                    return OP_CSRRS;
+                case 0x3:
+                    return OP_CSRRC;
+                case 0x5:
+                    return OP_CSRRWI;
+                case 0x6:
+                    return OP_CSRRSI;
+                case 0x7:
+                    return OP_CSRRCI;
+                default:
+                    return OP_INVALID;
+            }
+        default:
+            return OP_INVALID;
+    }
+}
+
+int disassemble(uint32_t raw_instr, char *buf, size_t size) {
+    uint32_t rd = (raw_instr >> 7) & 0x1F, rs1 = (raw_instr >> 15) & 0x1F, rs2 = (raw_instr >> 20) & 0x1F;
+    uint32_t csr = raw_instr >> 20, shamt = (raw_instr >> 20) & 0x3F, upper = raw_instr >> 12;
+    int32_t imm_i = (int32_t)raw_instr >> 20;
+    int32_t imm_s = (int32_t)(raw_instr & 0xFE000000) >> 20 | ((raw_instr >> 7) & 0x1F);
+    int32_t imm_b = (int32_t)(raw_instr & 0x80000000) >> 19 | ((raw_instr << 4) & 0x800) |
+                    ((raw_instr >> 20) & 0x7E0) | ((raw_instr >> 7) & 0x1E);
+    int32_t imm_j = (int32_t)(raw_instr & 0x80000000) >> 11 | (raw_instr & 0xFF000) |
+                    ((raw_instr >> 9) & 0x800) | ((raw_instr >> 20) & 0x7FE);
+    (void)rd; (void)rs1; (void)rs2; (void)csr; (void)shamt; (void)upper;
+    (void)imm_i; (void)imm_s; (void)imm_b; (void)imm_j;
+    Op op = decode_op(raw_instr);
+    const char *name = isa_info[op].name;
+    switch (op) {
+        case OP_FENCE:
+        case OP_ECALL:
+        case OP_EBREAK:
+        case OP_MRET:
+            return snprintf(buf, size, "%s", name);
+        case OP_ADD:
+        case OP_SUB:
+        case OP_SLL:
+        case OP_SLT:
+        case OP_SLTU:
+        case OP_XOR:
+        case OP_SRL:
+        case OP_SRA:
+        case OP_OR:
+        case OP_AND:
+        case OP_ADDW:
+        case OP_SUBW:
+        case OP_SLLW:
+        case OP_SRLW:
+        case OP_SRAW:
+        case OP_MUL:
+        case OP_MULH:
+        case OP_MULHSU:
+        case OP_MULHU:
+        case OP_DIV:
+        case OP_DIVU:
+        case OP_REM:
+        case OP_REMU:
+        case OP_MULW:
+        case OP_DIVW:
+        case OP_DIVUW:
+        case OP_REMW:
+        case OP_REMUW:
+            return snprintf(buf, size, "%s x%u, x%u, x%u", name, rd, rs1, rs2);
+        case OP_ADDI:
+        case OP_SLTI:
+        case OP_SLTIU:
+        case OP_XORI:
+        case OP_ORI:
+        case OP_ANDI:
+        case OP_ADDIW:
+            return snprintf(buf, size, "%s x%u, x%u, %d", name, rd, rs1, imm_i);
+        case OP_SLLI:
+        case OP_SRLI:
+        case OP_SRAI:
+        case OP_SLLIW:
+        case OP_SRLIW:
+        case OP_SRAIW:
+            return snprintf(buf, size, "%s x%u, x%u, %u", name, rd, rs1, shamt);
+        case OP_LB:
+        case OP_LH:
+        case OP_LW:
+        case OP_LD:
+        case OP_LBU:
+        case OP_LHU:
+        case OP_LWU:
+            return snprintf(buf, size, "%s x%u, %d(x%u)", name, rd, imm_i, rs1);
+        case OP_SB:
+        case OP_SH:
+        case OP_SW:
+        case OP_SD:
+            return snprintf(buf, size, "%s x%u, %d(x%u)", name, rs2, imm_s, rs1);
+        case OP_BEQ:
+        case OP_BNE:
+        case OP_BLT:
+        case OP_BGE:
+        case OP_BLTU:
+        case OP_BGEU:
+            return snprintf(buf, size, "%s x%u, x%u, %d", name, rs1, rs2, imm_b);
+        case OP_LUI:
+        case OP_AUIPC:
+            return snprintf(buf, size, "%s x%u, 0x%x", name, rd, upper);
+        case OP_JAL:
+            return snprintf(buf, size, "%s x%u, %d", name, rd, imm_j);
+        case OP_JALR:
+            return snprintf(buf, size, "%s x%u, %d(x%u)", name, rd, imm_i, rs1);
+        case OP_CSRRW:
+        case OP_CSRRS:
+        case OP_CSRRC:
+            return snprintf(buf, size, "%s x%u, 0x%x, x%u", name, rd, csr, rs1);
+        case OP_CSRRWI:
+        case OP_CSRRSI:
+        case OP_CSRRCI:
+            return snprintf(buf, size, "%s x%u, 0x%x, %u", name, rd, csr, rs1);
+        case OP_SC_W:
+        case OP_AMOSWAP_W:
+        case OP_AMOADD_W:
+        case OP_AMOXOR_W:
+        case OP_AMOAND_W:
+        case OP_AMOOR_W:
+        case OP_AMOMIN_W:
+        case OP_AMOMAX_W:
+        case OP_AMOMINU_W:
+        case OP_AMOMAXU_W:
+        case OP_SC_D:
+        case OP_AMOSWAP_D:
+        case OP_AMOADD_D:
+        case OP_AMOXOR_D:
+        case OP_AMOAND_D:
+        case OP_AMOOR_D:
+        case OP_AMOMIN_D:
+        case OP_AMOMAX_D:
+        case OP_AMOMINU_D:
+        case OP_AMOMAXU_D:
+            return snprintf(buf, size, "%s x%u, x%u, (x%u)", name, rd, rs2, rs1);
+        case OP_LR_W:
+        case OP_LR_D:
+            return snprintf(buf, size, "%s x%u, (x%u)", name, rd, rs1);
+        default:
+            return snprintf(buf, size, ".word 0x%08x", raw_instr);
+    }
+}
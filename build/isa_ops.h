@@ -0,0 +1,104 @@
+// Generated by isagen from src/isa.tbl; edit the table instead
+#ifndef ISA_OPS_H
+#define ISA_OPS_H
+
+typedef enum {
+    OP_INVALID,
+    OP_LUI,
+    OP_AUIPC,
+    OP_JAL,
+    OP_JALR,
+    OP_BEQ,
+    OP_BNE,
+    OP_BLT,
+    OP_BGE,
+    OP_BLTU,
+    OP_BGEU,
+    OP_LB,
+    OP_LH,
+    OP_LW,
+    OP_LD,
+    OP_LBU,
+    OP_LHU,
+    OP_LWU,
+    OP_SB,
+    OP_SH,
+    OP_SW,
+    OP_SD,
+    OP_ADDI,
+    OP_SLTI,
+    OP_SLTIU,
+    OP_XORI,
+    OP_ORI,
+    OP_ANDI,
+    OP_SLLI,
+    OP_SRLI,
+    OP_SRAI,
+    OP_ADD,
+    OP_SUB,
+    OP_SLL,
+    OP_SLT,
+    OP_SLTU,
+    OP_XOR,
+    OP_SRL,
+    OP_SRA,
+    OP_OR,
+    OP_AND,
+    OP_ADDIW,
+    OP_SLLIW,
+    OP_SRLIW,
+    OP_SRAIW,
+    OP_ADDW,
+    OP_SUBW,
+    OP_SLLW,
+    OP_SRLW,
+    OP_SRAW,
+    OP_FENCE,
+    OP_MUL,
+    OP_MULH,
+    OP_MULHSU,
+    OP_MULHU,
+    OP_DIV,
+    OP_DIVU,
+    OP_REM,
+    OP_REMU,
+    OP_MULW,
+    OP_DIVW,
+    OP_DIVUW,
+    OP_REMW,
+    OP_REMUW,
+    OP_LR_W,
+    OP_SC_W,
+    OP_AMOSWAP_W,
+    OP_AMOADD_W,
+    OP_AMOXOR_W,
+    OP_AMOAND_W,
+    OP_AMOOR_W,
+    OP_AMOMIN_W,
+    OP_AMOMAX_W,
+    OP_AMOMINU_W,
+    OP_AMOMAXU_W,
+    OP_LR_D,
+    OP_SC_D,
+    OP_AMOSWAP_D,
+    OP_AMOADD_D,
+    OP_AMOXOR_D,
+    OP_AMOAND_D,
+    OP_AMOOR_D,
+    OP_AMOMIN_D,
+    OP_AMOMAX_D,
+    OP_AMOMINU_D,
+    OP_AMOMAXU_D,
+    OP_CSRRW,
+    OP_CSRRS,
+    OP_CSRRC,
+    OP_CSRRWI,
+    OP_CSRRSI,
+    OP_CSRRCI,
+    OP_ECALL,
+    OP_EBREAK,
+    OP_MRET,
+    NUM_OPS
+} Op;
+
+#endif // ISA_OPS_H
@@ -0,0 +1,291 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "checkpoint.h"
+
+bool save_checkpoint(const Emulator *emu, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (!file) {
+        perror("Failed to create checkpoint");
+        return false;
+    }
+
+    uint64_t magic = CHECKPOINT_MAGIC;
+    uint64_t mtime = live_mtime(&emu->devices);
+    bool ok = fwrite(&magic, sizeof(magic), 1, file) == 1 &&
+              fwrite(&emu->state, sizeof(emu->state), 1, file) == 1 &&
+              fwrite(&mtime, sizeof(mtime), 1, file) == 1 &&
+              fwrite(&emu->memory_size, sizeof(emu->memory_size), 1, file) == 1 &&
+              fwrite(emu->memory, emu->memory_size, 1, file) == 1;
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Failed to write checkpoint: %s\n", path);
+    }
+    return ok;
+}
+
+bool load_checkpoint(Emulator *emu, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("Failed to open checkpoint");
+        return false;
+    }
+
+    uint64_t magic = 0, mtime = 0, memory_size = 0;
+    bool ok = fread(&magic, sizeof(magic), 1, file) == 1 && magic == CHECKPOINT_MAGIC &&
+              fread(&emu->state, sizeof(emu->state), 1, file) == 1 &&
+              fread(&mtime, sizeof(mtime), 1, file) == 1 &&
+              fread(&memory_size, sizeof(memory_size), 1, file) == 1 && memory_size == emu->memory_size &&
+              fread(emu->memory, emu->memory_size, 1, file) == 1;
+    fclose(file);
+    if (!ok) {
+        fprintf(stderr, "Invalid checkpoint: %s\n", path);
+        return false;
+    }
+
+    restore_mtime(&emu->devices, mtime);
+    flush_block_cache(emu);
+    mark_dirty(emu, 0, emu->memory_size);
+    return true;
+}
+
+static void chain_path(char *path, size_t size, const char *dir, uint64_t sequence, const char *suffix) {
+    snprintf(path, size, "%s/ckpt-%06lu.%s", dir, sequence, suffix);
+}
+
+// Called from the writer thread; the staging copy is stable while pending is set
+static bool write_incremental(const CheckpointWriter *writer) {
+    char tmp_path[512], path[512];
+    chain_path(tmp_path, sizeof(tmp_path), writer->dir, writer->sequence, "tmp");
+    chain_path(path, sizeof(path), writer->dir, writer->sequence, "bin");
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        perror("Failed to create checkpoint");
+        return false;
+    }
+
+    uint64_t header[4] = { INCREMENTAL_MAGIC, writer->sequence, writer->memory_size, writer->mtime };
+    bool ok = fwrite(header, sizeof(header), 1, file) == 1 &&
+              fwrite(&writer->state, sizeof(writer->state), 1, file) == 1 &&
+              fwrite(&writer->num_pages, sizeof(writer->num_pages), 1, file) == 1 &&
+              fwrite(writer->pages, sizeof(uint32_t), writer->num_pages, file) == writer->num_pages &&
+              fwrite(writer->data, PAGE_SIZE, writer->num_pages, file) == writer->num_pages &&
+              fflush(file) == 0 && fsync(fileno(file)) == 0;
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    // Only complete files get the name resume looks for
+    if (ok && rename(tmp_path, path) == 0) {
+        int dir_fd = open(writer->dir, O_RDONLY);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+        return true;
+    }
+    fprintf(stderr, "Failed to write checkpoint: %s\n", path);
+    unlink(tmp_path);
+    return false;
+}
+
+static void *writer_thread(void *arg) {
+    CheckpointWriter *writer = arg;
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        while (!writer->pending && !writer->stopping) {
+            pthread_cond_wait(&writer->wake, &writer->lock);
+        }
+        if (!writer->pending) {
+            break;
+        }
+        pthread_mutex_unlock(&writer->lock);
+        bool ok = write_incremental(writer);
+        pthread_mutex_lock(&writer->lock);
+        if (ok) {
+            writer->sequence++;
+        } else {
+            writer->write_failed = true;
+        }
+        writer->pending = false;
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+// The guest only pauses for the copy of its dirty pages
+static void take_checkpoint(CheckpointWriter *writer, Emulator *emu) {
+    pthread_mutex_lock(&writer->lock);
+    if (writer->pending) {
+        // Still writing the previous one; the pages stay dirty and go into the next checkpoint
+        pthread_mutex_unlock(&writer->lock);
+        return;
+    }
+
+    bool all_pages = writer->write_failed;
+    writer->write_failed = false;
+    writer->state = emu->state;
+    writer->mtime = live_mtime(&emu->devices);
+    writer->num_pages = 0;
+    for (size_t page = 0; page < emu->num_pages; page++) {
+        if (all_pages || (emu->dirty_pages[page] & DIRTY_CHECKPOINT)) {
+            writer->pages[writer->num_pages] = page;
+            // Past 4 GiB of RAM the byte offsets no longer fit the 32-bit page numbers
+            memcpy(writer->data + (size_t)writer->num_pages * PAGE_SIZE, emu->memory + (page << PAGE_SHIFT), PAGE_SIZE);
+            writer->num_pages++;
+        }
+        emu->dirty_pages[page] &= ~DIRTY_CHECKPOINT;
+    }
+    writer->pending = true;
+    pthread_cond_signal(&writer->wake);
+    pthread_mutex_unlock(&writer->lock);
+}
+
+// A file is applied only after all of it has been read and checked
+static bool apply_incremental(Emulator *emu, const char *path, uint64_t sequence, uint32_t *pages, uint8_t *data,
+                              uint64_t *mtime) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+
+    uint64_t header[4] = { 0 };
+    State state;
+    uint32_t num_pages = 0;
+    bool ok = fread(header, sizeof(header), 1, file) == 1 &&
+              header[0] == INCREMENTAL_MAGIC && header[1] == sequence && header[2] == emu->memory_size &&
+              fread(&state, sizeof(state), 1, file) == 1 &&
+              fread(&num_pages, sizeof(num_pages), 1, file) == 1 && num_pages <= emu->num_pages &&
+              fread(pages, sizeof(uint32_t), num_pages, file) == num_pages &&
+              fread(data, PAGE_SIZE, num_pages, file) == num_pages;
+    fclose(file);
+    for (uint32_t i = 0; ok && i < num_pages; i++) {
+        ok = pages[i] < emu->num_pages;
+    }
+    if (!ok) {
+        fprintf(stderr, "Ignoring incomplete checkpoint: %s\n", path);
+        return false;
+    }
+
+    emu->state = state;
+    *mtime = header[3];
+    for (size_t i = 0; i < num_pages; i++) {
+        memcpy(emu->memory + ((uint64_t)pages[i] << PAGE_SHIFT), data + i * PAGE_SIZE, PAGE_SIZE);
+    }
+    return true;
+}
+
+static void remove_chain(const char *dir, uint64_t from) {
+    char path[512];
+    for (uint64_t sequence = from;; sequence++) {
+        chain_path(path, sizeof(path), dir, sequence, "bin");
+        if (unlink(path) != 0) {
+            break;
+        }
+    }
+    // A run killed while writing leaves its .tmp behind; no writer is running for dir yet
+    DIR *handle = opendir(dir);
+    if (!handle) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(handle))) {
+        size_t len = strlen(entry->d_name);
+        if (strncmp(entry->d_name, "ckpt-", 5) == 0 && len > 4 && strcmp(entry->d_name + len - 4, ".tmp") == 0) {
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            unlink(path);
+        }
+    }
+    closedir(handle);
+}
+
+bool start_checkpointing(CheckpointWriter *writer, Emulator *emu, const char *dir, uint64_t interval, bool resume) {
+    memset(writer, 0, sizeof(CheckpointWriter));
+    writer->dir = dir;
+    writer->interval = interval ? interval : CHECKPOINT_INTERVAL;
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror("Failed to create checkpoint directory");
+        return false;
+    }
+    writer->memory_size = emu->memory_size;
+    writer->pages = malloc(emu->num_pages * sizeof(uint32_t));
+    writer->data = malloc(emu->num_pages * PAGE_SIZE);
+    if (!writer->pages || !writer->data) {
+        perror("Failed to allocate checkpoint buffer");
+        exit(1);
+    }
+
+    if (resume) {
+        char path[512];
+        uint64_t mtime = 0;
+        for (;;) {
+            chain_path(path, sizeof(path), dir, writer->sequence, "bin");
+            if (!apply_incremental(emu, path, writer->sequence, writer->pages, writer->data, &mtime)) {
+                break;
+            }
+            writer->sequence++;
+        }
+        if (writer->sequence == 0) {
+            fprintf(stderr, "No checkpoint to resume from in %s\n", dir);
+            free(writer->pages);
+            free(writer->data);
+            return false;
+        }
+        restore_mtime(&emu->devices, mtime);
+        emu->block_start = emu->block_end = 0;
+        flush_block_cache(emu);
+        mark_dirty(emu, 0, emu->memory_size);
+        fprintf(stderr, "Resumed from checkpoint %lu at instruction %lu\n", writer->sequence - 1, emu->state.instret);
+    }
+    // Files past the end of the chain belong to an older run
+    remove_chain(dir, writer->sequence);
+    for (size_t page = 0; page < emu->num_pages; page++) {
+        // A new chain starts with every page; a resumed one already matches memory
+        if (resume) {
+            emu->dirty_pages[page] &= ~DIRTY_CHECKPOINT;
+        } else {
+            emu->dirty_pages[page] |= DIRTY_CHECKPOINT;
+        }
+    }
+    writer->next = emu->state.instret + writer->interval;
+
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->wake, NULL);
+    if (pthread_create(&writer->thread, NULL, writer_thread, writer) != 0) {
+        fprintf(stderr, "Failed to start checkpoint writer\n");
+        free(writer->pages);
+        free(writer->data);
+        return false;
+    }
+    return true;
+}
+
+void run_with_checkpoints(CheckpointWriter *writer, Emulator *emu) {
+    while (run_until(emu, writer->next)) {
+        take_checkpoint(writer, emu);
+        writer->next = emu->state.instret + writer->interval;
+    }
+}
+
+void stop_checkpointing(CheckpointWriter *writer) {
+    pthread_mutex_lock(&writer->lock);
+    writer->stopping = true;
+    pthread_cond_signal(&writer->wake);
+    pthread_mutex_unlock(&writer->lock);
+    pthread_join(writer->thread, NULL);
+    pthread_mutex_destroy(&writer->lock);
+    pthread_cond_destroy(&writer->wake);
+    free(writer->pages);
+    free(writer->data);
+    writer->pages = NULL;
+    writer->data = NULL;
+}
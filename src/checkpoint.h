@@ -0,0 +1,44 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <stdbool.h>
+#include <pthread.h>
+#include "emulator.h"
+
+#define CHECKPOINT_MAGIC 0x32504b4356524d45ull // "EMRVCKP2"
+#define INCREMENTAL_MAGIC 0x32434e4956524d45ull // "EMRVINC2"
+#define CHECKPOINT_INTERVAL 100000000 // Instructions between incremental checkpoints
+
+// A checkpoint holds the architectural state, mtime and the whole guest memory; it only loads into RAM of the same size
+bool save_checkpoint(const Emulator *emu, const char *path);
+bool load_checkpoint(Emulator *emu, const char *path);
+
+// Incremental checkpoints: DIR/ckpt-N.bin holds the state and the pages written since
+// checkpoint N-1, and a background thread writes them while the guest keeps running
+typedef struct {
+    const char *dir;
+    uint64_t interval;
+    uint64_t memory_size; // Resume only accepts a chain written for the same RAM size
+    uint64_t next;      // Instret of the next checkpoint
+    uint64_t sequence;  // Number of the file being written next
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    bool pending;       // The staging copy below belongs to the writer until it clears this
+    bool stopping;
+    bool write_failed;  // The next checkpoint rewrites every page under the same number
+    State state;        // Staging copy taken at the checkpoint
+    uint64_t mtime;
+    uint32_t num_pages;
+    uint32_t *pages;
+    uint8_t *data;
+} CheckpointWriter;
+
+// With resume, continues from the newest complete checkpoint in dir; otherwise starts a new chain
+bool start_checkpointing(CheckpointWriter *writer, Emulator *emu, const char *dir, uint64_t interval, bool resume);
+// Runs to completion, handing a copy of the dirty pages to the writer every interval
+void run_with_checkpoints(CheckpointWriter *writer, Emulator *emu);
+// Waits for the checkpoint being written
+void stop_checkpointing(CheckpointWriter *writer);
+
+#endif // CHECKPOINT_H
@@ -0,0 +1,207 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "codecache.h"
+
+// Encodings isagen generated from isa.tbl, decoded below to fingerprint decode() itself
+#include "isa_vectors.inc"
+
+static uint64_t mix(uint64_t hash, uint64_t value) {
+    hash ^= value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+    hash *= 0xBF58476D1CE4E5B9ull;
+    return hash ^ (hash >> 31);
+}
+
+uint64_t code_cache_version(void) {
+    uint64_t hash = mix(CODE_CACHE_FORMAT, sizeof(CachedBlock));
+    hash = mix(hash, NUM_OPS);
+    for (uint32_t op = 0; op < NUM_OPS; op++) {
+        hash = mix(hash, isa_info[op].match);
+        hash = mix(hash, isa_info[op].mask);
+        hash = mix(hash, (uint64_t)isa_info[op].format << 32 | isa_info[op].flags);
+    }
+    // The table does not say how operands are extracted, so hash what decode() makes of every vector
+    for (size_t i = 0; i < sizeof(isa_vectors) / sizeof(isa_vectors[0]); i++) {
+        Instruction instr = decode(isa_vectors[i].raw);
+        hash = mix(hash, (uint64_t)instr.op << 32 | instr.opcode);
+        hash = mix(hash, (uint64_t)instr.rd << 48 | (uint64_t)instr.funct3 << 32 | instr.rs1 << 16 | instr.rs2);
+        hash = mix(hash, (uint64_t)instr.funct7 << 32 | instr.imm_u);
+        hash = mix(hash, (uint64_t)(uint32_t)instr.imm_i << 32 | (uint32_t)instr.imm_b);
+        hash = mix(hash, (uint64_t)(uint32_t)instr.imm_j << 32 | (uint32_t)instr.imm_jalr);
+        hash = mix(hash, (uint64_t)(uint32_t)instr.imm_s << 32 | (uint32_t)instr.imm_l);
+    }
+    return hash;
+}
+
+static uint64_t image_hash(const Emulator *emu) {
+    uint64_t hash = mix(emu->image_start, emu->image_end);
+    uint64_t addr = emu->image_start;
+    for (; addr + 8 <= emu->image_end; addr += 8) {
+        uint64_t word;
+        memcpy(&word, &emu->memory[addr], sizeof(word));
+        hash = mix(hash, word);
+    }
+    for (; addr < emu->image_end; addr++) {
+        hash = mix(hash, emu->memory[addr]);
+    }
+    return hash;
+}
+
+// Anything that does not look like a complete file from this build is ignored and replaced on save
+static bool valid_file(const CodeCache *cache, const CodeCacheHeader *header, size_t size) {
+    return size >= sizeof(CodeCacheHeader) && header->magic == CODE_CACHE_MAGIC &&
+           header->version == cache->version && header->image_hash == cache->image_hash &&
+           header->memory_size == cache->memory_size && header->num_blocks <= CODE_CACHE_MAX_BLOCKS &&
+           size == sizeof(CodeCacheHeader) + header->num_blocks * sizeof(CachedBlock);
+}
+
+bool open_code_cache(CodeCache *cache, const char *dir, const Emulator *emu) {
+    memset(cache, 0, sizeof(CodeCache));
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+        perror("Failed to create code cache directory");
+        return false;
+    }
+    cache->version = code_cache_version();
+    cache->image_hash = image_hash(emu);
+    cache->memory_size = emu->memory_size;
+    uint64_t key = mix(mix(cache->version, cache->image_hash), cache->memory_size);
+    snprintf(cache->path, sizeof(cache->path), "%s/%016lx.bin", dir, key);
+
+    int fd = open(cache->path, O_RDONLY);
+    if (fd < 0) {
+        return true; // First run of this image
+    }
+    struct stat st;
+    void *mapping = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(CodeCacheHeader)) {
+        mapping = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        return true;
+    }
+    if (!valid_file(cache, mapping, st.st_size)) {
+        munmap(mapping, st.st_size);
+        return true;
+    }
+    cache->header = mapping;
+    cache->mapped = st.st_size;
+    cache->blocks = (const CachedBlock *)(cache->header + 1);
+    cache->num_blocks = cache->header->num_blocks;
+    return true;
+}
+
+static const CachedBlock *search(const CachedBlock *blocks, uint64_t count, uint64_t pc) {
+    uint64_t lo = 0, hi = count;
+    while (lo < hi) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (blocks[mid].pc < pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < count && blocks[lo].pc == pc ? &blocks[lo] : NULL;
+}
+
+const CachedBlock *find_cached_block(const CodeCache *cache, uint64_t pc) {
+    return search(cache->blocks, cache->num_blocks, pc);
+}
+
+static bool same_block(const CachedBlock *cached, const Block *block) {
+    return cached && cached->num_instrs == block->num_instrs &&
+           memcmp(cached->raw, block->raw, block->num_instrs * sizeof(uint32_t)) == 0;
+}
+
+static int by_pc(const void *a, const void *b) {
+    uint64_t x = ((const CachedBlock *)a)->pc, y = ((const CachedBlock *)b)->pc;
+    return x < y ? -1 : x > y;
+}
+
+bool save_code_cache(CodeCache *cache, const Emulator *emu) {
+    size_t num_new = 0;
+    for (size_t i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        const Block *block = &emu->blocks[i];
+        num_new += block->valid && block->num_instrs && !same_block(find_cached_block(cache, block->pc), block);
+    }
+    if (num_new == 0) {
+        return true;
+    }
+
+    // Zeroed so padding is deterministic; the new blocks win over older records at the same PC
+    CachedBlock *records = calloc(num_new + cache->num_blocks, sizeof(CachedBlock));
+    if (!records) {
+        perror("Failed to allocate code cache");
+        return false;
+    }
+    size_t count = 0;
+    for (size_t i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        const Block *block = &emu->blocks[i];
+        if (block->valid && block->num_instrs && !same_block(find_cached_block(cache, block->pc), block)) {
+            CachedBlock *record = &records[count++];
+            record->pc = block->pc;
+            record->num_instrs = block->num_instrs;
+            record->num_loads = block->num_loads;
+            record->num_stores = block->num_stores;
+            memcpy(record->raw, block->raw, block->num_instrs * sizeof(uint32_t));
+            memcpy(record->instrs, block->instrs, block->num_instrs * sizeof(Instruction));
+        }
+    }
+    qsort(records, count, sizeof(CachedBlock), by_pc);
+    size_t num_fresh = count;
+    for (uint64_t i = 0; i < cache->num_blocks && count < CODE_CACHE_MAX_BLOCKS; i++) {
+        if (!search(records, num_fresh, cache->blocks[i].pc)) {
+            records[count++] = cache->blocks[i];
+        }
+    }
+    if (count > CODE_CACHE_MAX_BLOCKS) {
+        count = CODE_CACHE_MAX_BLOCKS;
+    }
+    qsort(records, count, sizeof(CachedBlock), by_pc);
+
+    // Each process writes its own file; rename replaces the old one in a single step, and
+    // processes that still map the old one keep reading it undisturbed
+    char tmp_path[sizeof(cache->path) + 32];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", cache->path, (int)getpid());
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        perror("Failed to create code cache");
+        free(records);
+        return false;
+    }
+    CodeCacheHeader header = {
+        .magic = CODE_CACHE_MAGIC,
+        .version = cache->version,
+        .image_hash = cache->image_hash,
+        .memory_size = cache->memory_size,
+        .num_blocks = count
+    };
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+              fwrite(records, sizeof(CachedBlock), count, file) == count;
+    if (fclose(file) != 0) {
+        ok = false;
+    }
+    free(records);
+    if (ok && rename(tmp_path, cache->path) == 0) {
+        return true;
+    }
+    fprintf(stderr, "Failed to write code cache: %s\n", cache->path);
+    unlink(tmp_path);
+    return false;
+}
+
+void close_code_cache(CodeCache *cache) {
+    if (cache->header) {
+        munmap((void *)cache->header, cache->mapped);
+    }
+    cache->header = NULL;
+    cache->blocks = NULL;
+    cache->num_blocks = 0;
+}
@@ -0,0 +1,56 @@
+#ifndef CODECACHE_H
+#define CODECACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "emulator.h"
+
+#define CODE_CACHE_MAGIC 0x45484341434d5652ull // "RVMCACHE"
+#define CODE_CACHE_FORMAT 2
+#define CODE_CACHE_MAX_BLOCKS 16384 // About 32 MiB of records per image
+
+// DIR/KEY.bin, where KEY hashes the loaded image, the RAM size and the decoder version. Readers
+// map it read-only; writers build a private temporary file and rename it over the old one, so
+// any number of emulator processes can share a directory and never see a partial file
+typedef struct {
+    uint64_t magic;
+    uint64_t version;     // code_cache_version() of the writer
+    uint64_t image_hash;
+    uint64_t memory_size;
+    uint64_t num_blocks;  // Records follow, sorted by PC
+} CodeCacheHeader;
+
+// A decoded block as build_block left it; the raw words are compared with RAM before use
+typedef struct {
+    uint64_t pc;
+    uint32_t num_instrs;
+    uint32_t num_loads;
+    uint32_t num_stores;
+    uint32_t raw[BLOCK_MAX_INSTRS];
+    Instruction instrs[BLOCK_MAX_INSTRS];
+} CachedBlock;
+
+typedef struct CodeCache {
+    char path[4096];
+    uint64_t version;
+    uint64_t image_hash;
+    uint64_t memory_size;
+    const CodeCacheHeader *header; // Read-only mapping, NULL when there was no usable file
+    size_t mapped;
+    const CachedBlock *blocks;
+    uint64_t num_blocks;
+    uint64_t hits;   // Block cache misses served from the file
+    uint64_t misses; // and the ones decoded from scratch
+} CodeCache;
+
+// Changes whenever a cached record could mean something else: file format, Instruction layout, isa.tbl or decode()
+uint64_t code_cache_version(void);
+// Hashes the image the emulator was loaded with and maps DIR/KEY.bin if an earlier run wrote one
+bool open_code_cache(CodeCache *cache, const char *dir, const Emulator *emu);
+const CachedBlock *find_cached_block(const CodeCache *cache, uint64_t pc);
+// Merges the blocks decoded in this run into the file; does nothing when they were all there already
+bool save_code_cache(CodeCache *cache, const Emulator *emu);
+void close_code_cache(CodeCache *cache);
+
+#endif // CODECACHE_H
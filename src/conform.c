@@ -0,0 +1,295 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "emulator.h"
+#include "state.h"
+
+#define TOHOST_ADDR 0x8000 // Tests write 1 here on success and (test << 1) | 1 on failure
+#define CONFORM_DIR "tests/isa"
+#define CONFORM_REPORT "build/conformance.xml"
+#define CONFORM_MAX_INSTRS 10000000
+#define CONFORM_TIMEOUT 10 // Seconds before a test counts as hung
+
+typedef enum {
+    OUTCOME_PASS,
+    OUTCOME_FAIL,  // The test reported a failing case through tohost
+    OUTCOME_ERROR  // It never reported, or the emulator crashed or hung
+} Outcome;
+
+// What the forked child sends back through its pipe
+typedef struct {
+    uint64_t tohost;
+    uint64_t instret;
+    StopReason stop_reason;
+} TestResult;
+
+typedef struct {
+    char path[512];
+    char name[128];
+    pid_t pid;
+    int pipe_fd;
+    double start;
+    double seconds;
+    Outcome outcome;
+    char message[128];
+} TestCase;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static bool has_suffix(const char *name, const char *suffix) {
+    size_t len = strlen(name), suffix_len = strlen(suffix);
+    return len > suffix_len && strcmp(name + len - suffix_len, suffix) == 0;
+}
+
+static bool add_test(TestCase **tests, size_t *num_tests, size_t *capacity, const char *path) {
+    if (*num_tests == *capacity) {
+        *capacity = *capacity ? *capacity * 2 : 64;
+        *tests = realloc(*tests, *capacity * sizeof(TestCase));
+        if (!*tests) {
+            perror("Failed to grow test list");
+            exit(1);
+        }
+    }
+    TestCase *test = &(*tests)[(*num_tests)++];
+    memset(test, 0, sizeof(TestCase));
+    snprintf(test->path, sizeof(test->path), "%s", path);
+    const char *base = strrchr(path, '/');
+    snprintf(test->name, sizeof(test->name), "%s", base ? base + 1 : path);
+    if (has_suffix(test->name, ".hex")) {
+        test->name[strlen(test->name) - 4] = '\0';
+    }
+    return true;
+}
+
+static bool collect_dir(TestCase **tests, size_t *num_tests, size_t *capacity, const char *dir) {
+    DIR *handle = opendir(dir);
+    if (!handle) {
+        perror("Failed to open test directory");
+        return false;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(handle))) {
+        if (has_suffix(entry->d_name, ".hex")) {
+            char path[512];
+            snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+            add_test(tests, num_tests, capacity, path);
+        }
+    }
+    closedir(handle);
+    return true;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(((const TestCase *)a)->name, ((const TestCase *)b)->name);
+}
+
+// Each test runs in its own process, so a crash or hang only takes that test down
+static void run_child(const TestCase *test, int fd) {
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+    alarm(CONFORM_TIMEOUT);
+
+    Emulator *emu = malloc(sizeof(Emulator));
+    if (!emu) {
+        _exit(1);
+    }
+    init_emulator(emu, test->path, 0, current_memory_config()->size / 4, "/dev/null");
+    emu->log_enabled = false;
+    emu->max_instrs = CONFORM_MAX_INSTRS;
+    while (fetch_and_execute(emu));
+
+    TestResult result = { 0, emu->state.instret, emu->stop_reason };
+    memcpy(&result.tohost, &emu->memory[TOHOST_ADDR], sizeof(result.tohost));
+    _exit(write(fd, &result, sizeof(result)) == sizeof(result) ? 0 : 1);
+}
+
+static void start_test(TestCase *test) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        perror("Failed to create pipe");
+        exit(1);
+    }
+    test->start = now_seconds();
+    test->pid = fork();
+    if (test->pid == 0) {
+        close(fds[0]);
+        run_child(test, fds[1]);
+    }
+    if (test->pid < 0) {
+        perror("Failed to fork test");
+        exit(1);
+    }
+    close(fds[1]);
+    test->pipe_fd = fds[0];
+}
+
+static void finish_test(TestCase *test, int status) {
+    test->seconds = now_seconds() - test->start;
+    TestResult result;
+    bool reported = read(test->pipe_fd, &result, sizeof(result)) == sizeof(result);
+    close(test->pipe_fd);
+
+    test->outcome = OUTCOME_ERROR;
+    if (WIFSIGNALED(status)) {
+        snprintf(test->message, sizeof(test->message), WTERMSIG(status) == SIGALRM ? "timed out after %d s" : "killed by signal %d",
+                 WTERMSIG(status) == SIGALRM ? CONFORM_TIMEOUT : WTERMSIG(status));
+    } else if (!reported) {
+        snprintf(test->message, sizeof(test->message), "emulator exited with status %d", WEXITSTATUS(status));
+    } else if (result.tohost == 1) {
+        test->outcome = OUTCOME_PASS;
+    } else if (result.tohost & 1) {
+        test->outcome = OUTCOME_FAIL;
+        snprintf(test->message, sizeof(test->message), "test %lu failed", result.tohost >> 1);
+    } else {
+        static const char *reasons[] = { "running", "exit", "instruction limit", "bad instruction", "breakpoint", "watchpoint" };
+        snprintf(test->message, sizeof(test->message), "no tohost write after %lu instructions (stopped: %s)",
+                 result.instret, reasons[result.stop_reason]);
+    }
+}
+
+static void write_escaped(FILE *file, const char *text) {
+    for (; *text; text++) {
+        switch (*text) {
+            case '&': fputs("&amp;", file); break;
+            case '<': fputs("&lt;", file); break;
+            case '>': fputs("&gt;", file); break;
+            case '"': fputs("&quot;", file); break;
+            default: fputc(*text, file); break;
+        }
+    }
+}
+
+static bool write_junit(const char *path, const TestCase *tests, size_t num_tests, double seconds) {
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror("Failed to create JUnit report");
+        return false;
+    }
+    size_t failures = 0, errors = 0;
+    for (size_t i = 0; i < num_tests; i++) {
+        failures += tests[i].outcome == OUTCOME_FAIL;
+        errors += tests[i].outcome == OUTCOME_ERROR;
+    }
+    fprintf(file, "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n");
+    fprintf(file, "<testsuites>\n");
+    fprintf(file, "  <testsuite name=\"isa\" tests=\"%zu\" failures=\"%zu\" errors=\"%zu\" time=\"%.6f\">\n",
+            num_tests, failures, errors, seconds);
+    for (size_t i = 0; i < num_tests; i++) {
+        const TestCase *test = &tests[i];
+        fprintf(file, "    <testcase classname=\"isa\" name=\"");
+        write_escaped(file, test->name);
+        fprintf(file, "\" time=\"%.6f\"", test->seconds);
+        if (test->outcome == OUTCOME_PASS) {
+            fprintf(file, "/>\n");
+            continue;
+        }
+        fprintf(file, ">\n      <%s message=\"", test->outcome == OUTCOME_FAIL ? "failure" : "error");
+        write_escaped(file, test->message);
+        fprintf(file, "\"/>\n    </testcase>\n");
+    }
+    fprintf(file, "  </testsuite>\n</testsuites>\n");
+    return fclose(file) == 0;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options] [DIR | TEST.hex ...]\n", prog);
+    fprintf(stderr, "  --jobs=N       Tests run in parallel (default: all cores)\n");
+    fprintf(stderr, "  --junit=PATH   JUnit XML report (default %s)\n", CONFORM_REPORT);
+    fprintf(stderr, "Runs every .hex test (default directory %s); each reports through tohost at 0x%x\n",
+            CONFORM_DIR, TOHOST_ADDR);
+}
+
+int main(int argc, char *argv[]) {
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *report = CONFORM_REPORT;
+    TestCase *tests = NULL;
+    size_t num_tests = 0, capacity = 0;
+    bool any_path = false;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            jobs = strtol(argv[i] + 7, NULL, 0);
+        } else if (strncmp(argv[i], "--junit=", 8) == 0) {
+            report = argv[i] + 8;
+        } else if (strncmp(argv[i], "--", 2) == 0) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            struct stat info;
+            any_path = true;
+            if (stat(argv[i], &info) == 0 && S_ISDIR(info.st_mode)) {
+                if (!collect_dir(&tests, &num_tests, &capacity, argv[i])) {
+                    return 1;
+                }
+            } else {
+                add_test(&tests, &num_tests, &capacity, argv[i]);
+            }
+        }
+    }
+    if (!any_path && !collect_dir(&tests, &num_tests, &capacity, CONFORM_DIR)) {
+        return 1;
+    }
+    if (jobs < 1) {
+        jobs = 1;
+    }
+    qsort(tests, num_tests, sizeof(TestCase), compare_names);
+
+    double start = now_seconds();
+    size_t next = 0, running = 0, done = 0, passed = 0;
+    while (done < num_tests) {
+        while (running < (size_t)jobs && next < num_tests) {
+            start_test(&tests[next++]);
+            running++;
+        }
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            perror("Failed to wait for test");
+            return 1;
+        }
+        for (size_t i = 0; i < next; i++) {
+            if (tests[i].pid == pid) {
+                TestCase *test = &tests[i];
+                finish_test(test, status);
+                test->pid = 0;
+                running--;
+                done++;
+                passed += test->outcome == OUTCOME_PASS;
+                if (test->outcome == OUTCOME_PASS) {
+                    printf("\033[0;32mPASS\033[0m  %-12s %8.2f ms\n", test->name, test->seconds * 1e3);
+                } else {
+                    printf("\033[0;31m%s\033[0m  %-12s %8.2f ms  %s\n", test->outcome == OUTCOME_FAIL ? "FAIL" : "ERROR",
+                           test->name, test->seconds * 1e3, test->message);
+                }
+                break;
+            }
+        }
+    }
+    double seconds = now_seconds() - start;
+
+    bool written = write_junit(report, tests, num_tests, seconds);
+    printf("%zu/%zu conformance tests passed in %.2f s (%ld jobs), report in %s\n",
+           passed, num_tests, seconds, jobs, report);
+    free(tests);
+    return written && passed == num_tests ? 0 : 1;
+}
@@ -0,0 +1,302 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <unistd.h>
+#include "devices.h"
+#include "emulator.h"
+#include "virtio.h"
+
+static uint64_t host_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static uint64_t host_mtime(const Devices *devices) {
+    return (host_ns() - devices->start_ns) / (1000000000ull / MTIME_HZ);
+}
+
+static bool host_input_ready(void) {
+    struct pollfd pfd = { .fd = STDIN_FILENO, .events = POLLIN };
+    return poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN);
+}
+
+static uint64_t host_uart_read(const Devices *devices, uint64_t addr) {
+    (void)devices;
+    if (addr == UART_BASE + UART_LSR) {
+        return UART_LSR_THR_EMPTY | (host_input_ready() ? UART_LSR_DATA_READY : 0);
+    }
+    uint8_t c = 0;
+    if (host_input_ready() && read(STDIN_FILENO, &c, 1) != 1) {
+        c = 0;
+    }
+    return c;
+}
+
+static uint64_t host_mtime_read(const Devices *devices, uint64_t addr) {
+    (void)addr;
+    return host_mtime(devices);
+}
+
+void init_devices(Devices *devices) {
+    memset(devices, 0, sizeof(Devices));
+    devices->mode = REPLAY_OFF;
+    devices->replay_end = UINT64_MAX;
+    devices->next_poll = DEVICE_POLL_INSTRS;
+    devices->start_ns = host_ns();
+}
+
+// A NULL path records into memory only, which needs keep_history
+bool start_recording(Devices *devices, const char *path) {
+    if (path) {
+        devices->log = fopen(path, "wb");
+        if (!devices->log) {
+            perror("Failed to create event log");
+            return false;
+        }
+        uint64_t magic = EVENT_LOG_MAGIC;
+        fwrite(&magic, sizeof(magic), 1, devices->log);
+        fflush(devices->log);
+    }
+    devices->mode = REPLAY_RECORD;
+    return true;
+}
+
+static size_t next_event(const Devices *devices, size_t from, DeviceEventType type) {
+    while (from < devices->num_events && devices->events[from].type != type) {
+        from++;
+    }
+    return from;
+}
+
+bool start_replay(Devices *devices, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("Failed to open event log");
+        return false;
+    }
+
+    uint64_t magic = 0;
+    if (fread(&magic, sizeof(magic), 1, file) != 1 || magic != EVENT_LOG_MAGIC) {
+        fprintf(stderr, "Invalid event log: %s\n", path);
+        fclose(file);
+        return false;
+    }
+    devices->capacity = EVENT_HISTORY_CAPACITY;
+    devices->events = malloc(devices->capacity * sizeof(DeviceEvent));
+    while (devices->events) {
+        if (devices->num_events == devices->capacity) {
+            devices->capacity *= 2;
+            devices->events = realloc(devices->events, devices->capacity * sizeof(DeviceEvent));
+            continue;
+        }
+        if (fread(&devices->events[devices->num_events], sizeof(DeviceEvent), 1, file) != 1) {
+            break;
+        }
+        devices->num_events++;
+    }
+    fclose(file);
+    if (!devices->events) {
+        perror("Failed to load event log");
+        return false;
+    }
+
+    rewind_devices(devices, 0, UINT64_MAX);
+    return true;
+}
+
+// Index of the first event that has not happened yet
+size_t event_position(const Devices *devices) {
+    if (devices->mode != REPLAY_REPLAY) {
+        return devices->num_events;
+    }
+    return devices->read_cursor < devices->irq_cursor ? devices->read_cursor : devices->irq_cursor;
+}
+
+static void update_next_poll(Devices *devices) {
+    uint64_t next_irq = devices->irq_cursor < devices->num_events ? devices->events[devices->irq_cursor].instret : UINT64_MAX;
+    devices->next_poll = next_irq < devices->replay_end ? next_irq : devices->replay_end;
+}
+
+// Replays the kept history from position, going live again at replay_end
+void rewind_devices(Devices *devices, size_t position, uint64_t replay_end) {
+    devices->mode = REPLAY_REPLAY;
+    devices->replay_end = replay_end;
+    devices->read_cursor = next_event(devices, position, EVENT_MMIO_READ);
+    devices->irq_cursor = next_event(devices, position, EVENT_INTERRUPT);
+    update_next_poll(devices);
+}
+
+// Forgets everything from position on and keeps recording from there
+void truncate_events(Devices *devices, size_t position) {
+    if (position < devices->num_events) {
+        devices->num_events = position;
+    }
+    if (devices->mode == REPLAY_REPLAY) {
+        devices->mode = REPLAY_RECORD;
+        devices->replay_end = UINT64_MAX;
+    }
+}
+
+void free_devices(Devices *devices) {
+    if (devices->log) {
+        fclose(devices->log);
+        devices->log = NULL;
+    }
+    free(devices->events);
+    devices->events = NULL;
+}
+
+static void record_event(Devices *devices, DeviceEventType type, uint64_t instret, uint64_t addr, uint32_t size, uint64_t value) {
+    DeviceEvent event = { .instret = instret, .addr = addr, .value = value, .type = type, .size = size };
+    // Flushed per event: a log that ends in a crash is the one most worth replaying
+    if (devices->log && (fwrite(&event, sizeof(event), 1, devices->log) != 1 || fflush(devices->log) != 0)) {
+        perror("Failed to write event log");
+        exit(1);
+    }
+    if (devices->keep_history) {
+        if (devices->num_events == devices->capacity) {
+            devices->capacity = devices->capacity ? devices->capacity * 2 : EVENT_HISTORY_CAPACITY;
+            devices->events = realloc(devices->events, devices->capacity * sizeof(DeviceEvent));
+            if (!devices->events) {
+                perror("Failed to grow event history");
+                exit(1);
+            }
+        }
+        devices->events[devices->num_events++] = event;
+    }
+}
+
+// Once the kept history is used up past replay_end, inputs come from the host again
+static void leave_finished_replay(Devices *devices, uint64_t instret) {
+    if (devices->mode == REPLAY_REPLAY && instret >= devices->replay_end &&
+        devices->read_cursor >= devices->num_events && devices->irq_cursor >= devices->num_events) {
+        devices->mode = REPLAY_RECORD;
+        devices->replay_end = UINT64_MAX;
+    }
+}
+
+static void replay_diverged(uint64_t instret, const char *what) {
+    fprintf(stderr, "Replay diverged at instruction %lu: %s\n", instret, what);
+    exit(1);
+}
+
+// Every value the guest can observe from the host goes through here
+static uint64_t nondeterministic_read(Emulator *emu, uint64_t addr, uint32_t size,
+                                      uint64_t (*host_read)(const Devices *, uint64_t)) {
+    Devices *devices = &emu->devices;
+    uint64_t instret = retired_instrs(emu);
+
+    leave_finished_replay(devices, instret);
+    if (devices->mode == REPLAY_REPLAY) {
+        if (devices->read_cursor >= devices->num_events) {
+            replay_diverged(instret, "event log exhausted");
+        }
+        const DeviceEvent *event = &devices->events[devices->read_cursor];
+        if (event->instret != instret || event->addr != addr) {
+            replay_diverged(instret, "unexpected device read");
+        }
+        devices->read_cursor = next_event(devices, devices->read_cursor + 1, EVENT_MMIO_READ);
+        return event->value;
+    }
+
+    uint64_t value = host_read(devices, addr);
+    if (devices->mode == REPLAY_RECORD) {
+        record_event(devices, EVENT_MMIO_READ, instret, addr, size, value);
+    }
+    return value;
+}
+
+uint64_t device_mtime(Emulator *emu) {
+    return nondeterministic_read(emu, CLINT_MTIME, 8, host_mtime_read);
+}
+
+uint64_t live_mtime(const Devices *devices) {
+    return host_mtime(devices);
+}
+
+// Checkpoints restore mtimecmp as an absolute value, so mtime has to pick up where it was saved
+void restore_mtime(Devices *devices, uint64_t mtime) {
+    devices->start_ns = host_ns() - mtime * (1000000000ull / MTIME_HZ);
+}
+
+_Static_assert(VIRTIO_BASE + VIRTIO_NUM_DEVICES * VIRTIO_MMIO_SIZE == MMIO_BASE + MMIO_SIZE,
+               "the virtio windows must end where the MMIO window does");
+
+// Whether an access falls inside a 64-bit register, without wrapping on addresses near the top
+static bool in_register(uint64_t addr, uint32_t size, uint64_t base) {
+    return size <= 8 && addr >= base && addr - base <= 8 - size;
+}
+
+// The console only reads guest RAM, so replay needs no events for it; main keeps --disk, whose
+// writes change the image under a later replay, away from --record and --replay
+static bool in_virtio(const Emulator *emu, uint64_t addr, uint32_t size) {
+    uint64_t offset = addr - VIRTIO_BASE;
+    return emu->virtio && addr >= VIRTIO_BASE && offset < VIRTIO_NUM_DEVICES * VIRTIO_MMIO_SIZE &&
+           offset % VIRTIO_MMIO_SIZE <= VIRTIO_MMIO_SIZE - size;
+}
+
+uint64_t device_load(Emulator *emu, uint64_t addr, uint32_t size) {
+    if (in_register(addr, size, CLINT_MTIMECMP)) {
+        return emu->state.mtimecmp >> ((addr - CLINT_MTIMECMP) * 8);
+    }
+    if (in_register(addr, size, CLINT_MTIME)) {
+        return device_mtime(emu) >> ((addr - CLINT_MTIME) * 8);
+    }
+    if (addr == UART_BASE + UART_RBR || addr == UART_BASE + UART_LSR) {
+        return nondeterministic_read(emu, addr, size, host_uart_read);
+    }
+    if (in_virtio(emu, addr, size)) {
+        return virtio_load(emu, addr, size);
+    }
+    return 0; // Unmapped
+}
+
+void device_store(Emulator *emu, uint64_t addr, uint32_t size, uint64_t value) {
+    if (in_register(addr, size, CLINT_MTIMECMP)) {
+        uint32_t shift = (addr - CLINT_MTIMECMP) * 8;
+        uint64_t mask = size == 8 ? UINT64_MAX : ((1ull << (size * 8)) - 1) << shift;
+        emu->state.mtimecmp = (emu->state.mtimecmp & ~mask) | ((value << shift) & mask);
+        emu->state.csrs[CSR_MIP] &= ~MIP_MTIP; // Writing mtimecmp acknowledges the interrupt
+    } else if (addr == UART_BASE + UART_RBR) {
+        putchar(value & 0xFF);
+    } else if (in_virtio(emu, addr, size)) {
+        virtio_store(emu, addr, size, value);
+    }
+}
+
+// Called from the block loop once instret reaches next_poll; true means take a timer interrupt now
+bool poll_timer(Emulator *emu, bool enabled) {
+    Devices *devices = &emu->devices;
+    uint64_t instret = emu->state.instret;
+
+    leave_finished_replay(devices, instret);
+    if (devices->mode == REPLAY_REPLAY) {
+        bool due = false;
+        if (devices->irq_cursor < devices->num_events) {
+            const DeviceEvent *event = &devices->events[devices->irq_cursor];
+            if (event->instret < instret) {
+                replay_diverged(instret, "missed timer interrupt");
+            }
+            due = event->instret == instret;
+            if (due) {
+                devices->irq_cursor = next_event(devices, devices->irq_cursor + 1, EVENT_INTERRUPT);
+            }
+        }
+        update_next_poll(devices);
+        return due;
+    }
+
+    devices->next_poll = instret + DEVICE_POLL_INSTRS;
+    if (!enabled || host_mtime(devices) < emu->state.mtimecmp) {
+        return false;
+    }
+    if (devices->mode == REPLAY_RECORD) {
+        record_event(devices, EVENT_INTERRUPT, instret, 0, 0, 0);
+    }
+    return true;
+}
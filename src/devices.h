@@ -0,0 +1,84 @@
+#ifndef DEVICES_H
+#define DEVICES_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// CLINT timer
+#define CLINT_BASE 0x02000000
+#define CLINT_MTIMECMP (CLINT_BASE + 0x4000)
+#define CLINT_MTIME (CLINT_BASE + 0xBFF8)
+#define CLINT_SIZE 0x10000
+#define MTIME_HZ 10000000
+
+// 16550-style UART: reads take input from the host's stdin
+#define UART_BASE 0x10000000
+#define UART_RBR 0 // Receive buffer (read) / transmit holding register (write)
+#define UART_LSR 5 // Line status
+#define UART_LSR_DATA_READY 0x01
+#define UART_LSR_THR_EMPTY 0x20
+
+// The UART and the virtio windows after it; like the CLINT this stays a device when RAM is larger
+#define MMIO_BASE UART_BASE
+#define MMIO_SIZE 0x3000
+
+#define DEVICE_POLL_INSTRS 10000 // Instructions between timer checks when not replaying
+#define EVENT_LOG_MAGIC 0x3154564552564d45ull // "EMRVEVT1"
+#define EVENT_HISTORY_CAPACITY 1024
+
+typedef enum {
+    REPLAY_OFF,
+    REPLAY_RECORD, // Log every nondeterministic input
+    REPLAY_REPLAY  // Feed the logged inputs back instead of asking the host
+} ReplayMode;
+
+typedef enum {
+    EVENT_MMIO_READ, // Value returned by a nondeterministic device read
+    EVENT_INTERRUPT  // Timer interrupt taken before the instruction at instret
+} DeviceEventType;
+
+typedef struct {
+    uint64_t instret;
+    uint64_t addr;
+    uint64_t value;
+    uint32_t type;
+    uint32_t size;
+} DeviceEvent;
+
+typedef struct {
+    ReplayMode mode;
+    FILE *log;
+    DeviceEvent *events; // The whole log when replaying, or the history when keep_history is set
+    size_t num_events;
+    size_t capacity;
+    bool keep_history;   // Recording also keeps events in memory so they can be replayed later
+    size_t read_cursor;  // Next EVENT_MMIO_READ to hand out
+    size_t irq_cursor;   // Next EVENT_INTERRUPT to deliver
+    uint64_t replay_end; // Replay goes live again once the history up to here is used up
+    uint64_t next_poll;  // The block loop stops at this instret to check the timer
+    uint64_t start_ns;
+} Devices;
+
+struct Emulator;
+
+void init_devices(Devices *devices);
+bool start_recording(Devices *devices, const char *path);
+bool start_replay(Devices *devices, const char *path);
+size_t event_position(const Devices *devices);
+void rewind_devices(Devices *devices, size_t position, uint64_t replay_end);
+void truncate_events(Devices *devices, size_t position);
+void free_devices(Devices *devices);
+// RAM starts at 0, so a guest larger than CLINT_BASE has holes where the device windows are
+static inline bool in_device_window(uint64_t addr) {
+    return addr - CLINT_BASE < CLINT_SIZE || addr - MMIO_BASE < MMIO_SIZE;
+}
+uint64_t device_load(struct Emulator *emu, uint64_t addr, uint32_t size);
+void device_store(struct Emulator *emu, uint64_t addr, uint32_t size, uint64_t value);
+uint64_t device_mtime(struct Emulator *emu);
+// mtime from the host clock without a record/replay event, and moving its base so it continues from a saved value
+uint64_t live_mtime(const Devices *devices);
+void restore_mtime(Devices *devices, uint64_t mtime);
+bool poll_timer(struct Emulator *emu, bool enabled);
+
+#endif // DEVICES_H
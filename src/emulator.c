@@ -2,10 +2,38 @@
 #include <stdlib.h>
 #include <string.h>
 #include "emulator.h"
+#include "codecache.h"
 #include "state.h"
 
-void init_emulator(Emulator *emu, const char *hex_file, uint64_t start_pc, size_t num_instrs, const char *log_file_name) {
+void init_bare_emulator(Emulator *emu) {
     memset(emu, 0, sizeof(Emulator));
+    emu->log_enabled = false;
+    emu->max_instrs = MAX_EXEC_INSTRS;
+    emu->stop_at = UINT64_MAX;
+    emu->state.mtimecmp = UINT64_MAX;
+    init_devices(&emu->devices);
+
+    emu->blocks = calloc(BLOCK_CACHE_SIZE, sizeof(Block));
+    if (!emu->blocks) {
+        perror("Failed to allocate block cache");
+        exit(1);
+    }
+
+    // RAM lives outside the struct so it can be large, huge-page backed and on the thread's NUMA node
+    const MemoryConfig *config = current_memory_config();
+    emu->memory_size = config->size;
+    emu->memory = map_guest_memory(config->size, config->huge_pages, &emu->memory_mapped, &emu->huge_pages);
+    emu->num_pages = config->size >> PAGE_SHIFT;
+    emu->code_map = calloc(config->size >> CODE_GRANULE_SHIFT, 1);
+    emu->dirty_pages = calloc(emu->num_pages, 1);
+    if (!emu->code_map || !emu->dirty_pages) {
+        perror("Failed to allocate page maps");
+        exit(1);
+    }
+}
+
+void init_emulator(Emulator *emu, const char *hex_file, uint64_t start_pc, size_t num_instrs, const char *log_file_name) {
+    init_bare_emulator(emu);
     emu->log_enabled = true;
     emu->state.pc = start_pc;
     emu->state.dnpc = start_pc + 4;
@@ -24,7 +52,11 @@ void init_emulator(Emulator *emu, const char *hex_file, uint64_t start_pc, size_
         }
         uint32_t value;
         if (sscanf(line, "%x", &value) == 1) {
-            if (emu->state.pc + count * 4 < MEMORY_SIZE) {
+            if (emu->state.pc + count * 4 < emu->memory_size) {
+                if (emu->memory_size > CLINT_BASE && in_device_window(emu->state.pc + count * 4)) {
+                    fprintf(stderr, "Hex image overlaps a device window at 0x%lx\n", emu->state.pc + count * 4);
+                    exit(1);
+                }
                 memcpy(&emu->memory[emu->state.pc + count * 4], &value, sizeof(value));
                 count++;
             }
@@ -32,7 +64,12 @@ void init_emulator(Emulator *emu, const char *hex_file, uint64_t start_pc, size_
     }
 
     fclose(file);
+    emu->image_start = start_pc;
+    emu->image_end = start_pc + count * 4;
+    open_log(emu, log_file_name);
+}
 
+void open_log(Emulator *emu, const char *log_file_name) {
     if (log_file_name == NULL) {
         log_file_name = LOG_FILE;
     }
@@ -43,78 +80,145 @@ void init_emulator(Emulator *emu, const char *hex_file, uint64_t start_pc, size_
     }
 }
 
-uint32_t fetch(Emulator *emu) {
-    uint32_t raw_instr;
-    memcpy(&raw_instr, &emu->memory[PC], sizeof(raw_instr));
-    return raw_instr;
+void free_emulator(Emulator *emu) {
+    if (emu->log_file) {
+        fclose(emu->log_file);
+    }
+    free(emu->blocks);
+    emu->blocks = NULL;
+    unmap_guest_memory(emu->memory, emu->memory_mapped);
+    emu->memory = NULL;
+    free(emu->code_map);
+    emu->code_map = NULL;
+    free(emu->dirty_pages);
+    emu->dirty_pages = NULL;
+    pc_set_clear(&emu->breakpoints);
+    free_devices(&emu->devices);
 }
 
-bool execute(Emulator *emu, Instruction instr) {
-    switch (instr.opcode) {
-        case 0x33: // R-type instructions
-            execute_r_type(emu, instr);
-            break;
-        case 0x13: // I-type instructions
-            execute_i_type(emu, instr);
-            break;
-        case 0x63: // B-type instructions
-            execute_b_type(emu, instr);
-            break;
-        case 0x6F: // JAL
-            execute_jal(emu, instr);
-            break;
-        case 0x67: // JALR
-            execute_jalr(emu, instr);
-            break;
-        case 0x17: // AUIPC
-            execute_auipc(emu, instr);
-            break;
-        case 0x37: // LUI
-            execute_lui(emu, instr);
-            break;
-        case 0x03: // Load instructions
-            execute_load(emu, instr);
-            break;
-        case 0x23: // Store instructions
-            execute_store(emu, instr);
-            break;
-        case 0x3B: // W-type instructions
-            execute_addw(emu, instr);
-            break;
-        case 0x73: // CSR and system instructions
-            if (instr.funct3 == 0) {
-                if (instr.imm_i == 0) {
-                    execute_ecall(emu);
-                } else if (instr.imm_i == 1) {
-                    execute_ebreak(emu);
-                } else if (instr.imm_i == 0x302) {
-                    execute_mret(emu);
-                }
-            } else {
-                execute_csr(emu, instr);
+static size_t pc_set_slot(const PcSet *set, uint64_t pc) {
+    return (pc >> 2) * 0x9E3779B97F4A7C15ull >> 32 & (set->capacity - 1);
+}
+
+bool pc_set_contains(const PcSet *set, uint64_t pc) {
+    if (set->count == 0) {
+        return false;
+    }
+    for (size_t slot = pc_set_slot(set, pc); set->slots[slot]; slot = (slot + 1) & (set->capacity - 1)) {
+        if (set->slots[slot] == pc + 1) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void pc_set_insert(PcSet *set, uint64_t pc) {
+    size_t slot = pc_set_slot(set, pc);
+    while (set->slots[slot]) {
+        slot = (slot + 1) & (set->capacity - 1);
+    }
+    set->slots[slot] = pc + 1;
+    set->count++;
+}
+
+void pc_set_add(PcSet *set, uint64_t pc) {
+    if (pc_set_contains(set, pc)) {
+        return;
+    }
+    // Keep the table at most half full
+    if ((set->count + 1) * 2 > set->capacity) {
+        PcSet grown = { .capacity = set->capacity ? set->capacity * 2 : 16 };
+        grown.slots = calloc(grown.capacity, sizeof(uint64_t));
+        if (!grown.slots) {
+            perror("Failed to allocate PC set");
+            exit(1);
+        }
+        for (size_t i = 0; i < set->capacity; i++) {
+            if (set->slots[i]) {
+                pc_set_insert(&grown, set->slots[i] - 1);
             }
-            break;
-        // ...other instruction types...
-        default:
-            return false;
+        }
+        free(set->slots);
+        *set = grown;
     }
-    return true;
+    pc_set_insert(set, pc);
 }
 
-bool fetch_and_execute(Emulator *emu) {
-    static size_t executed_instrs = 0;
+void pc_set_remove(PcSet *set, uint64_t pc) {
+    if (!pc_set_contains(set, pc)) {
+        return;
+    }
+    // Rehash the remaining entries instead of leaving tombstones
+    uint64_t *old_slots = set->slots;
+    size_t old_capacity = set->capacity;
+    set->slots = calloc(old_capacity, sizeof(uint64_t));
+    if (!set->slots) {
+        perror("Failed to allocate PC set");
+        exit(1);
+    }
+    set->count = 0;
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old_slots[i] && old_slots[i] != pc + 1) {
+            pc_set_insert(set, old_slots[i] - 1);
+        }
+    }
+    free(old_slots);
+}
 
-    if (PC >= MEMORY_SIZE || executed_instrs >= MAX_EXEC_INSTRS) {
-        fprintf(stderr, "Maximum instruction limit reached or memory overflow.\n");
+void pc_set_clear(PcSet *set) {
+    free(set->slots);
+    set->slots = NULL;
+    set->capacity = 0;
+    set->count = 0;
+}
+
+bool add_watchpoint(Emulator *emu, uint64_t addr, uint64_t len, uint32_t kind) {
+    if (emu->num_watchpoints == MAX_WATCHPOINTS) {
         return false;
     }
+    emu->watchpoints[emu->num_watchpoints++] = (Watchpoint) { .addr = addr, .len = len, .kind = kind };
+    return true;
+}
 
-    uint32_t raw_instr = fetch(emu);
-    if (raw_instr == 0xFFFFFFFF) {
-        return false;
+bool remove_watchpoint(Emulator *emu, uint64_t addr, uint64_t len, uint32_t kind) {
+    for (size_t i = 0; i < emu->num_watchpoints; i++) {
+        Watchpoint *watch = &emu->watchpoints[i];
+        if (watch->addr == addr && watch->len == len && watch->kind == kind) {
+            *watch = emu->watchpoints[--emu->num_watchpoints];
+            return true;
+        }
+    }
+    return false;
+}
+
+static void check_watchpoints(Emulator *emu, uint64_t address, uint64_t size, uint32_t kind) {
+    for (size_t i = 0; i < emu->num_watchpoints; i++) {
+        const Watchpoint *watch = &emu->watchpoints[i];
+        if ((watch->kind & kind) && address < watch->addr + watch->len && watch->addr < address + size) {
+            emu->stop_reason = STOP_WATCHPOINT;
+            emu->stop_addr = address;
+            emu->stop_kind = kind;
+            return;
+        }
+    }
+}
+
+void flush_block_cache(Emulator *emu) {
+    for (size_t i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        emu->blocks[i].valid = false;
     }
-    
+    memset(emu->code_map, 0, emu->memory_size >> CODE_GRANULE_SHIFT);
+}
+
+uint32_t fetch(Emulator *emu) {
+    uint32_t raw_instr;
+    memcpy(&raw_instr, &emu->memory[PC], sizeof(raw_instr));
+    return raw_instr;
+}
+
+Instruction decode(uint32_t raw_instr) {
     Instruction instr = {
+        .op = decode_op(raw_instr),
         .opcode = raw_instr & 0x7F,
         .rd = (raw_instr >> 7) & 0x1F,
         .funct3 = (raw_instr >> 12) & 0x07,
@@ -123,352 +227,667 @@ bool fetch_and_execute(Emulator *emu) {
         .funct7 = (raw_instr >> 25) & 0x7F,
         .imm_i = (int32_t)(raw_instr & 0xFFF00000) >> 20,
         .imm_b = ((raw_instr >> 7) & 0x1E) | ((raw_instr >> 20) & 0x7E0) | ((raw_instr << 4) & 0x800) | ((raw_instr >> 19) & 0x1000),
-        .imm_j = ((raw_instr >> 12) & 0xFF) | ((raw_instr >> 20) & 0x1) << 11 | ((raw_instr >> 21) & 0x3FF) << 1 | ((raw_instr >> 31) & 0x1) << 20,
+        .imm_j = (raw_instr & 0xFF000) | ((raw_instr >> 20) & 0x1) << 11 | ((raw_instr >> 21) & 0x3FF) << 1 | ((raw_instr >> 31) & 0x1) << 20,
         .imm_u = (int32_t)(raw_instr & 0xFFFFF000),
         .imm_jalr = (int32_t)(raw_instr & 0xFFF00000) >> 20,
-        .imm_s = ((raw_instr >> 7) & 0x1F) | ((raw_instr >> 25) & 0x7F) << 5,
+        .imm_s = (int32_t)((((raw_instr >> 7) & 0x1F) | (raw_instr & 0xFE000000) >> 20) << 20) >> 20,
         .imm_l = (int32_t)(raw_instr & 0xFFF00000) >> 20
     };
-    bool success = execute(emu, instr);
-    if (!success) {
-        fprintf(stderr, "Failed to execute instruction: 0x%08x\n", raw_instr);
-        return false;
+    // LR/SC and AMOs address rs1 alone; their upper bits hold funct5, aq/rl and rs2
+    if (instr.opcode == 0x2F) {
+        instr.imm_l = 0;
+        instr.imm_s = 0;
     }
+    return instr;
+}
 
-    if (emu->log_enabled) {
-        log_state(emu, raw_instr);
+// Idioms run as one operation when nothing observes the state between the two instructions
+enum {
+    FUSE_NONE,
+    FUSE_LUI_ADDI,      // lui rd, hi; addi rd, rd, lo
+    FUSE_AUIPC_ADDI,    // auipc rd, hi; addi rd, rd, lo
+    FUSE_AUIPC_JALR,    // auipc rt, hi; jalr rd, lo(rt)
+    FUSE_SHIFT_PAIR,    // slli rd, rs, n; srli rd, rd, n (zero-extension)
+    FUSE_COMPARE_BRANCH // slt[i][u] rd, ...; beq/bne rd, x0
+};
+
+static uint8_t fusion_kind(Instruction first, Instruction second) {
+    if (first.rd == 0) {
+        return FUSE_NONE;
     }
-
-    PC = DNPC;
-    DNPC = PC + 4;
-    executed_instrs++;
-    return true;
+    bool chained = second.rs1 == first.rd;
+    bool addi = second.op == OP_ADDI && second.rd == first.rd && chained;
+    if (first.op == OP_LUI && addi) {
+        return FUSE_LUI_ADDI;
+    }
+    if (first.op == OP_AUIPC && addi) {
+        return FUSE_AUIPC_ADDI;
+    }
+    if (first.op == OP_AUIPC && second.op == OP_JALR && chained) {
+        return FUSE_AUIPC_JALR;
+    }
+    if (first.op == OP_SLLI && second.op == OP_SRLI && second.rd == first.rd && chained &&
+        (first.imm_i & 0x3F) == (second.imm_i & 0x3F)) {
+        return FUSE_SHIFT_PAIR;
+    }
+    bool compare = first.op == OP_SLT || first.op == OP_SLTU || first.op == OP_SLTI || first.op == OP_SLTIU;
+    bool tests_rd = (second.rs1 == first.rd && second.rs2 == 0) || (second.rs1 == 0 && second.rs2 == first.rd);
+    if (compare && (second.op == OP_BEQ || second.op == OP_BNE) && tests_rd) {
+        return FUSE_COMPARE_BRANCH;
+    }
+    return FUSE_NONE;
 }
 
-void log_state(const Emulator *emu, const uint32_t instr) {
-    fprintf(emu->log_file, "PC: 0x%016lx\t", emu->state.pc);  // Print PC as 64-bit hex
-    fprintf(emu->log_file, "Instr: 0x%08x\n", instr);
-    for (int i = 0; i < NUM_REGS; i++) {
-        if (i % 4 == 3) {
-            fprintf(emu->log_file, "x%d: 0x%016lx\n", i, emu->state.regs[i]);  // Print registers as 64-bit hex
-        } else {
-            fprintf(emu->log_file, "x%d: 0x%016lx ", i, emu->state.regs[i]);  // Print registers as 64-bit hex
+// Runs instrs[i] and instrs[i + 1] as one operation and leaves PC after the pair
+static void execute_fused(Emulator *emu, const Block *block, uint32_t i) {
+    Instruction first = block->instrs[i];
+    Instruction second = block->instrs[i + 1];
+    uint64_t *regs = emu->state.regs;
+    switch (block->fusion[i]) {
+        case FUSE_LUI_ADDI:
+            regs[first.rd] = (int64_t)(int32_t)first.imm_u + second.imm_i;
+            break;
+        case FUSE_AUIPC_ADDI:
+            regs[first.rd] = PC + (int64_t)(int32_t)first.imm_u + second.imm_i;
+            break;
+        case FUSE_AUIPC_JALR: {
+            uint64_t base = PC + (int64_t)(int32_t)first.imm_u;
+            regs[first.rd] = base;
+            if (second.rd != 0) {
+                regs[second.rd] = PC + 8;
+            }
+            PC = (base + second.imm_jalr) & ~1;
+            DNPC = PC + 4;
+            return;
+        }
+        case FUSE_SHIFT_PAIR: {
+            uint32_t shamt = first.imm_i & 0x3F;
+            regs[first.rd] = regs[first.rs1] << shamt >> shamt;
+            break;
+        }
+        case FUSE_COMPARE_BRANCH: {
+            uint64_t a = regs[first.rs1];
+            uint64_t b = first.op == OP_SLTI || first.op == OP_SLTIU ? (uint64_t)(int64_t)first.imm_i : regs[first.rs2];
+            uint64_t value = first.op == OP_SLT || first.op == OP_SLTI ? (int64_t)a < (int64_t)b : a < b;
+            regs[first.rd] = value;
+            bool taken = (second.op == OP_BEQ) == (value == 0); // Against x0
+            int32_t imm = (int32_t)((uint32_t)second.imm_b << 19) >> 19;
+            PC = taken ? PC + 4 + imm : PC + 8;
+            DNPC = PC + 4;
+            return;
         }
     }
-    fprintf(emu->log_file, "\n");
-    // Log CSRs if needed
-    // for (int i = 0; i < 4096; i++) {
-    //     fprintf(emu->log_file, "CSR[%d]: 0x%08x\n", i, emu->state.csrs[i]);
-    // }
+    PC += 8;
+    DNPC = PC + 4;
 }
 
-void execute_r_type(Emulator *emu, Instruction instr) {
-    if (instr.rd == 0) return; // Skip if rd is x0
+static void fuse_block(Block *block) {
+    for (uint32_t i = 0; i < block->num_instrs; i++) {
+        block->fusion[i] = i + 1 < block->num_instrs ? fusion_kind(block->instrs[i], block->instrs[i + 1]) : FUSE_NONE;
+    }
+}
 
-    switch (instr.funct3) {
-        case 0x0:
-            if (instr.funct7 == 0x00) {
-                // ADD
-                RD = RS1 + RS2;
-            } else if (instr.funct7 == 0x20) {
-                // SUB
-                RD = RS1 - RS2;
-            }
-            break;
-        case 0x1:
-            if (instr.funct7 == 0x00) {
-                // SLL
-                RD = RS1 << (RS2 & 0x3F);
-            }
-            break;
-        case 0x2:
-            if (instr.funct7 == 0x00) {
-                // SLT
-                RD = (int64_t)RS1 < (int64_t)RS2 ? 1 : 0;
-            }
-            break;
-        case 0x3:
-            if (instr.funct7 == 0x00) {
-                // SLTU
-                RD = RS1 < RS2 ? 1 : 0;
-            }
-            break;
-        case 0x4:
-            if (instr.funct7 == 0x00) {
-                // XOR
-                RD = RS1 ^ RS2;
-            } else if (instr.funct7 == 0x01) {
-                // MUL
-                RD = RS1 * RS2;
-            }
-            break;
-        case 0x5:
-            if (instr.funct7 == 0x00) {
-                // SRL
-                RD = RS1 >> (RS2 & 0x3F);
-            } else if (instr.funct7 == 0x20) {
-                // SRA
-                RD = (int64_t)RS1 >> (RS2 & 0x3F);
-            } else if (instr.funct7 == 0x01) {
-                // DIV
-                RD = RS1 / RS2;
-            }
-            break;
-        case 0x6:
-            if (instr.funct7 == 0x00) {
-                // OR
-                RD = RS1 | RS2;
-            } else if (instr.funct7 == 0x01) {
-                // REM
-                RD = RS1 % RS2;
-            }
+static void build_block(Emulator *emu, Block *block, uint64_t pc) {
+    block->pc = pc;
+    block->num_instrs = 0;
+    block->num_loads = 0;
+    block->num_stores = 0;
+    block->valid = true;
+    block->jump_target = NULL;
+    // An empty block caches an undecodable word, so rewriting that word must drop it too
+    emu->code_map[pc >> CODE_GRANULE_SHIFT] = 1;
+
+    // The exit marker and undecodable words end the block; executing them is left to the caller
+    while (block->num_instrs < BLOCK_MAX_INSTRS && pc + 4 <= emu->memory_size) {
+        uint32_t raw_instr;
+        memcpy(&raw_instr, &emu->memory[pc], sizeof(raw_instr));
+        Instruction instr = decode(raw_instr);
+        if (raw_instr == 0xFFFFFFFF || instr.op == OP_INVALID) {
             break;
-        case 0x7:
-            if (instr.funct7 == 0x00) {
-                // AND
-                RD = RS1 & RS2;
-            }
+        }
+
+        block->raw[block->num_instrs] = raw_instr;
+        block->instrs[block->num_instrs] = instr;
+        block->num_instrs++;
+        uint32_t flags = isa_info[instr.op].flags;
+        block->num_loads += (flags & ISA_LOAD) != 0;
+        block->num_stores += (flags & ISA_STORE) != 0;
+        emu->code_map[pc >> CODE_GRANULE_SHIFT] = 1;
+        pc += 4;
+        // Branches, jumps and system instructions may redirect the PC or touch counters
+        if (flags & ISA_ENDS_BLOCK) {
             break;
-        // ...other R-type instructions...
+        }
     }
+    fuse_block(block);
 }
 
-void execute_i_type(Emulator *emu, Instruction instr) {
-    if (instr.rd == 0) return; // Skip if rd is x0
+// Takes the block from the code cache when an earlier run decoded the same words at pc.
+// The file only holds decoder output, so fusion is worked out again here
+static bool restore_block(Emulator *emu, Block *block, uint64_t pc) {
+    const CachedBlock *cached = find_cached_block(emu->code_cache, pc);
+    if (!cached || cached->num_instrs > (emu->memory_size - pc) / 4 ||
+        memcmp(&emu->memory[pc], cached->raw, cached->num_instrs * sizeof(uint32_t)) != 0) {
+        emu->code_cache->misses++;
+        return false;
+    }
+    emu->code_cache->hits++;
+    block->pc = pc;
+    block->num_instrs = cached->num_instrs;
+    block->num_loads = cached->num_loads;
+    block->num_stores = cached->num_stores;
+    block->valid = true;
+    block->jump_target = NULL;
+    memcpy(block->raw, cached->raw, cached->num_instrs * sizeof(uint32_t));
+    memcpy(block->instrs, cached->instrs, cached->num_instrs * sizeof(Instruction));
+    uint64_t last = (pc + cached->num_instrs * 4 - 1) >> CODE_GRANULE_SHIFT;
+    for (uint64_t granule = pc >> CODE_GRANULE_SHIFT; granule <= last; granule++) {
+        emu->code_map[granule] = 1;
+    }
+    fuse_block(block);
+    return true;
+}
 
-    switch (instr.funct3) {
-        case 0x0:
-            // ADDI
-            RD = RS1 + instr.imm_i;
-            break;
-        case 0x2:
-            // SLTI
-            RD = (int64_t)RS1 < instr.imm_i ? 1 : 0;
-            break;
-        case 0x3:
-            // SLTIU
-            RD = RS1 < (uint64_t)instr.imm_i ? 1 : 0;
-            break;
-        case 0x4:
-            // XORI
-            RD = RS1 ^ instr.imm_i;
-            break;
-        case 0x6:
-            // ORI
-            RD = RS1 | instr.imm_i;
-            break;
-        case 0x7:
-            // ANDI
-            RD = RS1 & instr.imm_i;
-            break;
-        case 0x1:
-            // SLLI
-            RD = RS1 << (instr.imm_i & 0x3F);
-            break;
-        case 0x5:
-            if ((instr.imm_i & 0x400) == 0) {
-                // SRLI
-                RD = RS1 >> (instr.imm_i & 0x3F);
-            } else {
-                // SRAI
-                RD = (int64_t)RS1 >> (instr.imm_i & 0x3F);
-            }
-            break;
-        // ...other I-type instructions...
+static Block *lookup_block(Emulator *emu, uint64_t pc) {
+    Block *block = &emu->blocks[(pc >> 2) & (BLOCK_CACHE_SIZE - 1)];
+    if (!block->valid || block->pc != pc) {
+        emu->blocks_decoded++;
+        if (!emu->code_cache || !restore_block(emu, block, pc)) {
+            build_block(emu, block, pc);
+        }
     }
+    return block;
 }
 
-void execute_b_type(Emulator *emu, Instruction instr) {
-    int32_t imm = (instr.imm_b << 19) >> 19; // Sign-extend the immediate
+static Block *cached_block(Emulator *emu, uint64_t pc) {
+    Block *block = &emu->blocks[(pc >> 2) & (BLOCK_CACHE_SIZE - 1)];
+    return block->valid && block->pc == pc ? block : NULL;
+}
 
-    switch (instr.funct3) {
-        case 0x0:
-            // BEQ
-            if (RS1 == RS2) {
-                DNPC = PC + imm;
-            }
-            break;
-        case 0x1:
-            // BNE
-            if (RS1 != RS2) {
-                DNPC = PC + imm;
-            }
-            break;
-        case 0x4:
-            // BLT
-            if ((int64_t)RS1 < (int64_t)RS2) {
-                DNPC = PC + imm;
-            }
-            break;
-        case 0x5:
-            // BGE
-            if ((int64_t)RS1 >= (int64_t)RS2) {
-                DNPC = PC + imm;
-            }
-            break;
-        case 0x6:
-            // BLTU
-            if (RS1 < RS2) {
-                DNPC = PC + imm;
-            }
-            break;
-        case 0x7:
-            // BGEU
-            if (RS1 >= RS2) {
-                DNPC = PC + imm;
-            }
-            break;
-        // ...other B-type instructions...
+// Returns the decoded block that runs after a jump, or NULL to leave it to the next lookup.
+// Returns pop the RAS; every other jump site remembers where it went last time
+static Block *predict_successor(Emulator *emu, Block *block, const Instruction *jump) {
+    bool links = jump->rd == 1 || jump->rd == 5;
+    Block *next = NULL;
+    if (jump->op == OP_JALR && !links && (jump->rs1 == 1 || jump->rs1 == 5)) {
+        emu->ras_top = (emu->ras_top - 1) & (RAS_SIZE - 1);
+        RasEntry *entry = &emu->ras[emu->ras_top];
+        emu->returns++;
+        if (entry->pc == PC) {
+            emu->return_hits++;
+            next = entry->block;
+        }
+    } else {
+        next = block->jump_target;
+        bool hit = next && next->valid && next->pc == PC;
+        if (jump->op == OP_JALR) {
+            emu->indirect_jumps++;
+            emu->indirect_hits += hit;
+        }
+        if (!hit) {
+            next = block->jump_target = cached_block(emu, PC);
+        }
     }
+    if (links) {
+        RasEntry *entry = &emu->ras[emu->ras_top];
+        entry->pc = emu->block_end;
+        entry->block = cached_block(emu, emu->block_end);
+        emu->ras_top = (emu->ras_top + 1) & (RAS_SIZE - 1);
+    }
+    return next;
 }
 
-void execute_jal(Emulator *emu, Instruction instr) {
-    if (instr.rd != 0) {
-        RD = PC + 4;
+static void invalidate_code(Emulator *emu, uint64_t address) {
+    uint64_t granule = address >> CODE_GRANULE_SHIFT;
+    for (size_t i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        Block *block = &emu->blocks[i];
+        uint64_t first = block->pc >> CODE_GRANULE_SHIFT;
+        uint64_t last = (block->pc + block->num_instrs * 4) >> CODE_GRANULE_SHIFT;
+        if (block->valid && granule >= first && granule <= last) {
+            block->valid = false;
+        }
     }
-    int32_t imm = (instr.imm_j << 11) >> 11; // Sign-extend the immediate
-    DNPC = PC + imm;
+    emu->code_map[granule] = 0;
 }
 
-void execute_jalr(Emulator *emu, Instruction instr) {
-    if (instr.rd != 0) {
-        RD = PC + 4;
+// For writes that bypass the store path: debugger edits, host I/O into guest buffers, checkpoints
+void mark_dirty(Emulator *emu, uint64_t addr, uint64_t len) {
+    if (len == 0) {
+        return;
+    }
+    if (emu->host_write_probe && emu->host_write_probe - 1 - addr < len) {
+        emu->host_write_seen = true;
+    }
+    for (uint64_t page = addr >> PAGE_SHIFT; page <= (addr + len - 1) >> PAGE_SHIFT; page++) {
+        emu->dirty_pages[page] = DIRTY_ALL;
+    }
+    for (uint64_t granule = addr >> CODE_GRANULE_SHIFT; granule <= (addr + len - 1) >> CODE_GRANULE_SHIFT; granule++) {
+        if (emu->code_map[granule]) {
+            invalidate_code(emu, granule << CODE_GRANULE_SHIFT);
+        }
     }
-    DNPC = (RS1 + instr.imm_jalr) & ~1;
 }
 
-void execute_auipc(Emulator *emu, Instruction instr) {
-    if (instr.rd != 0) {
-        RD = PC + (instr.imm_u);
+// Past the end of RAM, or a device window RAM reaches into; user mode has no devices
+static bool is_device(const Emulator *emu, uint64_t address, uint32_t size) {
+    return address > emu->memory_size - size || (emu->memory_size > CLINT_BASE && !emu->user && in_device_window(address));
+}
+
+static void note_store(Emulator *emu, uint64_t address, size_t size) {
+    // Stores into decoded code drop the stale blocks (self-modifying code)
+    if (is_device(emu, address, size)) {
+        return;
+    }
+    emu->dirty_pages[address >> PAGE_SHIFT] = DIRTY_ALL;
+    emu->dirty_pages[(address + size - 1) >> PAGE_SHIFT] = DIRTY_ALL;
+    if (emu->code_map[address >> CODE_GRANULE_SHIFT]) {
+        invalidate_code(emu, address);
+    }
+    if (emu->code_map[(address + size - 1) >> CODE_GRANULE_SHIFT]) {
+        invalidate_code(emu, address + size - 1);
     }
 }
 
-void execute_lui(Emulator *emu, Instruction instr) {
-    if (instr.rd != 0) {
-        RD = instr.imm_u;
+// Whether the instruction writes a nonzero rd
+bool writes_rd(Instruction instr) {
+    return (isa_info[instr.op].flags & ISA_WRITES_RD) && instr.rd != 0;
+}
+
+uint64_t retired_instrs(const Emulator *emu) {
+    // instret is committed when a block starts; do not count the part still ahead of PC
+    if (PC >= emu->block_start && PC < emu->block_end) {
+        return emu->state.instret - (emu->block_end - PC) / 4;
     }
+    return emu->state.instret;
 }
 
-void execute_load(Emulator *emu, Instruction instr) {
-    uint64_t address = RS1 + instr.imm_l;
-    switch (instr.funct3) {
-        case 0x0: // LB
-            RD = (int8_t)emu->memory[address];
-            break;
-        case 0x1: // LH
-            RD = (int16_t)(emu->memory[address] | 
-                (emu->memory[address + 1] << 8));
-            break;
-        case 0x2: // LW
-            RD = (int32_t)(emu->memory[address] | 
-                          (emu->memory[address + 1] << 8) | 
-                          (emu->memory[address + 2] << 16) | 
-                          (emu->memory[address + 3] << 24));
-            break;
-        case 0x3: // LD
-            RD = (uint64_t)(emu->memory[address] | 
-                           (emu->memory[address + 1] << 8) | 
-                           (emu->memory[address + 2] << 16) | 
-                           (emu->memory[address + 3] << 24) |
-                           ((uint64_t)emu->memory[address + 4] << 32) | 
-                           ((uint64_t)emu->memory[address + 5] << 40) | 
-                           ((uint64_t)emu->memory[address + 6] << 48) | 
-                           ((uint64_t)emu->memory[address + 7] << 56));
-            break;
-        case 0x4: // LBU
-            RD = emu->memory[address];
-            break;
-        case 0x5: // LHU
-            RD = (uint16_t)(emu->memory[address] | (emu->memory[address + 1] << 8));
-            break;
-        case 0x6: // LWU
-            RD = (uint32_t)(emu->memory[address] | (emu->memory[address + 1] << 8) | (emu->memory[address + 2] << 16) | (emu->memory[address + 3] << 24));
-            break;
-        // ...other load instructions...
+static uint64_t raw_counter(const Emulator *emu, uint32_t index) {
+    if (index == 0 || index == 2) {
+        // One instruction per cycle
+        return retired_instrs(emu);
     }
+    uint64_t event = emu->state.csrs[CSR_MHPMEVENT3 + index - 3];
+    return event < NUM_HPM_EVENTS ? emu->state.hpm_events[event] : 0;
 }
 
-void execute_store(Emulator *emu, Instruction instr) {
-    uint64_t address = RS1 + instr.imm_s;
-    switch (instr.funct3) {
-        case 0x0: // SB
-            emu->memory[address] = RS2 & 0xFF;
-            break;
-        case 0x1: // SH
-            emu->memory[address] = RS2 & 0xFF;
-            emu->memory[address + 1] = (RS2 >> 8) & 0xFF;
-            break;
-        case 0x2: // SW
-            emu->memory[address] = RS2 & 0xFF;
-            emu->memory[address + 1] = (RS2 >> 8) & 0xFF;
-            emu->memory[address + 2] = (RS2 >> 16) & 0xFF;
-            emu->memory[address + 3] = (RS2 >> 24) & 0xFF;
-            break;
-        case 0x3: // SD
-            emu->memory[address] = RS2 & 0xFF;
-            emu->memory[address + 1] = (RS2 >> 8) & 0xFF;
-            emu->memory[address + 2] = (RS2 >> 16) & 0xFF;
-            emu->memory[address + 3] = (RS2 >> 24) & 0xFF;
-            emu->memory[address + 4] = (RS2 >> 32) & 0xFF;
-            emu->memory[address + 5] = (RS2 >> 40) & 0xFF;
-            emu->memory[address + 6] = (RS2 >> 48) & 0xFF;
-            emu->memory[address + 7] = (RS2 >> 56) & 0xFF;
-            break;
-        // ...other store instructions...
+uint64_t read_counter(Emulator *emu, uint32_t index) {
+    if (index == 1) {
+        return device_mtime(emu);
     }
+    return raw_counter(emu, index) + emu->state.counter_offsets[index];
 }
 
-void execute_addw(Emulator *emu, Instruction instr) {
-    if (instr.rd == 0) return; // Skip if rd is x0
+static bool is_counter_csr(uint32_t csr) {
+    return (csr >= CSR_MCYCLE && csr <= CSR_MHPMCOUNTER31) || (csr >= CSR_CYCLE && csr <= CSR_HPMCOUNTER31);
+}
 
-    switch (instr.funct3) {
-        case 0x0:
-            if (instr.funct7 == 0x00) {
-                // ADDW
-                RD = (int32_t)(RS1 + RS2);
-            } else if (instr.funct7 == 0x20) {
-                // SUBW
-                RD = (int32_t)(RS1 - RS2);
-            }
-            break;
-        // ...other W-type instructions...
+uint64_t read_csr(Emulator *emu, uint32_t csr) {
+    if (is_counter_csr(csr)) {
+        return read_counter(emu, csr & 0x1F);
     }
+    return emu->state.csrs[csr];
 }
 
-void execute_csr(Emulator *emu, Instruction instr) {
+bool write_csr(Emulator *emu, uint32_t csr, uint64_t value) {
+    if (csr >= CSR_CYCLE && csr <= CSR_HPMCOUNTER31) {
+        return false; // User-level counters are read-only
+    }
+    if (is_counter_csr(csr)) {
+        uint32_t index = csr & 0x1F;
+        if (index == 1) {
+            return false; // There is no machine-level time CSR
+        }
+        // The written value is what the next instruction sees, so the writer itself does not count
+        uint64_t self = (index == 0 || index == 2) ? 1 : 0;
+        emu->state.counter_offsets[index] = value - raw_counter(emu, index) - self;
+        return true;
+    }
+    emu->state.csrs[csr] = value;
+    return true;
+}
+
+// Operands the handlers in isa.tbl use besides the state macros
+#define IMM_B ((int32_t)((uint32_t)instr.imm_b << 19) >> 19)
+#define IMM_J ((int32_t)((uint32_t)instr.imm_j << 11) >> 11)
+
+// Little-endian access to RAM; the device windows and anything past RAM, including addresses that wrap, are devices
+static uint64_t load(Emulator *emu, uint64_t address, uint32_t size) {
+    if (emu->timing) {
+        timing_record(emu->timing, TIMING_LOAD, address, size);
+    }
+    if (emu->num_watchpoints) {
+        check_watchpoints(emu, address, size, WATCH_READ);
+    }
+    if (is_device(emu, address, size)) {
+        return device_load(emu, address, size);
+    }
+    uint64_t value = 0;
+    memcpy(&value, &emu->memory[address], size);
+    return value;
+}
+
+static void store(Emulator *emu, uint64_t address, uint32_t size, uint64_t value) {
+    note_store(emu, address, size);
+    if (emu->timing) {
+        timing_record(emu->timing, TIMING_STORE, address, size);
+    }
+    if (emu->num_watchpoints) {
+        check_watchpoints(emu, address, size, WATCH_WRITE);
+    }
+    if (emu->tracer && emu->tracer->on_store) {
+        trace_store(emu, address, size);
+    }
+    if (is_device(emu, address, size)) {
+        device_store(emu, address, size, value);
+        return;
+    }
+    memcpy(&emu->memory[address], &value, size);
+}
+
+// All six CSR instructions: rd gets the old value and the CSR becomes (old & ~clear) | set
+static void csr_modify(Emulator *emu, Instruction instr, uint64_t clear, uint64_t set) {
     uint32_t csr = instr.imm_i & 0xFFF;
-    uint64_t value = emu->state.csrs[csr];
+    uint64_t value = read_csr(emu, csr);
+    uint64_t new_value = value;
+    // CSRRS/CSRRC with rs1 = x0 and CSRRSI/CSRRCI with uimm = 0 only read, so counters keep counting
+    if ((instr.rs1 != 0 || clear == UINT64_MAX) && write_csr(emu, csr, (value & ~clear) | set)) {
+        new_value = (value & ~clear) | set;
+    }
+    // Not read back: reading time again would take another record/replay event
+    if (emu->tracer && emu->tracer->on_csr) {
+        trace_csr(emu, csr, value, new_value);
+    }
+    RD = value;
+}
 
-    switch (instr.funct3) {
-        case 0x1: // CSRRW
-            emu->state.csrs[csr] = RS1;
-            RD = value;
-            break;
-        case 0x2: // CSRRS
-            emu->state.csrs[csr] |= RS1;
-            RD = value;
-            break;
-        case 0x3: // CSRRC
-            emu->state.csrs[csr] &= ~RS1;
-            RD = value;
-            break;
-        case 0x5: // CSRRWI
-            emu->state.csrs[csr] = instr.rs1;
-            RD = value;
+// Division never traps: INT64_MIN / -1 overflows to the dividend with remainder 0
+static uint64_t signed_div(uint64_t a, uint64_t b) {
+    if (b == 0) {
+        return UINT64_MAX;
+    }
+    if ((int64_t)a == INT64_MIN && (int64_t)b == -1) {
+        return a;
+    }
+    return (int64_t)a / (int64_t)b;
+}
+
+static uint64_t signed_rem(uint64_t a, uint64_t b) {
+    if (b == 0) {
+        return a;
+    }
+    if ((int64_t)a == INT64_MIN && (int64_t)b == -1) {
+        return 0;
+    }
+    return (int64_t)a % (int64_t)b;
+}
+
+// SC only stores to the address the last LR reserved and writes 0 to rd then; either way the reservation is gone
+static uint64_t store_conditional(Emulator *emu, uint64_t address, uint32_t size, uint64_t value) {
+    bool reserved = emu->reservation == address + 1;
+    emu->reservation = 0;
+    if (reserved) {
+        store(emu, address, size, value);
+    }
+    return !reserved;
+}
+
+// AMO*.W/.D: memory gets the old value combined with rs2 (funct5 picks the operation), rd the old value
+static uint64_t atomic_op(Emulator *emu, Instruction instr, uint32_t size) {
+    uint64_t address = RS1;
+    uint64_t src = RS2;
+    uint64_t old = load(emu, address, size);
+    if (size == 4) {
+        // Sign extension keeps both the signed and the unsigned order of the 32-bit values
+        old = (int32_t)old;
+        src = (int32_t)src;
+    }
+    uint64_t value;
+    switch (instr.funct7 >> 2) {
+        case 0x01: value = src; break;
+        case 0x04: value = old ^ src; break;
+        case 0x08: value = old | src; break;
+        case 0x0C: value = old & src; break;
+        case 0x10: value = (int64_t)old < (int64_t)src ? old : src; break;
+        case 0x14: value = (int64_t)old > (int64_t)src ? old : src; break;
+        case 0x18: value = old < src ? old : src; break;
+        case 0x1C: value = old > src ? old : src; break;
+        default: value = old + src; break;
+    }
+    store(emu, address, size, value);
+    return old;
+}
+
+// handle_<name> for every entry of isa.tbl and the isa_handlers table indexed by Op
+#include "isa_exec.inc"
+
+bool execute(Emulator *emu, Instruction instr) {
+    isa_handlers[instr.op](emu, instr);
+    emu->state.regs[0] = 0; // Handlers write rd even when it is x0
+    return instr.op != OP_INVALID;
+}
+
+static void count_block_events(Emulator *emu, const Block *block, uint32_t first, uint32_t last, int64_t delta) {
+    for (uint32_t i = first; i < last; i++) {
+        uint32_t flags = isa_info[block->instrs[i].op].flags;
+        emu->state.hpm_events[HPM_EVENT_LOADS] += ((flags & ISA_LOAD) != 0) * delta;
+        emu->state.hpm_events[HPM_EVENT_STORES] += ((flags & ISA_STORE) != 0) * delta;
+    }
+}
+
+// Returns how many instructions of the block can run before reaching a breakpoint
+static uint32_t breakpoint_cut(Emulator *emu, const Block *block, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        uint64_t pc = block->pc + i * 4;
+        if (pc_set_contains(&emu->breakpoints, pc) && !(i == 0 && emu->skip_breakpoint)) {
+            return i;
+        }
+    }
+    return count;
+}
+
+static void take_interrupt(Emulator *emu, uint64_t cause) {
+    uint64_t mstatus = emu->state.csrs[CSR_MSTATUS];
+    emu->state.csrs[CSR_MEPC] = PC;
+    emu->state.csrs[CSR_MCAUSE] = MCAUSE_INTERRUPT | cause;
+    emu->state.csrs[CSR_MTVAL] = 0;
+    emu->state.csrs[CSR_MIP] |= MIP_MTIP;
+    // MPIE <- MIE, MIE <- 0, MPP <- M
+    mstatus = (mstatus & ~MSTATUS_MPIE) | ((mstatus & MSTATUS_MIE) << 4);
+    emu->state.csrs[CSR_MSTATUS] = (mstatus & ~MSTATUS_MIE) | MSTATUS_MPP;
+    PC = emu->state.csrs[CSR_MTVEC] & ~3ull;
+    DNPC = PC + 4;
+    emu->traps++;
+    if (emu->tracer && emu->tracer->on_trap) {
+        trace_trap(emu, MCAUSE_INTERRUPT | cause);
+    }
+}
+
+bool fetch_and_execute(Emulator *emu) {
+    emu->stop_reason = STOP_NONE;
+    if (emu->state.instret >= emu->devices.next_poll) {
+        bool enabled = (emu->state.csrs[CSR_MSTATUS] & MSTATUS_MIE) && (emu->state.csrs[CSR_MIE] & MIE_MTIE);
+        if (poll_timer(emu, enabled)) {
+            take_interrupt(emu, IRQ_M_TIMER);
+        }
+    }
+    if (PC >= emu->memory_size || emu->state.instret >= emu->max_instrs) {
+        fprintf(stderr, "Maximum instruction limit reached or memory overflow.\n");
+        emu->stop_reason = STOP_LIMIT;
+        return false;
+    }
+
+    Block *block = lookup_block(emu, PC);
+    if (block->num_instrs == 0) {
+        uint32_t raw_instr = fetch(emu);
+        if (raw_instr != 0xFFFFFFFF) {
+            fprintf(stderr, "Failed to execute instruction: 0x%08x\n", raw_instr);
+            emu->stop_reason = STOP_ERROR;
+        } else {
+            emu->stop_reason = STOP_EXIT;
+        }
+        return false;
+    }
+
+    // Never run past the instruction limit or the caller's stopping point
+    uint64_t limit = emu->max_instrs < emu->stop_at ? emu->max_instrs : emu->stop_at;
+    if (emu->devices.next_poll < limit) {
+        limit = emu->devices.next_poll;
+    }
+    if (emu->state.instret >= limit) {
+        return true;
+    }
+    uint32_t count = block->num_instrs;
+    if (count > limit - emu->state.instret) {
+        count = limit - emu->state.instret;
+    }
+
+    // Breakpoints are only looked up when some are set, once per block
+    if (emu->breakpoints.count) {
+        count = breakpoint_cut(emu, block, count);
+        if (count == 0) {
+            emu->stop_reason = STOP_BREAKPOINT;
+            return false;
+        }
+    }
+    emu->skip_breakpoint = false;
+
+    // Triggers are checked once per block; untraced blocks keep the fast loop
+    bool traced = emu->tracer && trace_block(emu->tracer, PC, emu->state.instret, count);
+    uint64_t first_instret = emu->state.instret;
+
+    // Nothing looks at the state between instructions, so pairs can be fused, or between
+    // blocks, so a predicted successor can run without going back to the caller
+    bool fast = emu->num_watchpoints == 0 && !traced && !emu->log_enabled;
+    bool chain = fast && !emu->tracer && emu->breakpoints.count == 0;
+    for (;;) {
+        // Counters are updated once per block; CSR reads work out the exact value from PC
+        emu->blocks_run++;
+        emu->block_start = PC;
+        emu->block_end = PC + count * 4;
+        emu->state.instret += count;
+        // A watchpoint can end the block early, so then the fetch is recorded once the loop knows how far it got
+        if (emu->timing && emu->num_watchpoints == 0) {
+            timing_record(emu->timing, TIMING_FETCH, PC, count);
+        }
+        if (count == block->num_instrs) {
+            emu->state.hpm_events[HPM_EVENT_LOADS] += block->num_loads;
+            emu->state.hpm_events[HPM_EVENT_STORES] += block->num_stores;
+        } else {
+            count_block_events(emu, block, 0, count, 1);
+        }
+
+        if (fast) {
+            // A pair is only fused when both halves are inside this run of the block
+            for (uint32_t i = 0; i < count; i++) {
+                if (block->fusion[i] && i + 1 < count) {
+                    execute_fused(emu, block, i++);
+                    continue;
+                }
+                execute(emu, block->instrs[i]);
+                PC = DNPC;
+                DNPC = PC + 4;
+            }
+        } else if (emu->num_watchpoints == 0 && !traced) {
+            for (uint32_t i = 0; i < count; i++) {
+                execute(emu, block->instrs[i]);
+                if (emu->log_enabled) {
+                    log_state(emu, block->raw[i]);
+                }
+                PC = DNPC;
+                DNPC = PC + 4;
+            }
+        } else {
+            // A watchpoint stops the block right after the accessing instruction
+            for (uint32_t i = 0; i < count; i++) {
+                if (traced) {
+                    trace_before(emu, block->raw[i]);
+                }
+                execute(emu, block->instrs[i]);
+                if (emu->log_enabled) {
+                    log_state(emu, block->raw[i]);
+                }
+                if (traced) {
+                    trace_after(emu, block->raw[i], first_instret + i);
+                }
+                PC = DNPC;
+                DNPC = PC + 4;
+                if (emu->stop_reason == STOP_WATCHPOINT) {
+                    emu->state.instret -= count - i - 1;
+                    count_block_events(emu, block, i + 1, count, -1);
+                    emu->block_end = block->pc + (i + 1) * 4;
+                    count = i + 1;
+                    break;
+                }
+            }
+            if (emu->timing && emu->num_watchpoints) {
+                timing_record(emu->timing, TIMING_FETCH, block->pc, count);
+            }
+        }
+
+        const Instruction *last = &block->instrs[count - 1];
+        uint32_t flags = isa_info[last->op].flags;
+        if (flags & ISA_BRANCH) {
+            bool taken = PC != emu->block_end;
+            emu->state.hpm_events[HPM_EVENT_TAKEN_BRANCHES] += taken;
+            if (emu->timing) {
+                timing_record(emu->timing, TIMING_BRANCH, emu->block_end - 4, taken);
+            }
             break;
-        case 0x6: // CSRRSI
-            emu->state.csrs[csr] |= instr.rs1;
-            RD = value;
+        }
+        if (!(flags & ISA_JUMP) || count != block->num_instrs) {
             break;
-        case 0x7: // CSRRCI
-            emu->state.csrs[csr] &= ~instr.rs1;
-            RD = value;
+        }
+        // A stale or wrong guess fails the PC check and leaves the successor to the next lookup
+        Block *next = predict_successor(emu, block, last);
+        if (!chain || !next || !next->valid || next->pc != PC || next->num_instrs == 0 ||
+            emu->stop_reason != STOP_NONE || emu->state.instret + next->num_instrs > limit ||
+            emu->state.instret + next->num_instrs > emu->devices.next_poll) {
             break;
-        // ...other CSR instructions...
+        }
+        block = next;
+        count = block->num_instrs;
     }
+
+    if (emu->stats && emu->state.instret >= emu->stats_next) {
+        emu->stats_next = emu->state.instret + STATS_PUBLISH_INSTRS;
+        publish_stats(emu->stats, emu);
+    }
+    return emu->stop_reason == STOP_NONE;
+}
+
+bool run_until(Emulator *emu, uint64_t instret) {
+    emu->stop_at = instret;
+    bool running = true;
+    while (running && emu->state.instret < instret) {
+        running = fetch_and_execute(emu);
+    }
+    emu->stop_at = UINT64_MAX;
+    return running;
+}
+
+void log_state(const Emulator *emu, const uint32_t instr) {
+    fprintf(emu->log_file, "PC: 0x%016lx\t", emu->state.pc);  // Print PC as 64-bit hex
+    fprintf(emu->log_file, "Instr: 0x%08x\n", instr);
+    for (int i = 0; i < NUM_REGS; i++) {
+        if (i % 4 == 3) {
+            fprintf(emu->log_file, "x%d: 0x%016lx\n", i, emu->state.regs[i]);  // Print registers as 64-bit hex
+        } else {
+            fprintf(emu->log_file, "x%d: 0x%016lx ", i, emu->state.regs[i]);  // Print registers as 64-bit hex
+        }
+    }
+    fprintf(emu->log_file, "\n");
+    // Log CSRs if needed
+    // for (int i = 0; i < 4096; i++) {
+    //     fprintf(emu->log_file, "CSR[%d]: 0x%08x\n", i, emu->state.csrs[i]);
+    // }
 }
 
 void execute_ecall(Emulator *emu) {
+    emu->traps++;
+    if (emu->user) {
+        user_syscall(emu);
+        return;
+    }
     // Handle system call
     // For simplicity, we just print a message and set the appropriate CSRs
     printf("ECALL at PC: 0x%016lx\n", emu->state.pc);
@@ -476,9 +895,13 @@ void execute_ecall(Emulator *emu) {
     emu->state.csrs[CSR_MCAUSE] = 11; // Environment call from M-mode
     emu->state.csrs[CSR_MTVAL] = 0;
     DNPC = emu->state.csrs[CSR_MTVEC];
+    if (emu->tracer && emu->tracer->on_trap) {
+        trace_trap(emu, 11);
+    }
 }
 
 void execute_ebreak(Emulator *emu) {
+    emu->traps++;
     // Handle breakpoint
     // For simplicity, we just print a message and set the appropriate CSRs
     printf("EBREAK at PC: 0x%016lx\n", emu->state.pc);
@@ -486,6 +909,9 @@ void execute_ebreak(Emulator *emu) {
     emu->state.csrs[CSR_MCAUSE] = 3; // Breakpoint
     emu->state.csrs[CSR_MTVAL] = 0;
     DNPC = emu->state.csrs[CSR_MTVEC];
+    if (emu->tracer && emu->tracer->on_trap) {
+        trace_trap(emu, 3);
+    }
 }
 
 void execute_mret(Emulator *emu) {
@@ -493,4 +919,6 @@ void execute_mret(Emulator *emu) {
     DNPC = emu->state.csrs[CSR_MEPC];
     // Restore the previous privilege mode from the MSTATUS CSR
     emu->state.csrs[CSR_MSTATUS] = (emu->state.csrs[CSR_MSTATUS] & ~0x1800) | ((emu->state.csrs[CSR_MSTATUS] >> 4) & 0x1800);
+    // Re-enable interrupts if they were enabled when the trap was taken
+    emu->state.csrs[CSR_MSTATUS] = (emu->state.csrs[CSR_MSTATUS] & ~MSTATUS_MIE) | ((emu->state.csrs[CSR_MSTATUS] & MSTATUS_MPIE) >> 4) | MSTATUS_MPIE;
 }
\ No newline at end of file
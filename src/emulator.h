@@ -1,15 +1,33 @@
 #ifndef EMULATOR_H
 #define EMULATOR_H
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include "state.h"
+#include "timing.h"
+#include "devices.h"
+#include "trace.h"
+#include "usermode.h"
+#include "stats.h"
+#include "memory.h"
+#include "isa.h"
 
-#define MEMORY_SIZE 65536
 #define PC_START 0
 #define NUM_INSTRS 100
 #define LOG_FILE "build/ref.log"
 #define MAX_EXEC_INSTRS 1000
+#define BLOCK_CACHE_SIZE 1024 // Must be a power of two
+#define BLOCK_MAX_INSTRS 32
+#define CODE_GRANULE_SHIFT 8
+#define DIRTY_REVERSE 0x1 // Each consumer of dirty pages owns one bit and clears it itself
+#define DIRTY_FUZZ 0x2    // Pages the fuzzer restores from its template before the next case
+#define DIRTY_CHECKPOINT 0x4 // Pages the next incremental checkpoint writes
+#define DIRTY_ALL 0xFF
+#define RAS_SIZE 16 // Return-address stack depth, must be a power of two
+#define MAX_WATCHPOINTS 16
+#define WATCH_READ 1
+#define WATCH_WRITE 2
 
 #define RS1 ((emu)->state.regs[(instr).rs1])
 #define RS2 ((emu)->state.regs[(instr).rs2])
@@ -18,13 +36,7 @@
 #define DNPC ((emu)->state.dnpc)
 
 typedef struct {
-    State state;
-    uint8_t memory[MEMORY_SIZE];
-    bool log_enabled;
-    FILE *log_file;
-} Emulator;
-
-typedef struct {
+    Op op;         // Entry of isa.tbl this word matched, OP_INVALID if none
     uint32_t opcode;
     uint32_t rd;
     uint32_t funct3;
@@ -41,25 +53,116 @@ typedef struct {
     // ...other immediate types if needed...
 } Instruction;
 
+typedef struct Block {
+    uint64_t pc;
+    uint32_t num_instrs;
+    uint32_t num_loads;
+    uint32_t num_stores;
+    bool valid;
+    uint32_t raw[BLOCK_MAX_INSTRS];
+    Instruction instrs[BLOCK_MAX_INSTRS];
+    uint8_t fusion[BLOCK_MAX_INSTRS]; // FUSE_* kind of the pair starting at each instruction
+    struct Block *jump_target; // Where the jump ending this block went last time
+} Block;
+
+typedef struct {
+    uint64_t pc;  // Return address pushed by a call
+    Block *block; // Its decoded block if it was cached at the time of the call
+} RasEntry;
+
+typedef struct {
+    uint64_t *slots; // PC + 1, 0 marks an empty slot
+    size_t capacity;
+    size_t count;
+} PcSet;
+
+typedef struct {
+    uint64_t addr;
+    uint64_t len;
+    uint32_t kind; // WATCH_READ | WATCH_WRITE
+} Watchpoint;
+
+typedef enum {
+    STOP_NONE,
+    STOP_EXIT,       // Reached the exit instruction
+    STOP_LIMIT,      // Instruction limit or PC out of memory
+    STOP_ERROR,      // Undecodable instruction
+    STOP_BREAKPOINT,
+    STOP_WATCHPOINT
+} StopReason;
+
+typedef struct Emulator {
+    State state;
+    uint8_t *memory;       // Guest RAM from map_guest_memory
+    uint64_t memory_size;
+    uint64_t image_start;  // Where the program was loaded; its contents key the code cache
+    uint64_t image_end;
+    size_t memory_mapped;  // Length of the host mapping, rounded up to its page size
+    HugePages huge_pages;  // What actually backs the mapping
+    bool log_enabled;
+    FILE *log_file;
+    Block *blocks; // Decoded basic blocks, indexed by start PC
+    uint8_t *code_map;    // Granules covered by a decoded block
+    uint8_t *dirty_pages; // Pages written since each consumer last looked (DIRTY_* bits)
+    size_t num_pages;
+    uint64_t block_start; // Bounds of the block being executed
+    uint64_t block_end;
+    uint64_t max_instrs; // Hard instruction limit
+    uint64_t stop_at;    // Blocks are cut short so instret never passes this
+    TimingModel *timing; // Optional timing model fed with batched events, NULL when disabled
+    PcSet breakpoints;
+    Watchpoint watchpoints[MAX_WATCHPOINTS];
+    size_t num_watchpoints;
+    bool skip_breakpoint; // Resume from a breakpoint at PC without stopping on it again
+    StopReason stop_reason; // Why fetch_and_execute last returned false
+    uint64_t stop_addr;     // Data address that triggered a watchpoint
+    uint32_t stop_kind;
+    Devices devices; // Timer and UART models, with event record/replay
+    Tracer *tracer;  // Optional trigger-based tracing, NULL when disabled
+    UserMode *user;  // Linux syscall emulation for user-mode programs, NULL on bare metal
+    uint64_t blocks_run;     // Blocks executed
+    uint64_t blocks_decoded; // Block cache misses
+    uint64_t traps;          // Exceptions and interrupts taken
+    RasEntry ras[RAS_SIZE];  // Return-address stack, pushed by calls and popped by returns
+    uint32_t ras_top;
+    uint64_t returns;        // Returns and how many the RAS predicted
+    uint64_t return_hits;
+    uint64_t indirect_jumps; // Other JALRs and how many the target cache predicted
+    uint64_t indirect_hits;
+    uint64_t reservation;    // Address + 1 of the last LR, 0 when SC has nothing to pair with
+    uint64_t host_write_probe; // Address + 1 whose host-side writes set host_write_seen, 0 when off
+    bool host_write_seen;
+    struct CodeCache *code_cache; // Blocks decoded by earlier runs of the same image, NULL when disabled
+    struct Virtio *virtio;   // virtio-mmio disk and console, NULL when neither is configured
+    StatsSegment *stats;     // Live counters in shared memory, NULL when not exported
+    uint64_t stats_next;     // Instret at which the next block publishes them
+} Emulator;
+
 void init_emulator(Emulator *emu, const char *hex_file, uint64_t start_pc, size_t num_instrs, const char *log_file_name);
+void init_bare_emulator(Emulator *emu);
+void open_log(Emulator *emu, const char *log_file_name);
+void free_emulator(Emulator *emu);
+void flush_block_cache(Emulator *emu);
+void mark_dirty(Emulator *emu, uint64_t addr, uint64_t len);
 bool fetch_and_execute(Emulator *emu);
+bool run_until(Emulator *emu, uint64_t instret);
+bool pc_set_contains(const PcSet *set, uint64_t pc);
+void pc_set_add(PcSet *set, uint64_t pc);
+void pc_set_remove(PcSet *set, uint64_t pc);
+void pc_set_clear(PcSet *set);
+bool add_watchpoint(Emulator *emu, uint64_t addr, uint64_t len, uint32_t kind);
+bool remove_watchpoint(Emulator *emu, uint64_t addr, uint64_t len, uint32_t kind);
 void log_state(const Emulator *emu, const uint32_t raw_instr);
 uint32_t fetch(Emulator *emu);
+Instruction decode(uint32_t raw_instr);
+bool writes_rd(Instruction instr);
+uint64_t retired_instrs(const Emulator *emu);
+uint64_t read_counter(Emulator *emu, uint32_t index);
+uint64_t read_csr(Emulator *emu, uint32_t csr);
+bool write_csr(Emulator *emu, uint32_t csr, uint64_t value); // False when the CSR ignores writes
 bool execute(Emulator *emu, Instruction instr);
-void execute_r_type(Emulator *emu, Instruction instr);
-void execute_i_type(Emulator *emu, Instruction instr);
-void execute_b_type(Emulator *emu, Instruction instr);
-void execute_jal(Emulator *emu, Instruction instr);
-void execute_jalr(Emulator *emu, Instruction instr);
-void execute_auipc(Emulator *emu, Instruction instr);
-void execute_lui(Emulator *emu, Instruction instr);
-void execute_load(Emulator *emu, Instruction instr);
-void execute_store(Emulator *emu, Instruction instr);
-void execute_addw(Emulator *emu, Instruction instr);
-void execute_csr(Emulator *emu, Instruction instr);
 void execute_ecall(Emulator *emu);
 void execute_ebreak(Emulator *emu);
 void execute_mret(Emulator *emu);
-// ...other function declarations for different instruction types...
 
 #endif // EMULATOR_H
\ No newline at end of file
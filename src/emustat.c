@@ -0,0 +1,192 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "stats.h"
+
+#define HEADER_EVERY 20 // Repeat the column headers like vmstat
+
+typedef struct {
+    uint64_t instret;
+    uint64_t blocks;
+    uint64_t blocks_decoded;
+    uint64_t traps;
+    uint64_t returns;
+    uint64_t return_hits;
+    uint64_t indirect_jumps;
+    uint64_t indirect_hits;
+    uint64_t loads;
+    uint64_t stores;
+    uint64_t pc;
+    double time;
+} Sample;
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void take_sample(const StatsSegment *segment, Sample *sample) {
+    sample->instret = atomic_load_explicit(&segment->instret, memory_order_relaxed);
+    sample->blocks = atomic_load_explicit(&segment->blocks, memory_order_relaxed);
+    sample->blocks_decoded = atomic_load_explicit(&segment->blocks_decoded, memory_order_relaxed);
+    sample->traps = atomic_load_explicit(&segment->traps, memory_order_relaxed);
+    sample->returns = atomic_load_explicit(&segment->returns, memory_order_relaxed);
+    sample->return_hits = atomic_load_explicit(&segment->return_hits, memory_order_relaxed);
+    sample->indirect_jumps = atomic_load_explicit(&segment->indirect_jumps, memory_order_relaxed);
+    sample->indirect_hits = atomic_load_explicit(&segment->indirect_hits, memory_order_relaxed);
+    sample->loads = atomic_load_explicit(&segment->loads, memory_order_relaxed);
+    sample->stores = atomic_load_explicit(&segment->stores, memory_order_relaxed);
+    sample->pc = atomic_load_explicit(&segment->pc, memory_order_relaxed);
+    sample->time = now_seconds();
+}
+
+// With no name given, pick the only segment in /dev/shm
+static bool find_segment(char *name, size_t size) {
+    DIR *dir = opendir("/dev/shm");
+    if (!dir) {
+        perror("Failed to open /dev/shm");
+        return false;
+    }
+    int found = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir))) {
+        if (strncmp(entry->d_name, STATS_PREFIX + 1, strlen(STATS_PREFIX) - 1) == 0) {
+            if (found++ == 0) {
+                snprintf(name, size, "/%s", entry->d_name);
+            } else {
+                fprintf(stderr, "Several emulators are publishing stats (%s, /%s ...); name one\n", name, entry->d_name);
+                closedir(dir);
+                return false;
+            }
+        }
+    }
+    closedir(dir);
+    if (!found) {
+        fprintf(stderr, "No emulator is publishing stats; run it with --stats\n");
+    }
+    return found;
+}
+
+static StatsSegment *map_segment(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Failed to open stats segment %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    StatsSegment *segment = mmap(NULL, sizeof(StatsSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (segment == MAP_FAILED) {
+        perror("Failed to map stats segment");
+        return NULL;
+    }
+    if (atomic_load_explicit(&segment->magic, memory_order_acquire) != STATS_MAGIC || segment->version != STATS_VERSION) {
+        fprintf(stderr, "%s is not an emulator stats segment (or is still being created)\n", name);
+        munmap(segment, sizeof(StatsSegment));
+        return NULL;
+    }
+    return segment;
+}
+
+static double rate(uint64_t now, uint64_t before, double seconds) {
+    return seconds > 0 ? (now - before) / seconds : 0;
+}
+
+// Percentage of the events in the interval that hit
+static double hit_rate(uint64_t hits, uint64_t events) {
+    return events ? 100.0 * hits / events : 0;
+}
+
+static void print_header(void) {
+    printf("%14s %9s %10s %7s %7s %7s %9s %10s %10s %18s\n",
+           "instret", "MIPS", "blocks/s", "bc-hit%", "ret%", "ind%", "traps/s", "loads/s", "stores/s", "pc");
+}
+
+static void print_sample(const Sample *now, const Sample *before) {
+    double seconds = now->time - before->time;
+    uint64_t blocks = now->blocks - before->blocks;
+    uint64_t misses = now->blocks_decoded - before->blocks_decoded;
+    printf("%14lu %9.2f %10.0f %7.2f %7.2f %7.2f %9.0f %10.0f %10.0f 0x%016lx\n",
+           now->instret, rate(now->instret, before->instret, seconds) / 1e6,
+           rate(now->blocks, before->blocks, seconds), hit_rate(blocks - (misses < blocks ? misses : blocks), blocks),
+           hit_rate(now->return_hits - before->return_hits, now->returns - before->returns),
+           hit_rate(now->indirect_hits - before->indirect_hits, now->indirect_jumps - before->indirect_jumps),
+           rate(now->traps, before->traps, seconds),
+           rate(now->loads, before->loads, seconds),
+           rate(now->stores, before->stores, seconds), now->pc);
+    fflush(stdout);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [--pid=PID | --name=NAME] [INTERVAL [COUNT]]\n", prog);
+    fprintf(stderr, "Prints the counters an emulator started with --stats publishes, every INTERVAL seconds (default 1)\n");
+}
+
+int main(int argc, char *argv[]) {
+    char name[64] = "";
+    double interval = 1;
+    long count = -1;
+    int num_args = 0;
+
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--pid=", 6) == 0) {
+            snprintf(name, sizeof(name), STATS_PREFIX "%s", argv[i] + 6);
+        } else if (strncmp(argv[i], "--name=", 7) == 0) {
+            snprintf(name, sizeof(name), "%s%s", argv[i][7] == '/' ? "" : "/", argv[i] + 7);
+        } else if (strncmp(argv[i], "--", 2) == 0 || num_args == 2) {
+            usage(argv[0]);
+            return 1;
+        } else if (num_args++ == 0) {
+            interval = strtod(argv[i], NULL);
+        } else {
+            count = strtol(argv[i], NULL, 0);
+        }
+    }
+    if (interval <= 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    if (!name[0] && !find_segment(name, sizeof(name))) {
+        return 1;
+    }
+
+    StatsSegment *segment = map_segment(name);
+    if (!segment) {
+        return 1;
+    }
+    printf("%s (pid %u)\n", name, segment->pid);
+    print_header();
+
+    Sample before, now;
+    take_sample(segment, &before);
+    // The first line covers the whole run so far, like vmstat's averages since boot
+    Sample start = { .time = segment->start_ns / 1e9 };
+    print_sample(&before, &start);
+
+    struct timespec delay = { (time_t)interval, (long)((interval - (time_t)interval) * 1e9) };
+    for (long lines = 1; count < 0 || lines < count; lines++) {
+        nanosleep(&delay, NULL);
+        bool running = atomic_load(&segment->running) && kill(segment->pid, 0) == 0;
+        take_sample(segment, &now);
+        if (lines % HEADER_EVERY == 0) {
+            print_header();
+        }
+        print_sample(&now, &before);
+        before = now;
+        if (!running) {
+            printf("Emulator stopped after %lu instructions\n", now.instret);
+            break;
+        }
+    }
+    munmap(segment, sizeof(StatsSegment));
+    return 0;
+}
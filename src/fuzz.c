@@ -0,0 +1,544 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "emulator.h"
+#include "state.h"
+
+#define FUZZ_BODY_INSTRS 64 // Generated instructions after the register prologue
+#define FUZZ_DATA 0x400     // Initial register values, loaded by the prologue
+#define FUZZ_IMAGE_WORDS ((FUZZ_DATA >> 2) + 2 * NUM_REGS)
+#define COVERAGE_SIZE (1 << 16) // Must be a power of two
+#define CORPUS_CAPACITY 8192
+#define MAX_WORKERS 64
+#define FUZZ_OUT_DIR "build/fuzz-out"
+#define MAX_SAVED_CRASHES 32 // Most crashes repeat the same bug; the rest are only counted
+
+typedef struct {
+    uint32_t num_instrs;
+    uint32_t body[FUZZ_BODY_INSTRS];
+    uint64_t regs[NUM_REGS];
+} FuzzCase;
+
+// Lives in a MAP_SHARED mapping so every worker sees the same corpus and coverage
+typedef struct {
+    _Atomic uint8_t coverage[COVERAGE_SIZE]; // Hit-count classes seen per edge, one bit each
+    _Atomic uint32_t corpus_size;
+    _Atomic uint64_t execs;
+    _Atomic uint64_t edges;
+    _Atomic uint64_t divergences;
+    FuzzCase corpus[CORPUS_CAPACITY];
+    FuzzCase current[MAX_WORKERS]; // What each worker is running, saved by the parent if it dies
+} Shared;
+
+typedef struct {
+    int jobs;
+    uint64_t seconds;
+    uint64_t runs;
+    uint64_t seed;
+    const char *ref;
+    const char *out;
+} FuzzOptions;
+
+// Edge coverage of the instrumented emulator objects (-fsanitize-coverage=trace-pc), AFL style
+static uint8_t edge_hits[COVERAGE_SIZE];
+static uintptr_t prev_location;
+
+void __sanitizer_cov_trace_pc(void) {
+    uintptr_t location = (uintptr_t)__builtin_return_address(0);
+    location = (location >> 4) ^ (location << 8);
+    edge_hits[(location ^ prev_location) & (COVERAGE_SIZE - 1)]++;
+    prev_location = location >> 1;
+}
+
+static uint64_t next_random(uint64_t *rng) {
+    // xorshift64*
+    *rng ^= *rng >> 12;
+    *rng ^= *rng << 25;
+    *rng ^= *rng >> 27;
+    return *rng * 0x2545F4914F6CDD1Dull;
+}
+
+static uint32_t encode_r(uint32_t opcode, uint32_t rd, uint32_t funct3, uint32_t rs1, uint32_t rs2, uint32_t funct7) {
+    return funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t encode_i(uint32_t opcode, uint32_t rd, uint32_t funct3, uint32_t rs1, int32_t imm) {
+    return (uint32_t)imm << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode;
+}
+
+static uint32_t encode_s(uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm) {
+    return ((uint32_t)imm >> 5 & 0x7F) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | ((uint32_t)imm & 0x1F) << 7 | 0x23;
+}
+
+static uint32_t encode_b(uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t offset) {
+    uint32_t imm = offset;
+    return (imm >> 12 & 1) << 31 | (imm >> 5 & 0x3F) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+           (imm >> 1 & 0xF) << 8 | (imm >> 11 & 1) << 7 | 0x63;
+}
+
+static uint32_t encode_j(uint32_t rd, int32_t offset) {
+    uint32_t imm = offset;
+    return (imm >> 20 & 1) << 31 | (imm >> 1 & 0x3FF) << 21 | (imm >> 11 & 1) << 20 | (imm >> 12 & 0xFF) << 12 | rd << 7 | 0x6F;
+}
+
+static uint64_t random_value(uint64_t *rng) {
+    static const uint64_t interesting[] = {
+        0, 1, 2, 0xFFFFFFFFFFFFFFFFull, 0x8000000000000000ull, 0x7FFFFFFFFFFFFFFFull,
+        0x80000000, 0x7FFFFFFF, 0xFFFFFFFF, MEMORY_SIZE - 1, MEMORY_SIZE, 63, 64,
+        CLINT_MTIMECMP, UART_BASE + UART_LSR
+    };
+    switch (next_random(rng) % 4) {
+        case 0: return interesting[next_random(rng) % (sizeof(interesting) / sizeof(interesting[0]))];
+        case 1: return next_random(rng) % MEMORY_SIZE; // Addresses the loads and stores can reach
+        case 2: return (int64_t)(int8_t)next_random(rng);
+        default: return next_random(rng);
+    }
+}
+
+// A valid encoding of one of the instructions the emulator implements, with an occasional raw word
+static uint32_t random_instruction(uint64_t *rng) {
+    static const uint32_t csrs[] = {
+        CSR_MSCRATCH, CSR_MEPC, CSR_MCAUSE, CSR_MTVAL, CSR_MTVEC, 0xC00, 0xC02, 0xB00, 0xB02
+    };
+    static const uint32_t branch_funct3[] = { 0, 1, 4, 5, 6, 7 };
+    static const uint32_t csr_funct3[] = { 1, 2, 3, 5, 6, 7 };
+
+    uint32_t rd = next_random(rng) % NUM_REGS;
+    uint32_t rs1 = next_random(rng) % NUM_REGS;
+    uint32_t rs2 = next_random(rng) % NUM_REGS;
+    int32_t imm = (int32_t)(next_random(rng) << 20) >> 20;
+    int32_t offset = ((int32_t)(next_random(rng) % 17) - 8) * 4;
+
+    switch (next_random(rng) % 12) {
+        case 0:
+        case 1: {
+            // funct7 0x20 only exists for SUB and SRA
+            uint32_t funct3 = next_random(rng) % 8;
+            uint32_t funct7 = next_random(rng) % 2 ? 0x01 : (funct3 == 0 || funct3 == 5) && next_random(rng) % 2 ? 0x20 : 0x00;
+            return encode_r(0x33, rd, funct3, rs1, rs2, funct7);
+        }
+        case 2:
+        case 3: {
+            uint32_t funct3 = next_random(rng) % 8;
+            if (funct3 == 1 || funct3 == 5) {
+                imm = (next_random(rng) % 2 ? 0x400 : 0) | (imm & 0x3F);
+            }
+            return encode_i(0x13, rd, funct3, rs1, imm);
+        }
+        case 4:
+            return encode_r(0x3B, rd, 0, rs1, rs2, next_random(rng) % 2 ? 0x20 : 0x00);
+        case 5:
+            return (uint32_t)next_random(rng) << 12 | rd << 7 | (next_random(rng) % 2 ? 0x37 : 0x17);
+        case 6:
+            return encode_i(0x03, rd, next_random(rng) % 7, rs1, imm);
+        case 7:
+            return encode_s(next_random(rng) % 4, rs1, rs2, imm);
+        case 8:
+            return encode_b(branch_funct3[next_random(rng) % 6], rs1, rs2, offset);
+        case 9:
+            return next_random(rng) % 2 ? encode_j(rd, offset) : encode_i(0x67, rd, 0, rs1, imm);
+        case 10:
+            return encode_i(0x73, rd, csr_funct3[next_random(rng) % 6], rs1,
+                            csrs[next_random(rng) % (sizeof(csrs) / sizeof(csrs[0]))]);
+        default:
+            return next_random(rng) % 4 ? (uint32_t)next_random(rng) : encode_i(0x13, rd, 0, rs1, imm);
+    }
+}
+
+static void random_case(uint64_t *rng, FuzzCase *fuzz_case) {
+    memset(fuzz_case, 0, sizeof(FuzzCase));
+    fuzz_case->num_instrs = 1 + next_random(rng) % FUZZ_BODY_INSTRS;
+    for (uint32_t i = 0; i < fuzz_case->num_instrs; i++) {
+        fuzz_case->body[i] = random_instruction(rng);
+    }
+    for (uint32_t r = 1; r < NUM_REGS; r++) {
+        fuzz_case->regs[r] = random_value(rng);
+    }
+}
+
+static void mutate_case(uint64_t *rng, FuzzCase *fuzz_case, const FuzzCase *other) {
+    for (uint64_t n = 1 + next_random(rng) % 4; n > 0; n--) {
+        uint32_t at = next_random(rng) % fuzz_case->num_instrs;
+        switch (next_random(rng) % 6) {
+            case 0:
+                fuzz_case->body[at] = random_instruction(rng);
+                break;
+            case 1:
+                fuzz_case->body[at] ^= 1u << (next_random(rng) % 32);
+                break;
+            case 2:
+                if (fuzz_case->num_instrs < FUZZ_BODY_INSTRS) {
+                    memmove(&fuzz_case->body[at + 1], &fuzz_case->body[at], (fuzz_case->num_instrs - at) * 4);
+                    fuzz_case->body[at] = random_instruction(rng);
+                    fuzz_case->num_instrs++;
+                }
+                break;
+            case 3:
+                if (fuzz_case->num_instrs > 1) {
+                    memmove(&fuzz_case->body[at], &fuzz_case->body[at + 1], (fuzz_case->num_instrs - at - 1) * 4);
+                    fuzz_case->num_instrs--;
+                }
+                break;
+            case 4:
+                fuzz_case->regs[1 + next_random(rng) % (NUM_REGS - 1)] = random_value(rng);
+                break;
+            default: {
+                // Splice: our head, the other case's tail
+                uint32_t from = next_random(rng) % other->num_instrs;
+                uint32_t count = other->num_instrs - from;
+                if (at + count > FUZZ_BODY_INSTRS) {
+                    count = FUZZ_BODY_INSTRS - at;
+                }
+                memcpy(&fuzz_case->body[at], &other->body[from], count * 4);
+                fuzz_case->num_instrs = at + count;
+                break;
+            }
+        }
+    }
+}
+
+// Prologue loading x1-x31 from the data area, the body, the exit marker, then the register values
+static void build_image(const FuzzCase *fuzz_case, uint32_t image[FUZZ_IMAGE_WORDS]) {
+    memset(image, 0, FUZZ_IMAGE_WORDS * 4);
+    size_t n = 0;
+    for (uint32_t r = 1; r < NUM_REGS; r++) {
+        image[n++] = encode_i(0x03, r, 3, 0, FUZZ_DATA + r * 8);
+    }
+    memcpy(&image[n], fuzz_case->body, fuzz_case->num_instrs * 4);
+    image[n + fuzz_case->num_instrs] = 0xFFFFFFFF;
+    memcpy(&image[FUZZ_DATA >> 2], fuzz_case->regs, sizeof(fuzz_case->regs));
+}
+
+static bool write_hex(const char *path, const FuzzCase *fuzz_case) {
+    uint32_t image[FUZZ_IMAGE_WORDS];
+    build_image(fuzz_case, image);
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        return false;
+    }
+    fprintf(file, "# Fuzzer case: run with start_pc 0 and num_instrs %d\n", FUZZ_IMAGE_WORDS);
+    for (size_t i = 0; i < FUZZ_IMAGE_WORDS; i++) {
+        fprintf(file, "%08x\n", image[i]);
+    }
+    return fclose(file) == 0;
+}
+
+// Only pages the last case wrote are copied back; blocks decoded from them are dropped with them
+static void reset_emulator(Emulator *emu, const Emulator *template) {
+    for (size_t page = 0; page < emu->num_pages; page++) {
+        if (emu->dirty_pages[page] & DIRTY_FUZZ) {
+            memcpy(emu->memory + (page << PAGE_SHIFT), template->memory + (page << PAGE_SHIFT), PAGE_SIZE);
+            mark_dirty(emu, page << PAGE_SHIFT, PAGE_SIZE);
+            emu->dirty_pages[page] &= ~DIRTY_FUZZ;
+        }
+    }
+    emu->state = template->state;
+    emu->devices = template->devices;
+    emu->block_start = emu->block_end = 0;
+    emu->stop_at = UINT64_MAX;
+    emu->skip_breakpoint = false;
+    emu->stop_reason = STOP_NONE;
+}
+
+static void run_case(Emulator *emu, const Emulator *template, const FuzzCase *fuzz_case) {
+    uint32_t image[FUZZ_IMAGE_WORDS];
+    build_image(fuzz_case, image);
+    reset_emulator(emu, template);
+    memcpy(emu->memory, image, sizeof(image));
+    mark_dirty(emu, 0, sizeof(image));
+
+    memset(edge_hits, 0, sizeof(edge_hits));
+    prev_location = 0;
+    while (fetch_and_execute(emu)) {
+    }
+}
+
+static uint8_t hit_class(uint8_t hits) {
+    if (hits <= 3) return 1 << (hits - 1);
+    if (hits <= 7) return 0x08;
+    if (hits <= 15) return 0x10;
+    if (hits <= 31) return 0x20;
+    if (hits <= 127) return 0x40;
+    return 0x80;
+}
+
+static bool merge_coverage(Shared *shared) {
+    bool found = false;
+    for (size_t i = 0; i < COVERAGE_SIZE; i++) {
+        if (!edge_hits[i]) {
+            continue;
+        }
+        uint8_t bit = hit_class(edge_hits[i]);
+        if (atomic_load_explicit(&shared->coverage[i], memory_order_relaxed) & bit) {
+            continue;
+        }
+        uint8_t old = atomic_fetch_or(&shared->coverage[i], bit);
+        if (!(old & bit)) {
+            found = true;
+            if (!old) {
+                atomic_fetch_add(&shared->edges, 1);
+            }
+        }
+    }
+    return found;
+}
+
+static bool same_contents(const char *path_a, const char *path_b) {
+    FILE *a = fopen(path_a, "r");
+    FILE *b = fopen(path_b, "r");
+    bool same = a && b;
+    while (same) {
+        int ca = fgetc(a);
+        same = ca == fgetc(b);
+        if (ca == EOF) {
+            break;
+        }
+    }
+    if (a) fclose(a);
+    if (b) fclose(b);
+    return same;
+}
+
+static void quiet_stdio(void) {
+    int null_fd = open("/dev/null", O_RDWR);
+    if (null_fd >= 0) {
+        dup2(null_fd, STDIN_FILENO);
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        close(null_fd);
+    }
+}
+
+// The reference takes the emulator's command line and writes the same log format
+static bool run_reference(const char *ref, const char *hex, const char *log) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        char num_instrs[16];
+        snprintf(num_instrs, sizeof(num_instrs), "%d", FUZZ_IMAGE_WORDS);
+        quiet_stdio();
+        alarm(10);
+        execl(ref, ref, hex, "0", num_instrs, log, "true", (char *)NULL);
+        _exit(127);
+    }
+    int status;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) != 127;
+}
+
+// Counter 1 (time) follows the host clock, so two simulators never agree on it
+static bool reads_host_time(const FuzzCase *fuzz_case) {
+    for (uint32_t i = 0; i < fuzz_case->num_instrs; i++) {
+        uint32_t raw = fuzz_case->body[i];
+        uint32_t csr = raw >> 20;
+        if ((raw & 0x7F) == 0x73 && (raw >> 12 & 0x7) != 0 && (csr == CSR_TIME || csr == CSR_MCYCLE + 1)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Re-runs a new corpus entry with logging on and compares the log with the reference's
+static void check_divergence(Shared *shared, const FuzzOptions *options, int worker,
+                             Emulator *emu, const Emulator *template, const FuzzCase *fuzz_case) {
+    char hex[256], log[256], ref_log[256];
+    snprintf(hex, sizeof(hex), "%s/worker-%d.hex", options->out, worker);
+    snprintf(log, sizeof(log), "%s/worker-%d.log", options->out, worker);
+    snprintf(ref_log, sizeof(ref_log), "%s/worker-%d.ref.log", options->out, worker);
+    if (reads_host_time(fuzz_case) || !write_hex(hex, fuzz_case) || !run_reference(options->ref, hex, ref_log)) {
+        return;
+    }
+
+    open_log(emu, log);
+    emu->log_enabled = true;
+    run_case(emu, template, fuzz_case);
+    emu->log_enabled = false;
+    fclose(emu->log_file);
+    emu->log_file = NULL;
+
+    if (!same_contents(log, ref_log)) {
+        // Both logs are kept next to the case so the first differing line is easy to find
+        char path[256];
+        uint64_t n = atomic_fetch_add(&shared->divergences, 1);
+        snprintf(path, sizeof(path), "%s/diff-%lu.hex", options->out, n);
+        write_hex(path, fuzz_case);
+        snprintf(path, sizeof(path), "%s/diff-%lu.log", options->out, n);
+        rename(log, path);
+        snprintf(path, sizeof(path), "%s/diff-%lu.ref.log", options->out, n);
+        rename(ref_log, path);
+    }
+}
+
+static void run_worker(Shared *shared, const FuzzOptions *options, int worker, time_t deadline) {
+    quiet_stdio();
+    uint64_t rng = options->seed * 0x9E3779B97F4A7C15ull + worker + 1;
+    if (rng == 0) rng = 1;
+
+    Emulator *template = malloc(sizeof(Emulator));
+    Emulator *emu = malloc(sizeof(Emulator));
+    if (!template || !emu) {
+        _exit(1);
+    }
+    init_bare_emulator(template);
+    init_bare_emulator(emu);
+    template->state.dnpc = 4;
+
+    for (uint64_t run = 0; !options->runs || run < options->runs; run++) {
+        if ((run & 0xFF) == 0 && time(NULL) >= deadline) {
+            break;
+        }
+
+        FuzzCase *fuzz_case = &shared->current[worker];
+        uint32_t size = atomic_load(&shared->corpus_size);
+        if (size > CORPUS_CAPACITY) {
+            size = CORPUS_CAPACITY;
+        }
+        if (size == 0 || next_random(&rng) % 8 == 0) {
+            random_case(&rng, fuzz_case);
+        } else {
+            *fuzz_case = shared->corpus[next_random(&rng) % size];
+            mutate_case(&rng, fuzz_case, &shared->corpus[next_random(&rng) % size]);
+        }
+
+        run_case(emu, template, fuzz_case);
+        atomic_fetch_add_explicit(&shared->execs, 1, memory_order_relaxed);
+
+        if (merge_coverage(shared)) {
+            uint32_t slot = atomic_fetch_add(&shared->corpus_size, 1);
+            if (slot >= CORPUS_CAPACITY) {
+                slot = next_random(&rng) % CORPUS_CAPACITY;
+            }
+            shared->corpus[slot] = *fuzz_case;
+            if (options->ref) {
+                check_divergence(shared, options, worker, emu, template, fuzz_case);
+            }
+        }
+    }
+    _exit(0);
+}
+
+static pid_t start_worker(Shared *shared, const FuzzOptions *options, int worker, time_t deadline) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        run_worker(shared, options, worker, deadline);
+    }
+    if (pid < 0) {
+        perror("Failed to fork fuzz worker");
+        exit(1);
+    }
+    return pid;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [options]\n", prog);
+    fprintf(stderr, "  --jobs=N     Parallel workers (default: all cores)\n");
+    fprintf(stderr, "  --time=S     Stop after S seconds (default 60)\n");
+    fprintf(stderr, "  --runs=N     Stop each worker after N cases\n");
+    fprintf(stderr, "  --seed=N     Random seed\n");
+    fprintf(stderr, "  --ref=PATH   Reference simulator with the emulator's command line and log format\n");
+    fprintf(stderr, "  --out=DIR    Where crashes and divergences are written (default %s)\n", FUZZ_OUT_DIR);
+}
+
+int main(int argc, char *argv[]) {
+    FuzzOptions options = { sysconf(_SC_NPROCESSORS_ONLN), 60, 0, time(NULL), NULL, FUZZ_OUT_DIR };
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--jobs=", 7) == 0) {
+            options.jobs = atoi(argv[i] + 7);
+        } else if (strncmp(argv[i], "--time=", 7) == 0) {
+            options.seconds = strtoull(argv[i] + 7, NULL, 0);
+        } else if (strncmp(argv[i], "--runs=", 7) == 0) {
+            options.runs = strtoull(argv[i] + 7, NULL, 0);
+        } else if (strncmp(argv[i], "--seed=", 7) == 0) {
+            options.seed = strtoull(argv[i] + 7, NULL, 0);
+        } else if (strncmp(argv[i], "--ref=", 6) == 0) {
+            options.ref = argv[i] + 6;
+        } else if (strncmp(argv[i], "--out=", 6) == 0) {
+            options.out = argv[i] + 6;
+        } else {
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (options.jobs < 1 || options.jobs > MAX_WORKERS) {
+        fprintf(stderr, "--jobs must be between 1 and %d\n", MAX_WORKERS);
+        return 1;
+    }
+    if (options.ref && access(options.ref, X_OK) != 0) {
+        fprintf(stderr, "Reference simulator %s is not executable\n", options.ref);
+        return 1;
+    }
+    mkdir(options.out, 0755);
+
+    // Undefined behaviour in the emulator kills the worker; the report goes next to the saved case.
+    // The sanitizer runtime reads its options before main, so they take effect through a re-exec.
+    if (!getenv("UBSAN_OPTIONS")) {
+        char ubsan_options[512];
+        snprintf(ubsan_options, sizeof(ubsan_options), "log_path=%s/ubsan:print_stacktrace=1", options.out);
+        setenv("UBSAN_OPTIONS", ubsan_options, 1);
+        execv("/proc/self/exe", argv);
+    }
+
+    Shared *shared = mmap(NULL, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("Failed to map shared corpus");
+        return 1;
+    }
+
+    time_t start = time(NULL);
+    time_t deadline = start + options.seconds;
+    pid_t workers[MAX_WORKERS];
+    for (int w = 0; w < options.jobs; w++) {
+        workers[w] = start_worker(shared, &options, w, deadline);
+    }
+
+    uint64_t crashes = 0;
+    int running = options.jobs;
+    while (running > 0) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+        if (pid < 0) {
+            break;
+        }
+        int w = 0;
+        while (w < options.jobs && workers[w] != pid) {
+            w++;
+        }
+        if (w == options.jobs) {
+            continue;
+        }
+
+        if (WIFSIGNALED(status) || WEXITSTATUS(status) != 0) {
+            if (crashes < MAX_SAVED_CRASHES) {
+                char path[256];
+                snprintf(path, sizeof(path), "%s/crash-%lu.hex", options.out, crashes);
+                write_hex(path, &shared->current[w]);
+                fprintf(stderr, "Worker %d died (%s %d), case saved to %s\n", w,
+                        WIFSIGNALED(status) ? "signal" : "status",
+                        WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status), path);
+            }
+            crashes++;
+            if (time(NULL) < deadline) {
+                workers[w] = start_worker(shared, &options, w, deadline);
+                continue;
+            }
+        }
+        workers[w] = 0;
+        running--;
+    }
+
+    uint64_t execs = atomic_load(&shared->execs);
+    uint64_t seconds = time(NULL) - start;
+    fprintf(stderr, "Fuzzing: %lu cases in %lus (%lu/s), %u corpus entries, %lu edges, %lu crashes, %lu divergences\n",
+            execs, seconds, seconds ? execs / seconds : execs, atomic_load(&shared->corpus_size),
+            atomic_load(&shared->edges), crashes, atomic_load(&shared->divergences));
+    return crashes || atomic_load(&shared->divergences) ? 1 : 0;
+}
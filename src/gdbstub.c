@@ -0,0 +1,532 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "gdbstub.h"
+
+typedef struct {
+    int fd;
+    Emulator *emu;
+    TimeTravel *tt;      // NULL unless reverse execution is enabled
+    bool interrupted;
+    bool history_start;  // Reverse execution ran out of recorded history
+    char packet[GDB_PACKET_SIZE];
+    char reply[GDB_PACKET_SIZE];
+} GdbSession;
+
+static const char hex_digits[] = "0123456789abcdef";
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Registers travel as target-endian (little-endian) byte strings
+static void encode_u64(char *out, uint64_t value) {
+    for (int i = 0; i < 8; i++) {
+        uint8_t byte = value >> (i * 8);
+        out[i * 2] = hex_digits[byte >> 4];
+        out[i * 2 + 1] = hex_digits[byte & 0xF];
+    }
+    out[16] = '\0';
+}
+
+static bool decode_u64(const char *in, uint64_t *value) {
+    *value = 0;
+    for (int i = 0; i < 8; i++) {
+        int hi = hex_value(in[i * 2]);
+        int lo = hex_value(in[i * 2 + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        *value |= (uint64_t)(hi << 4 | lo) << (i * 8);
+    }
+    return true;
+}
+
+// True when in holds exactly digits hex digits, so a malformed packet is refused before anything is written
+static bool valid_hex(const char *in, size_t digits) {
+    for (size_t i = 0; i < digits; i++) {
+        if (hex_value(in[i]) < 0) {
+            return false;
+        }
+    }
+    return in[digits] == '\0';
+}
+
+static int open_listener(const char *address) {
+    int fd;
+    if (strncmp(address, "unix:", 5) == 0) {
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (strlen(address + 5) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "Socket path too long: %s\n", address + 5);
+            return -1;
+        }
+        strcpy(addr.sun_path, address + 5);
+        unlink(addr.sun_path);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            perror("Failed to bind GDB socket");
+            return -1;
+        }
+    } else {
+        struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_port = htons(strtoul(address, NULL, 0)),
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+        };
+        int reuse = 1;
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            perror("Failed to create GDB socket");
+            return -1;
+        }
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            perror("Failed to bind GDB socket");
+            return -1;
+        }
+    }
+    if (listen(fd, 1) != 0) {
+        perror("Failed to listen for GDB");
+        return -1;
+    }
+    return fd;
+}
+
+static bool read_byte(GdbSession *session, char *c) {
+    return read(session->fd, c, 1) == 1;
+}
+
+static bool write_all(int fd, const char *data, size_t len) {
+    while (len > 0) {
+        ssize_t written = write(fd, data, len);
+        if (written <= 0) {
+            return false;
+        }
+        data += written;
+        len -= written;
+    }
+    return true;
+}
+
+static bool recv_packet(GdbSession *session) {
+    char c;
+    for (;;) {
+        do {
+            if (!read_byte(session, &c)) {
+                return false;
+            }
+        } while (c != '$');
+
+        size_t len = 0;
+        uint8_t sum = 0;
+        while (read_byte(session, &c) && c != '#') {
+            if (len + 1 < sizeof(session->packet)) {
+                session->packet[len++] = c;
+            }
+            sum += (uint8_t)c;
+        }
+        char check[2];
+        if (!read_byte(session, &check[0]) || !read_byte(session, &check[1])) {
+            return false;
+        }
+        session->packet[len] = '\0';
+
+        if (hex_value(check[0]) << 4 == (sum & 0xF0) && hex_value(check[1]) == (sum & 0xF)) {
+            return write_all(session->fd, "+", 1);
+        }
+        if (!write_all(session->fd, "-", 1)) {
+            return false;
+        }
+    }
+}
+
+static bool send_packet(GdbSession *session, const char *data) {
+    static char frame[GDB_PACKET_SIZE + 4];
+    size_t len = strlen(data);
+    uint8_t sum = 0;
+    for (size_t i = 0; i < len; i++) {
+        sum += (uint8_t)data[i];
+    }
+    int framed = snprintf(frame, sizeof(frame), "$%s#%02x", data, sum);
+
+    for (;;) {
+        if (!write_all(session->fd, frame, framed)) {
+            return false;
+        }
+        char ack;
+        do {
+            if (!read_byte(session, &ack)) {
+                return false;
+            }
+        } while (ack != '+' && ack != '-');
+        if (ack == '+') {
+            return true;
+        }
+    }
+}
+
+static bool interrupt_pending(GdbSession *session) {
+    struct pollfd pfd = { .fd = session->fd, .events = POLLIN };
+    char c;
+    while (poll(&pfd, 1, 0) > 0 && (pfd.revents & POLLIN)) {
+        if (!read_byte(session, &c) || c == 0x03) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool read_register(Emulator *emu, unsigned long reg, uint64_t *value) {
+    if (reg < NUM_REGS) {
+        *value = emu->state.regs[reg];
+    } else if (reg == GDB_REG_PC) {
+        *value = emu->state.pc;
+    } else if (reg >= GDB_REG_CSR_BASE && reg < GDB_REG_CSR_BASE + 4096) {
+        *value = read_csr(emu, reg - GDB_REG_CSR_BASE);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool write_register(Emulator *emu, unsigned long reg, uint64_t value) {
+    if (reg < NUM_REGS) {
+        if (reg != 0) {
+            emu->state.regs[reg] = value;
+        }
+    } else if (reg == GDB_REG_PC) {
+        emu->state.pc = value;
+        emu->state.dnpc = value + 4;
+    } else if (reg >= GDB_REG_CSR_BASE && reg < GDB_REG_CSR_BASE + 4096) {
+        write_csr(emu, reg - GDB_REG_CSR_BASE, value);
+    } else {
+        return false;
+    }
+    return true;
+}
+
+static bool valid_range(const Emulator *emu, uint64_t addr, uint64_t len) {
+    return addr <= emu->memory_size && len <= emu->memory_size - addr;
+}
+
+static void stop_reply(GdbSession *session) {
+    const Emulator *emu = session->emu;
+    switch (emu->stop_reason) {
+        case STOP_EXIT:
+        case STOP_LIMIT:
+            strcpy(session->reply, "W00");
+            break;
+        case STOP_ERROR:
+            strcpy(session->reply, "W01");
+            break;
+        case STOP_WATCHPOINT:
+            snprintf(session->reply, sizeof(session->reply), "T05%s:%lx;",
+                     emu->stop_kind == WATCH_WRITE ? "watch" : "rwatch", emu->stop_addr);
+            break;
+        default:
+            if (session->history_start) {
+                strcpy(session->reply, "T05replaylog:begin;");
+            } else {
+                strcpy(session->reply, session->interrupted ? "S02" : "S05");
+            }
+            break;
+    }
+}
+
+static bool run_forward(GdbSession *session, uint64_t instret) {
+    if (session->tt) {
+        return tt_run_until(session->tt, session->emu, instret);
+    }
+    return run_until(session->emu, instret);
+}
+
+static void resume(GdbSession *session, bool step) {
+    Emulator *emu = session->emu;
+    session->interrupted = false;
+    session->history_start = false;
+    emu->skip_breakpoint = true;
+    if (step) {
+        run_forward(session, emu->state.instret + 1);
+        return;
+    }
+    while (run_forward(session, emu->state.instret + GDB_POLL_INSTRS)) {
+        if (interrupt_pending(session)) {
+            session->interrupted = true;
+            return;
+        }
+    }
+}
+
+static void reverse(GdbSession *session, bool step) {
+    Emulator *emu = session->emu;
+    TimeTravel *tt = session->tt;
+    session->interrupted = false;
+    emu->stop_reason = STOP_NONE;
+    if (step) {
+        uint64_t first = tt->snapshots[0].state.instret;
+        session->history_start = emu->state.instret <= first;
+        if (!session->history_start) {
+            tt_goto(tt, emu, emu->state.instret - 1);
+        }
+    } else {
+        session->history_start = !tt_reverse_continue(tt, emu);
+    }
+}
+
+// Editing state in the past makes the recorded future unreachable
+static void before_edit(GdbSession *session) {
+    if (session->tt && session->emu->state.instret < session->tt->frontier) {
+        tt_discard_future(session->tt, session->emu);
+    }
+}
+
+// "monitor last-write xN" or "monitor last-write ADDR"
+static void handle_monitor(GdbSession *session, const char *hex) {
+    char command[GDB_PACKET_SIZE / 2];
+    char output[GDB_PACKET_SIZE / 2];
+    size_t len = 0;
+    while (hex[0] && hex[1] && len + 1 < sizeof(command)) {
+        command[len++] = hex_value(hex[0]) << 4 | hex_value(hex[1]);
+        hex += 2;
+    }
+    command[len] = '\0';
+
+    unsigned reg;
+    uint64_t addr;
+    WriteSite site;
+    if (strncmp(command, "last-write ", 11) != 0) {
+        snprintf(output, sizeof(output), "Unknown command: %.64s\n", command);
+    } else if (!session->tt) {
+        snprintf(output, sizeof(output), "Reverse execution is disabled; start with --reverse\n");
+    } else if (sscanf(command + 11, "x%u", &reg) == 1 && reg < NUM_REGS) {
+        if (tt_last_reg_write(session->tt, session->emu, reg, &site)) {
+            snprintf(output, sizeof(output), "x%u last written at instruction %lu (pc 0x%lx)\n", reg, site.instret, site.pc);
+        } else {
+            snprintf(output, sizeof(output), "x%u not written since instruction %lu\n", reg,
+                     session->tt->snapshots[0].state.instret);
+        }
+    } else if (sscanf(command + 11, "%lx", &addr) == 1) {
+        if (tt_last_mem_write(session->tt, session->emu, addr, &site)) {
+            snprintf(output, sizeof(output), "0x%lx last written at instruction %lu (pc 0x%lx)\n", addr, site.instret, site.pc);
+        } else {
+            snprintf(output, sizeof(output), "0x%lx not written since instruction %lu\n", addr,
+                     session->tt->snapshots[0].state.instret);
+        }
+    } else {
+        snprintf(output, sizeof(output), "Usage: last-write xN|ADDR\n");
+    }
+
+    char *reply = session->reply;
+    for (size_t i = 0; output[i]; i++) {
+        *reply++ = hex_digits[(uint8_t)output[i] >> 4];
+        *reply++ = hex_digits[output[i] & 0xF];
+    }
+    *reply = '\0';
+}
+
+static void handle_breakpoint(GdbSession *session, bool insert) {
+    Emulator *emu = session->emu;
+    unsigned type;
+    uint64_t addr, len;
+    if (sscanf(session->packet + 1, "%u,%lx,%lx", &type, &addr, &len) != 3) {
+        strcpy(session->reply, "E01");
+        return;
+    }
+
+    bool ok = true;
+    if (type == 0 || type == 1) {
+        // Software and hardware breakpoints share the PC set
+        if (insert) {
+            pc_set_add(&emu->breakpoints, addr);
+        } else {
+            pc_set_remove(&emu->breakpoints, addr);
+        }
+    } else if (type >= 2 && type <= 4) {
+        uint32_t kind = type == 2 ? WATCH_WRITE : type == 3 ? WATCH_READ : WATCH_READ | WATCH_WRITE;
+        ok = insert ? add_watchpoint(emu, addr, len, kind) : remove_watchpoint(emu, addr, len, kind);
+    } else {
+        session->reply[0] = '\0';
+        return;
+    }
+    strcpy(session->reply, ok ? "OK" : "E02");
+}
+
+// Returns false once the session is over
+static bool handle_packet(GdbSession *session) {
+    Emulator *emu = session->emu;
+    const char *packet = session->packet;
+    char *reply = session->reply;
+    uint64_t addr, len, value;
+    unsigned long reg;
+    reply[0] = '\0';
+
+    switch (packet[0]) {
+        case '?':
+            stop_reply(session);
+            break;
+        case 'g':
+            for (unsigned long i = 0; i <= GDB_REG_PC; i++) {
+                read_register(emu, i, &value);
+                encode_u64(reply + i * 16, value);
+            }
+            break;
+        case 'G':
+            if (strlen(packet + 1) < (GDB_REG_PC + 1) * 16) {
+                strcpy(reply, "E01");
+                break;
+            }
+            before_edit(session);
+            for (unsigned long i = 0; i <= GDB_REG_PC; i++) {
+                if (decode_u64(packet + 1 + i * 16, &value)) {
+                    write_register(emu, i, value);
+                }
+            }
+            strcpy(reply, "OK");
+            break;
+        case 'p':
+            if (sscanf(packet + 1, "%lx", &reg) == 1 && read_register(emu, reg, &value)) {
+                encode_u64(reply, value);
+            } else {
+                strcpy(reply, "E01");
+            }
+            break;
+        case 'P': {
+            const char *equals = strchr(packet, '=');
+            bool valid = equals && sscanf(packet + 1, "%lx", &reg) == 1 && decode_u64(equals + 1, &value);
+            if (valid) {
+                before_edit(session);
+            }
+            if (valid && write_register(emu, reg, value)) {
+                strcpy(reply, "OK");
+            } else {
+                strcpy(reply, "E01");
+            }
+            break;
+        }
+        case 'm':
+            if (sscanf(packet + 1, "%lx,%lx", &addr, &len) != 2 || !valid_range(emu, addr, len) ||
+                len * 2 >= sizeof(session->reply)) {
+                strcpy(reply, "E14");
+                break;
+            }
+            for (uint64_t i = 0; i < len; i++) {
+                reply[i * 2] = hex_digits[emu->memory[addr + i] >> 4];
+                reply[i * 2 + 1] = hex_digits[emu->memory[addr + i] & 0xF];
+            }
+            reply[len * 2] = '\0';
+            break;
+        case 'M': {
+            const char *data = strchr(packet, ':');
+            if (!data || sscanf(packet + 1, "%lx,%lx", &addr, &len) != 2 || !valid_range(emu, addr, len)) {
+                strcpy(reply, "E14");
+                break;
+            }
+            if (!valid_hex(data + 1, len * 2)) {
+                strcpy(reply, "E01");
+                break;
+            }
+            before_edit(session);
+            for (uint64_t i = 0; i < len; i++) {
+                emu->memory[addr + i] = hex_value(data[1 + i * 2]) << 4 | hex_value(data[2 + i * 2]);
+            }
+            mark_dirty(emu, addr, len);
+            flush_block_cache(emu);
+            strcpy(reply, "OK");
+            break;
+        }
+        case 'c':
+        case 's':
+            if (packet[1] && sscanf(packet + 1, "%lx", &addr) == 1) {
+                write_register(emu, GDB_REG_PC, addr);
+            }
+            resume(session, packet[0] == 's');
+            stop_reply(session);
+            break;
+        case 'b':
+            if (session->tt && (packet[1] == 's' || packet[1] == 'c') && !packet[2]) {
+                reverse(session, packet[1] == 's');
+                stop_reply(session);
+            }
+            break;
+        case 'Z':
+        case 'z':
+            handle_breakpoint(session, packet[0] == 'Z');
+            break;
+        case 'H':
+            strcpy(reply, "OK");
+            break;
+        case 'k':
+            return false;
+        case 'D':
+            send_packet(session, "OK");
+            return false;
+        case 'q':
+            if (strncmp(packet, "qSupported", 10) == 0) {
+                snprintf(reply, sizeof(session->reply), "PacketSize=%x%s", GDB_PACKET_SIZE,
+                         session->tt ? ";ReverseStep+;ReverseContinue+" : "");
+            } else if (strcmp(packet, "qAttached") == 0) {
+                strcpy(reply, "1");
+            } else if (strcmp(packet, "qC") == 0) {
+                strcpy(reply, "QC1");
+            } else if (strcmp(packet, "qfThreadInfo") == 0) {
+                strcpy(reply, "m1");
+            } else if (strcmp(packet, "qsThreadInfo") == 0) {
+                strcpy(reply, "l");
+            } else if (strncmp(packet, "qRcmd,", 6) == 0) {
+                handle_monitor(session, packet + 6);
+            }
+            break;
+        default:
+            break; // Empty reply: not supported
+    }
+
+    if (!send_packet(session, reply)) {
+        return false;
+    }
+    // After an exit report there is nothing left to debug
+    return reply[0] != 'W';
+}
+
+int gdb_serve(Emulator *emu, const char *address, TimeTravel *tt) {
+    int listen_fd = open_listener(address);
+    if (listen_fd < 0) {
+        return 1;
+    }
+    fprintf(stderr, "Waiting for GDB on %s\n", address);
+
+    GdbSession session = { .emu = emu, .tt = tt };
+    session.fd = accept(listen_fd, NULL, NULL);
+    close(listen_fd);
+    if (session.fd < 0) {
+        perror("Failed to accept GDB connection");
+        return 1;
+    }
+
+    bool detached = false;
+    while (recv_packet(&session)) {
+        if (!handle_packet(&session)) {
+            detached = session.packet[0] == 'D';
+            break;
+        }
+    }
+    close(session.fd);
+
+    // A detached program keeps running without breakpoints
+    if (detached) {
+        pc_set_clear(&emu->breakpoints);
+        emu->num_watchpoints = 0;
+        while (fetch_and_execute(emu));
+    }
+    return 0;
+}
@@ -0,0 +1,16 @@
+#ifndef GDBSTUB_H
+#define GDBSTUB_H
+
+#include "emulator.h"
+#include "reverse.h"
+
+#define GDB_PACKET_SIZE 4096
+#define GDB_POLL_INSTRS 1000000 // Instructions run between checks for a Ctrl-C from GDB
+#define GDB_REG_PC 32
+#define GDB_REG_CSR_BASE 65     // GDB numbers CSRs from here in the default RISC-V description
+
+// Listens on "PORT" (127.0.0.1) or "unix:PATH" and serves one GDB session; returns the exit status.
+// With tt set the session also supports reverse execution.
+int gdb_serve(Emulator *emu, const char *address, TimeTravel *tt);
+
+#endif // GDBSTUB_H
@@ -0,0 +1,48 @@
+#ifndef ISA_H
+#define ISA_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "isa_ops.h" // Generated from isa.tbl: the Op enum, OP_INVALID first and NUM_OPS last
+
+typedef enum {
+    FORMAT_NONE,
+    FORMAT_R,     // rd, rs1, rs2
+    FORMAT_I,     // rd, rs1, imm
+    FORMAT_SHIFT, // rd, rs1, shamt
+    FORMAT_LOAD,  // rd, imm(rs1)
+    FORMAT_S,     // rs2, imm(rs1)
+    FORMAT_B,     // rs1, rs2, offset
+    FORMAT_U,     // rd, imm[31:12]
+    FORMAT_J,     // rd, offset
+    FORMAT_JALR,  // rd, imm(rs1)
+    FORMAT_CSR,   // rd, csr, rs1
+    FORMAT_CSRI,  // rd, csr, uimm
+    FORMAT_AMO,   // rd, rs2, (rs1)
+    FORMAT_LR     // rd, (rs1)
+} IsaFormat;
+
+#define ISA_LOAD      0x01
+#define ISA_STORE     0x02
+#define ISA_BRANCH    0x04
+#define ISA_JUMP      0x08
+#define ISA_SYSTEM    0x10
+#define ISA_WRITES_RD 0x20 // Set for every format with an rd field
+#define ISA_ENDS_BLOCK (ISA_BRANCH | ISA_JUMP | ISA_SYSTEM)
+
+typedef struct {
+    const char *name;
+    uint32_t match;
+    uint32_t mask;
+    IsaFormat format;
+    uint32_t flags; // ISA_* bits
+} IsaInfo;
+
+extern const IsaInfo isa_info[NUM_OPS];
+
+// Decision tree over the fields the table's masks share, OP_INVALID when nothing matches
+Op decode_op(uint32_t raw_instr);
+// Writes the assembly text, or ".word" for an undecodable word, and returns what snprintf returns
+int disassemble(uint32_t raw_instr, char *buf, size_t size);
+
+#endif // ISA_H
@@ -0,0 +1,401 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+// Reads the instruction table (src/isa.tbl) and writes into OUTDIR:
+//   isa_ops.h      the Op enum
+//   isa.c          the decision-tree decoder, isa_info[] and the disassembler
+//   isa_exec.inc   one handler per instruction and the dispatch table, included by emulator.c
+//   isa_vectors.inc  encodings with random operand bits and their expected op and text, for test.c
+
+#define MAX_ENTRIES 256
+#define VECTORS_PER_ENTRY 4
+
+typedef struct {
+    const char *name;     // As written in the table
+    const char *text;     // Disassembly after the mnemonic
+    const char *args;     // Matching printf arguments in the generated disassembler
+    bool has_rd;
+} Format;
+
+// Same order as IsaFormat in isa.h
+static const Format formats[] = {
+    { "NONE",  "",                   "",                    false },
+    { "R",     " x%u, x%u, x%u",     ", rd, rs1, rs2",      true },
+    { "I",     " x%u, x%u, %d",      ", rd, rs1, imm_i",    true },
+    { "SHIFT", " x%u, x%u, %u",      ", rd, rs1, shamt",    true },
+    { "LOAD",  " x%u, %d(x%u)",      ", rd, imm_i, rs1",    true },
+    { "S",     " x%u, %d(x%u)",      ", rs2, imm_s, rs1",   false },
+    { "B",     " x%u, x%u, %d",      ", rs1, rs2, imm_b",   false },
+    { "U",     " x%u, 0x%x",         ", rd, upper",         true },
+    { "J",     " x%u, %d",           ", rd, imm_j",         true },
+    { "JALR",  " x%u, %d(x%u)",      ", rd, imm_i, rs1",    true },
+    { "CSR",   " x%u, 0x%x, x%u",    ", rd, csr, rs1",      true },
+    { "CSRI",  " x%u, 0x%x, %u",     ", rd, csr, rs1",      true },
+    { "AMO",   " x%u, x%u, (x%u)",   ", rd, rs2, rs1",      true },
+    { "LR",    " x%u, (x%u)",        ", rd, rs1",           true },
+};
+#define NUM_FORMATS (sizeof(formats) / sizeof(formats[0]))
+
+static const char *flag_names[] = { "load", "store", "branch", "jump", "system" };
+static const char *flag_macros[] = { "ISA_LOAD", "ISA_STORE", "ISA_BRANCH", "ISA_JUMP", "ISA_SYSTEM" };
+#define NUM_FLAGS (sizeof(flag_names) / sizeof(flag_names[0]))
+
+typedef struct {
+    char name[32];
+    char ident[32];   // The name with dots as underscores, for handle_ names
+    char upper[32];   // For the OP_ name
+    uint32_t match;
+    uint32_t mask;
+    size_t format;
+    uint32_t flags;   // Bit i is flag_names[i]
+    char semantics[512];
+    int line;
+} Entry;
+
+static Entry entries[MAX_ENTRIES];
+static size_t num_entries;
+
+static void fail(int line, const char *message, const char *detail) {
+    fprintf(stderr, "isa.tbl:%d: %s%s%s\n", line, message, detail ? ": " : "", detail ? detail : "");
+    exit(1);
+}
+
+static bool parse_flags(char *text, uint32_t *flags) {
+    *flags = 0;
+    if (strcmp(text, "-") == 0) {
+        return true;
+    }
+    for (char *flag = strtok(text, ","); flag; flag = strtok(NULL, ",")) {
+        size_t i = 0;
+        while (i < NUM_FLAGS && strcmp(flag, flag_names[i]) != 0) {
+            i++;
+        }
+        if (i == NUM_FLAGS) {
+            return false;
+        }
+        *flags |= 1u << i;
+    }
+    return true;
+}
+
+static void read_table(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Failed to open instruction table");
+        exit(1);
+    }
+    char line[1024];
+    for (int line_number = 1; fgets(line, sizeof(line), file); line_number++) {
+        char *text = line;
+        while (isspace((unsigned char)*text)) {
+            text++;
+        }
+        if (*text == '\0' || *text == '#') {
+            continue;
+        }
+        if (num_entries == MAX_ENTRIES) {
+            fail(line_number, "too many instructions", NULL);
+        }
+
+        Entry *entry = &entries[num_entries];
+        char format[16], flags[64];
+        int consumed = 0;
+        if (sscanf(text, "%31s %x %x %15s %63s %n", entry->name, &entry->match, &entry->mask, format, flags, &consumed) != 5 ||
+            consumed == 0) {
+            fail(line_number, "expected name, match, mask, format, flags and semantics", NULL);
+        }
+        snprintf(entry->semantics, sizeof(entry->semantics), "%s", text + consumed);
+        entry->semantics[strcspn(entry->semantics, "\r\n")] = '\0';
+        if (entry->semantics[0] == '\0') {
+            fail(line_number, "missing semantics", entry->name);
+        }
+        entry->line = line_number;
+        for (size_t i = 0; i <= strlen(entry->name); i++) {
+            entry->ident[i] = entry->name[i] == '.' ? '_' : entry->name[i];
+            entry->upper[i] = toupper((unsigned char)entry->ident[i]);
+        }
+
+        entry->format = 0;
+        while (entry->format < NUM_FORMATS && strcmp(format, formats[entry->format].name) != 0) {
+            entry->format++;
+        }
+        if (entry->format == NUM_FORMATS) {
+            fail(line_number, "unknown format", format);
+        }
+        if (!parse_flags(flags, &entry->flags)) {
+            fail(line_number, "unknown flag", flags);
+        }
+        if (entry->match & ~entry->mask) {
+            fail(line_number, "match has bits outside the mask", entry->name);
+        }
+        for (size_t i = 0; i < num_entries; i++) {
+            if (strcmp(entries[i].name, entry->name) == 0) {
+                fail(line_number, "duplicate instruction", entry->name);
+            }
+            // Two entries overlap when they agree on every bit both of them fix
+            if (((entries[i].match ^ entry->match) & entries[i].mask & entry->mask) == 0) {
+                fail(line_number, "encoding overlaps", entries[i].name);
+            }
+        }
+        num_entries++;
+    }
+    fclose(file);
+    if (num_entries == 0) {
+        fail(0, "no instructions", NULL);
+    }
+}
+
+static FILE *create(const char *dir, const char *name) {
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    FILE *file = fopen(path, "w");
+    if (!file) {
+        perror(path);
+        exit(1);
+    }
+    fprintf(file, "// Generated by isagen from src/isa.tbl; edit the table instead\n");
+    return file;
+}
+
+static void finish(FILE *file) {
+    if (ferror(file) || fclose(file) != 0) {
+        fprintf(stderr, "Failed to write generated file\n");
+        exit(1);
+    }
+}
+
+static void write_ops(const char *dir) {
+    FILE *file = create(dir, "isa_ops.h");
+    fprintf(file, "#ifndef ISA_OPS_H\n#define ISA_OPS_H\n\ntypedef enum {\n    OP_INVALID,\n");
+    for (size_t i = 0; i < num_entries; i++) {
+        fprintf(file, "    OP_%s,\n", entries[i].upper);
+    }
+    fprintf(file, "    NUM_OPS\n} Op;\n\n#endif // ISA_OPS_H\n");
+    finish(file);
+}
+
+static uint32_t field_shift, field_mask;
+
+static int by_field(const void *a, const void *b) {
+    uint32_t x = (entries[*(const size_t *)a].match >> field_shift) & field_mask;
+    uint32_t y = (entries[*(const size_t *)b].match >> field_shift) & field_mask;
+    return x < y ? -1 : x > y;
+}
+
+// Switches on the lowest run of bits every remaining entry fixes, until one entry is left
+static void write_node(FILE *file, size_t *set, size_t count, uint32_t tested, int depth) {
+    int indent = 4 + depth * 8;
+    if (count == 1) {
+        const Entry *entry = &entries[set[0]];
+        uint32_t rest = entry->mask & ~tested;
+        if (rest) {
+            fprintf(file, "%*sreturn (raw_instr & 0x%08x) == 0x%08x ? OP_%s : OP_INVALID;\n",
+                    indent, "", rest, entry->match & rest, entry->upper);
+        } else {
+            fprintf(file, "%*sreturn OP_%s;\n", indent, "", entry->upper);
+        }
+        return;
+    }
+
+    uint32_t common = ~tested;
+    for (size_t i = 0; i < count; i++) {
+        common &= entries[set[i]].mask;
+    }
+    if (common == 0) {
+        fail(entries[set[0]].line, "no field separates this instruction from", entries[set[1]].name);
+    }
+    uint32_t shift = __builtin_ctz(common);
+    uint32_t width = 0;
+    while (shift + width < 32 && (common >> (shift + width)) & 1) {
+        width++;
+    }
+    uint32_t mask = width == 32 ? UINT32_MAX : (1u << width) - 1;
+    field_shift = shift;
+    field_mask = mask;
+    qsort(set, count, sizeof(size_t), by_field);
+
+    if (shift) {
+        fprintf(file, "%*sswitch ((raw_instr >> %u) & 0x%x) {\n", indent, "", shift, mask);
+    } else {
+        fprintf(file, "%*sswitch (raw_instr & 0x%x) {\n", indent, "", mask);
+    }
+    for (size_t start = 0; start < count;) {
+        uint32_t value = (entries[set[start]].match >> shift) & mask;
+        size_t end = start + 1;
+        while (end < count && ((entries[set[end]].match >> shift) & mask) == value) {
+            end++;
+        }
+        fprintf(file, "%*scase 0x%x:\n", indent + 4, "", value);
+        write_node(file, set + start, end - start, tested | (mask << shift), depth + 1);
+        start = end;
+    }
+    fprintf(file, "%*sdefault:\n%*sreturn OP_INVALID;\n%*s}\n", indent + 4, "", indent + 8, "", indent, "");
+}
+
+static void write_decoder(const char *dir) {
+    FILE *file = create(dir, "isa.c");
+    fprintf(file, "#include <stdio.h>\n#include \"isa.h\"\n\n");
+
+    fprintf(file, "const IsaInfo isa_info[NUM_OPS] = {\n");
+    fprintf(file, "    [OP_INVALID] = { \"invalid\", 0, 0, FORMAT_NONE, 0 },\n");
+    for (size_t i = 0; i < num_entries; i++) {
+        const Entry *entry = &entries[i];
+        char flags[256] = "";
+        for (size_t f = 0; f < NUM_FLAGS; f++) {
+            if (entry->flags & (1u << f)) {
+                snprintf(flags + strlen(flags), sizeof(flags) - strlen(flags), "%s%s", flags[0] ? " | " : "", flag_macros[f]);
+            }
+        }
+        if (formats[entry->format].has_rd) {
+            snprintf(flags + strlen(flags), sizeof(flags) - strlen(flags), "%sISA_WRITES_RD", flags[0] ? " | " : "");
+        }
+        fprintf(file, "    [OP_%s] = { \"%s\", 0x%08x, 0x%08x, FORMAT_%s, %s },\n", entry->upper, entry->name,
+                entry->match, entry->mask, formats[entry->format].name, flags[0] ? flags : "0");
+    }
+    fprintf(file, "};\n\n");
+
+    size_t set[MAX_ENTRIES];
+    for (size_t i = 0; i < num_entries; i++) {
+        set[i] = i;
+    }
+    fprintf(file, "Op decode_op(uint32_t raw_instr) {\n");
+    write_node(file, set, num_entries, 0, 0);
+    fprintf(file, "}\n\n");
+
+    fprintf(file, "int disassemble(uint32_t raw_instr, char *buf, size_t size) {\n");
+    fprintf(file, "    uint32_t rd = (raw_instr >> 7) & 0x1F, rs1 = (raw_instr >> 15) & 0x1F, rs2 = (raw_instr >> 20) & 0x1F;\n");
+    fprintf(file, "    uint32_t csr = raw_instr >> 20, shamt = (raw_instr >> 20) & 0x3F, upper = raw_instr >> 12;\n");
+    fprintf(file, "    int32_t imm_i = (int32_t)raw_instr >> 20;\n");
+    fprintf(file, "    int32_t imm_s = (int32_t)(raw_instr & 0xFE000000) >> 20 | ((raw_instr >> 7) & 0x1F);\n");
+    fprintf(file, "    int32_t imm_b = (int32_t)(raw_instr & 0x80000000) >> 19 | ((raw_instr << 4) & 0x800) |\n");
+    fprintf(file, "                    ((raw_instr >> 20) & 0x7E0) | ((raw_instr >> 7) & 0x1E);\n");
+    fprintf(file, "    int32_t imm_j = (int32_t)(raw_instr & 0x80000000) >> 11 | (raw_instr & 0xFF000) |\n");
+    fprintf(file, "                    ((raw_instr >> 9) & 0x800) | ((raw_instr >> 20) & 0x7FE);\n");
+    fprintf(file, "    (void)rd; (void)rs1; (void)rs2; (void)csr; (void)shamt; (void)upper;\n");
+    fprintf(file, "    (void)imm_i; (void)imm_s; (void)imm_b; (void)imm_j;\n");
+    fprintf(file, "    Op op = decode_op(raw_instr);\n");
+    fprintf(file, "    const char *name = isa_info[op].name;\n");
+    fprintf(file, "    switch (op) {\n");
+    for (size_t f = 0; f < NUM_FORMATS; f++) {
+        bool any = false;
+        for (size_t i = 0; i < num_entries; i++) {
+            if (entries[i].format == f) {
+                fprintf(file, "        case OP_%s:\n", entries[i].upper);
+                any = true;
+            }
+        }
+        if (any) {
+            fprintf(file, "            return snprintf(buf, size, \"%%s%s\", name%s);\n", formats[f].text, formats[f].args);
+        }
+    }
+    fprintf(file, "        default:\n            return snprintf(buf, size, \".word 0x%%08x\", raw_instr);\n    }\n}\n");
+    finish(file);
+}
+
+static bool uses_instr(const char *semantics) {
+    return strstr(semantics, "instr") || strstr(semantics, "RD") || strstr(semantics, "RS1") ||
+           strstr(semantics, "RS2") || strstr(semantics, "IMM_");
+}
+
+static void write_handlers(const char *dir) {
+    FILE *file = create(dir, "isa_exec.inc");
+    fprintf(file, "\nstatic void handle_invalid(Emulator *emu, Instruction instr) {\n    (void)emu;\n    (void)instr;\n}\n");
+    for (size_t i = 0; i < num_entries; i++) {
+        const Entry *entry = &entries[i];
+        fprintf(file, "\n// isa.tbl:%d\nstatic void handle_%s(Emulator *emu, Instruction instr) {\n", entry->line, entry->ident);
+        if (!uses_instr(entry->semantics)) {
+            fprintf(file, "    (void)instr;\n");
+        }
+        fprintf(file, "    %s\n}\n", entry->semantics);
+    }
+    fprintf(file, "\nstatic void (*const isa_handlers[NUM_OPS])(Emulator *emu, Instruction instr) = {\n");
+    fprintf(file, "    [OP_INVALID] = handle_invalid,\n");
+    for (size_t i = 0; i < num_entries; i++) {
+        fprintf(file, "    [OP_%s] = handle_%s,\n", entries[i].upper, entries[i].ident);
+    }
+    fprintf(file, "};\n");
+    finish(file);
+}
+
+// Same text the generated disassembler prints, worked out independently from the fields
+static void render(const Entry *entry, uint32_t raw, char *buf, size_t size) {
+    uint32_t rd = (raw >> 7) & 0x1F, rs1 = (raw >> 15) & 0x1F, rs2 = (raw >> 20) & 0x1F;
+    int32_t imm_i = (int32_t)raw >> 20;
+    int32_t imm_s = (int32_t)(((raw >> 25) << 5) | ((raw >> 7) & 0x1F)) << 20 >> 20;
+    int32_t imm_b = (int32_t)((((raw >> 31) & 1) << 12) | (((raw >> 7) & 1) << 11) |
+                              (((raw >> 25) & 0x3F) << 5) | (((raw >> 8) & 0xF) << 1)) << 19 >> 19;
+    int32_t imm_j = (int32_t)((((raw >> 31) & 1) << 20) | (((raw >> 12) & 0xFF) << 12) |
+                              (((raw >> 20) & 1) << 11) | (((raw >> 21) & 0x3FF) << 1)) << 11 >> 11;
+    int n = snprintf(buf, size, "%s", entry->name);
+    buf += n;
+    size -= n;
+    switch (entry->format) {
+        case 1: snprintf(buf, size, " x%u, x%u, x%u", rd, rs1, rs2); break;
+        case 2: snprintf(buf, size, " x%u, x%u, %d", rd, rs1, imm_i); break;
+        case 3: snprintf(buf, size, " x%u, x%u, %u", rd, rs1, (raw >> 20) & 0x3F); break;
+        case 4: snprintf(buf, size, " x%u, %d(x%u)", rd, imm_i, rs1); break;
+        case 5: snprintf(buf, size, " x%u, %d(x%u)", rs2, imm_s, rs1); break;
+        case 6: snprintf(buf, size, " x%u, x%u, %d", rs1, rs2, imm_b); break;
+        case 7: snprintf(buf, size, " x%u, 0x%x", rd, raw >> 12); break;
+        case 8: snprintf(buf, size, " x%u, %d", rd, imm_j); break;
+        case 9: snprintf(buf, size, " x%u, %d(x%u)", rd, imm_i, rs1); break;
+        case 10: snprintf(buf, size, " x%u, 0x%x, x%u", rd, raw >> 20, rs1); break;
+        case 11: snprintf(buf, size, " x%u, 0x%x, %u", rd, raw >> 20, rs1); break;
+        case 12: snprintf(buf, size, " x%u, x%u, (x%u)", rd, rs2, rs1); break;
+        case 13: snprintf(buf, size, " x%u, (x%u)", rd, rs1); break;
+        default: break;
+    }
+}
+
+static uint64_t next_random(uint64_t *state) {
+    *state ^= *state << 13;
+    *state ^= *state >> 7;
+    *state ^= *state << 17;
+    return *state;
+}
+
+static void write_vectors(const char *dir) {
+    FILE *file = create(dir, "isa_vectors.inc");
+    fprintf(file, "\nstatic const struct {\n    uint32_t raw;\n    Op op;\n    const char *text;\n} isa_vectors[] = {\n");
+    uint64_t rng = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < num_entries; i++) {
+        const Entry *entry = &entries[i];
+        for (int v = 0; v < VECTORS_PER_ENTRY; v++) {
+            // The first vector has every operand bit clear, the rest random ones
+            uint32_t raw = entry->match | (v ? (uint32_t)next_random(&rng) & ~entry->mask : 0);
+            char text[128];
+            render(entry, raw, text, sizeof(text));
+            fprintf(file, "    { 0x%08x, OP_%s, \"%s\" },\n", raw, entry->upper, text);
+        }
+    }
+    // Words no entry matches
+    static const uint32_t invalid[] = { 0x00000000, 0xffffffff, 0x0000707f, 0x02001073 & ~0x7000u };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        bool matched = false;
+        for (size_t e = 0; e < num_entries; e++) {
+            matched |= (invalid[i] & entries[e].mask) == entries[e].match;
+        }
+        if (!matched) {
+            fprintf(file, "    { 0x%08x, OP_INVALID, \".word 0x%08x\" },\n", invalid[i], invalid[i]);
+        }
+    }
+    fprintf(file, "};\n");
+    finish(file);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s TABLE OUTDIR\n", argv[0]);
+        return 1;
+    }
+    read_table(argv[1]);
+    write_ops(argv[2]);
+    write_decoder(argv[2]);
+    write_handlers(argv[2]);
+    write_vectors(argv[2]);
+    return 0;
+}
@@ -5,20 +5,369 @@
 #include <string.h>
 #include "emulator.h"
 #include "state.h"
+#include "timing.h"
+#include "simpoint.h"
+#include "checkpoint.h"
+#include "gdbstub.h"
+#include "reverse.h"
+#include "trace.h"
+#include "usermode.h"
+#include "stats.h"
+#include "codecache.h"
+#include "virtio.h"
+#include "memory.h"
+
+#define NUM_POSITIONAL_ARGS 5
+
+static void usage(const char *prog) {
+    fprintf(stderr, "Usage: %s [hex_file start_pc num_instrs log_file log_enabled] [options] [--user PROGRAM ARGS...]\n", prog);
+    fprintf(stderr, "  --timing               Run the cache and branch predictor timing model\n");
+    fprintf(stderr, "  --l1i=SIZE:WAYS:LINE   L1 instruction cache geometry\n");
+    fprintf(stderr, "  --l1d=SIZE:WAYS:LINE   L1 data cache geometry\n");
+    fprintf(stderr, "  --l2=SIZE:WAYS:LINE    Unified L2 geometry\n");
+    fprintf(stderr, "  --bp-history=BITS      gshare global history length\n");
+    fprintf(stderr, "  --max-instrs=N         Stop after N instructions (default %d)\n", MAX_EXEC_INSTRS);
+    fprintf(stderr, "  --memory=SIZE[K|M|G]   Guest RAM size (default %d, %u with --user)\n", MEMORY_SIZE, USER_MEMORY_SIZE);
+    fprintf(stderr, "  --hugepages=MODE       Back guest RAM with off, thp (default) or hugetlb pages\n");
+    fprintf(stderr, "  --numa=NODE[,NODE...]  Bind emulator threads and their RAM to these nodes, round-robin\n");
+    fprintf(stderr, "  --simpoint=N           Sampled simulation with intervals of N instructions\n");
+    fprintf(stderr, "  --simpoint-k=K         Maximum number of SimPoint clusters\n");
+    fprintf(stderr, "  --simpoint-dir=DIR     Where the interval checkpoints are written\n");
+    fprintf(stderr, "  --simpoint-warmup=N    Detailed instructions before each interval that are not measured (default %d)\n", SIMPOINT_WARMUP);
+    fprintf(stderr, "  --threads=N            Detailed simulation threads (default: all cores)\n");
+    fprintf(stderr, "  --gdb=PORT|unix:PATH   Wait for a GDB remote connection before running\n");
+    fprintf(stderr, "  --record=FILE          Log timer interrupts and device input for replay\n");
+    fprintf(stderr, "  --replay=FILE          Re-run a recorded execution from its event log\n");
+    fprintf(stderr, "  --reverse[=N]          Let GDB run backwards, snapshotting every N instructions\n");
+    fprintf(stderr, "  --trace=TRIGGER        Trace selected instructions to the log (repeatable):\n");
+    fprintf(stderr, "                         pc:LO-HI, instret:LO-HI, store:ADDR[-HI], csr:NUM or trap,\n");
+    fprintf(stderr, "                         optionally followed by /regs, /mem or /full\n");
+    fprintf(stderr, "  --trace-window=N       Instructions traced after a store, csr or trap trigger (default %d)\n", TRACE_WINDOW);
+    fprintf(stderr, "  --checkpoint=DIR       Write incremental checkpoints to DIR in the background\n");
+    fprintf(stderr, "  --checkpoint-interval=N  Instructions between checkpoints (default %d)\n", CHECKPOINT_INTERVAL);
+    fprintf(stderr, "  --resume               Continue from the newest checkpoint in the --checkpoint directory\n");
+    fprintf(stderr, "  --disk=FILE            virtio block device at 0x%x backed by FILE, mapped into the emulator\n", VIRTIO_BASE + VIRTIO_BLK * VIRTIO_MMIO_SIZE);
+    fprintf(stderr, "  --virtio-console       virtio console at 0x%x, output only\n", VIRTIO_BASE + VIRTIO_CONSOLE * VIRTIO_MMIO_SIZE);
+    fprintf(stderr, "  --code-cache=DIR       Reuse blocks decoded by earlier runs of the same image, kept in DIR\n");
+    fprintf(stderr, "  --stats[=NAME]         Publish live counters in shared memory for emustat (default %sPID)\n", STATS_PREFIX);
+    fprintf(stderr, "  --user PROGRAM ARGS    Run a static RV64 Linux executable with syscall emulation\n");
+}
+
+static bool parse_option(const char *arg, const char *name, const char **value) {
+    size_t len = strlen(name);
+    if (strncmp(arg, name, len) == 0 && arg[len] == '=') {
+        *value = arg + len + 1;
+        return true;
+    }
+    return false;
+}
 
 int main(int argc, char *argv[]) {
-    const char *hex_file = (argc > 1) ? argv[1] : "assets/instr.hex";
-    uint64_t start_pc = (argc > 2) ? strtoull(argv[2], NULL, 0) : PC_START;
-    size_t num_instrs = (argc > 3) ? strtoul(argv[3], NULL, 0) : NUM_INSTRS;
-    const char *log_file = (argc > 4) ? argv[4] : LOG_FILE;
-    bool log_enabled = (argc > 5) ? (strcmp(argv[5], "true") == 0) : true;
+    const char *args[NUM_POSITIONAL_ARGS] = { NULL };
+    int num_args = 0;
+    bool timing_enabled = false;
+    const char *gdb_address = NULL;
+    const char *record_file = NULL;
+    const char *replay_file = NULL;
+    uint64_t reverse_interval = 0;
+    const char *checkpoint_dir = NULL;
+    uint64_t checkpoint_interval = CHECKPOINT_INTERVAL;
+    bool resume = false;
+    const char *code_cache_dir = NULL;
+    const char *disk_file = NULL;
+    bool virtio_console = false;
+    bool stats_enabled = false;
+    const char *stats_name = NULL;
+    uint64_t max_instrs = MAX_EXEC_INSTRS;
+    bool max_instrs_set = false;
+    bool memory_set = false;
+    int user_argc = 0;
+    char **user_argv = NULL;
+    TimingConfig timing_config;
+    default_timing_config(&timing_config);
+    MemoryConfig memory_config;
+    default_memory_config(&memory_config);
+    SimPointConfig simpoint_config;
+    default_simpoint_config(&simpoint_config);
+    Tracer tracer;
+    init_tracer(&tracer);
+
+    for (int i = 1; i < argc; i++) {
+        const char *value;
+        if (strcmp(argv[i], "--timing") == 0) {
+            timing_enabled = true;
+        } else if (parse_option(argv[i], "--l1i", &value)) {
+            if (!parse_cache_config(value, &timing_config.l1i)) {
+                fprintf(stderr, "Invalid cache geometry: %s\n", value);
+                return 1;
+            }
+        } else if (parse_option(argv[i], "--l1d", &value)) {
+            if (!parse_cache_config(value, &timing_config.l1d)) {
+                fprintf(stderr, "Invalid cache geometry: %s\n", value);
+                return 1;
+            }
+        } else if (parse_option(argv[i], "--l2", &value)) {
+            if (!parse_cache_config(value, &timing_config.l2)) {
+                fprintf(stderr, "Invalid cache geometry: %s\n", value);
+                return 1;
+            }
+        } else if (parse_option(argv[i], "--bp-history", &value)) {
+            timing_config.history_bits = strtoul(value, NULL, 0);
+            if (timing_config.history_bits == 0 || timing_config.history_bits > 24) {
+                fprintf(stderr, "Invalid branch history length: %s\n", value);
+                return 1;
+            }
+        } else if (parse_option(argv[i], "--max-instrs", &value)) {
+            max_instrs = strtoull(value, NULL, 0);
+            max_instrs_set = true;
+        } else if (parse_option(argv[i], "--memory", &value)) {
+            if (!parse_memory_size(value, &memory_config.size)) {
+                fprintf(stderr, "Invalid memory size: %s\n", value);
+                return 1;
+            }
+            memory_set = true;
+        } else if (parse_option(argv[i], "--hugepages", &value)) {
+            if (!parse_huge_pages(value, &memory_config.huge_pages)) {
+                fprintf(stderr, "Invalid huge page mode: %s\n", value);
+                return 1;
+            }
+        } else if (parse_option(argv[i], "--numa", &value)) {
+            if (!parse_numa_nodes(value, &memory_config)) {
+                fprintf(stderr, "Invalid NUMA node list: %s\n", value);
+                return 1;
+            }
+        } else if (parse_option(argv[i], "--simpoint", &value)) {
+            simpoint_config.interval = strtoull(value, NULL, 0);
+            if (simpoint_config.interval == 0) {
+                fprintf(stderr, "Invalid SimPoint interval: %s\n", value);
+                return 1;
+            }
+        } else if (parse_option(argv[i], "--simpoint-k", &value)) {
+            simpoint_config.max_clusters = strtoul(value, NULL, 0);
+            if (simpoint_config.max_clusters == 0) {
+                fprintf(stderr, "Invalid cluster count: %s\n", value);
+                return 1;
+            }
+        } else if (parse_option(argv[i], "--simpoint-warmup", &value)) {
+            simpoint_config.warmup = strtoull(value, NULL, 0);
+        } else if (parse_option(argv[i], "--simpoint-dir", &value)) {
+            simpoint_config.checkpoint_dir = value;
+        } else if (parse_option(argv[i], "--threads", &value)) {
+            simpoint_config.num_threads = strtoul(value, NULL, 0);
+        } else if (parse_option(argv[i], "--gdb", &value)) {
+            gdb_address = value;
+        } else if (parse_option(argv[i], "--record", &value)) {
+            record_file = value;
+        } else if (parse_option(argv[i], "--replay", &value)) {
+            replay_file = value;
+        } else if (parse_option(argv[i], "--trace", &value)) {
+            if (!add_trigger(&tracer, value)) {
+                fprintf(stderr, "Invalid trace trigger: %s\n", value);
+                return 1;
+            }
+        } else if (parse_option(argv[i], "--trace-window", &value)) {
+            tracer.window = strtoull(value, NULL, 0);
+        } else if (strcmp(argv[i], "--reverse") == 0) {
+            reverse_interval = REVERSE_INTERVAL;
+        } else if (parse_option(argv[i], "--reverse", &value)) {
+            reverse_interval = strtoull(value, NULL, 0);
+            if (reverse_interval == 0) {
+                fprintf(stderr, "Invalid snapshot interval: %s\n", value);
+                return 1;
+            }
+        } else if (parse_option(argv[i], "--checkpoint", &value)) {
+            checkpoint_dir = value;
+        } else if (parse_option(argv[i], "--checkpoint-interval", &value)) {
+            checkpoint_interval = strtoull(value, NULL, 0);
+            if (checkpoint_interval == 0) {
+                fprintf(stderr, "Invalid checkpoint interval: %s\n", value);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--resume") == 0) {
+            resume = true;
+        } else if (parse_option(argv[i], "--code-cache", &value)) {
+            code_cache_dir = value;
+        } else if (parse_option(argv[i], "--disk", &value)) {
+            disk_file = value;
+        } else if (strcmp(argv[i], "--virtio-console") == 0) {
+            virtio_console = true;
+        } else if (strcmp(argv[i], "--stats") == 0) {
+            stats_enabled = true;
+        } else if (parse_option(argv[i], "--stats", &value)) {
+            stats_enabled = true;
+            stats_name = value;
+        } else if (strcmp(argv[i], "--user") == 0) {
+            // Everything after --user is the guest's own command line
+            user_argc = argc - i - 1;
+            user_argv = &argv[i + 1];
+            if (user_argc == 0) {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        } else if (strncmp(argv[i], "--", 2) == 0 || num_args == NUM_POSITIONAL_ARGS) {
+            usage(argv[0]);
+            return 1;
+        } else {
+            args[num_args++] = argv[i];
+        }
+    }
 
+    const char *hex_file = (num_args > 0) ? args[0] : "assets/instr.hex";
+    uint64_t start_pc = (num_args > 1) ? strtoull(args[1], NULL, 0) : PC_START;
+    size_t num_instrs = (num_args > 2) ? strtoul(args[2], NULL, 0) : NUM_INSTRS;
+    const char *log_file = (num_args > 3) ? args[3] : LOG_FILE;
+    bool log_enabled = (num_args > 4) ? (strcmp(args[4], "true") == 0) : !user_argv;
+
+    if (user_argv && !memory_set) {
+        memory_config.size = USER_MEMORY_SIZE;
+    }
+    // RAM may have holes where the devices are, but it cannot end partway through one
+    if (!user_argv && in_device_window(memory_config.size - 1)) {
+        fprintf(stderr, "Memory size 0x%lx ends inside a device window\n", memory_config.size);
+        return 1;
+    }
+    // Guest RAM is mapped by init, so the thread has to be on its node by then
+    set_memory_config(&memory_config);
+    if (memory_config.num_nodes && !bind_thread_to_node(numa_node_for(0))) {
+        return 1;
+    }
     Emulator emu;
-    init_emulator(&emu, hex_file, start_pc, num_instrs, log_file);
+    UserMode user;
+    if (user_argv) {
+        init_bare_emulator(&emu);
+        if (num_args > 3 || log_enabled || tracer.num_triggers) {
+            open_log(&emu, log_file);
+        }
+        if (!load_user_program(&emu, &user, user_argc, user_argv)) {
+            free_emulator(&emu);
+            return 1;
+        }
+        if (!max_instrs_set) {
+            max_instrs = UINT64_MAX;
+        }
+    } else {
+        init_emulator(&emu, hex_file, start_pc, num_instrs, log_file);
+    }
     emu.log_enabled = log_enabled;
+    emu.max_instrs = max_instrs;
+    if (record_file && replay_file) {
+        fprintf(stderr, "--record and --replay are mutually exclusive\n");
+        return 1;
+    }
+    if (reverse_interval && (!gdb_address || record_file)) {
+        // Editing the past in GDB rewrites history, which an event log on disk cannot follow
+        fprintf(stderr, "--reverse needs --gdb and cannot be combined with --record\n");
+        return 1;
+    }
+    if (resume && !checkpoint_dir) {
+        fprintf(stderr, "--resume needs --checkpoint=DIR\n");
+        return 1;
+    }
+    if (checkpoint_dir && (gdb_address || simpoint_config.interval || user_argv || record_file || replay_file)) {
+        // Checkpoints hold the guest state only: no event log position, host files or debugger session
+        fprintf(stderr, "--checkpoint cannot be combined with --gdb, --simpoint, --user, --record or --replay\n");
+        return 1;
+    }
+    if ((disk_file || virtio_console) && (reverse_interval || checkpoint_dir || simpoint_config.interval || user_argv)) {
+        // Queue state and disk writes live outside the guest state that snapshots and checkpoints restore
+        fprintf(stderr, "--disk and --virtio-console cannot be combined with --reverse, --checkpoint, --simpoint or --user\n");
+        return 1;
+    }
+    if (disk_file && (record_file || replay_file)) {
+        // The recorded run writes into the shared image, so a replay would read a different disk
+        fprintf(stderr, "--disk cannot be combined with --record or --replay\n");
+        return 1;
+    }
+    if ((record_file && !start_recording(&emu.devices, record_file)) ||
+        (replay_file && !start_replay(&emu.devices, replay_file))) {
+        return 1;
+    }
+
+    if ((stats_enabled || code_cache_dir) && simpoint_config.interval) {
+        fprintf(stderr, "--stats and --code-cache cannot be combined with --simpoint\n");
+        return 1;
+    }
+
+    if (simpoint_config.interval) {
+        emu.log_enabled = false;
+        int status = run_simpoint(&emu, &simpoint_config, &timing_config);
+        free_emulator(&emu);
+        return status;
+    }
+
+    if (timing_enabled) {
+        emu.timing = create_timing_model(&timing_config);
+    }
+    if (tracer.num_triggers) {
+        emu.tracer = &tracer;
+    }
+    StatsExport stats = { .segment = NULL };
+    if (stats_enabled) {
+        if (!open_stats(&stats, stats_name)) {
+            free_emulator(&emu);
+            return 1;
+        }
+        emu.stats = stats.segment;
+        fprintf(stderr, "Publishing stats in %s\n", stats.name);
+    }
+    // Opened once the image is in RAM, since its contents pick the file
+    CodeCache code_cache;
+    if (code_cache_dir) {
+        if (!open_code_cache(&code_cache, code_cache_dir, &emu)) {
+            free_emulator(&emu);
+            return 1;
+        }
+        emu.code_cache = &code_cache;
+    }
+    Virtio virtio;
+    if (disk_file || virtio_console) {
+        if (!open_virtio(&virtio, disk_file, virtio_console)) {
+            free_emulator(&emu);
+            return 1;
+        }
+        emu.virtio = &virtio;
+    }
 
-    while (fetch_and_execute(&emu));
+    int status = 0;
+    if (gdb_address && reverse_interval) {
+        TimeTravel tt;
+        init_time_travel(&tt, &emu, reverse_interval);
+        status = gdb_serve(&emu, gdb_address, &tt);
+        free_time_travel(&tt);
+    } else if (gdb_address) {
+        status = gdb_serve(&emu, gdb_address, NULL);
+    } else if (checkpoint_dir) {
+        CheckpointWriter writer;
+        if (!start_checkpointing(&writer, &emu, checkpoint_dir, checkpoint_interval, resume)) {
+            free_emulator(&emu);
+            return 1;
+        }
+        run_with_checkpoints(&writer, &emu);
+        stop_checkpointing(&writer);
+    } else {
+        while (fetch_and_execute(&emu));
+    }
 
-    fclose(emu.log_file);
-    return 0;
-}
\ No newline at end of file
+    if (emu.user) {
+        fflush(stdout);
+        fprintf(stderr, "Exited with status %d after %lu instructions\n", user.exit_status, emu.state.instret);
+        status = user.exited ? user.exit_status : 1;
+    }
+    if (emu.stats) {
+        close_stats(&stats, &emu);
+    }
+    if (emu.virtio) {
+        close_virtio(&virtio);
+    }
+    if (emu.code_cache) {
+        save_code_cache(&code_cache, &emu);
+        close_code_cache(&code_cache);
+    }
+    if (emu.timing) {
+        report_timing(emu.timing, stdout);
+        free_timing_model(emu.timing);
+    }
+    free_emulator(&emu);
+    return status;
+}
@@ -0,0 +1,194 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "memory.h"
+
+#define MPOL_BIND 2 // From <linux/mempolicy.h>, which libc does not wrap
+
+static MemoryConfig current_config = { .size = MEMORY_SIZE, .huge_pages = HUGE_PAGES_THP };
+static _Thread_local int thread_node = -1; // Node the calling thread was bound to
+
+void default_memory_config(MemoryConfig *config) {
+    memset(config, 0, sizeof(MemoryConfig));
+    config->size = MEMORY_SIZE;
+    config->huge_pages = HUGE_PAGES_THP;
+}
+
+bool parse_memory_size(const char *text, uint64_t *size) {
+    char *end;
+    uint64_t value = strtoull(text, &end, 0);
+    switch (*end) {
+        case 'G': case 'g': value <<= 10; // Fall through
+        case 'M': case 'm': value <<= 10; // Fall through
+        case 'K': case 'k': value <<= 10; end++; break;
+        default: break;
+    }
+    if (*end != '\0' || value < PAGE_SIZE || value % PAGE_SIZE != 0) {
+        return false;
+    }
+    *size = value;
+    return true;
+}
+
+bool parse_huge_pages(const char *text, HugePages *huge_pages) {
+    if (strcmp(text, "off") == 0) {
+        *huge_pages = HUGE_PAGES_OFF;
+    } else if (strcmp(text, "thp") == 0) {
+        *huge_pages = HUGE_PAGES_THP;
+    } else if (strcmp(text, "hugetlb") == 0) {
+        *huge_pages = HUGE_PAGES_HUGETLB;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+bool parse_numa_nodes(const char *text, MemoryConfig *config) {
+    config->num_nodes = 0;
+    while (*text) {
+        char *end;
+        long node = strtol(text, &end, 10);
+        if (end == text || node < 0 || node >= MAX_NUMA_NODES || config->num_nodes == MAX_NUMA_NODES ||
+            (*end != ',' && *end != '\0') || (*end == ',' && end[1] == '\0')) {
+            return false;
+        }
+        config->nodes[config->num_nodes++] = node;
+        text = *end ? end + 1 : end;
+    }
+    return config->num_nodes > 0;
+}
+
+void set_memory_config(const MemoryConfig *config) {
+    current_config = *config;
+}
+
+const MemoryConfig *current_memory_config(void) {
+    return &current_config;
+}
+
+int numa_node_for(uint32_t index) {
+    return current_config.num_nodes ? current_config.nodes[index % current_config.num_nodes] : -1;
+}
+
+// Reads a sysfs CPU list such as "0-3,8-11"
+static bool node_cpus(int node, cpu_set_t *cpus) {
+    char path[128];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        return false;
+    }
+    char list[4096];
+    bool ok = fgets(list, sizeof(list), file) != NULL;
+    fclose(file);
+
+    CPU_ZERO(cpus);
+    for (char *p = list; ok && *p && *p != '\n';) {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (*end == '-') {
+            last = strtol(end + 1, &end, 10);
+        }
+        for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, cpus);
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return ok && CPU_COUNT(cpus) > 0;
+}
+
+bool bind_thread_to_node(int node) {
+    cpu_set_t cpus;
+    if (!node_cpus(node, &cpus)) {
+        fprintf(stderr, "NUMA node %d has no CPUs\n", node);
+        return false;
+    }
+    if (sched_setaffinity(0, sizeof(cpus), &cpus) != 0) {
+        perror("Failed to bind thread to NUMA node");
+        return false;
+    }
+    // The policy covers pages the thread faults in from now on, including the host side of the emulator
+    unsigned long mask = 1ul << node;
+    if (syscall(SYS_set_mempolicy, MPOL_BIND, &mask, MAX_NUMA_NODES + 1) != 0) {
+        perror("Failed to set NUMA memory policy");
+        return false;
+    }
+    thread_node = node;
+    return true;
+}
+
+static uint8_t *map_anonymous(size_t len, int flags) {
+    void *memory = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+// Over-maps by one huge page and trims, so khugepaged can back every 2 MiB of the range
+static uint8_t *map_aligned(size_t len) {
+    uint8_t *raw = map_anonymous(len + HUGE_PAGE_SIZE, MAP_NORESERVE);
+    if (!raw) {
+        return NULL;
+    }
+    uint8_t *aligned = (uint8_t *)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (aligned > raw) {
+        munmap(raw, aligned - raw);
+    }
+    munmap(aligned + len, raw + HUGE_PAGE_SIZE - aligned);
+    return aligned;
+}
+
+uint8_t *map_guest_memory(uint64_t size, HugePages huge_pages, size_t *mapped, HugePages *used) {
+    size_t huge_len = (size + HUGE_PAGE_SIZE - 1) & ~(uint64_t)(HUGE_PAGE_SIZE - 1);
+    uint8_t *memory = NULL;
+    if (huge_pages == HUGE_PAGES_HUGETLB) {
+        // Reserving up front makes a shortage fail here instead of as SIGBUS on first touch
+        memory = map_anonymous(huge_len, MAP_HUGETLB);
+        if (memory) {
+            *mapped = huge_len;
+        } else {
+            fprintf(stderr, "No free huge pages for %lu bytes of guest RAM, using transparent huge pages\n", size);
+            huge_pages = HUGE_PAGES_THP;
+        }
+    }
+    // Smaller RAM never fills a huge page
+    if (!memory && huge_pages == HUGE_PAGES_THP && size >= HUGE_PAGE_SIZE) {
+        memory = map_aligned(huge_len);
+        if (memory) {
+            *mapped = huge_len;
+            if (madvise(memory, huge_len, MADV_HUGEPAGE) != 0) {
+                huge_pages = HUGE_PAGES_OFF;
+            }
+        }
+    }
+    if (!memory) {
+        huge_pages = HUGE_PAGES_OFF;
+        *mapped = size;
+        memory = map_anonymous(size, MAP_NORESERVE);
+    }
+    if (!memory) {
+        perror("Failed to map guest memory");
+        exit(1);
+    }
+
+    if (thread_node >= 0) {
+        unsigned long mask = 1ul << thread_node;
+        if (syscall(SYS_mbind, memory, *mapped, MPOL_BIND, &mask, MAX_NUMA_NODES + 1, 0) != 0) {
+            perror("Failed to bind guest memory to NUMA node");
+        }
+    }
+    if (used) {
+        *used = huge_pages;
+    }
+    return memory;
+}
+
+void unmap_guest_memory(uint8_t *memory, size_t mapped) {
+    if (memory) {
+        munmap(memory, mapped);
+    }
+}
@@ -0,0 +1,47 @@
+#ifndef MEMORY_H
+#define MEMORY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define MEMORY_SIZE 65536 // Default guest RAM size
+#define PAGE_SHIFT 12 // Granule of dirty-page tracking, independent of the host pages backing RAM
+#define PAGE_SIZE (1 << PAGE_SHIFT)
+#define HUGE_PAGE_SIZE (2u << 20)
+#define MAX_NUMA_NODES 64
+
+typedef enum {
+    HUGE_PAGES_OFF,     // Plain 4 KiB pages
+    HUGE_PAGES_THP,     // Transparent huge pages through MADV_HUGEPAGE, 4 KiB if the kernel declines
+    HUGE_PAGES_HUGETLB  // Reserved huge pages through MAP_HUGETLB, THP if none are free
+} HugePages;
+
+typedef struct {
+    uint64_t size;          // Guest RAM in bytes, a multiple of the 4 KiB dirty-page size
+    HugePages huge_pages;
+    uint32_t num_nodes;     // Emulator threads are bound round-robin to these NUMA nodes, 0 leaves placement to the kernel
+    int nodes[MAX_NUMA_NODES];
+} MemoryConfig;
+
+void default_memory_config(MemoryConfig *config);
+// Accepts a byte count with an optional K, M or G suffix
+bool parse_memory_size(const char *text, uint64_t *size);
+bool parse_huge_pages(const char *text, HugePages *huge_pages);
+// A comma-separated list of node numbers
+bool parse_numa_nodes(const char *text, MemoryConfig *config);
+
+// Emulators initialised afterwards get RAM of this size and kind
+void set_memory_config(const MemoryConfig *config);
+const MemoryConfig *current_memory_config(void);
+
+// Node for the index-th emulator thread, -1 when no nodes are configured
+int numa_node_for(uint32_t index);
+// Runs the calling thread on the node's CPUs; guest RAM it maps afterwards is allocated there too
+bool bind_thread_to_node(int node);
+
+// Anonymous zero-filled mapping; mapped gets the length to unmap and huge_pages what was actually used
+uint8_t *map_guest_memory(uint64_t size, HugePages huge_pages, size_t *mapped, HugePages *used);
+void unmap_guest_memory(uint8_t *memory, size_t mapped);
+
+#endif // MEMORY_H
@@ -0,0 +1,290 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "reverse.h"
+
+typedef struct {
+    PcSet breakpoints;
+    size_t num_watchpoints;
+} DebugHooks;
+
+// Re-executing history must not stop on the user's breakpoints
+static DebugHooks suspend_hooks(Emulator *emu) {
+    DebugHooks hooks = { emu->breakpoints, emu->num_watchpoints };
+    memset(&emu->breakpoints, 0, sizeof(emu->breakpoints));
+    emu->num_watchpoints = 0;
+    return hooks;
+}
+
+static void resume_hooks(Emulator *emu, DebugHooks hooks) {
+    emu->breakpoints = hooks.breakpoints;
+    emu->num_watchpoints = hooks.num_watchpoints;
+}
+
+static void take_snapshot(TimeTravel *tt, Emulator *emu, bool all_pages) {
+    if (tt->num_snapshots == tt->capacity) {
+        tt->capacity = tt->capacity ? tt->capacity * 2 : 64;
+        tt->snapshots = realloc(tt->snapshots, tt->capacity * sizeof(Snapshot));
+        if (!tt->snapshots) {
+            perror("Failed to grow snapshot list");
+            exit(1);
+        }
+    }
+
+    Snapshot *snap = &tt->snapshots[tt->num_snapshots++];
+    snap->state = emu->state;
+    snap->reservation = emu->reservation;
+    snap->event_pos = event_position(&emu->devices);
+    snap->num_pages = 0;
+    for (size_t page = 0; page < emu->num_pages; page++) {
+        if (all_pages || (emu->dirty_pages[page] & DIRTY_REVERSE)) {
+            snap->num_pages++;
+        }
+    }
+    snap->pages = malloc(snap->num_pages * sizeof(uint32_t));
+    snap->data = malloc(snap->num_pages * PAGE_SIZE);
+    if ((!snap->pages || !snap->data) && snap->num_pages) {
+        perror("Failed to allocate snapshot");
+        exit(1);
+    }
+
+    size_t n = 0;
+    for (size_t page = 0; page < emu->num_pages; page++) {
+        if (all_pages || (emu->dirty_pages[page] & DIRTY_REVERSE)) {
+            snap->pages[n] = page;
+            memcpy(snap->data + n * PAGE_SIZE, emu->memory + (page << PAGE_SHIFT), PAGE_SIZE);
+            n++;
+        }
+        emu->dirty_pages[page] &= ~DIRTY_REVERSE;
+    }
+}
+
+static void free_snapshot(Snapshot *snap) {
+    free(snap->pages);
+    free(snap->data);
+}
+
+static const uint8_t *snapshot_page(const Snapshot *snap, uint32_t page) {
+    size_t lo = 0, hi = snap->num_pages;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (snap->pages[mid] == page) {
+            return snap->data + mid * PAGE_SIZE;
+        }
+        if (snap->pages[mid] < page) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+// Index of the last snapshot at or before instret
+static size_t find_snapshot(const TimeTravel *tt, uint64_t instret) {
+    size_t lo = 0, hi = tt->num_snapshots;
+    while (hi - lo > 1) {
+        size_t mid = (lo + hi) / 2;
+        if (tt->snapshots[mid].state.instret <= instret) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void restore_snapshot(TimeTravel *tt, Emulator *emu, size_t index) {
+    // Only pages written since the snapshot can differ from it
+    uint8_t *stale = malloc(emu->num_pages);
+    if (!stale) {
+        perror("Failed to allocate page list");
+        exit(1);
+    }
+    for (size_t page = 0; page < emu->num_pages; page++) {
+        stale[page] = emu->dirty_pages[page] & DIRTY_REVERSE;
+    }
+    for (size_t i = index + 1; i < tt->num_snapshots; i++) {
+        for (size_t n = 0; n < tt->snapshots[i].num_pages; n++) {
+            stale[tt->snapshots[i].pages[n]] = 1;
+        }
+    }
+
+    for (size_t page = 0; page < emu->num_pages; page++) {
+        if (!stale[page]) {
+            continue;
+        }
+        for (size_t i = index + 1; i-- > 0;) {
+            const uint8_t *data = snapshot_page(&tt->snapshots[i], page);
+            if (data) {
+                memcpy(emu->memory + (page << PAGE_SHIFT), data, PAGE_SIZE);
+                break;
+            }
+        }
+        // Other consumers see the rewrite as an ordinary store
+        emu->dirty_pages[page] = DIRTY_ALL & ~DIRTY_REVERSE;
+    }
+    free(stale);
+
+    const Snapshot *snap = &tt->snapshots[index];
+    emu->state = snap->state;
+    emu->reservation = snap->reservation;
+    emu->block_start = emu->block_end = 0;
+    flush_block_cache(emu);
+    rewind_devices(&emu->devices, snap->event_pos, tt->frontier);
+}
+
+void init_time_travel(TimeTravel *tt, Emulator *emu, uint64_t interval) {
+    memset(tt, 0, sizeof(TimeTravel));
+    tt->interval = interval ? interval : REVERSE_INTERVAL;
+    tt->frontier = emu->state.instret;
+    emu->devices.keep_history = true;
+    if (emu->devices.mode == REPLAY_OFF) {
+        start_recording(&emu->devices, NULL);
+    }
+    take_snapshot(tt, emu, true);
+}
+
+void free_time_travel(TimeTravel *tt) {
+    for (size_t i = 0; i < tt->num_snapshots; i++) {
+        free_snapshot(&tt->snapshots[i]);
+    }
+    free(tt->snapshots);
+    tt->snapshots = NULL;
+    tt->num_snapshots = 0;
+}
+
+bool tt_run_until(TimeTravel *tt, Emulator *emu, uint64_t instret) {
+    bool running = true;
+    while (running && emu->state.instret < instret) {
+        uint64_t next = tt->snapshots[tt->num_snapshots - 1].state.instret + tt->interval;
+        running = run_until(emu, instret < next ? instret : next);
+        if (emu->state.instret > tt->frontier) {
+            tt->frontier = emu->state.instret;
+        }
+        if (emu->state.instret == next) {
+            take_snapshot(tt, emu, false);
+        }
+    }
+    return running;
+}
+
+bool tt_goto(TimeTravel *tt, Emulator *emu, uint64_t instret) {
+    if (instret < emu->state.instret) {
+        restore_snapshot(tt, emu, find_snapshot(tt, instret));
+    }
+    DebugHooks hooks = suspend_hooks(emu);
+    tt_run_until(tt, emu, instret);
+    resume_hooks(emu, hooks);
+    return emu->state.instret == instret;
+}
+
+bool tt_reverse_continue(TimeTravel *tt, Emulator *emu) {
+    uint64_t now = emu->state.instret;
+    size_t index = find_snapshot(tt, now ? now - 1 : 0);
+
+    for (;;) {
+        // Replay one interval with the hooks armed and keep the last hit before now
+        restore_snapshot(tt, emu, index);
+        uint64_t hit = NO_INSTRET;
+        StopReason reason = STOP_NONE;
+        uint64_t stop_addr = 0;
+        uint32_t stop_kind = 0;
+        emu->skip_breakpoint = false;
+        while (!tt_run_until(tt, emu, now) && emu->state.instret < now &&
+               (emu->stop_reason == STOP_BREAKPOINT || emu->stop_reason == STOP_WATCHPOINT)) {
+            hit = emu->state.instret;
+            reason = emu->stop_reason;
+            stop_addr = emu->stop_addr;
+            stop_kind = emu->stop_kind;
+            emu->skip_breakpoint = true;
+        }
+
+        if (hit != NO_INSTRET) {
+            tt_goto(tt, emu, hit);
+            emu->stop_reason = reason;
+            emu->stop_addr = stop_addr;
+            emu->stop_kind = stop_kind;
+            return true;
+        }
+        now = tt->snapshots[index].state.instret;
+        if (index == 0) {
+            tt_goto(tt, emu, now);
+            emu->stop_reason = STOP_NONE;
+            return false;
+        }
+        index--;
+    }
+}
+
+static bool writes_reg(const Emulator *emu, Instruction instr, uint64_t reg) {
+    if (emu->user && instr.op == OP_ECALL) {
+        return reg == USER_RESULT_REG;
+    }
+    return writes_rd(instr) && instr.rd == reg;
+}
+
+static bool writes_byte(const Emulator *emu, Instruction instr, uint64_t addr) {
+    if (!(isa_info[instr.op].flags & ISA_STORE)) {
+        return false;
+    }
+    uint64_t address = RS1 + instr.imm_s;
+    return addr >= address && addr < address + (1u << instr.funct3);
+}
+
+// Single-steps back through the intervals until one contains a matching instruction.
+// With probe set (address + 1), an instruction whose syscall or device access made
+// mark_dirty cover that byte counts as a match too.
+static bool last_write(TimeTravel *tt, Emulator *emu, bool (*matches)(const Emulator *, Instruction, uint64_t),
+                       uint64_t arg, uint64_t probe, WriteSite *site) {
+    uint64_t target = emu->state.instret;
+    uint64_t now = target;
+    size_t index = find_snapshot(tt, now ? now - 1 : 0);
+    DebugHooks hooks = suspend_hooks(emu);
+    bool found = false;
+
+    for (;;) {
+        restore_snapshot(tt, emu, index);
+        emu->host_write_probe = probe;
+        while (emu->state.instret < now && PC + 4 <= emu->memory_size) {
+            WriteSite step = { emu->state.instret, PC };
+            bool hit = matches(emu, decode(fetch(emu)), arg);
+            emu->host_write_seen = false;
+            bool running = tt_run_until(tt, emu, emu->state.instret + 1);
+            if (hit || emu->host_write_seen) {
+                *site = step;
+                found = true;
+            }
+            if (!running) {
+                break;
+            }
+        }
+        emu->host_write_probe = 0;
+        now = tt->snapshots[index].state.instret;
+        if (found || index == 0) {
+            break;
+        }
+        index--;
+    }
+
+    resume_hooks(emu, hooks);
+    tt_goto(tt, emu, target);
+    return found;
+}
+
+bool tt_last_reg_write(TimeTravel *tt, Emulator *emu, uint32_t reg, WriteSite *site) {
+    return last_write(tt, emu, writes_reg, reg, 0, site);
+}
+
+bool tt_last_mem_write(TimeTravel *tt, Emulator *emu, uint64_t addr, WriteSite *site) {
+    return last_write(tt, emu, writes_byte, addr, addr + 1, site);
+}
+
+void tt_discard_future(TimeTravel *tt, Emulator *emu) {
+    uint64_t now = emu->state.instret;
+    while (tt->num_snapshots > 1 && tt->snapshots[tt->num_snapshots - 1].state.instret > now) {
+        free_snapshot(&tt->snapshots[--tt->num_snapshots]);
+    }
+    truncate_events(&emu->devices, event_position(&emu->devices));
+    tt->frontier = now;
+}
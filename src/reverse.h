@@ -0,0 +1,50 @@
+#ifndef REVERSE_H
+#define REVERSE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "emulator.h"
+
+#define REVERSE_INTERVAL 100000 // Default instructions between snapshots
+#define NO_INSTRET UINT64_MAX
+
+// The state at one instret plus the pages written since the previous snapshot
+typedef struct {
+    State state;
+    uint64_t reservation; // LR reservation, so an SC after a restore pairs as it did
+    size_t event_pos;  // Device events from here on had not happened yet
+    size_t num_pages;
+    uint32_t *pages;   // Ascending page numbers
+    uint8_t *data;     // num_pages * PAGE_SIZE bytes
+} Snapshot;
+
+typedef struct {
+    uint64_t interval;
+    Snapshot *snapshots; // Ordered by instret; the first holds every page
+    size_t num_snapshots;
+    size_t capacity;
+    uint64_t frontier;   // Furthest instret executed so far
+} TimeTravel;
+
+typedef struct {
+    uint64_t instret; // Instructions retired before the write
+    uint64_t pc;
+} WriteSite;
+
+// Records device input in memory and takes the first snapshot at the current state
+void init_time_travel(TimeTravel *tt, Emulator *emu, uint64_t interval);
+void free_time_travel(TimeTravel *tt);
+// run_until that also snapshots every interval instructions past the last snapshot
+bool tt_run_until(TimeTravel *tt, Emulator *emu, uint64_t instret);
+// Moves to any instret up to the frontier by restoring a snapshot and re-executing
+bool tt_goto(TimeTravel *tt, Emulator *emu, uint64_t instret);
+// Goes back to the last breakpoint or watchpoint hit; false when it reached the first snapshot instead
+bool tt_reverse_continue(TimeTravel *tt, Emulator *emu);
+// Finds the last write to x<reg> (or to the byte at addr) before the current instret,
+// counting syscall results and host or DMA writes as made by the instruction that caused them
+bool tt_last_reg_write(TimeTravel *tt, Emulator *emu, uint32_t reg, WriteSite *site);
+bool tt_last_mem_write(TimeTravel *tt, Emulator *emu, uint64_t addr, WriteSite *site);
+// Drops the history after the current instret, e.g. when a debugger edits state in the past
+void tt_discard_future(TimeTravel *tt, Emulator *emu);
+
+#endif // REVERSE_H
@@ -0,0 +1,418 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <float.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "simpoint.h"
+#include "checkpoint.h"
+
+typedef struct {
+    double v[SIMPOINT_DIMS];
+} Bbv;
+
+typedef struct {
+    const SimPointConfig *config;
+    const TimingConfig *timing_config;
+    SimPoint *points;
+    size_t num_points;
+    uint64_t max_instrs;
+    atomic_size_t next;
+    atomic_uint num_workers; // Numbers the threads for NUMA placement
+} SimJob;
+
+void default_simpoint_config(SimPointConfig *config) {
+    config->interval = 0;
+    config->max_clusters = 10;
+    config->warmup = SIMPOINT_WARMUP;
+    config->checkpoint_dir = SIMPOINT_DIR;
+    config->num_threads = 0;
+}
+
+static uint64_t splitmix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+// Adds count executions of the block at pc to the projected vector
+static void project_block(Bbv *bbv, uint64_t pc, uint64_t count) {
+    for (int d = 0; d < SIMPOINT_DIMS; d++) {
+        uint64_t h = splitmix64(pc * SIMPOINT_DIMS + d);
+        double r = (double)(h >> 11) / (double)(1ull << 53) * 2.0 - 1.0;
+        bbv->v[d] += r * count;
+    }
+}
+
+static double distance(const Bbv *a, const Bbv *b) {
+    double sum = 0.0;
+    for (int d = 0; d < SIMPOINT_DIMS; d++) {
+        double diff = a->v[d] - b->v[d];
+        sum += diff * diff;
+    }
+    return sum;
+}
+
+static Bbv *profile_intervals(Emulator *emu, uint64_t interval, size_t *num_intervals) {
+    size_t capacity = 64;
+    size_t count = 0;
+    Bbv *bbvs = malloc(capacity * sizeof(Bbv));
+    if (!bbvs) {
+        perror("Failed to allocate basic-block vectors");
+        exit(1);
+    }
+
+    uint64_t start = emu->state.instret;
+    bool running = true;
+    while (running) {
+        Bbv bbv = { { 0 } };
+        uint64_t interval_start = emu->state.instret;
+        emu->stop_at = interval_start + interval;
+        while (running && emu->state.instret < emu->stop_at) {
+            uint64_t pc = PC;
+            uint64_t before = emu->state.instret;
+            running = fetch_and_execute(emu);
+            project_block(&bbv, pc, emu->state.instret - before);
+        }
+
+        // A trailing partial interval is only kept if it covers at least half an interval
+        uint64_t executed = emu->state.instret - interval_start;
+        if (executed == 0 || (executed < interval / 2 && count > 0)) {
+            break;
+        }
+        for (int d = 0; d < SIMPOINT_DIMS; d++) {
+            bbv.v[d] /= executed;
+        }
+        if (count == capacity) {
+            capacity *= 2;
+            bbvs = realloc(bbvs, capacity * sizeof(Bbv));
+            if (!bbvs) {
+                perror("Failed to allocate basic-block vectors");
+                exit(1);
+            }
+        }
+        bbvs[count++] = bbv;
+    }
+    emu->stop_at = UINT64_MAX;
+
+    fprintf(stderr, "Profiled %zu intervals (%lu instructions)\n", count, emu->state.instret - start);
+    *num_intervals = count;
+    return bbvs;
+}
+
+// k-means with k-means++ seeding; returns the cluster of every interval
+static uint32_t *cluster_intervals(const Bbv *bbvs, size_t n, uint32_t k, Bbv *centroids) {
+    uint32_t *assignment = calloc(n, sizeof(uint32_t));
+    double *nearest = malloc(n * sizeof(double));
+    if (!assignment || !nearest) {
+        perror("Failed to allocate cluster state");
+        exit(1);
+    }
+
+    uint64_t seed = 1;
+    centroids[0] = bbvs[0];
+    for (uint32_t c = 1; c < k; c++) {
+        double total = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            nearest[i] = DBL_MAX;
+            for (uint32_t j = 0; j < c; j++) {
+                double dist = distance(&bbvs[i], &centroids[j]);
+                if (dist < nearest[i]) {
+                    nearest[i] = dist;
+                }
+            }
+            total += nearest[i];
+        }
+        seed = splitmix64(seed);
+        double target = (double)(seed >> 11) / (double)(1ull << 53) * total;
+        size_t pick = n - 1;
+        for (size_t i = 0; i < n; i++) {
+            target -= nearest[i];
+            if (target <= 0.0) {
+                pick = i;
+                break;
+            }
+        }
+        centroids[c] = bbvs[pick];
+    }
+
+    for (int iteration = 0; iteration < SIMPOINT_MAX_ITERATIONS; iteration++) {
+        bool changed = iteration == 0;
+        for (size_t i = 0; i < n; i++) {
+            uint32_t best = 0;
+            double best_dist = DBL_MAX;
+            for (uint32_t c = 0; c < k; c++) {
+                double dist = distance(&bbvs[i], &centroids[c]);
+                if (dist < best_dist) {
+                    best_dist = dist;
+                    best = c;
+                }
+            }
+            if (assignment[i] != best) {
+                assignment[i] = best;
+                changed = true;
+            }
+        }
+        if (!changed) {
+            break;
+        }
+
+        for (uint32_t c = 0; c < k; c++) {
+            Bbv sum = { { 0 } };
+            size_t members = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (assignment[i] == c) {
+                    for (int d = 0; d < SIMPOINT_DIMS; d++) {
+                        sum.v[d] += bbvs[i].v[d];
+                    }
+                    members++;
+                }
+            }
+            if (members > 0) {
+                for (int d = 0; d < SIMPOINT_DIMS; d++) {
+                    centroids[c].v[d] = sum.v[d] / members;
+                }
+            }
+        }
+    }
+
+    free(nearest);
+    return assignment;
+}
+
+static void checkpoint_path(char *path, size_t size, const char *dir, uint64_t interval_index) {
+    snprintf(path, size, "%s/simpoint-%06lu.ckpt", dir, interval_index);
+}
+
+static void *simulate_points(void *arg) {
+    SimJob *job = arg;
+    // Each worker maps its own guest RAM, so binding the thread first keeps that RAM node-local
+    int node = numa_node_for(atomic_fetch_add(&job->num_workers, 1));
+    if (node >= 0 && !bind_thread_to_node(node)) {
+        exit(1);
+    }
+    Emulator *emu = malloc(sizeof(Emulator));
+    if (!emu) {
+        perror("Failed to allocate emulator");
+        exit(1);
+    }
+
+    size_t index;
+    while ((index = atomic_fetch_add(&job->next, 1)) < job->num_points) {
+        SimPoint *point = &job->points[index];
+        char path[4096];
+        checkpoint_path(path, sizeof(path), job->config->checkpoint_dir, point->interval_index);
+
+        init_bare_emulator(emu);
+        emu->max_instrs = job->max_instrs;
+        if (!load_checkpoint(emu, path)) {
+            fprintf(stderr, "SimPoint interval %lu: failed to load %s\n", point->interval_index, path);
+            free_emulator(emu);
+            continue;
+        }
+        // The warmup fills the caches and predictor; only the interval itself is measured
+        emu->timing = create_timing_model(job->timing_config);
+        run_until(emu, point->start_instret);
+        timing_consume(emu->timing);
+        uint64_t warm_instrs = emu->timing->instrs;
+        uint64_t warm_stalls = emu->timing->stall_cycles;
+        uint64_t end = point->start_instret + job->config->interval;
+        run_until(emu, end);
+        timing_consume(emu->timing);
+        uint64_t instrs = emu->timing->instrs - warm_instrs;
+        // A guest that stops inside the interval would report the CPI of a fraction of it
+        if (emu->state.instret != end || instrs == 0) {
+            fprintf(stderr, "SimPoint interval %lu: guest stopped at instruction %lu of %lu..%lu\n",
+                    point->interval_index, emu->state.instret, point->start_instret, end);
+        } else {
+            point->cpi = (double)(instrs + emu->timing->stall_cycles - warm_stalls) / instrs;
+            point->measured = true;
+        }
+        free_timing_model(emu->timing);
+        free_emulator(emu);
+    }
+
+    free(emu);
+    return NULL;
+}
+
+// The representative of a cluster is its interval closest to the centroid; returns them in program order
+static size_t pick_representatives(const Bbv *bbvs, size_t num_intervals, uint32_t k, const Bbv *centroids,
+                                   const uint32_t *assignment, SimPoint *points, uint64_t first_instret,
+                                   uint64_t interval) {
+    size_t num_points = 0;
+    for (uint32_t c = 0; c < k; c++) {
+        size_t members = 0;
+        size_t best = 0;
+        double best_dist = DBL_MAX;
+        for (size_t i = 0; i < num_intervals; i++) {
+            if (assignment[i] != c) {
+                continue;
+            }
+            members++;
+            double dist = distance(&bbvs[i], &centroids[c]);
+            if (dist < best_dist) {
+                best_dist = dist;
+                best = i;
+            }
+        }
+        if (members > 0) {
+            points[num_points++] = (SimPoint) {
+                .interval_index = best,
+                .start_instret = first_instret + best * interval,
+                .weight = (double)members / num_intervals,
+            };
+        }
+    }
+
+    // Program order lets a single fast-forward pass checkpoint them all
+    for (size_t i = 1; i < num_points; i++) {
+        SimPoint point = points[i];
+        size_t j = i;
+        while (j > 0 && points[j - 1].interval_index > point.interval_index) {
+            points[j] = points[j - 1];
+            j--;
+        }
+        points[j] = point;
+    }
+    return num_points;
+}
+
+// Checkpoints the representatives on a second pass from the initial image and simulates them
+static int simulate_intervals(Emulator *emu, const SimPointConfig *config, const TimingConfig *timing_config,
+                              const State *initial_state, const uint8_t *initial_memory,
+                              SimPoint *points, size_t num_points, size_t num_intervals) {
+    emu->state = *initial_state;
+    memcpy(emu->memory, initial_memory, emu->memory_size);
+    flush_block_cache(emu);
+    for (size_t i = 0; i < num_points; i++) {
+        uint64_t start = points[i].start_instret;
+        uint64_t warmup = start - initial_state->instret < config->warmup ? start - initial_state->instret : config->warmup;
+        points[i].checkpoint_instret = start - warmup;
+        // Timer interrupts come from the host clock, so this pass can stop short of where profiling went
+        if (!run_until(emu, points[i].checkpoint_instret)) {
+            fprintf(stderr, "Guest stopped at instruction %lu, before interval %lu\n",
+                    emu->state.instret, points[i].interval_index);
+            return 1;
+        }
+        char path[4096];
+        checkpoint_path(path, sizeof(path), config->checkpoint_dir, points[i].interval_index);
+        if (!save_checkpoint(emu, path)) {
+            return 1;
+        }
+    }
+
+    uint32_t num_threads = config->num_threads;
+    if (num_threads == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+        num_threads = online > 0 ? online : 1;
+    }
+    if (num_threads > num_points) {
+        num_threads = num_points;
+    }
+
+    SimJob job = {
+        .config = config,
+        .timing_config = timing_config,
+        .points = points,
+        .num_points = num_points,
+        .max_instrs = emu->max_instrs,
+    };
+    atomic_init(&job.next, 0);
+    atomic_init(&job.num_workers, 0);
+    pthread_t *threads = malloc(num_threads * sizeof(pthread_t));
+    if (!threads) {
+        perror("Failed to allocate threads");
+        return 1;
+    }
+    for (uint32_t i = 0; i < num_threads; i++) {
+        if (pthread_create(&threads[i], NULL, simulate_points, &job) != 0) {
+            fprintf(stderr, "Failed to start simulation thread\n");
+            exit(1);
+        }
+    }
+    for (uint32_t i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+
+    // Points that could not be measured drop out and the others' weights are renormalised
+    double cpi = 0.0, weight = 0.0;
+    size_t failed = 0;
+    printf("SimPoints: %zu of %zu intervals (%lu instructions each, %lu warmup, %u threads)\n",
+           num_points, num_intervals, config->interval, config->warmup, num_threads);
+    printf("%10s %10s %8s\n", "interval", "weight", "CPI");
+    for (size_t i = 0; i < num_points; i++) {
+        if (!points[i].measured) {
+            printf("%10lu %10.4f %8s\n", points[i].interval_index, points[i].weight, "failed");
+            failed++;
+            continue;
+        }
+        printf("%10lu %10.4f %8.3f\n", points[i].interval_index, points[i].weight, points[i].cpi);
+        cpi += points[i].weight * points[i].cpi;
+        weight += points[i].weight;
+    }
+    if (weight == 0.0) {
+        fprintf(stderr, "No SimPoint interval could be measured\n");
+        return 1;
+    }
+    printf("Weighted CPI: %.3f\n", cpi / weight);
+    if (failed) {
+        fprintf(stderr, "%zu of %zu SimPoint intervals failed; the CPI covers %.1f%% of the weight\n",
+                failed, num_points, weight * 100.0);
+        return 1;
+    }
+    return 0;
+}
+
+int run_simpoint(Emulator *emu, const SimPointConfig *config, const TimingConfig *timing_config) {
+    if (mkdir(config->checkpoint_dir, 0755) != 0 && errno != EEXIST) {
+        perror("Failed to create checkpoint directory");
+        return 1;
+    }
+
+    // Keep the starting image so the representative intervals can be checkpointed on a second pass
+    State *initial_state = malloc(sizeof(State));
+    uint8_t *initial_memory = malloc(emu->memory_size);
+    if (!initial_state || !initial_memory) {
+        perror("Failed to allocate initial image");
+        free(initial_state);
+        free(initial_memory);
+        return 1;
+    }
+    *initial_state = emu->state;
+    memcpy(initial_memory, emu->memory, emu->memory_size);
+
+    size_t num_intervals;
+    Bbv *bbvs = profile_intervals(emu, config->interval, &num_intervals);
+    uint32_t k = config->max_clusters < num_intervals ? config->max_clusters : num_intervals;
+    Bbv *centroids = malloc((k ? k : 1) * sizeof(Bbv));
+    SimPoint *points = calloc(k ? k : 1, sizeof(SimPoint));
+    uint32_t *assignment = NULL;
+    int status = 1;
+    if (num_intervals == 0) {
+        fprintf(stderr, "Nothing to sample.\n");
+    } else if (!centroids || !points) {
+        perror("Failed to allocate clusters");
+    } else {
+        assignment = cluster_intervals(bbvs, num_intervals, k, centroids);
+        size_t num_points = pick_representatives(bbvs, num_intervals, k, centroids, assignment, points,
+                                                 initial_state->instret, config->interval);
+        status = simulate_intervals(emu, config, timing_config, initial_state, initial_memory,
+                                    points, num_points, num_intervals);
+    }
+
+    free(assignment);
+    free(points);
+    free(centroids);
+    free(bbvs);
+    free(initial_state);
+    free(initial_memory);
+    return status;
+}
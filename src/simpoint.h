@@ -0,0 +1,34 @@
+#ifndef SIMPOINT_H
+#define SIMPOINT_H
+
+#include <stdint.h>
+#include "emulator.h"
+#include "timing.h"
+
+#define SIMPOINT_DIMS 15 // Basic-block vectors are randomly projected down to this many dimensions
+#define SIMPOINT_MAX_ITERATIONS 100
+#define SIMPOINT_DIR "build/simpoints"
+#define SIMPOINT_WARMUP 1000000 // Instructions simulated in detail before each interval but not measured
+
+typedef struct {
+    uint64_t interval;      // Instructions per interval
+    uint32_t max_clusters;
+    uint64_t warmup;        // Detailed instructions run ahead of each interval to warm caches and predictors
+    const char *checkpoint_dir;
+    uint32_t num_threads;   // 0 uses every online host core
+} SimPointConfig;
+
+typedef struct {
+    uint64_t interval_index;
+    uint64_t start_instret;
+    uint64_t checkpoint_instret; // Where the warmup starts, at most warmup instructions earlier
+    double weight;          // Fraction of all intervals in this cluster
+    double cpi;
+    bool measured;          // The checkpoint loaded and the guest ran the whole interval
+} SimPoint;
+
+void default_simpoint_config(SimPointConfig *config);
+// Profiles emu from its current state, checkpoints the representative intervals and simulates them in parallel
+int run_simpoint(Emulator *emu, const SimPointConfig *config, const TimingConfig *timing_config);
+
+#endif // SIMPOINT_H
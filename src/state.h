@@ -15,11 +15,45 @@
 #define CSR_MTVAL 0x343
 #define CSR_MIP 0x344
 
+#define MSTATUS_MIE 0x8
+#define MSTATUS_MPIE 0x80
+#define MSTATUS_MPP 0x1800
+#define MIE_MTIE 0x80
+#define MIP_MTIP 0x80
+#define MCAUSE_INTERRUPT (1ull << 63)
+#define IRQ_M_TIMER 7
+
+// Counters and hardware performance monitors (Zicntr / Zihpm)
+#define CSR_MHPMEVENT3 0x323
+#define CSR_MHPMEVENT31 0x33F
+#define CSR_MCYCLE 0xB00
+#define CSR_MINSTRET 0xB02
+#define CSR_MHPMCOUNTER3 0xB03
+#define CSR_MHPMCOUNTER31 0xB1F
+#define CSR_CYCLE 0xC00
+#define CSR_TIME 0xC01
+#define CSR_INSTRET 0xC02
+#define CSR_HPMCOUNTER3 0xC03
+#define CSR_HPMCOUNTER31 0xC1F
+
+#define NUM_COUNTERS 32
+
+// Events selectable through mhpmevent3..31
+#define HPM_EVENT_NONE 0
+#define HPM_EVENT_LOADS 1
+#define HPM_EVENT_STORES 2
+#define HPM_EVENT_TAKEN_BRANCHES 3
+#define NUM_HPM_EVENTS 4
+
 typedef struct {
     uint64_t regs[NUM_REGS];
     uint64_t pc;
     uint64_t dnpc; // Next PC
-    uint32_t csrs[4096];
+    uint64_t csrs[4096];
+    uint64_t instret; // Retired instructions, committed a whole block at a time
+    uint64_t hpm_events[NUM_HPM_EVENTS];
+    uint64_t counter_offsets[NUM_COUNTERS]; // Applied on top of the raw counts by CSR writes
+    uint64_t mtimecmp; // CLINT timer compare register
 } State;
 
 #endif // STATE_H
\ No newline at end of file
@@ -0,0 +1,77 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "stats.h"
+#include "emulator.h"
+
+bool open_stats(StatsExport *stats, const char *name) {
+    if (name && *name) {
+        snprintf(stats->name, sizeof(stats->name), "%s%s", name[0] == '/' ? "" : "/", name);
+    } else {
+        snprintf(stats->name, sizeof(stats->name), STATS_PREFIX "%d", (int)getpid());
+    }
+    // Never take over a segment another emulator may still be publishing into
+    int fd = shm_open(stats->name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0 && errno == EEXIST) {
+        fprintf(stderr, "Stats segment %s already exists; another emulator is using it, or remove /dev/shm%s\n",
+                stats->name, stats->name);
+        return false;
+    }
+    if (fd < 0) {
+        perror("Failed to create stats segment");
+        return false;
+    }
+    if (ftruncate(fd, sizeof(StatsSegment)) != 0) {
+        perror("Failed to size stats segment");
+        close(fd);
+        shm_unlink(stats->name);
+        return false;
+    }
+    stats->segment = mmap(NULL, sizeof(StatsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (stats->segment == MAP_FAILED) {
+        perror("Failed to map stats segment");
+        shm_unlink(stats->name);
+        return false;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    StatsSegment *segment = stats->segment;
+    segment->version = STATS_VERSION;
+    segment->pid = getpid();
+    segment->start_ns = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    atomic_store(&segment->running, 1);
+    atomic_store_explicit(&segment->magic, STATS_MAGIC, memory_order_release);
+    return true;
+}
+
+// Called at block boundaries: plain stores of the running totals, no read-modify-write
+void publish_stats(StatsSegment *segment, const Emulator *emu) {
+    atomic_store_explicit(&segment->instret, emu->state.instret, memory_order_relaxed);
+    atomic_store_explicit(&segment->blocks, emu->blocks_run, memory_order_relaxed);
+    atomic_store_explicit(&segment->blocks_decoded, emu->blocks_decoded, memory_order_relaxed);
+    atomic_store_explicit(&segment->traps, emu->traps, memory_order_relaxed);
+    atomic_store_explicit(&segment->returns, emu->returns, memory_order_relaxed);
+    atomic_store_explicit(&segment->return_hits, emu->return_hits, memory_order_relaxed);
+    atomic_store_explicit(&segment->indirect_jumps, emu->indirect_jumps, memory_order_relaxed);
+    atomic_store_explicit(&segment->indirect_hits, emu->indirect_hits, memory_order_relaxed);
+    atomic_store_explicit(&segment->loads, emu->state.hpm_events[HPM_EVENT_LOADS], memory_order_relaxed);
+    atomic_store_explicit(&segment->stores, emu->state.hpm_events[HPM_EVENT_STORES], memory_order_relaxed);
+    atomic_store_explicit(&segment->pc, emu->state.pc, memory_order_relaxed);
+}
+
+// Readers that already mapped the segment keep it after the unlink and see the final totals
+void close_stats(StatsExport *stats, const Emulator *emu) {
+    publish_stats(stats->segment, emu);
+    atomic_store(&stats->segment->running, 0);
+    munmap(stats->segment, sizeof(StatsSegment));
+    shm_unlink(stats->name);
+    stats->segment = NULL;
+}
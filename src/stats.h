@@ -0,0 +1,45 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+
+#define STATS_MAGIC 0x5354415453554d45ull
+#define STATS_VERSION 2
+#define STATS_PUBLISH_INSTRS 4096 // Counters are published at the first block boundary past this many instructions
+#define STATS_PREFIX "/rvemu." // Default segment name is the prefix followed by the PID
+
+struct Emulator;
+
+// Layout of the POSIX shared-memory segment, shared with emustat. The emulator
+// is the only writer and stores whole counter values, so readers never lock
+typedef struct {
+    _Atomic uint64_t magic; // Release-stored last, once the rest is initialised; readers load it with acquire
+    uint32_t version;
+    uint32_t pid;
+    uint64_t start_ns; // CLOCK_MONOTONIC when the segment was created
+    _Atomic uint64_t instret;
+    _Atomic uint64_t blocks;         // Blocks executed
+    _Atomic uint64_t blocks_decoded; // Block cache misses
+    _Atomic uint64_t traps;          // Exceptions and interrupts taken
+    _Atomic uint64_t returns;        // Returns and how many the return-address stack predicted
+    _Atomic uint64_t return_hits;
+    _Atomic uint64_t indirect_jumps; // Other JALRs and how many the target cache predicted
+    _Atomic uint64_t indirect_hits;
+    _Atomic uint64_t loads;
+    _Atomic uint64_t stores;
+    _Atomic uint64_t pc;
+    _Atomic uint32_t running; // Cleared when the emulator stops
+} StatsSegment;
+
+typedef struct {
+    char name[64];
+    StatsSegment *segment;
+} StatsExport;
+
+bool open_stats(StatsExport *stats, const char *name);
+void publish_stats(StatsSegment *segment, const struct Emulator *emu);
+void close_stats(StatsExport *stats, const struct Emulator *emu);
+
+#endif // STATS_H
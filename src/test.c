@@ -1,25 +1,52 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
-#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include "emulator.h"
+#include "checkpoint.h"
+#include "reverse.h"
+#include "codecache.h"
+#include "virtio.h"
 // Remove the conflicting include
 #include "state.h"
 
-Instruction int_to_instruction(uint32_t raw_instr) {
-    return (Instruction) {
-        .opcode = raw_instr & 0x7F,
-        .rd = (raw_instr >> 7) & 0x1F,
-        .funct3 = (raw_instr >> 12) & 0x07,
-        .rs1 = (raw_instr >> 15) & 0x1F,
-        .rs2 = (raw_instr >> 20) & 0x1F,
-        .funct7 = (raw_instr >> 25) & 0x7F,
-        .imm_i = (int32_t)(raw_instr & 0xFFF00000) >> 20,
-        .imm_b = ((raw_instr >> 7) & 0x1E) | ((raw_instr >> 20) & 0x7E0) | ((raw_instr << 4) & 0x800) | ((raw_instr >> 19) & 0x1000),
-        .imm_j = ((raw_instr >> 12) & 0xFF) | ((raw_instr >> 20) & 0x1) << 11 | ((raw_instr >> 21) & 0x3FF) << 1 | ((raw_instr >> 31) & 0x1) << 20,
-        .imm_u = (int32_t)(raw_instr & 0xFFFFF000),
-        .imm_jalr = (int32_t)(raw_instr & 0xFFF00000) >> 20,
-        .imm_s = ((raw_instr >> 7) & 0x1F) | ((raw_instr >> 25) & 0x7F) << 5,
-        .imm_l = (int32_t)(raw_instr & 0xFFF00000) >> 20
-    };
+// Encodings isagen generated from isa.tbl with the op and text each must decode to
+#include "isa_vectors.inc"
+
+// A failed check is reported and counted; the remaining tests still run
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static int failures;
+static int reported_failures;
+
+static void check(bool ok, const char *text, int line) {
+    if (!ok) {
+        failures++;
+        printf("\033[0;31m  line %d: CHECK(%s) failed\033[0m\n", line, text);
+    }
+}
+
+static void report(const char *name) {
+    if (failures == reported_failures) {
+        printf("\033[0;32m%s\t PASSED\n", name);
+    } else {
+        printf("\033[0;31m%s\t FAILED\n", name);
+    }
+    reported_failures = failures;
+}
+
+// Fills in descriptor index of a virtqueue whose table starts at table
+static void put_desc(Emulator *emu, uint64_t table, uint16_t index, uint64_t addr, uint32_t len, uint16_t flags, uint16_t next) {
+    uint8_t *desc = &emu->memory[table + index * 16];
+    memcpy(desc, &addr, 8);
+    memcpy(desc + 8, &len, 4);
+    memcpy(desc + 12, &flags, 2);
+    memcpy(desc + 14, &next, 2);
 }
 
 void run_tests() {
@@ -29,277 +56,277 @@ void run_tests() {
     // Test ADD
     emu.state.regs[1] = 5;
     emu.state.regs[2] = 10;
-    execute_r_type(&emu, int_to_instruction(0x002080b3)); // ADD x1, x1, x2
-    assert(emu.state.regs[1] == 15);
+    execute(&emu, decode(0x002080b3)); // ADD x1, x1, x2
+    CHECK(emu.state.regs[1] == 15);
 
     emu.state.regs[1] = 0xffffffffffffffff;
     emu.state.regs[2] = 1;
-    execute_r_type(&emu, int_to_instruction(0x002080b3)); // ADD x1, x1, x2
-    assert(emu.state.regs[1] == 0);
+    execute(&emu, decode(0x002080b3)); // ADD x1, x1, x2
+    CHECK(emu.state.regs[1] == 0);
 
-    execute_r_type(&emu, int_to_instruction(0x00208033)); // ADD x0, x1, x2
-    assert(emu.state.regs[0] == 0);
+    execute(&emu, decode(0x00208033)); // ADD x0, x1, x2
+    CHECK(emu.state.regs[0] == 0);
 
-    printf("\033[0;32mADD\t PASSED\n");
+    report("ADD");
 
     // Test SUB
     emu.state.regs[1] = 10;
     emu.state.regs[2] = 5;
-    execute_r_type(&emu, int_to_instruction(0x402080b3)); // SUB x1, x1, x2
-    assert(emu.state.regs[1] == 5);
+    execute(&emu, decode(0x402080b3)); // SUB x1, x1, x2
+    CHECK(emu.state.regs[1] == 5);
 
     emu.state.regs[1] = 0;
     emu.state.regs[2] = 1;
-    execute_r_type(&emu, int_to_instruction(0x402080b3)); // SUB x1, x1, x2
-    assert(emu.state.regs[1] == (uint64_t)-1);
+    execute(&emu, decode(0x402080b3)); // SUB x1, x1, x2
+    CHECK(emu.state.regs[1] == (uint64_t)-1);
 
-    printf("\033[0;32mSUB\t PASSED\n");
+    report("SUB");
     // Test SLL
     emu.state.regs[1] = 1;
     emu.state.regs[2] = 3;
-    execute_r_type(&emu, int_to_instruction(0x002090b3)); // SLL x1, x1, x2
-    assert(emu.state.regs[1] == 8);
-    printf("\033[0;32mSLL\t PASSED\n");
+    execute(&emu, decode(0x002090b3)); // SLL x1, x1, x2
+    CHECK(emu.state.regs[1] == 8);
+    report("SLL");
     
     // Test SRL
     emu.state.regs[1] = 16;
     emu.state.regs[2] = 2;
-    execute_r_type(&emu, int_to_instruction(0x0020d0b3)); // SRL x1, x1, x2
-    assert(emu.state.regs[1] == 4);
-    printf("\033[0;32mSRL\t PASSED\n");
+    execute(&emu, decode(0x0020d0b3)); // SRL x1, x1, x2
+    CHECK(emu.state.regs[1] == 4);
+    report("SRL");
 
     // Test SRA
     emu.state.regs[1] = -16;
     emu.state.regs[2] = 2;
-    execute_r_type(&emu, int_to_instruction(0x4020d0b3)); // SRA x1, x1, x2
-    assert(emu.state.regs[1] == (uint64_t)-4);
-    printf("\033[0;32mSRA\t PASSED\n");
+    execute(&emu, decode(0x4020d0b3)); // SRA x1, x1, x2
+    CHECK(emu.state.regs[1] == (uint64_t)-4);
+    report("SRA");
 
     // Test ADDI
     emu.state.regs[1] = 5;
-    execute_i_type(&emu, int_to_instruction(0x00508093)); // ADDI x1, x1, 5
-    assert(emu.state.regs[1] == 10);
-    printf("\033[0;32mADDI\t PASSED\n");
+    execute(&emu, decode(0x00508093)); // ADDI x1, x1, 5
+    CHECK(emu.state.regs[1] == 10);
+    report("ADDI");
 
     // Test SLTI
     emu.state.regs[1] = 5;
-    execute_i_type(&emu, int_to_instruction(0x0060a093)); // SLTI x1, x1, 6
-    assert(emu.state.regs[1] == 1);
+    execute(&emu, decode(0x0060a093)); // SLTI x1, x1, 6
+    CHECK(emu.state.regs[1] == 1);
 
     emu.state.regs[1] = 7;
-    execute_i_type(&emu, int_to_instruction(0x0060a093)); // SLTI x1, x1, 6
-    assert(emu.state.regs[1] == 0);
-    printf("\033[0;32mSLTI\t PASSED\n");
+    execute(&emu, decode(0x0060a093)); // SLTI x1, x1, 6
+    CHECK(emu.state.regs[1] == 0);
+    report("SLTI");
 
     // Test SLTIU
     emu.state.regs[1] = 5;
-    execute_i_type(&emu, int_to_instruction(0x0060a093)); // SLTIU x1, x1, 6
-    assert(emu.state.regs[1] == 1);
+    execute(&emu, decode(0x0060a093)); // SLTIU x1, x1, 6
+    CHECK(emu.state.regs[1] == 1);
 
     emu.state.regs[1] = 7;
-    execute_i_type(&emu, int_to_instruction(0x0060b093)); // SLTIU x1, x1, 6
-    assert(emu.state.regs[1] == 0);
-    printf("\033[0;32mSLTIU\t PASSED\n");
+    execute(&emu, decode(0x0060b093)); // SLTIU x1, x1, 6
+    CHECK(emu.state.regs[1] == 0);
+    report("SLTIU");
 
     // Test XORI
     emu.state.regs[1] = 5;
-    execute_i_type(&emu, int_to_instruction(0x00f0c093)); // XORI x1, x1, 15
-    assert(emu.state.regs[1] == 10);
-    printf("\033[0;32mXORI\t PASSED\n");
+    execute(&emu, decode(0x00f0c093)); // XORI x1, x1, 15
+    CHECK(emu.state.regs[1] == 10);
+    report("XORI");
 
     // Test ORI
     emu.state.regs[1] = 5;
-    execute_i_type(&emu, int_to_instruction(0x00f0e093)); // ORI x1, x1, 15
-    assert(emu.state.regs[1] == 15);
-    printf("\033[0;32mORI\t PASSED\n");
+    execute(&emu, decode(0x00f0e093)); // ORI x1, x1, 15
+    CHECK(emu.state.regs[1] == 15);
+    report("ORI");
 
     // Test ANDI
     emu.state.regs[1] = 5;
-    execute_i_type(&emu, int_to_instruction(0x00f0f093)); // ANDI x1, x1, 15
-    assert(emu.state.regs[1] == 5);
-    printf("\033[0;32mANDI\t PASSED\n");
+    execute(&emu, decode(0x00f0f093)); // ANDI x1, x1, 15
+    CHECK(emu.state.regs[1] == 5);
+    report("ANDI");
 
     // Test SLLI
     emu.state.regs[1] = 1;
-    execute_i_type(&emu, int_to_instruction(0x00309093)); // SLLI x1, x1, 3
-    assert(emu.state.regs[1] == 8);
-    printf("\033[0;32mSLLI\t PASSED\n");
+    execute(&emu, decode(0x00309093)); // SLLI x1, x1, 3
+    CHECK(emu.state.regs[1] == 8);
+    report("SLLI");
 
     // Test SRLI
     emu.state.regs[1] = 16;
-    execute_i_type(&emu, int_to_instruction(0x0020d093)); // SRLI x1, x1, 2
-    assert(emu.state.regs[1] == 4);
-    printf("\033[0;32mSRLI\t PASSED\n");
+    execute(&emu, decode(0x0020d093)); // SRLI x1, x1, 2
+    CHECK(emu.state.regs[1] == 4);
+    report("SRLI");
 
     // Test SRAI
     emu.state.regs[1] = -16;
-    execute_i_type(&emu, int_to_instruction(0x4020d093)); // SRAI x1, x1, 2
-    assert(emu.state.regs[1] == (uint64_t)-4);
-    printf("\033[0;32mSRAI\t PASSED\n");
+    execute(&emu, decode(0x4020d093)); // SRAI x1, x1, 2
+    CHECK(emu.state.regs[1] == (uint64_t)-4);
+    report("SRAI");
 
     emu.state.pc = 0x100; // Set PC to 0x100
     // Test BEQ
     emu.state.regs[1] = 5;
     emu.state.regs[2] = 5;
-    execute_b_type(&emu, int_to_instruction(0x00208063)); // BEQ x1, x2, 0
-    assert(emu.state.dnpc == emu.state.pc);
+    execute(&emu, decode(0x00208063)); // BEQ x1, x2, 0
+    CHECK(emu.state.dnpc == emu.state.pc);
 
     emu.state.dnpc = 0x100 + 4;
     emu.state.regs[1] = 5;
     emu.state.regs[2] = 10;
-    execute_b_type(&emu, int_to_instruction(0x00208063)); // BEQ x1, x2, 0
-    assert(emu.state.dnpc == emu.state.pc + 4);
-    printf("\033[0;32mBEQ\t PASSED\n");
+    execute(&emu, decode(0x00208063)); // BEQ x1, x2, 0
+    CHECK(emu.state.dnpc == emu.state.pc + 4);
+    report("BEQ");
 
     // Test BNE
     emu.state.dnpc = 0x100 + 4;
     emu.state.regs[1] = 5;
     emu.state.regs[2] = 10;
-    execute_b_type(&emu, int_to_instruction(0x00209063)); // BNE x1, x2, 0
-    assert(emu.state.dnpc ==  emu.state.pc);
+    execute(&emu, decode(0x00209063)); // BNE x1, x2, 0
+    CHECK(emu.state.dnpc ==  emu.state.pc);
 
     emu.state.dnpc = 0x100 + 4;
     emu.state.regs[1] = 5;
     emu.state.regs[2] = 5;
-    execute_b_type(&emu, int_to_instruction(0x00209063)); // BNE x1, x2, 0
-    assert(emu.state.dnpc == emu.state.pc + 4);
-    printf("\033[0;32mBNE\t PASSED\n");
+    execute(&emu, decode(0x00209063)); // BNE x1, x2, 0
+    CHECK(emu.state.dnpc == emu.state.pc + 4);
+    report("BNE");
 
     // Test BLT
     emu.state.dnpc = 0x100 + 4;
     emu.state.regs[1] = 5;
     emu.state.regs[2] = 10;
-    execute_b_type(&emu, int_to_instruction(0x0020c063)); // BLT x1, x2, 0
-    assert(emu.state.dnpc == emu.state.pc);
+    execute(&emu, decode(0x0020c063)); // BLT x1, x2, 0
+    CHECK(emu.state.dnpc == emu.state.pc);
 
     emu.state.dnpc = 0x100 + 4;
     emu.state.regs[1] = 10;
     emu.state.regs[2] = 5;
-    execute_b_type(&emu, int_to_instruction(0x0020c063)); // BLT x1, x2, 0
-    assert(emu.state.dnpc == emu.state.pc + 4);
-    printf("\033[0;32mBLT\t PASSED\n");
+    execute(&emu, decode(0x0020c063)); // BLT x1, x2, 0
+    CHECK(emu.state.dnpc == emu.state.pc + 4);
+    report("BLT");
 
     // Test BGE
     emu.state.dnpc = 0x100 + 4;
     emu.state.regs[1] = 10;
     emu.state.regs[2] = 5;
-    execute_b_type(&emu, int_to_instruction(0x0020d063)); // BGE x1, x2, 0
-    assert(emu.state.dnpc == emu.state.pc);
+    execute(&emu, decode(0x0020d063)); // BGE x1, x2, 0
+    CHECK(emu.state.dnpc == emu.state.pc);
 
     emu.state.dnpc = 0x100 + 4;
     emu.state.regs[1] = 5;
     emu.state.regs[2] = 10;
-    execute_b_type(&emu, int_to_instruction(0x0020d063)); // BGE x1, x2, 0
-    assert(emu.state.dnpc == emu.state.pc + 4);
-    printf("\033[0;32mBGE\t PASSED\n");
+    execute(&emu, decode(0x0020d063)); // BGE x1, x2, 0
+    CHECK(emu.state.dnpc == emu.state.pc + 4);
+    report("BGE");
 
     // Test BLTU
     emu.state.dnpc = 0x100 + 4;
     emu.state.regs[1] = 5;
     emu.state.regs[2] = 10;
-    execute_b_type(&emu, int_to_instruction(0x0020e063)); // BLTU x1, x2, 0
-    assert(emu.state.dnpc == emu.state.pc);
+    execute(&emu, decode(0x0020e063)); // BLTU x1, x2, 0
+    CHECK(emu.state.dnpc == emu.state.pc);
 
     emu.state.dnpc = 0x100 + 4;
     emu.state.regs[1] = 10;
     emu.state.regs[2] = 5;
-    execute_b_type(&emu, int_to_instruction(0x0020e063)); // BLTU x1, x2, 0
-    assert(emu.state.dnpc == emu.state.pc + 4);
-    printf("\033[0;32mBLTU\t PASSED\n");
+    execute(&emu, decode(0x0020e063)); // BLTU x1, x2, 0
+    CHECK(emu.state.dnpc == emu.state.pc + 4);
+    report("BLTU");
 
     // Test BGEU
     emu.state.dnpc = 0x100 + 4;
     emu.state.regs[1] = 10;
     emu.state.regs[2] = 5;
-    execute_b_type(&emu, int_to_instruction(0x0020f063)); // BGEU x1, x2, 0
-    assert(emu.state.dnpc == emu.state.pc);
+    execute(&emu, decode(0x0020f063)); // BGEU x1, x2, 0
+    CHECK(emu.state.dnpc == emu.state.pc);
 
     emu.state.dnpc = 0x100 + 4;
     emu.state.regs[1] = 5;
     emu.state.regs[2] = 10;
-    execute_b_type(&emu, int_to_instruction(0x0020f063)); // BGEU x1, x2, 0
-    assert(emu.state.dnpc == emu.state.pc + 4);
-    printf("\033[0;32mBGEU\t PASSED\n");
+    execute(&emu, decode(0x0020f063)); // BGEU x1, x2, 0
+    CHECK(emu.state.dnpc == emu.state.pc + 4);
+    report("BGEU");
 
     emu.state.regs[1] = 0;
     // Test JAL
     emu.state.pc = 0x100;
     emu.state.dnpc = 0x100 + 4;
-    execute_jal(&emu, int_to_instruction(0x0000006F)); // JAL x0, 0
-    assert(emu.state.dnpc == emu.state.pc);
+    execute(&emu, decode(0x0000006F)); // JAL x0, 0
+    CHECK(emu.state.dnpc == emu.state.pc);
 
     emu.state.pc = 0x100;
     emu.state.dnpc = 0x100 + 4;
-    execute_jal(&emu, int_to_instruction(0x0040006F)); // JAL x0, 4
-    assert(emu.state.dnpc == emu.state.pc + 4);
+    execute(&emu, decode(0x0040006F)); // JAL x0, 4
+    CHECK(emu.state.dnpc == emu.state.pc + 4);
 
     emu.state.pc = 0x100;
     emu.state.dnpc = 0x100 + 4;
-    execute_jal(&emu, int_to_instruction(0x004000EF)); // JAL x1, 4
-    assert(emu.state.dnpc == emu.state.pc + 4);
-    assert(emu.state.regs[1] == emu.state.pc + 4);
-    printf("\033[0;32mJAL\t PASSED\n");
+    execute(&emu, decode(0x004000EF)); // JAL x1, 4
+    CHECK(emu.state.dnpc == emu.state.pc + 4);
+    CHECK(emu.state.regs[1] == emu.state.pc + 4);
+    report("JAL");
 
     // Test JALR
     emu.state.pc = 0x100;
     emu.state.regs[1] = 0x200;
-    execute_jalr(&emu, int_to_instruction(0x00008067)); // JALR x0, 0(x1)
-    assert(emu.state.dnpc == ((emu.state.regs[1] + 0) & ~1));
+    execute(&emu, decode(0x00008067)); // JALR x0, 0(x1)
+    CHECK(emu.state.dnpc == ((emu.state.regs[1] + 0) & ~1));
 
     emu.state.pc = 0x100;
     emu.state.regs[1] = 0x200;
-    execute_jalr(&emu, int_to_instruction(0x00408067)); // JALR x0, 4(x1)
-    assert(emu.state.dnpc == ((emu.state.regs[1] + 4) & ~1));
+    execute(&emu, decode(0x00408067)); // JALR x0, 4(x1)
+    CHECK(emu.state.dnpc == ((emu.state.regs[1] + 4) & ~1));
 
     emu.state.pc = 0x100;
     emu.state.regs[1] = 0x200;
-    execute_jalr(&emu, int_to_instruction(0x004080E7)); // JALR x1, 4(x1)
-    assert(emu.state.dnpc == ((emu.state.regs[1] + 4) & ~1));
-    assert(emu.state.regs[1] == emu.state.pc + 4);
-    printf("\033[0;32mJALR\t PASSED\n");
+    execute(&emu, decode(0x004080E7)); // JALR x1, 4(x1)
+    CHECK(emu.state.dnpc == 0x204);
+    CHECK(emu.state.regs[1] == emu.state.pc + 4);
+    report("JALR");
 
     // Test AUIPC
     emu.state.pc = 0x100;
-    execute_auipc(&emu, int_to_instruction(0x00000017)); // AUIPC x0, 0
-    assert(emu.state.regs[0] == 0);
+    execute(&emu, decode(0x00000017)); // AUIPC x0, 0
+    CHECK(emu.state.regs[0] == 0);
 
     emu.state.pc = 0x100;
-    execute_auipc(&emu, int_to_instruction(0x00400017)); // AUIPC x0, 4
-    assert(emu.state.regs[0] == 0);
+    execute(&emu, decode(0x00400017)); // AUIPC x0, 4
+    CHECK(emu.state.regs[0] == 0);
 
     emu.state.pc = 0x100;
-    execute_auipc(&emu, int_to_instruction(0x00400097)); // AUIPC x1, 4
-    assert(emu.state.regs[1] == emu.state.pc + (4 << 12));
-    printf("\033[0;32mAUIPC\t PASSED\n");
+    execute(&emu, decode(0x00004097)); // AUIPC x1, 4
+    CHECK(emu.state.regs[1] == emu.state.pc + (4 << 12));
+    report("AUIPC");
 
     // Test LUI
     emu.state.pc = 0x100;
-    execute_lui(&emu, int_to_instruction(0x00000037)); // LUI x0, 0
-    assert(emu.state.regs[0] == 0);
+    execute(&emu, decode(0x00000037)); // LUI x0, 0
+    CHECK(emu.state.regs[0] == 0);
 
     emu.state.pc = 0x100;
-    execute_lui(&emu, int_to_instruction(0x00400037)); // LUI x0, 4
-    assert(emu.state.regs[0] == 0);
+    execute(&emu, decode(0x00400037)); // LUI x0, 4
+    CHECK(emu.state.regs[0] == 0);
 
     emu.state.pc = 0x100;
-    execute_lui(&emu, int_to_instruction(0x004000B7)); // LUI x1, 4
-    assert(emu.state.regs[1] == (4 << 12));
-    printf("\033[0;32mLUI\t PASSED\n");
+    execute(&emu, decode(0x000040B7)); // LUI x1, 4
+    CHECK(emu.state.regs[1] == (4 << 12));
+    report("LUI");
 
     // Test LB
     emu.state.regs[1] = 0x100;
     emu.memory[0x100] = 0xFF;
-    execute_load(&emu, int_to_instruction(0x00008083)); // LB x1, 0(x1)
-    assert((int8_t)emu.state.regs[1] == -1);
-    printf("\033[0;32mLB\t PASSED\n");
+    execute(&emu, decode(0x00008083)); // LB x1, 0(x1)
+    CHECK((int8_t)emu.state.regs[1] == -1);
+    report("LB");
 
     // Test LH
     emu.state.regs[1] = 0x100;
     emu.memory[0x100] = 0xFF;
     emu.memory[0x101] = 0xFF;
-    execute_load(&emu, int_to_instruction(0x00009083)); // LH x1, 0(x1)
-    assert((int16_t)emu.state.regs[1] == -1);
-    printf("\033[0;32mLH\t PASSED\n");
+    execute(&emu, decode(0x00009083)); // LH x1, 0(x1)
+    CHECK((int16_t)emu.state.regs[1] == -1);
+    report("LH");
 
     // Test LW
     emu.state.regs[1] = 0x100;
@@ -307,9 +334,9 @@ void run_tests() {
     emu.memory[0x101] = 0xFF;
     emu.memory[0x102] = 0xFF;
     emu.memory[0x103] = 0xFF;
-    execute_load(&emu, int_to_instruction(0x0000a083)); // LW x1, 0(x1)
-    assert((int32_t)emu.state.regs[1] == -1);
-    printf("\033[0;32mLW\t PASSED\n");
+    execute(&emu, decode(0x0000a083)); // LW x1, 0(x1)
+    CHECK((int32_t)emu.state.regs[1] == -1);
+    report("LW");
 
     // Test LD
     emu.state.regs[1] = 0x100;
@@ -321,24 +348,24 @@ void run_tests() {
     emu.memory[0x105] = 0xFF;
     emu.memory[0x106] = 0xFF;
     emu.memory[0x107] = 0xFF;
-    execute_load(&emu, int_to_instruction(0x0000b083)); // LD x1, 0(x1)
-    assert((int64_t)emu.state.regs[1] == -1);
-    printf("\033[0;32mLD\t PASSED\n");
+    execute(&emu, decode(0x0000b083)); // LD x1, 0(x1)
+    CHECK((int64_t)emu.state.regs[1] == -1);
+    report("LD");
 
     // Test LBU
     emu.state.regs[1] = 0x100;
     emu.memory[0x100] = 0xFF;
-    execute_load(&emu, int_to_instruction(0x0000c083)); // LBU x1, 0(x1)
-    assert(emu.state.regs[1] == 0xFF);
-    printf("\033[0;32mLBU\t PASSED\n");
+    execute(&emu, decode(0x0000c083)); // LBU x1, 0(x1)
+    CHECK(emu.state.regs[1] == 0xFF);
+    report("LBU");
 
     // Test LHU
     emu.state.regs[1] = 0x100;
     emu.memory[0x100] = 0xFF;
     emu.memory[0x101] = 0xFF;
-    execute_load(&emu, int_to_instruction(0x0000d083)); // LHU x1, 0(x1)
-    assert(emu.state.regs[1] == 0xFFFF);
-    printf("\033[0;32mLHU\t PASSED\n");
+    execute(&emu, decode(0x0000d083)); // LHU x1, 0(x1)
+    CHECK(emu.state.regs[1] == 0xFFFF);
+    report("LHU");
 
     // Test LWU
     emu.state.regs[1] = 0x100;
@@ -346,26 +373,26 @@ void run_tests() {
     emu.memory[0x101] = 0xFF;
     emu.memory[0x102] = 0xFF;
     emu.memory[0x103] = 0xFF;
-    execute_load(&emu, int_to_instruction(0x0000e083)); // LWU x1, 0(x1)
-    assert(emu.state.regs[1] == 0xFFFFFFFF);
-    printf("\033[0;32mLWU\t PASSED\n");
+    execute(&emu, decode(0x0000e083)); // LWU x1, 0(x1)
+    CHECK(emu.state.regs[1] == 0xFFFFFFFF);
+    report("LWU");
 
     // Test SB
     emu.memory[0x100] = 0;
     emu.state.regs[1] = 0x100;
     emu.state.regs[2] = 0xFF;
-    execute_store(&emu, int_to_instruction(0x00208023)); // SB x2, 0(x1)
-    assert(emu.memory[0x100] == 0xFF);
-    printf("\033[0;32mSB\t PASSED\n");
+    execute(&emu, decode(0x00208023)); // SB x2, 0(x1)
+    CHECK(emu.memory[0x100] == 0xFF);
+    report("SB");
 
     // Test SH
     emu.memory[0x100] = 0;
     emu.memory[0x101] = 0;
     emu.state.regs[1] = 0x100;
     emu.state.regs[2] = 0xFFFF;
-    execute_store(&emu, int_to_instruction(0x00209023)); // SH x2, 0(x1)
-    assert(emu.memory[0x100] == 0xFF && emu.memory[0x101] == 0xFF);
-    printf("\033[0;32mSH\t PASSED\n");
+    execute(&emu, decode(0x00209023)); // SH x2, 0(x1)
+    CHECK(emu.memory[0x100] == 0xFF && emu.memory[0x101] == 0xFF);
+    report("SH");
 
     // Test SW
     emu.memory[0x100] = 0;
@@ -374,9 +401,9 @@ void run_tests() {
     emu.memory[0x103] = 0;
     emu.state.regs[1] = 0x100;
     emu.state.regs[2] = 0xFFFFFFFF;
-    execute_store(&emu, int_to_instruction(0x0020A023)); // SW x2, 0(x1)
-    assert(emu.memory[0x100] == 0xFF && emu.memory[0x101] == 0xFF && emu.memory[0x102] == 0xFF && emu.memory[0x103] == 0xFF);
-    printf("\033[0;32mSW\t PASSED\n");
+    execute(&emu, decode(0x0020A023)); // SW x2, 0(x1)
+    CHECK(emu.memory[0x100] == 0xFF && emu.memory[0x101] == 0xFF && emu.memory[0x102] == 0xFF && emu.memory[0x103] == 0xFF);
+    report("SW");
 
     // Test SD
     emu.memory[0x100] = 0;
@@ -389,90 +416,806 @@ void run_tests() {
     emu.memory[0x107] = 0;
     emu.state.regs[1] = 0x100;
     emu.state.regs[2] = 0xFFFFFFFFFFFFFFFF;
-    execute_store(&emu, int_to_instruction(0x0020B023)); // SD x2, 0(x1)
-    assert(emu.memory[0x100] == 0xFF && emu.memory[0x101] == 0xFF && emu.memory[0x102] == 0xFF && emu.memory[0x103] == 0xFF &&
+    execute(&emu, decode(0x0020B023)); // SD x2, 0(x1)
+    CHECK(emu.memory[0x100] == 0xFF && emu.memory[0x101] == 0xFF && emu.memory[0x102] == 0xFF && emu.memory[0x103] == 0xFF &&
            emu.memory[0x104] == 0xFF && emu.memory[0x105] == 0xFF && emu.memory[0x106] == 0xFF && emu.memory[0x107] == 0xFF);
-    printf("\033[0;32mSD\t PASSED\n");
+    report("SD");
 
     // Test ADDW
     emu.state.regs[1] = 0xFFFFFFFF;
     emu.state.regs[2] = 1;
-    execute_addw(&emu, int_to_instruction(0x002080BB)); // ADDW x1, x1, x2
-    assert((int32_t)emu.state.regs[1] == 0);
-    printf("\033[0;32mADDW\t PASSED\n");
+    execute(&emu, decode(0x002080BB)); // ADDW x1, x1, x2
+    CHECK((int32_t)emu.state.regs[1] == 0);
+    report("ADDW");
 
     // Test SUBW
     emu.state.regs[1] = 0;
     emu.state.regs[2] = 1;
-    execute_addw(&emu, int_to_instruction(0x402080BB)); // SUBW x1, x1, x2
-    assert((int32_t)emu.state.regs[1] == -1);
-    printf("\033[0;32mSUBW\t PASSED\n");
+    execute(&emu, decode(0x402080BB)); // SUBW x1, x1, x2
+    CHECK((int32_t)emu.state.regs[1] == -1);
+    report("SUBW");
+
+    // Test the other 32-bit operations: results are sign-extended from bit 31
+    emu.state.regs[1] = 0x80000000;
+    emu.state.regs[2] = 0x21; // Only the low five bits count
+    execute(&emu, decode(0xfff0819b)); // ADDIW x3, x1, -1
+    CHECK(emu.state.regs[3] == 0x7FFFFFFF);
+    execute(&emu, decode(0x0040d19b)); // SRLIW x3, x1, 4
+    CHECK(emu.state.regs[3] == 0x08000000);
+    execute(&emu, decode(0x4040d19b)); // SRAIW x3, x1, 4
+    CHECK(emu.state.regs[3] == 0xFFFFFFFFF8000000);
+    execute(&emu, decode(0x0020d1bb)); // SRLW x3, x1, x2
+    CHECK(emu.state.regs[3] == 0x40000000);
+    execute(&emu, decode(0x4020d1bb)); // SRAW x3, x1, x2
+    CHECK(emu.state.regs[3] == 0xFFFFFFFFC0000000);
+    emu.state.regs[1] = 0x18000000;
+    execute(&emu, decode(0x0040919b)); // SLLIW x3, x1, 4
+    CHECK(emu.state.regs[3] == 0xFFFFFFFF80000000);
+    execute(&emu, decode(0x002091bb)); // SLLW x3, x1, x2
+    CHECK(emu.state.regs[3] == 0x30000000);
+    report("SHIFTW");
+
+    emu.state.regs[1] = 0x80000000; // INT32_MIN in the low word
+    emu.state.regs[2] = 0xFFFFFFFF; // -1
+    execute(&emu, decode(0x022081bb)); // MULW x3, x1, x2
+    CHECK(emu.state.regs[3] == 0xFFFFFFFF80000000);
+    execute(&emu, decode(0x0220c1bb)); // DIVW x3, x1, x2 overflows
+    CHECK(emu.state.regs[3] == 0xFFFFFFFF80000000);
+    execute(&emu, decode(0x0220e1bb)); // REMW x3, x1, x2
+    CHECK(emu.state.regs[3] == 0);
+    execute(&emu, decode(0x0220d1bb)); // DIVUW x3, x1, x2
+    CHECK(emu.state.regs[3] == 0);
+    execute(&emu, decode(0x0220f1bb)); // REMUW x3, x1, x2
+    CHECK(emu.state.regs[3] == 0xFFFFFFFF80000000);
+    emu.state.regs[2] = 0x100000000; // Zero in the low word
+    execute(&emu, decode(0x0220c1bb)); // DIVW x3, x1, x2
+    CHECK(emu.state.regs[3] == UINT64_MAX);
+    execute(&emu, decode(0x0220f1bb)); // REMUW x3, x1, x2
+    CHECK(emu.state.regs[3] == 0xFFFFFFFF80000000);
+    report("MULW");
+
+    // Test the A extension on a doubleword at 0x600
+    uint64_t amo_word = 0xFFFFFFFF00000005;
+    memcpy(&emu.memory[0x600], &amo_word, 8);
+    emu.state.regs[1] = 0x600;
+    emu.state.regs[2] = 0xFFFFFFFF; // -1 as a word
+    execute(&emu, decode(0x0020a1af)); // AMOADD.W x3, x2, (x1)
+    CHECK(emu.state.regs[3] == 5 && emu.memory[0x600] == 4 && emu.memory[0x604] == 0xFF);
+    execute(&emu, decode(0xc020a1af)); // AMOMINU.W x3, x2, (x1)
+    CHECK(emu.state.regs[3] == 4 && emu.memory[0x600] == 4);
+    execute(&emu, decode(0xa020b1af)); // AMOMAX.D x3, x2, (x1)
+    CHECK(emu.state.regs[3] == 0xFFFFFFFF00000004 && emu.memory[0x600] == 0xFF && emu.memory[0x604] == 0);
+    emu.state.regs[2] = 0xAB00000000000077;
+    execute(&emu, decode(0x0e20b12f)); // AMOSWAP.D.AQRL x2, x2, (x1): rd == rs2 swaps
+    CHECK(emu.state.regs[2] == 0xFFFFFFFF && emu.memory[0x600] == 0x77 && emu.memory[0x607] == 0xAB);
+    execute(&emu, decode(0x1820a22f)); // SC.W x4, x2, (x1) without LR fails
+    CHECK(emu.state.regs[4] == 1 && emu.memory[0x600] == 0x77);
+    emu.state.regs[2] = 0x1234;
+    execute(&emu, decode(0x1000a1af)); // LR.W x3, (x1)
+    CHECK(emu.state.regs[3] == 0x77);
+    execute(&emu, decode(0x1820a22f)); // SC.W x4, x2, (x1)
+    CHECK(emu.state.regs[4] == 0 && emu.memory[0x600] == 0x34 && emu.memory[0x607] == 0xAB);
+    execute(&emu, decode(0x1820a22f)); // SC.W again: the reservation is used up
+    CHECK(emu.state.regs[4] == 1);
+    execute(&emu, decode(0x1000b1af)); // LR.D x3, (x1)
+    CHECK(emu.state.regs[3] == 0xAB00000000001234);
+    execute(&emu, decode(0x1820b22f)); // SC.D x4, x2, (x1)
+    CHECK(emu.state.regs[4] == 0 && emu.memory[0x607] == 0);
+    CHECK(execute(&emu, decode(0x0ff0000f))); // FENCE
+    report("ATOMIC");
 
     // Test CSR instructions
     emu.state.regs[1] = 0x1234;
     emu.state.csrs[CSR_MSTATUS] = 0x0;
-    execute_csr(&emu, int_to_instruction(0x300090f3)); // CSRRW x1, mstatus, x1
-    assert(emu.state.csrs[CSR_MSTATUS] == 0x1234);
-    assert(emu.state.regs[1] == 0x0);
-    printf("\033[0;32mCSRRW\t PASSED\n");
+    execute(&emu, decode(0x300090f3)); // CSRRW x1, mstatus, x1
+    CHECK(emu.state.csrs[CSR_MSTATUS] == 0x1234);
+    CHECK(emu.state.regs[1] == 0x0);
+    report("CSRRW");
 
     emu.state.regs[1] = 0x1;
-    execute_csr(&emu, int_to_instruction(0x3000a0fe)); // CSRRS x1, mstatus, x1
-    assert(emu.state.csrs[CSR_MSTATUS] == 0x1235);
-    assert(emu.state.regs[1] == 0x1234);
-    printf("\033[0;32mCSRRS\t PASSED\n");
+    execute(&emu, decode(0x3000a0f3)); // CSRRS x1, mstatus, x1
+    CHECK(emu.state.csrs[CSR_MSTATUS] == 0x1235);
+    CHECK(emu.state.regs[1] == 0x1234);
+    report("CSRRS");
 
     emu.state.regs[1] = 0x1;
-    execute_csr(&emu, int_to_instruction(0x3000b0f3)); // CSRRC x1, mstatus, x1
-    assert(emu.state.csrs[CSR_MSTATUS] == 0x1234);
-    assert(emu.state.regs[1] == 0x1235);
-    printf("\033[0;32mCSRRC\t PASSED\n");
-
-    execute_csr(&emu, int_to_instruction(0x3000d0f3)); // CSRRWI x1, mstatus, 1
-    assert(emu.state.csrs[CSR_MSTATUS] == 0x1);
-    assert(emu.state.regs[1] == 0x1234);
-    printf("\033[0;32mCSRRWI\t PASSED\n");
-
-    execute_csr(&emu, int_to_instruction(0x300160f3)); // CSRRSI x1, mstatus, 2
-    assert(emu.state.csrs[CSR_MSTATUS] == 0x3);
-    assert(emu.state.regs[1] == 0x1);
-    printf("\033[0;32mCSRRSI\t PASSED\n");
-
-    execute_csr(&emu, int_to_instruction(0x3001f0f3)); // CSRRCI x1, mstatus, 3
-    assert(emu.state.csrs[CSR_MSTATUS] == 0x0);
-    assert(emu.state.regs[1] == 0x3);
-    printf("\033[0;32mCSRRCI\t PASSED\n");
+    execute(&emu, decode(0x3000b0f3)); // CSRRC x1, mstatus, x1
+    CHECK(emu.state.csrs[CSR_MSTATUS] == 0x1234);
+    CHECK(emu.state.regs[1] == 0x1235);
+    report("CSRRC");
+
+    execute(&emu, decode(0x3000d0f3)); // CSRRWI x1, mstatus, 1
+    CHECK(emu.state.csrs[CSR_MSTATUS] == 0x1);
+    CHECK(emu.state.regs[1] == 0x1234);
+    report("CSRRWI");
+
+    execute(&emu, decode(0x300160f3)); // CSRRSI x1, mstatus, 2
+    CHECK(emu.state.csrs[CSR_MSTATUS] == 0x3);
+    CHECK(emu.state.regs[1] == 0x1);
+    report("CSRRSI");
+
+    execute(&emu, decode(0x3001f0f3)); // CSRRCI x1, mstatus, 3
+    CHECK(emu.state.csrs[CSR_MSTATUS] == 0x0);
+    CHECK(emu.state.regs[1] == 0x3);
+    report("CSRRCI");
 
     // Test ECALL
     emu.state.pc = 0x100;
     execute_ecall(&emu);
-    assert(emu.state.csrs[CSR_MEPC] == 0x100);
-    assert(emu.state.csrs[CSR_MCAUSE] == 11);
-    assert(emu.state.dnpc == emu.state.csrs[CSR_MTVEC]);
-    printf("\033[0;32mECALL\t PASSED\n");
+    CHECK(emu.state.csrs[CSR_MEPC] == 0x100);
+    CHECK(emu.state.csrs[CSR_MCAUSE] == 11);
+    CHECK(emu.state.dnpc == emu.state.csrs[CSR_MTVEC]);
+    report("ECALL");
 
     // Test EBREAK
     emu.state.pc = 0x100;
     execute_ebreak(&emu);
-    assert(emu.state.csrs[CSR_MEPC] == 0x100);
-    assert(emu.state.csrs[CSR_MCAUSE] == 3);
-    assert(emu.state.dnpc == emu.state.csrs[CSR_MTVEC]);
-    printf("\033[0;32mEBREAK\t PASSED\n");
+    CHECK(emu.state.csrs[CSR_MEPC] == 0x100);
+    CHECK(emu.state.csrs[CSR_MCAUSE] == 3);
+    CHECK(emu.state.dnpc == emu.state.csrs[CSR_MTVEC]);
+    report("EBREAK");
 
     // Test MRET
     emu.state.csrs[CSR_MEPC] = 0x200;
     emu.state.csrs[CSR_MSTATUS] = 0x1800;
     execute_mret(&emu);
-    assert(emu.state.dnpc == 0x200);
-    assert((emu.state.csrs[CSR_MSTATUS] & 0x1800) == 0x0);
-    printf("\033[0;32mMRET\t PASSED\n");
-
-    fclose(emu.log_file);
+    CHECK(emu.state.dnpc == 0x200);
+    CHECK((emu.state.csrs[CSR_MSTATUS] & 0x1800) == 0x0);
+    report("MRET");
+
+    // Test counters through the block loop
+    uint32_t program[] = {
+        0x10002103, // LW x2, 0x100(x0)
+        0x10202223, // SW x2, 0x104(x0)
+        0x00000463, // BEQ x0, x0, 8
+        0x00130313, // ADDI x6, x6, 1 (skipped)
+        0xb02021f3, // CSRR x3, minstret
+        0xb0302273, // CSRR x4, mhpmcounter3
+        0xb04022f3, // CSRR x5, mhpmcounter4
+        0xb0201073, // CSRW minstret, x0
+        0xc0202373, // CSRR x6, instret
+        0xffffffff  // EXIT
+    };
+    memcpy(&emu.memory[0x200], program, sizeof(program));
+    memset(emu.state.regs, 0, sizeof(emu.state.regs));
+    emu.state.pc = 0x200;
+    emu.state.dnpc = 0x204;
+    emu.state.instret = 0;
+    emu.state.csrs[CSR_MHPMEVENT3] = HPM_EVENT_LOADS;
+    emu.state.csrs[CSR_MHPMEVENT3 + 1] = HPM_EVENT_TAKEN_BRANCHES;
+    emu.log_enabled = false;
+    while (fetch_and_execute(&emu));
+    CHECK(emu.state.regs[3] == 3);
+    CHECK(emu.state.regs[4] == 1);
+    CHECK(emu.state.regs[5] == 1);
+    CHECK(emu.state.regs[6] == 0);
+    CHECK(emu.state.instret == 8);
+    uint32_t back_to_back[] = {
+        0xb02021f3, // CSRR x3, minstret
+        0xb0202273, // CSRR x4, minstret
+        0xb02022f3, // CSRR x5, minstret
+        0xb0002373, // CSRR x6, mcycle
+        0xb00063f3, // CSRRSI x7, mcycle, 0
+        0xb0007473, // CSRRCI x8, mcycle, 0
+        0xffffffff  // EXIT
+    };
+    memcpy(&emu.memory[0x200], back_to_back, sizeof(back_to_back));
+    emu.state.pc = 0x200;
+    emu.state.dnpc = 0x204;
+    emu.state.instret = 0;
+    memset(emu.state.counter_offsets, 0, sizeof(emu.state.counter_offsets));
+    flush_block_cache(&emu);
+    while (fetch_and_execute(&emu));
+    for (int i = 0; i < 6; i++) {
+        CHECK(emu.state.regs[3 + i] == (uint64_t)i);
+    }
+    memcpy(&emu.memory[0x200], program, sizeof(program));
+    flush_block_cache(&emu);
+    report("COUNTERS");
+
+    // Test timing model
+    TimingConfig timing_config;
+    default_timing_config(&timing_config);
+    TimingModel *timing = create_timing_model(&timing_config);
+    timing_record(timing, TIMING_LOAD, 0x1000, 8);
+    timing_record(timing, TIMING_LOAD, 0x1008, 8);
+    timing_record(timing, TIMING_STORE, 0x2000, 8);
+    timing_consume(timing);
+    CHECK(timing->l1d.accesses == 3 && timing->l1d.misses == 2);
+    CHECK(timing->l2.accesses == 2 && timing->l2.misses == 2);
+    free_timing_model(timing);
+    report("TIMING");
+
+    // Test checkpoint round trip and run_until
+    emu.state.pc = 0x200;
+    emu.state.dnpc = 0x204;
+    emu.state.instret = 0;
+    CHECK(run_until(&emu, 2) && emu.state.instret == 2 && emu.state.pc == 0x208);
+    emu.devices.start_ns -= 10000000000ull; // Ten seconds of guest time, which the restore must not lose
+    CHECK(save_checkpoint(&emu, "build/test.ckpt"));
+    Emulator restored;
+    init_bare_emulator(&restored);
+    CHECK(load_checkpoint(&restored, "build/test.ckpt"));
+    CHECK(restored.state.pc == 0x208 && restored.state.instret == 2);
+    CHECK(live_mtime(&restored.devices) >= 10 * MTIME_HZ);
+    CHECK(restored.memory_size == emu.memory_size && memcmp(restored.memory, emu.memory, emu.memory_size) == 0);
+    free_emulator(&restored);
+    report("CHECKPOINT");
+
+    // Test breakpoints and watchpoints
+    emu.state.pc = 0x200;
+    emu.state.dnpc = 0x204;
+    pc_set_add(&emu.breakpoints, 0x208);
+    CHECK(fetch_and_execute(&emu) && emu.state.pc == 0x208);
+    CHECK(!fetch_and_execute(&emu) && emu.stop_reason == STOP_BREAKPOINT);
+    emu.skip_breakpoint = true;
+    CHECK(fetch_and_execute(&emu) && emu.state.pc == 0x210);
+    pc_set_remove(&emu.breakpoints, 0x208);
+    CHECK(emu.breakpoints.count == 0);
+    emu.state.pc = 0x200;
+    emu.state.dnpc = 0x204;
+    add_watchpoint(&emu, 0x104, 4, WATCH_WRITE);
+    emu.timing = create_timing_model(&timing_config);
+    CHECK(!fetch_and_execute(&emu) && emu.stop_reason == STOP_WATCHPOINT);
+    CHECK(emu.state.pc == 0x208 && emu.stop_addr == 0x104);
+    timing_consume(emu.timing);
+    CHECK(emu.timing->instrs == 2); // Only the instructions up to the watchpoint were fetched
+    free_timing_model(emu.timing);
+    emu.timing = NULL;
+    remove_watchpoint(&emu, 0x104, 4, WATCH_WRITE);
+    report("BREAKPOINT");
+
+    // Test reverse execution over a loop that stores its counter
+    uint32_t loop[] = {
+        0x00128293, // ADDI x5, x5, 1
+        0x40502023, // SW x5, 0x400(x0)
+        0xfe629ce3, // BNE x5, x6, -8
+        0xffffffff  // EXIT
+    };
+    memcpy(&emu.memory[0x300], loop, sizeof(loop));
+    emu.state.regs[5] = 0;
+    emu.state.regs[6] = 50;
+    emu.state.pc = 0x300;
+    emu.state.dnpc = 0x304;
+    emu.state.instret = 0;
+    TimeTravel tt;
+    init_time_travel(&tt, &emu, 16);
+    CHECK(!tt_run_until(&tt, &emu, UINT64_MAX) && emu.state.instret == 150);
+    CHECK(tt.num_snapshots == 10);
+    CHECK(tt_goto(&tt, &emu, 30) && emu.state.regs[5] == 10 && emu.memory[0x400] == 10);
+    pc_set_add(&emu.breakpoints, 0x304);
+    CHECK(tt_reverse_continue(&tt, &emu) && emu.state.instret == 28 && emu.stop_reason == STOP_BREAKPOINT);
+    pc_set_remove(&emu.breakpoints, 0x304);
+    WriteSite site;
+    CHECK(tt_last_mem_write(&tt, &emu, 0x400, &site) && site.instret == 25 && site.pc == 0x304);
+    CHECK(tt_last_reg_write(&tt, &emu, 5, &site) && site.instret == 27 && site.pc == 0x300);
+    CHECK(emu.state.instret == 28 && emu.memory[0x400] == 9);
+    CHECK(!tt_reverse_continue(&tt, &emu) && emu.state.instret == 0 && emu.state.regs[5] == 0);
+    free_time_travel(&tt);
+    // A syscall's result and buffer count as its writes, and a snapshot between LR and SC keeps the reservation
+    uint32_t user_program[] = {
+        0x00100513, // ADDI a0, x0, 1
+        0x05000893, // ADDI a7, x0, 80: fstat
+        0x48000593, // ADDI a1, x0, 0x480
+        0x00000073, // ECALL
+        0x50000293, // ADDI t0, x0, 0x500
+        0x1002b32f, // LR.D t1, (t0)
+        0x0ac00893, // ADDI a7, x0, 172
+        0x1862b3af, // SC.D t2, t1, (t0)
+        0xffffffff  // EXIT
+    };
+    memcpy(&emu.memory[0x340], user_program, sizeof(user_program));
+    State loop_state = emu.state;
+    UserMode reverse_user;
+    init_user_mode(&emu, &reverse_user, 0x8000);
+    emu.state.regs[2] = emu.memory_size - 16;
+    emu.state.regs[10] = 0;
+    emu.state.pc = 0x340;
+    emu.state.dnpc = 0x344;
+    emu.state.instret = 0;
+    emu.reservation = 0;
+    init_time_travel(&tt, &emu, 6);
+    CHECK(!tt_run_until(&tt, &emu, UINT64_MAX) && emu.state.instret == 8 && emu.state.regs[7] == 0);
+    CHECK(tt_last_mem_write(&tt, &emu, 0x488, &site) && site.instret == 3 && site.pc == 0x34c);
+    CHECK(tt_last_reg_write(&tt, &emu, 10, &site) && site.instret == 3 && site.pc == 0x34c);
+    CHECK(tt_goto(&tt, &emu, 7) && emu.reservation == 0x501);
+    CHECK(!tt_run_until(&tt, &emu, UINT64_MAX) && emu.state.regs[7] == 0);
+    free_time_travel(&tt);
+    emu.user = NULL;
+    emu.state = loop_state;
+    report("REVERSE");
+
+    // Test trace triggers on the same loop
+    Tracer tracer;
+    init_tracer(&tracer);
+    CHECK(add_trigger(&tracer, "pc:0x304-0x308/regs") && add_trigger(&tracer, "store:0x400/mem"));
+    CHECK(!add_trigger(&tracer, "pc:0x304") && !add_trigger(&tracer, "trap/all"));
+    CHECK(trace_block(&tracer, 0x300, 0, 3) && !trace_block(&tracer, 0x308, 0, 2));
+    emu.tracer = &tracer;
+    emu.state.regs[6] = 2;
+    while (fetch_and_execute(&emu));
+    CHECK(emu.state.instret == 6 && emu.state.regs[5] == 2);
+    CHECK(tracer.window_end == 4 + TRACE_WINDOW && tracer.window_content == TRACE_MEMORY);
+    // A csr trigger must not read time a second time, which would log an extra event
+    CHECK(add_trigger(&tracer, "csr:0xc01"));
+    emu.devices.keep_history = true;
+    CHECK(start_recording(&emu.devices, NULL));
+    execute(&emu, decode(0xc01021f3)); // CSRR x3, time
+    CHECK(emu.devices.num_events == 1);
+    emu.devices.mode = REPLAY_OFF;
+    emu.devices.keep_history = false;
+    emu.tracer = NULL;
+    report("TRACE");
+
+    // Test incremental checkpoints on the same loop, then resume in a fresh emulator
+    emu.state.regs[5] = 0;
+    emu.state.regs[6] = 50;
+    emu.state.pc = 0x300;
+    emu.state.dnpc = 0x304;
+    emu.state.instret = 0;
+    CheckpointWriter writer;
+    CHECK(start_checkpointing(&writer, &emu, "build/test-ckpt", 16, false));
+    run_with_checkpoints(&writer, &emu);
+    stop_checkpointing(&writer);
+    CHECK(emu.state.instret == 150 && writer.sequence > 0);
+    FILE *stale = fopen("build/test-ckpt/ckpt-000000.tmp", "wb"); // As left by a run killed mid-write
+    CHECK(stale && fclose(stale) == 0);
+    init_bare_emulator(&restored);
+    CHECK(start_checkpointing(&writer, &restored, "build/test-ckpt", 16, true));
+    CHECK(live_mtime(&restored.devices) >= 10 * MTIME_HZ && fopen("build/test-ckpt/ckpt-000000.tmp", "rb") == NULL);
+    uint64_t resumed_at = restored.state.instret;
+    CHECK(resumed_at % 16 == 0 && restored.state.regs[5] == (resumed_at + 2) / 3);
+    CHECK(restored.memory[0x400] == (resumed_at + 1) / 3);
+    run_with_checkpoints(&writer, &restored);
+    stop_checkpointing(&writer);
+    CHECK(restored.state.instret == 150 && restored.state.regs[5] == 50);
+    free_emulator(&restored);
+    report("INCREMENTAL");
+
+    // Test Linux syscalls in user mode
+    UserMode user;
+    init_user_mode(&emu, &user, 0x8000);
+    emu.state.regs[17] = LINUX_SYS_BRK;
+    emu.state.regs[10] = 0x9000;
+    execute_ecall(&emu);
+    CHECK(emu.state.regs[10] == 0x9000 && user.brk == 0x9000);
+    strcpy((char *)&emu.memory[0x500], "/dev/null");
+    emu.state.regs[17] = LINUX_SYS_OPENAT;
+    emu.state.regs[10] = (uint64_t)-100; // AT_FDCWD
+    emu.state.regs[11] = 0x500;
+    emu.state.regs[12] = 1; // O_WRONLY
+    execute_ecall(&emu);
+    uint64_t fd = emu.state.regs[10];
+    CHECK(fd > 2 && fd < 1024);
+    emu.state.regs[17] = LINUX_SYS_WRITE;
+    emu.state.regs[11] = 0x500;
+    emu.state.regs[12] = 9;
+    execute_ecall(&emu);
+    CHECK(emu.state.regs[10] == 9);
+    emu.state.regs[17] = LINUX_SYS_CLOSE;
+    emu.state.regs[10] = fd;
+    execute_ecall(&emu);
+    CHECK(emu.state.regs[10] == 0);
+    emu.state.regs[10] = fd;
+    execute_ecall(&emu);
+    CHECK(emu.state.regs[10] == (uint64_t)-EBADF);
+    int log_fd = fileno(emu.log_file); // The emulator's own, never the guest's
+    emu.state.regs[10] = log_fd;
+    execute_ecall(&emu);
+    CHECK(emu.state.regs[10] == (uint64_t)-EBADF && fcntl(log_fd, F_GETFD) != -1);
+    emu.state.regs[17] = LINUX_SYS_READ;
+    emu.state.regs[10] = log_fd;
+    execute_ecall(&emu);
+    CHECK(emu.state.regs[10] == (uint64_t)-EBADF);
+    emu.state.regs[17] = LINUX_SYS_MMAP;
+    emu.state.regs[10] = 0;
+    emu.state.regs[11] = 100;
+    emu.state.regs[13] = LINUX_MAP_ANONYMOUS;
+    execute_ecall(&emu);
+    // 16 KiB of stack in 64 KiB of RAM, then a 4 KiB guard gap
+    CHECK(user.stack_bottom == emu.memory_size - 0x4000 && emu.state.regs[10] == user.stack_bottom - 0x1000 - USER_PAGE_SIZE);
+    emu.state.regs[17] = LINUX_SYS_EXIT_GROUP;
+    emu.state.regs[10] = 7;
+    execute_ecall(&emu);
+    CHECK(user.exited && user.exit_status == 7 && emu.stop_reason == STOP_EXIT);
+    emu.user = NULL;
+    report("SYSCALL");
+
+    // Test CLINT registers through the MMIO path
+    emu.state.regs[1] = CLINT_MTIMECMP;
+    emu.state.regs[2] = 0x123456789;
+    execute(&emu, decode(0x0020B023)); // SD x2, 0(x1)
+    CHECK(emu.state.mtimecmp == 0x123456789);
+    execute(&emu, decode(0x0040a183)); // LW x3, 4(x1)
+    CHECK(emu.state.regs[3] == 0x1);
+    report("MMIO");
+
+    // Test corner cases found by the fuzzer
+    emu.state.regs[1] = 42;
+    emu.state.regs[2] = 0;
+    execute(&emu, decode(0x0220D1B3)); // DIVU x3, x1, x2
+    CHECK(emu.state.regs[3] == UINT64_MAX);
+    execute(&emu, decode(0x0220E1B3)); // REM x3, x1, x2
+    CHECK(emu.state.regs[3] == 42);
+    emu.state.regs[1] = UINT64_MAX;
+    execute(&emu, decode(0x0000A183)); // LW x3, 0(x1) wraps past the top of memory
+    CHECK(emu.state.regs[3] == 0);
+    emu.max_instrs = UINT64_MAX;
+    emu.state.pc = 0x700;
+    memset(&emu.memory[0x700], 0, 4);
+    CHECK(!fetch_and_execute(&emu) && emu.stop_reason == STOP_ERROR);
+    memset(&emu.memory[0x700], 0xFF, 4);
+    mark_dirty(&emu, 0x700, 4); // Must drop the empty block cached for the old word
+    CHECK(!fetch_and_execute(&emu) && emu.stop_reason == STOP_EXIT);
+    report("FUZZ");
+
+    // Test the shared-memory stats export
+    StatsExport stats;
+    CHECK(open_stats(&stats, NULL));
+    CHECK(atomic_load(&stats.segment->magic) == STATS_MAGIC);
+    StatsExport clash; // A second emulator must not truncate a live segment
+    CHECK(!open_stats(&clash, stats.name + 1) && stats.segment->pid == (uint32_t)getpid());
+    emu.stats = stats.segment;
+    emu.log_enabled = false;
+    uint32_t counting_loop[] = { 0x00108093, 0xffdff06f }; // ADDI x1, x1, 1; JAL x0, -4
+    memcpy(&emu.memory[0x800], counting_loop, sizeof(counting_loop));
+    mark_dirty(&emu, 0x800, sizeof(counting_loop));
+    emu.state.pc = 0x800;
+    emu.state.dnpc = 0x804;
+    emu.max_instrs = emu.state.instret + 3 * STATS_PUBLISH_INSTRS;
+    uint64_t traps = emu.traps;
+    while (fetch_and_execute(&emu));
+    CHECK(stats.segment->instret > emu.state.instret - STATS_PUBLISH_INSTRS - BLOCK_MAX_INSTRS);
+    CHECK(stats.segment->traps == traps && stats.segment->blocks <= emu.blocks_run);
+    close_stats(&stats, &emu);
+    CHECK(stats.segment == NULL);
+    emu.stats = NULL;
+    report("STATS");
+
+    // Test macro-op fusion against instruction-at-a-time execution with logging on
+    uint32_t idioms[] = {
+        0x123452b7, // LUI x5, 0x12345
+        0x67828293, // ADDI x5, x5, 0x678
+        0x00001317, // AUIPC x6, 1
+        0xff030313, // ADDI x6, x6, -16
+        0x02829393, // SLLI x7, x5, 40
+        0x0283d393, // SRLI x7, x7, 40
+        0x0053b433, // SLTU x8, x7, x5
+        0x00041463, // BNE x8, x0, 8
+        0x00100493, // ADDI x9, x0, 1
+        0x00000097, // AUIPC x1, 0
+        0x00c080e7, // JALR x1, 12(x1)
+        0x00248493, // ADDI x9, x9, 2
+        0x00448493, // ADDI x9, x9, 4
+        0xffffffff  // Exit
+    };
+    memcpy(&emu.memory[0x900], idioms, sizeof(idioms));
+    mark_dirty(&emu, 0x900, sizeof(idioms));
+    emu.max_instrs = UINT64_MAX;
+    uint64_t fused_regs[NUM_REGS];
+    for (int logged = 0; logged < 2; logged++) {
+        emu.log_enabled = logged;
+        emu.state.regs[9] = 0;
+        emu.state.pc = 0x900;
+        emu.state.dnpc = 0x904;
+        while (fetch_and_execute(&emu));
+        CHECK(emu.stop_reason == STOP_EXIT && emu.state.pc == 0x900 + 13 * 4);
+        if (!logged) {
+            memcpy(fused_regs, emu.state.regs, sizeof(fused_regs));
+        }
+    }
+    CHECK(memcmp(fused_regs, emu.state.regs, sizeof(fused_regs)) == 0);
+    CHECK(fused_regs[5] == 0x12345678 && fused_regs[6] == 0x18f8 && fused_regs[7] == 0x345678);
+    CHECK(fused_regs[8] == 1 && fused_regs[9] == 4 && fused_regs[1] == 0x900 + 11 * 4);
+    report("FUSION");
+
+    // Test return-address stack and indirect-target cache predictions
+    uint32_t calls[] = {
+        0x03200513, // ADDI x10, x0, 50
+        0x00000617, // AUIPC x12, 0
+        0x01060613, // ADDI x12, x12, 16
+        0x014000ef, // JAL x1, 20 (call)
+        0x00060067, // JALR x0, 0(x12) (indirect)
+        0xfff50513, // ADDI x10, x10, -1
+        0xfe051ae3, // BNE x10, x0, -12
+        0xffffffff, // Exit
+        0x00158593, // ADDI x11, x11, 1
+        0x00008067  // JALR x0, 0(x1) (return)
+    };
+    memcpy(&emu.memory[0xA00], calls, sizeof(calls));
+    mark_dirty(&emu, 0xA00, sizeof(calls));
+    emu.log_enabled = false;
+    emu.state.regs[11] = 0;
+    emu.state.pc = 0xA00;
+    emu.state.dnpc = 0xA04;
+    uint64_t returns = emu.returns, return_hits = emu.return_hits;
+    uint64_t indirect_jumps = emu.indirect_jumps, indirect_hits = emu.indirect_hits;
+    while (fetch_and_execute(&emu));
+    CHECK(emu.stop_reason == STOP_EXIT && emu.state.regs[11] == 50);
+    CHECK(emu.returns - returns == 50 && emu.return_hits - return_hits == 50);
+    // The site learns its target once the target block has been decoded, on the second pass
+    CHECK(emu.indirect_jumps - indirect_jumps == 50 && emu.indirect_hits - indirect_hits == 48);
+    report("PREDICT");
+
+    // Test guest RAM sizes and the mapping behind them
+    uint64_t size = 0;
+    CHECK(parse_memory_size("4M", &size) && size == 4u << 20);
+    CHECK(parse_memory_size("0x10000", &size) && size == 0x10000);
+    CHECK(!parse_memory_size("100", &size) && !parse_memory_size("1X", &size));
+    MemoryConfig memory;
+    default_memory_config(&memory);
+    CHECK(parse_numa_nodes("0,1", &memory) && memory.num_nodes == 2 && memory.nodes[1] == 1);
+    CHECK(!parse_numa_nodes("0,", &memory) && !parse_numa_nodes("x", &memory));
+    memory.num_nodes = 0;
+    memory.size = 4u << 20;
+    set_memory_config(&memory);
+    Emulator large;
+    init_bare_emulator(&large);
+    CHECK(large.memory_size == 4u << 20 && large.num_pages == 1024);
+    CHECK(((uintptr_t)large.memory & (HUGE_PAGE_SIZE - 1)) == 0 && large.memory_mapped == 4u << 20);
+    uint32_t top_of_ram[] = {
+        0x004002b7, // LUI x5, 0x400
+        0xfe62bc23, // SD x6, -8(x5)
+        0xff82b383, // LD x7, -8(x5)
+        0xffffffff  // Exit
+    };
+    memcpy(large.memory, top_of_ram, sizeof(top_of_ram));
+    large.state.dnpc = 4;
+    large.state.regs[6] = 0x1122334455667788;
+    while (fetch_and_execute(&large));
+    CHECK(large.stop_reason == STOP_EXIT && large.state.regs[7] == 0x1122334455667788);
+    CHECK(large.dirty_pages[1023] == DIRTY_ALL);
+    free_emulator(&large);
+    default_memory_config(&memory);
+    set_memory_config(&memory);
+    report("MEMORY");
+
+    // Test a guest past 4 GiB: the device windows stay devices and resume puts high pages back in place
+    memory.size = 5ull << 30;
+    memory.huge_pages = HUGE_PAGES_OFF; // MAP_NORESERVE, so only the touched pages are backed
+    set_memory_config(&memory);
+    Emulator huge;
+    init_bare_emulator(&huge);
+    CHECK(huge.memory_size == 5ull << 30 && huge.huge_pages == HUGE_PAGES_OFF);
+    uint32_t to_clint[] = {
+        0x020042b7, // LUI x5, 0x2004: mtimecmp
+        0x0062b023, // SD x6, 0(x5)
+        0x0002b383, // LD x7, 0(x5)
+        0xffffffff  // Exit
+    };
+    memcpy(huge.memory, to_clint, sizeof(to_clint));
+    huge.state.dnpc = 4;
+    huge.state.regs[6] = 12345;
+    while (fetch_and_execute(&huge));
+    CHECK(huge.stop_reason == STOP_EXIT && huge.state.mtimecmp == 12345 && huge.state.regs[7] == 12345);
+    CHECK(huge.memory[CLINT_MTIMECMP] == 0 && in_device_window(UART_BASE + UART_LSR) && !in_device_window(MMIO_BASE + MMIO_SIZE));
+    // Page 0x100001 is 4 GiB above page 1, where a 32-bit offset would put it
+    CHECK(mkdir("build/test-ckpt-large", 0755) == 0 || errno == EEXIST);
+    FILE *chain = fopen("build/test-ckpt-large/ckpt-000000.bin", "wb");
+    uint64_t chain_header[4] = { INCREMENTAL_MAGIC, 0, huge.memory_size, 0 };
+    uint32_t chain_count = 2, chain_pages[2] = { 1, 0x100001 };
+    static uint8_t chain_data[2][PAGE_SIZE];
+    memset(chain_data[0], 0x11, PAGE_SIZE);
+    memset(chain_data[1], 0x22, PAGE_SIZE);
+    CHECK(chain && fwrite(chain_header, sizeof(chain_header), 1, chain) == 1 &&
+          fwrite(&huge.state, sizeof(huge.state), 1, chain) == 1 && fwrite(&chain_count, sizeof(chain_count), 1, chain) == 1 &&
+          fwrite(chain_pages, sizeof(chain_pages), 1, chain) == 1 && fwrite(chain_data, sizeof(chain_data), 1, chain) == 1);
+    CHECK(chain && fclose(chain) == 0);
+    CheckpointWriter huge_writer;
+    CHECK(start_checkpointing(&huge_writer, &huge, "build/test-ckpt-large", 0, true));
+    stop_checkpointing(&huge_writer);
+    CHECK(huge.memory[0x1000] == 0x11 && huge.memory[0x100001000ull] == 0x22 && huge.memory[0x100001fffull] == 0x22);
+    free_emulator(&huge);
+    default_memory_config(&memory);
+    set_memory_config(&memory);
+    report("LARGE");
+
+    // Test loading a static executable linked at the usual 0x10000 and running it to exit_group
+    struct {
+        Elf64_Ehdr ehdr;
+        Elf64_Phdr phdr;
+        uint32_t code[16];
+    } image = { .code = {
+        0x00013503, // LD a0, 0(sp): argc
+        0x01013583, // LD a1, 16(sp): argv[1]
+        0x0005c603, // LBU a2, 0(a1)
+        0xfd06061b, // ADDIW a2, a2, -48
+        0xff010293, // ADDI t0, sp, -16
+        0x0002b023, // SD x0, 0(t0)
+        0x1002b32f, // LR.D t1, (t0)
+        0x00130313, // ADDI t1, t1, 1
+        0x1862b3af, // SC.D t2, t1, (t0)
+        0xfe039ae3, // BNE t2, x0, -12
+        0x00c2ae2f, // AMOADD.W t3, a2, (t0)
+        0x0002a683, // LW a3, 0(t0)
+        0x02d5053b, // MULW a0, a0, a3
+        0x01c50533, // ADD a0, a0, t3
+        0x05e00893, // ADDI a7, x0, 94: exit_group
+        0x00000073  // ECALL
+    } };
+    memcpy(image.ehdr.e_ident, ELFMAG, SELFMAG);
+    image.ehdr.e_ident[EI_CLASS] = ELFCLASS64;
+    image.ehdr.e_ident[EI_DATA] = ELFDATA2LSB;
+    image.ehdr.e_ident[EI_VERSION] = EV_CURRENT;
+    image.ehdr.e_type = ET_EXEC;
+    image.ehdr.e_machine = EM_RISCV;
+    image.ehdr.e_version = EV_CURRENT;
+    image.ehdr.e_entry = 0x10000 + ((uint8_t *)image.code - (uint8_t *)&image);
+    image.ehdr.e_phoff = sizeof(Elf64_Ehdr);
+    image.ehdr.e_ehsize = sizeof(Elf64_Ehdr);
+    image.ehdr.e_phentsize = sizeof(Elf64_Phdr);
+    image.ehdr.e_phnum = 1;
+    image.phdr.p_type = PT_LOAD;
+    image.phdr.p_flags = PF_R | PF_X;
+    image.phdr.p_vaddr = 0x10000;
+    image.phdr.p_filesz = sizeof(image);
+    image.phdr.p_memsz = sizeof(image) + USER_PAGE_SIZE; // With a .bss
+    FILE *elf = fopen("build/test-user.elf", "wb");
+    CHECK(elf && fwrite(&image, sizeof(image), 1, elf) == 1);
+    CHECK(elf && fclose(elf) == 0);
+    memory.size = USER_MEMORY_SIZE;
+    set_memory_config(&memory);
+    Emulator guest;
+    init_bare_emulator(&guest);
+    UserMode guest_user;
+    char *guest_argv[] = { "build/test-user.elf", "7" };
+    CHECK(load_user_program(&guest, &guest_user, 2, guest_argv));
+    CHECK(guest.state.pc == image.ehdr.e_entry && guest_user.brk == 0x10000 + 2 * USER_PAGE_SIZE);
+    CHECK(guest_user.stack_bottom == USER_MEMORY_SIZE - USER_STACK_SIZE);
+    CHECK(guest_user.mmap_bottom == guest_user.stack_bottom - USER_STACK_SIZE / 4);
+    uint64_t envp = 0; // The host environment stays out of the guest
+    memcpy(&envp, &guest.memory[guest.state.regs[2] + 4 * 8], sizeof(envp));
+    CHECK(envp == 0);
+    uint64_t guest_sp = guest.state.regs[2];
+    guest.max_instrs = 1000;
+    while (fetch_and_execute(&guest));
+    CHECK(guest.stop_reason == STOP_EXIT && guest_user.exited && guest_user.exit_status == 17); // 2 * (1 + 7) + 1
+    // A syscall with sp in the guard gap below the stack stops the guest
+    guest_user.exited = false;
+    guest.state.regs[2] = guest_user.stack_bottom - 64;
+    guest.state.regs[17] = LINUX_SYS_GETPID;
+    execute_ecall(&guest);
+    CHECK(guest_user.exited && guest_user.exit_status == USER_STACK_OVERFLOW_STATUS && guest_sp > guest_user.stack_bottom);
+    free_emulator(&guest);
+    default_memory_config(&memory);
+    set_memory_config(&memory);
+    report("ELF");
+
+    // Test the generated decoder and disassembler against the table
+    for (size_t i = 0; i < sizeof(isa_vectors) / sizeof(isa_vectors[0]); i++) {
+        char text[64];
+        disassemble(isa_vectors[i].raw, text, sizeof(text));
+        CHECK(decode_op(isa_vectors[i].raw) == isa_vectors[i].op);
+        CHECK(strcmp(text, isa_vectors[i].text) == 0);
+    }
+    CHECK(strcmp(isa_info[OP_SRAI].name, "srai") == 0 && (isa_info[OP_JALR].flags & ISA_ENDS_BLOCK));
+    CHECK(decode_op(0x0000100f) == OP_INVALID); // FENCE.I is not implemented
+    emu.state.regs[1] = (uint64_t)INT64_MIN;
+    emu.state.regs[2] = UINT64_MAX;
+    execute(&emu, decode(0x0220c1b3)); // DIV x3, x1, x2 overflows
+    CHECK(emu.state.regs[3] == (uint64_t)INT64_MIN);
+    execute(&emu, decode(0x0220e1b3)); // REM x3, x1, x2
+    CHECK(emu.state.regs[3] == 0);
+    emu.state.regs[1] = (uint64_t)-7;
+    emu.state.regs[2] = 2;
+    execute(&emu, decode(0x022081b3)); // MUL x3, x1, x2
+    CHECK(emu.state.regs[3] == (uint64_t)-14);
+    execute(&emu, decode(0x022091b3)); // MULH x3, x1, x2
+    CHECK(emu.state.regs[3] == UINT64_MAX);
+    execute(&emu, decode(0x0220b1b3)); // MULHU x3, x1, x2
+    CHECK(emu.state.regs[3] == 1);
+    execute(&emu, decode(0x0220c1b3)); // DIV x3, x1, x2
+    CHECK(emu.state.regs[3] == (uint64_t)-3);
+    CHECK(!execute(&emu, decode(0x0420c1b3))); // funct7 2 is not an instruction
+    report("ISA");
+
+    // Test the persistent code cache: the second run decodes nothing, the third finds code changed under it
+    uint32_t counted_loop[] = {
+        0x00a00093, // ADDI x1, x0, 10
+        0x00110113, // ADDI x2, x2, 1
+        0xfff08093, // ADDI x1, x1, -1
+        0xfe009ce3, // BNE x1, x0, -8
+        0xffffffff  // Exit
+    };
+    char cache_path[sizeof(((CodeCache *)NULL)->path)] = "";
+    for (int run = 0; run < 3; run++) {
+        Emulator warm;
+        init_bare_emulator(&warm);
+        memcpy(warm.memory, counted_loop, sizeof(counted_loop));
+        warm.image_end = sizeof(counted_loop);
+        warm.state.dnpc = 4;
+        CodeCache cache;
+        CHECK(open_code_cache(&cache, "build/test-code-cache", &warm));
+        CHECK(cache.num_blocks == (run ? 2u : 0u));
+        if (run == 2) {
+            memcpy(&warm.memory[8], &(uint32_t){ 0xffe08093 }, 4); // ADDI x1, x1, -2
+        }
+        warm.code_cache = &cache;
+        while (fetch_and_execute(&warm));
+        CHECK(warm.stop_reason == STOP_EXIT && warm.state.regs[2] == (run == 2 ? 5u : 10u));
+        CHECK(cache.hits == (run == 1 ? 2u : 0u));
+        CHECK(save_code_cache(&cache, &warm));
+        strcpy(cache_path, cache.path);
+        close_code_cache(&cache);
+        free_emulator(&warm);
+    }
+    remove(cache_path);
+    report("CODECACHE");
+
+    // Test the virtio block device: two chains made available before a single notify
+    FILE *disk_file = fopen("build/test-disk.img", "wb");
+    for (int i = 0; i < 4 * VIRTIO_BLK_SECTOR_SIZE; i++) {
+        fputc(i / VIRTIO_BLK_SECTOR_SIZE + 1, disk_file);
+    }
+    fclose(disk_file);
+    Virtio virtio;
+    CHECK(open_virtio(&virtio, "build/test-disk.img", true));
+    Emulator dev;
+    init_bare_emulator(&dev);
+    dev.virtio = &virtio;
+    uint64_t blk = VIRTIO_BASE + VIRTIO_BLK * VIRTIO_MMIO_SIZE;
+    CHECK(device_load(&dev, blk + VIRTIO_MMIO_MAGIC, 4) == VIRTIO_MAGIC);
+    CHECK(device_load(&dev, blk + VIRTIO_MMIO_DEVICE_ID, 4) == VIRTIO_ID_BLOCK);
+    CHECK(device_load(&dev, blk + VIRTIO_MMIO_CONFIG, 8) == 4); // Capacity in sectors
+    CHECK(device_load(&dev, VIRTIO_BASE + VIRTIO_CONSOLE * VIRTIO_MMIO_SIZE + VIRTIO_MMIO_DEVICE_ID, 4) == VIRTIO_ID_CONSOLE);
+    device_store(&dev, blk + VIRTIO_MMIO_QUEUE_SEL, 4, 0);
+    device_store(&dev, blk + VIRTIO_MMIO_QUEUE_NUM, 4, 8);
+    device_store(&dev, blk + VIRTIO_MMIO_QUEUE_DESC_LOW, 4, 0x1000);
+    device_store(&dev, blk + VIRTIO_MMIO_QUEUE_DRIVER_LOW, 4, 0x2000);
+    device_store(&dev, blk + VIRTIO_MMIO_QUEUE_DEVICE_LOW, 4, 0x3000);
+    device_store(&dev, blk + VIRTIO_MMIO_QUEUE_READY, 4, 1);
+    device_store(&dev, blk + VIRTIO_MMIO_STATUS, 4, VIRTIO_STATUS_FEATURES_OK | VIRTIO_STATUS_DRIVER_OK);
+    uint32_t read_header[4] = { VIRTIO_BLK_T_IN, 0, 1, 0 };   // Sectors 1 and 2
+    uint32_t write_header[4] = { VIRTIO_BLK_T_OUT, 0, 3, 0 }; // Sector 3
+    memcpy(&dev.memory[0x4000], read_header, sizeof(read_header));
+    memcpy(&dev.memory[0x4010], write_header, sizeof(write_header));
+    memset(&dev.memory[0x7000], 0xab, VIRTIO_BLK_SECTOR_SIZE);
+    put_desc(&dev, 0x1000, 0, 0x4000, 16, VIRTQ_DESC_F_NEXT, 1);
+    put_desc(&dev, 0x1000, 1, 0x5000, 2 * VIRTIO_BLK_SECTOR_SIZE, VIRTQ_DESC_F_NEXT | VIRTQ_DESC_F_WRITE, 2);
+    put_desc(&dev, 0x1000, 2, 0x6000, 1, VIRTQ_DESC_F_WRITE, 0);
+    put_desc(&dev, 0x1000, 3, 0x4010, 16, VIRTQ_DESC_F_NEXT, 4);
+    put_desc(&dev, 0x1000, 4, 0x7000, VIRTIO_BLK_SECTOR_SIZE, VIRTQ_DESC_F_NEXT, 5);
+    put_desc(&dev, 0x1000, 5, 0x6001, 1, VIRTQ_DESC_F_WRITE, 0);
+    uint16_t avail[4] = { 0, 2, 0, 3 }; // flags, idx, ring[0], ring[1]
+    memcpy(&dev.memory[0x2000], avail, sizeof(avail));
+    dev.memory[0x6000] = dev.memory[0x6001] = 0xff;
+    device_store(&dev, blk + VIRTIO_MMIO_QUEUE_NOTIFY, 4, 0);
+    uint16_t used_idx;
+    uint32_t used[4];
+    memcpy(&used_idx, &dev.memory[0x3002], sizeof(used_idx));
+    memcpy(used, &dev.memory[0x3004], sizeof(used));
+    CHECK(used_idx == 2 && used[0] == 0 && used[1] == 2 * VIRTIO_BLK_SECTOR_SIZE + 1 && used[2] == 3 && used[3] == 1);
+    CHECK(dev.memory[0x6000] == VIRTIO_BLK_S_OK && dev.memory[0x6001] == VIRTIO_BLK_S_OK);
+    CHECK(dev.memory[0x5000] == 2 && dev.memory[0x5000 + VIRTIO_BLK_SECTOR_SIZE] == 3);
+    CHECK(virtio.disk[3 * VIRTIO_BLK_SECTOR_SIZE] == 0xab && dev.dirty_pages[5] == DIRTY_ALL);
+    CHECK(device_load(&dev, blk + VIRTIO_MMIO_INTERRUPT_STATUS, 4) == VIRTIO_INT_USED_BUFFER);
+    device_store(&dev, blk + VIRTIO_MMIO_INTERRUPT_ACK, 4, VIRTIO_INT_USED_BUFFER);
+    CHECK(device_load(&dev, blk + VIRTIO_MMIO_INTERRUPT_STATUS, 4) == 0);
+    read_header[2] = 4; // Past the end of the disk
+    memcpy(&dev.memory[0x4000], read_header, sizeof(read_header));
+    avail[1] = 3;
+    avail[2] = 0;
+    memcpy(&dev.memory[0x2000], avail, sizeof(avail));
+    device_store(&dev, blk + VIRTIO_MMIO_QUEUE_NOTIFY, 4, 0);
+    CHECK(dev.memory[0x6000] == VIRTIO_BLK_S_IOERR && virtio.devices[VIRTIO_BLK].requests == 3);
+    close_virtio(&virtio);
+    free_emulator(&dev);
+    disk_file = fopen("build/test-disk.img", "rb");
+    fseek(disk_file, 3 * VIRTIO_BLK_SECTOR_SIZE, SEEK_SET);
+    CHECK(fgetc(disk_file) == 0xab); // Written through to the image
+    fclose(disk_file);
+    remove("build/test-disk.img");
+    report("VIRTIO");
+
+    free_emulator(&emu);
 }
 
 int main() {
     run_tests();
-    printf("\033[38;5;206m");
+    if (failures) {
+        printf("\033[0;31m%d checks failed.\033[0m\n", failures);
+        return 1;
+    }
     printf("\033[38;5;206mAll tests passed.\033[0m\n");
     return 0;
 }
\ No newline at end of file
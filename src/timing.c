@@ -0,0 +1,184 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "timing.h"
+
+void default_timing_config(TimingConfig *config) {
+    config->l1i = (CacheConfig) { .size = 32 * 1024, .ways = 8, .line_size = 64 };
+    config->l1d = (CacheConfig) { .size = 32 * 1024, .ways = 8, .line_size = 64 };
+    config->l2 = (CacheConfig) { .size = 512 * 1024, .ways = 16, .line_size = 64 };
+    config->history_bits = 12;
+    config->l2_latency = 10;
+    config->memory_latency = 100;
+    config->mispredict_penalty = 10;
+}
+
+static bool is_power_of_two(uint32_t value) {
+    return value != 0 && (value & (value - 1)) == 0;
+}
+
+// Format: SIZE:WAYS:LINE, e.g. "32768:8:64"
+bool parse_cache_config(const char *text, CacheConfig *config) {
+    CacheConfig parsed;
+    if (sscanf(text, "%u:%u:%u", &parsed.size, &parsed.ways, &parsed.line_size) != 3) {
+        return false;
+    }
+    if (parsed.ways == 0 || !is_power_of_two(parsed.line_size) ||
+        parsed.size % (parsed.ways * parsed.line_size) != 0 ||
+        !is_power_of_two(parsed.size / (parsed.ways * parsed.line_size))) {
+        return false;
+    }
+    *config = parsed;
+    return true;
+}
+
+static void init_cache(Cache *cache, const char *name, const CacheConfig *config, Cache *next) {
+    memset(cache, 0, sizeof(Cache));
+    cache->name = name;
+    cache->ways = config->ways;
+    cache->num_sets = config->size / (config->ways * config->line_size);
+    while ((1u << cache->line_shift) < config->line_size) {
+        cache->line_shift++;
+    }
+    cache->tags = calloc((size_t)cache->num_sets * cache->ways, sizeof(uint64_t));
+    cache->lru = calloc((size_t)cache->num_sets * cache->ways, sizeof(uint64_t));
+    if (!cache->tags || !cache->lru) {
+        perror("Failed to allocate cache model");
+        exit(1);
+    }
+    cache->next = next;
+}
+
+static bool cache_access(Cache *cache, uint64_t addr) {
+    uint64_t line = addr >> cache->line_shift;
+    uint32_t set = line & (cache->num_sets - 1);
+    uint64_t *tags = &cache->tags[(size_t)set * cache->ways];
+    uint64_t *lru = &cache->lru[(size_t)set * cache->ways];
+
+    cache->accesses++;
+    cache->clock++;
+    uint32_t victim = 0;
+    for (uint32_t way = 0; way < cache->ways; way++) {
+        if (tags[way] == line + 1) {
+            lru[way] = cache->clock;
+            return true;
+        }
+        if (lru[way] < lru[victim]) {
+            victim = way;
+        }
+    }
+
+    cache->misses++;
+    tags[victim] = line + 1;
+    lru[victim] = cache->clock;
+    return false;
+}
+
+static uint64_t memory_access(TimingModel *model, Cache *l1, uint64_t addr) {
+    if (cache_access(l1, addr)) {
+        return 0;
+    }
+    if (cache_access(l1->next, addr)) {
+        return model->config.l2_latency;
+    }
+    return model->config.l2_latency + model->config.memory_latency;
+}
+
+static bool predict_branch(Predictor *predictor, uint64_t pc, bool taken) {
+    uint32_t index = ((uint32_t)(pc >> 2) ^ predictor->history) & predictor->mask;
+    uint8_t *counter = &predictor->counters[index];
+    bool correct = (*counter >= 2) == taken;
+
+    if (taken && *counter < 3) {
+        (*counter)++;
+    } else if (!taken && *counter > 0) {
+        (*counter)--;
+    }
+    predictor->history = ((predictor->history << 1) | taken) & predictor->mask;
+    predictor->branches++;
+    predictor->mispredicts += !correct;
+    return correct;
+}
+
+TimingModel *create_timing_model(const TimingConfig *config) {
+    TimingModel *model = calloc(1, sizeof(TimingModel));
+    if (!model) {
+        perror("Failed to allocate timing model");
+        exit(1);
+    }
+    model->config = *config;
+    init_cache(&model->l2, "L2", &config->l2, NULL);
+    init_cache(&model->l1i, "L1I", &config->l1i, &model->l2);
+    init_cache(&model->l1d, "L1D", &config->l1d, &model->l2);
+
+    model->predictor.mask = (1u << config->history_bits) - 1;
+    model->predictor.counters = malloc((size_t)model->predictor.mask + 1);
+    if (!model->predictor.counters) {
+        perror("Failed to allocate branch predictor");
+        exit(1);
+    }
+    memset(model->predictor.counters, 1, (size_t)model->predictor.mask + 1); // Weakly not-taken
+    return model;
+}
+
+void free_timing_model(TimingModel *model) {
+    Cache *caches[] = { &model->l1i, &model->l1d, &model->l2 };
+    for (size_t i = 0; i < sizeof(caches) / sizeof(caches[0]); i++) {
+        free(caches[i]->tags);
+        free(caches[i]->lru);
+    }
+    free(model->predictor.counters);
+    free(model);
+}
+
+void timing_consume(TimingModel *model) {
+    for (size_t i = 0; i < model->num_events; i++) {
+        const TimingEvent *event = &model->events[i];
+        switch (event->type) {
+            case TIMING_FETCH: {
+                // One L1I access per line touched by the block
+                uint64_t line_size = 1ull << model->l1i.line_shift;
+                uint64_t end = event->addr + event->arg * 4;
+                for (uint64_t addr = event->addr & ~(line_size - 1); addr < end; addr += line_size) {
+                    model->stall_cycles += memory_access(model, &model->l1i, addr);
+                }
+                model->instrs += event->arg;
+                break;
+            }
+            case TIMING_LOAD:
+            case TIMING_STORE:
+                model->stall_cycles += memory_access(model, &model->l1d, event->addr);
+                break;
+            case TIMING_BRANCH:
+                if (!predict_branch(&model->predictor, event->addr, event->arg)) {
+                    model->stall_cycles += model->config.mispredict_penalty;
+                }
+                break;
+        }
+    }
+    model->num_events = 0;
+}
+
+static void report_cache(const Cache *cache, uint64_t instrs, FILE *out) {
+    double miss_rate = cache->accesses ? 100.0 * cache->misses / cache->accesses : 0.0;
+    double mpki = instrs ? 1000.0 * cache->misses / instrs : 0.0;
+    fprintf(out, "%-4s accesses: %lu misses: %lu miss rate: %.2f%% MPKI: %.2f\n",
+            cache->name, cache->accesses, cache->misses, miss_rate, mpki);
+}
+
+void report_timing(TimingModel *model, FILE *out) {
+    timing_consume(model);
+
+    const Predictor *predictor = &model->predictor;
+    double mispredict_rate = predictor->branches ? 100.0 * predictor->mispredicts / predictor->branches : 0.0;
+    double branch_mpki = model->instrs ? 1000.0 * predictor->mispredicts / model->instrs : 0.0;
+    double cpi = model->instrs ? (double)(model->instrs + model->stall_cycles) / model->instrs : 0.0;
+
+    fprintf(out, "Instructions: %lu\n", model->instrs);
+    report_cache(&model->l1i, model->instrs, out);
+    report_cache(&model->l1d, model->instrs, out);
+    report_cache(&model->l2, model->instrs, out);
+    fprintf(out, "Branches: %lu mispredicts: %lu mispredict rate: %.2f%% MPKI: %.2f\n",
+            predictor->branches, predictor->mispredicts, mispredict_rate, branch_mpki);
+    fprintf(out, "Estimated CPI: %.3f\n", cpi);
+}
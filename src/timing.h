@@ -0,0 +1,87 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define TIMING_BATCH 4096
+
+typedef enum {
+    TIMING_FETCH,  // addr = block start, arg = instructions fetched
+    TIMING_LOAD,   // addr = data address, arg = access size
+    TIMING_STORE,
+    TIMING_BRANCH  // addr = branch PC, arg = taken
+} TimingEventType;
+
+typedef struct {
+    uint64_t addr;
+    uint32_t arg;
+    uint32_t type;
+} TimingEvent;
+
+typedef struct {
+    uint32_t size;      // Bytes
+    uint32_t ways;
+    uint32_t line_size; // Bytes, power of two
+} CacheConfig;
+
+typedef struct {
+    CacheConfig l1i;
+    CacheConfig l1d;
+    CacheConfig l2;
+    uint32_t history_bits;       // gshare global history length
+    uint32_t l2_latency;         // Extra cycles for an L1 miss that hits in L2
+    uint32_t memory_latency;     // Extra cycles for an L2 miss
+    uint32_t mispredict_penalty;
+} TimingConfig;
+
+typedef struct Cache {
+    const char *name;
+    uint32_t num_sets;
+    uint32_t ways;
+    uint32_t line_shift;
+    uint64_t *tags;  // Line address + 1, 0 marks an empty way
+    uint64_t *lru;   // Last access stamp per way
+    uint64_t clock;
+    uint64_t accesses;
+    uint64_t misses;
+    struct Cache *next;
+} Cache;
+
+typedef struct {
+    uint8_t *counters; // 2-bit saturating counters
+    uint32_t history;
+    uint32_t mask;
+    uint64_t branches;
+    uint64_t mispredicts;
+} Predictor;
+
+typedef struct TimingModel {
+    TimingConfig config;
+    Cache l1i;
+    Cache l1d;
+    Cache l2;
+    Predictor predictor;
+    uint64_t instrs;
+    uint64_t stall_cycles;
+    size_t num_events;
+    TimingEvent events[TIMING_BATCH];
+} TimingModel;
+
+void default_timing_config(TimingConfig *config);
+bool parse_cache_config(const char *text, CacheConfig *config);
+TimingModel *create_timing_model(const TimingConfig *config);
+void free_timing_model(TimingModel *model);
+void timing_consume(TimingModel *model);
+void report_timing(TimingModel *model, FILE *out);
+
+// The emulator only appends to the batch; the model runs when it fills up
+static inline void timing_record(TimingModel *model, TimingEventType type, uint64_t addr, uint32_t arg) {
+    model->events[model->num_events++] = (TimingEvent) { .addr = addr, .arg = arg, .type = type };
+    if (model->num_events == TIMING_BATCH) {
+        timing_consume(model);
+    }
+}
+
+#endif // TIMING_H
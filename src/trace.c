@@ -0,0 +1,191 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "trace.h"
+#include "emulator.h"
+
+void init_tracer(Tracer *tracer) {
+    memset(tracer, 0, sizeof(Tracer));
+    tracer->window = TRACE_WINDOW;
+}
+
+static bool parse_range(const char *text, uint64_t *lo, uint64_t *hi, bool single_allowed) {
+    char *end;
+    *lo = strtoull(text, &end, 0);
+    if (end == text) {
+        return false;
+    }
+    if (*end == '-') {
+        const char *start = end + 1;
+        *hi = strtoull(start, &end, 0);
+        return end != start && *end == '\0' && *hi > *lo;
+    }
+    *hi = *lo + 1;
+    return single_allowed && *end == '\0';
+}
+
+bool add_trigger(Tracer *tracer, const char *spec) {
+    if (tracer->num_triggers == MAX_TRIGGERS) {
+        return false;
+    }
+    Trigger trigger = { .content = TRACE_FULL };
+
+    char text[256];
+    if (strlen(spec) >= sizeof(text)) {
+        return false;
+    }
+    strcpy(text, spec);
+    char *slash = strchr(text, '/');
+    if (slash) {
+        *slash = '\0';
+        if (strcmp(slash + 1, "regs") == 0) {
+            trigger.content = TRACE_REGS;
+        } else if (strcmp(slash + 1, "mem") == 0) {
+            trigger.content = TRACE_MEMORY;
+        } else if (strcmp(slash + 1, "full") != 0) {
+            return false;
+        }
+    }
+
+    bool ok;
+    if (strncmp(text, "pc:", 3) == 0) {
+        trigger.type = TRIGGER_PC;
+        ok = parse_range(text + 3, &trigger.lo, &trigger.hi, false);
+    } else if (strncmp(text, "instret:", 8) == 0) {
+        trigger.type = TRIGGER_INSTRET;
+        ok = parse_range(text + 8, &trigger.lo, &trigger.hi, false);
+    } else if (strncmp(text, "store:", 6) == 0) {
+        trigger.type = TRIGGER_STORE;
+        ok = parse_range(text + 6, &trigger.lo, &trigger.hi, true);
+        tracer->on_store |= ok;
+    } else if (strncmp(text, "csr:", 4) == 0) {
+        trigger.type = TRIGGER_CSR;
+        ok = parse_range(text + 4, &trigger.lo, &trigger.hi, true) && trigger.lo < 4096;
+        tracer->on_csr |= ok;
+    } else if (strcmp(text, "trap") == 0) {
+        trigger.type = TRIGGER_TRAP;
+        ok = true;
+        tracer->on_trap = true;
+    } else {
+        ok = false;
+    }
+    if (ok) {
+        tracer->triggers[tracer->num_triggers++] = trigger;
+    }
+    return ok;
+}
+
+bool trace_block(const Tracer *tracer, uint64_t pc, uint64_t instret, uint32_t count) {
+    if (instret < tracer->window_end) {
+        return true;
+    }
+    for (size_t i = 0; i < tracer->num_triggers; i++) {
+        const Trigger *trigger = &tracer->triggers[i];
+        if ((trigger->type == TRIGGER_PC && pc < trigger->hi && trigger->lo < pc + count * 4) ||
+            (trigger->type == TRIGGER_INSTRET && instret < trigger->hi && trigger->lo < instret + count)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint32_t active_content(const Tracer *tracer, uint64_t pc, uint64_t instret) {
+    uint32_t content = instret < tracer->window_end ? tracer->window_content : 0;
+    for (size_t i = 0; i < tracer->num_triggers; i++) {
+        const Trigger *trigger = &tracer->triggers[i];
+        if ((trigger->type == TRIGGER_PC && pc >= trigger->lo && pc < trigger->hi) ||
+            (trigger->type == TRIGGER_INSTRET && instret >= trigger->lo && instret < trigger->hi)) {
+            content |= trigger->content;
+        }
+    }
+    return content;
+}
+
+// Registers may change during the instruction, so the access address is taken beforehand
+void trace_before(Emulator *emu, uint32_t raw_instr) {
+    Instruction instr = decode(raw_instr);
+    uint32_t flags = isa_info[instr.op].flags;
+    if (flags & ISA_LOAD) {
+        emu->tracer->access = RS1 + instr.imm_l;
+    } else if (flags & ISA_STORE) {
+        emu->tracer->access = RS1 + instr.imm_s;
+    }
+}
+
+// Called after the instruction ran, with PC still pointing at it
+void trace_after(Emulator *emu, uint32_t raw_instr, uint64_t instret) {
+    Tracer *tracer = emu->tracer;
+    uint32_t content = active_content(tracer, PC, instret);
+    if (content == 0) {
+        return;
+    }
+    if (content & TRACE_FULL) {
+        fprintf(emu->log_file, "[%lu] ", instret);
+        log_state(emu, raw_instr);
+        return;
+    }
+
+    Instruction instr = decode(raw_instr);
+    if ((content & TRACE_REGS) && writes_rd(instr)) {
+        fprintf(emu->log_file, "[%lu] 0x%016lx x%u = 0x%016lx\n", instret, PC, instr.rd, RD);
+    }
+    uint32_t flags = isa_info[instr.op].flags;
+    if ((content & TRACE_MEMORY) && (flags & (ISA_LOAD | ISA_STORE))) {
+        bool load = flags & ISA_LOAD;
+        uint64_t value = load ? RD : RS2;
+        uint32_t size = 1 << (instr.funct3 & 0x3);
+        if (size < 8) {
+            value &= (1ull << (size * 8)) - 1;
+        }
+        fprintf(emu->log_file, "[%lu] 0x%016lx %s 0x%lx/%u = 0x%lx\n", instret, PC,
+                load ? "load" : "store", tracer->access, size, value);
+    }
+}
+
+// Event triggers open a window from the next block on
+static void open_window(Emulator *emu, uint32_t content) {
+    Tracer *tracer = emu->tracer;
+    uint64_t instret = retired_instrs(emu);
+    if (instret >= tracer->window_end) {
+        tracer->window_content = 0;
+    }
+    tracer->window_content |= content;
+    if (instret + tracer->window > tracer->window_end) {
+        tracer->window_end = instret + tracer->window;
+    }
+}
+
+void trace_store(Emulator *emu, uint64_t addr, uint64_t size) {
+    const Tracer *tracer = emu->tracer;
+    for (size_t i = 0; i < tracer->num_triggers; i++) {
+        const Trigger *trigger = &tracer->triggers[i];
+        if (trigger->type == TRIGGER_STORE && addr < trigger->hi && trigger->lo < addr + size) {
+            fprintf(emu->log_file, "[%lu] trigger: store to 0x%lx\n", retired_instrs(emu), addr);
+            open_window(emu, trigger->content);
+        }
+    }
+}
+
+void trace_csr(Emulator *emu, uint32_t csr, uint64_t old_value, uint64_t new_value) {
+    const Tracer *tracer = emu->tracer;
+    if (old_value == new_value) {
+        return;
+    }
+    for (size_t i = 0; i < tracer->num_triggers; i++) {
+        const Trigger *trigger = &tracer->triggers[i];
+        if (trigger->type == TRIGGER_CSR && csr >= trigger->lo && csr < trigger->hi) {
+            fprintf(emu->log_file, "[%lu] trigger: csr 0x%x 0x%lx -> 0x%lx\n", retired_instrs(emu), csr, old_value, new_value);
+            open_window(emu, trigger->content);
+        }
+    }
+}
+
+void trace_trap(Emulator *emu, uint64_t cause) {
+    const Tracer *tracer = emu->tracer;
+    for (size_t i = 0; i < tracer->num_triggers; i++) {
+        if (tracer->triggers[i].type == TRIGGER_TRAP) {
+            fprintf(emu->log_file, "[%lu] trigger: trap, mcause 0x%lx\n", retired_instrs(emu), cause);
+            open_window(emu, tracer->triggers[i].content);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MAX_TRIGGERS 16
+#define TRACE_WINDOW 10000 // Instructions traced after a store, CSR or trap trigger fires
+
+// What a trigger writes for each traced instruction
+#define TRACE_REGS 0x1   // Registers written
+#define TRACE_MEMORY 0x2 // Load and store addresses and values
+#define TRACE_FULL 0x4   // The same lines as log_state
+
+typedef enum {
+    TRIGGER_PC,      // Traces while PC is in [lo, hi)
+    TRIGGER_INSTRET, // Traces instructions number lo up to hi
+    TRIGGER_STORE,   // A store into [lo, hi) opens a window
+    TRIGGER_CSR,     // A write that changes CSR lo opens a window
+    TRIGGER_TRAP     // Trap entry opens a window
+} TriggerType;
+
+typedef struct {
+    TriggerType type;
+    uint64_t lo;
+    uint64_t hi;
+    uint32_t content; // TRACE_* bits
+} Trigger;
+
+typedef struct {
+    Trigger triggers[MAX_TRIGGERS];
+    size_t num_triggers;
+    uint64_t window;         // Length of the window an event trigger opens
+    uint64_t window_end;     // Instret where the open window closes
+    uint32_t window_content;
+    bool on_store;           // Which event hooks have triggers, so untraced code tests one flag
+    bool on_csr;
+    bool on_trap;
+    uint64_t access;         // Address of the load or store being traced
+} Tracer;
+
+struct Emulator;
+
+// Trace lines go to the emulator log file
+void init_tracer(Tracer *tracer);
+// "pc:LO-HI", "instret:LO-HI", "store:ADDR[-HI]", "csr:NUM" or "trap", optionally followed by
+// "/regs", "/mem" or "/full" (the default)
+bool add_trigger(Tracer *tracer, const char *spec);
+// Whether any instruction of a block may be traced; untraced blocks take the fast path
+bool trace_block(const Tracer *tracer, uint64_t pc, uint64_t instret, uint32_t count);
+void trace_before(struct Emulator *emu, uint32_t raw_instr);
+void trace_after(struct Emulator *emu, uint32_t raw_instr, uint64_t instret);
+void trace_store(struct Emulator *emu, uint64_t addr, uint64_t size);
+void trace_csr(struct Emulator *emu, uint32_t csr, uint64_t old_value, uint64_t new_value);
+void trace_trap(struct Emulator *emu, uint64_t cause);
+
+#endif // TRACE_H
@@ -0,0 +1,460 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <elf.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "usermode.h"
+#include "emulator.h"
+
+#define REG_SP 2
+#define REG_A0 USER_RESULT_REG
+#define REG_A7 17
+
+// USER_STACK_SIZE, or a quarter of RAM when that is smaller
+static uint64_t stack_size(const Emulator *emu) {
+    uint64_t quarter = (emu->memory_size / 4) & ~(uint64_t)(USER_PAGE_SIZE - 1);
+    return quarter < USER_STACK_SIZE ? quarter : USER_STACK_SIZE;
+}
+
+// The stack and the guard gap below it that mmap never hands out
+static uint64_t stack_reserve(const Emulator *emu) {
+    return stack_size(emu) + stack_size(emu) / 4;
+}
+
+void init_user_mode(Emulator *emu, UserMode *user, uint64_t brk) {
+    memset(user, 0, sizeof(UserMode));
+    user->brk_start = brk;
+    user->brk = brk;
+    user->stack_bottom = emu->memory_size - stack_size(emu);
+    user->mmap_bottom = emu->memory_size - stack_reserve(emu);
+    emu->user = user;
+}
+
+static uint64_t page_align(uint64_t value) {
+    return (value + USER_PAGE_SIZE - 1) & ~(uint64_t)(USER_PAGE_SIZE - 1);
+}
+
+static bool guest_range(const Emulator *emu, uint64_t addr, uint64_t len) {
+    return addr <= emu->memory_size && len <= emu->memory_size - addr;
+}
+
+static uint8_t *read_file(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        perror("Failed to open program");
+        return NULL;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t *data = length > 0 ? malloc(length) : NULL;
+    if (!data || fread(data, length, 1, file) != 1) {
+        fprintf(stderr, "Failed to read program: %s\n", path);
+        free(data);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+    *size = length;
+    return data;
+}
+
+// Copies a string onto the guest stack and returns its address
+static uint64_t push_string(Emulator *emu, uint64_t *sp, const char *text) {
+    size_t len = strlen(text) + 1;
+    *sp -= len;
+    memcpy(emu->memory + *sp, text, len);
+    return *sp;
+}
+
+static void store_u64(Emulator *emu, uint64_t addr, uint64_t value) {
+    memcpy(emu->memory + addr, &value, sizeof(value));
+}
+
+// The guest gets no environment, so runs do not depend on the host's
+static bool build_stack(Emulator *emu, int argc, char **argv, const Elf64_Ehdr *ehdr, uint64_t phdr_addr) {
+    // Strings go at the very top, then AT_RANDOM's 16 bytes
+    uint64_t sp = emu->memory_size;
+    uint64_t strings = 0;
+    for (int i = 0; i < argc; i++) {
+        strings += strlen(argv[i]) + 1;
+    }
+    if (strings + (argc + 64) * 8 > stack_size(emu) / 2) {
+        fprintf(stderr, "Arguments do not fit on the guest stack\n");
+        return false;
+    }
+    uint64_t *arg_addrs = malloc((argc + 1) * sizeof(uint64_t));
+    if (!arg_addrs) {
+        perror("Failed to allocate stack setup");
+        return false;
+    }
+    for (int i = 0; i < argc; i++) {
+        arg_addrs[i] = push_string(emu, &sp, argv[i]);
+    }
+    sp = (sp - 16) & ~15ull;
+    uint64_t random_addr = sp;
+    for (int i = 0; i < 16; i++) {
+        emu->memory[sp + i] = i * 0x9D + 0x5B; // Fixed bytes keep runs reproducible
+    }
+
+    uint64_t auxv[][2] = {
+        { AT_PHDR, phdr_addr },
+        { AT_PHENT, ehdr->e_phentsize },
+        { AT_PHNUM, ehdr->e_phnum },
+        { AT_PAGESZ, USER_PAGE_SIZE },
+        { AT_ENTRY, ehdr->e_entry },
+        { AT_UID, getuid() },
+        { AT_EUID, geteuid() },
+        { AT_GID, getgid() },
+        { AT_EGID, getegid() },
+        { AT_SECURE, 0 },
+        { AT_RANDOM, random_addr },
+        { AT_NULL, 0 },
+    };
+    size_t num_aux = sizeof(auxv) / sizeof(auxv[0]);
+    size_t words = 1 + (argc + 1) + 1 + num_aux * 2;
+    sp = (sp - words * 8) & ~15ull;
+
+    uint64_t pos = sp;
+    store_u64(emu, pos, argc);
+    pos += 8;
+    for (int i = 0; i < argc; i++, pos += 8) {
+        store_u64(emu, pos, arg_addrs[i]);
+    }
+    store_u64(emu, pos, 0);
+    pos += 8;
+    store_u64(emu, pos, 0); // envp
+    pos += 8;
+    for (size_t i = 0; i < num_aux; i++, pos += 16) {
+        store_u64(emu, pos, auxv[i][0]);
+        store_u64(emu, pos + 8, auxv[i][1]);
+    }
+    free(arg_addrs);
+
+    emu->state.regs[REG_SP] = sp;
+    return true;
+}
+
+bool load_user_program(Emulator *emu, UserMode *user, int argc, char **argv) {
+    size_t size;
+    uint8_t *image = read_file(argv[0], &size);
+    if (!image) {
+        return false;
+    }
+
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)image;
+    if (size < sizeof(Elf64_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0 ||
+        ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_ident[EI_DATA] != ELFDATA2LSB ||
+        ehdr->e_machine != EM_RISCV || ehdr->e_type != ET_EXEC ||
+        ehdr->e_phoff + (uint64_t)ehdr->e_phnum * sizeof(Elf64_Phdr) > size) {
+        fprintf(stderr, "Not a static RV64 executable: %s\n", argv[0]);
+        free(image);
+        return false;
+    }
+
+    const Elf64_Phdr *phdrs = (const Elf64_Phdr *)(image + ehdr->e_phoff);
+    uint64_t image_start = UINT64_MAX, image_end = 0;
+    uint64_t phdr_addr = 0;
+    for (int i = 0; i < ehdr->e_phnum; i++) {
+        const Elf64_Phdr *phdr = &phdrs[i];
+        if (phdr->p_type != PT_LOAD) {
+            continue;
+        }
+        if (!guest_range(emu, phdr->p_vaddr, phdr->p_memsz) ||
+            phdr->p_vaddr + phdr->p_memsz > emu->memory_size - stack_reserve(emu) ||
+            phdr->p_filesz > phdr->p_memsz || phdr->p_offset + phdr->p_filesz > size) {
+            fprintf(stderr, "Segment at 0x%lx (%lu bytes) does not fit in guest memory\n", phdr->p_vaddr, phdr->p_memsz);
+            free(image);
+            return false;
+        }
+        memcpy(emu->memory + phdr->p_vaddr, image + phdr->p_offset, phdr->p_filesz);
+        memset(emu->memory + phdr->p_vaddr + phdr->p_filesz, 0, phdr->p_memsz - phdr->p_filesz);
+        if (phdr->p_vaddr < image_start) {
+            image_start = phdr->p_vaddr;
+        }
+        if (phdr->p_vaddr + phdr->p_memsz > image_end) {
+            image_end = phdr->p_vaddr + phdr->p_memsz;
+        }
+        if (ehdr->e_phoff >= phdr->p_offset && ehdr->e_phoff < phdr->p_offset + phdr->p_filesz) {
+            phdr_addr = phdr->p_vaddr + (ehdr->e_phoff - phdr->p_offset);
+        }
+    }
+
+    bool ok = build_stack(emu, argc, argv, ehdr, phdr_addr);
+    if (ok) {
+        init_user_mode(emu, user, page_align(image_end));
+        emu->state.pc = ehdr->e_entry;
+        emu->state.dnpc = ehdr->e_entry + 4;
+        emu->image_start = image_start < image_end ? image_start : 0;
+        emu->image_end = image_end;
+        flush_block_cache(emu);
+    }
+    free(image);
+    return ok;
+}
+
+// stdio and the files the guest opened itself; the log, record and trace files stay out of reach
+static bool guest_fd(const Emulator *emu, int64_t fd) {
+    return fd >= 0 && fd < USER_MAX_FDS && (fd <= STDERR_FILENO || emu->user->open_fds[fd]);
+}
+
+static int64_t sys_read(Emulator *emu, int64_t fd, uint64_t buf, uint64_t len) {
+    if (!guest_fd(emu, fd)) {
+        return -EBADF;
+    }
+    if (!guest_range(emu, buf, len)) {
+        return -EFAULT;
+    }
+    // The host reads straight into guest memory
+    ssize_t n = read(fd, emu->memory + buf, len);
+    if (n < 0) {
+        return -errno;
+    }
+    mark_dirty(emu, buf, n);
+    return n;
+}
+
+static int64_t sys_write(Emulator *emu, int64_t fd, uint64_t buf, uint64_t len) {
+    if (!guest_fd(emu, fd)) {
+        return -EBADF;
+    }
+    if (!guest_range(emu, buf, len)) {
+        return -EFAULT;
+    }
+    if (fd == STDOUT_FILENO) {
+        fflush(stdout); // Keep the order relative to UART output
+    }
+    ssize_t n = write(fd, emu->memory + buf, len);
+    return n < 0 ? -errno : n;
+}
+
+// One write per iovec entry, stopping at the first short or failed one
+static int64_t sys_writev(Emulator *emu, int64_t fd, uint64_t iov, uint64_t count) {
+    if (count > LINUX_IOV_MAX || !guest_range(emu, iov, count * 16)) {
+        return -EINVAL;
+    }
+    int64_t total = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        uint64_t base, len;
+        memcpy(&base, emu->memory + iov + i * 16, 8);
+        memcpy(&len, emu->memory + iov + i * 16 + 8, 8);
+        int64_t n = sys_write(emu, fd, base, len);
+        if (n < 0) {
+            return total ? total : n;
+        }
+        total += n;
+        if ((uint64_t)n < len) {
+            break;
+        }
+    }
+    return total;
+}
+
+static int64_t sys_openat(Emulator *emu, int64_t dirfd, uint64_t path, int flags, int mode) {
+    if (dirfd != AT_FDCWD && !guest_fd(emu, dirfd)) {
+        return -EBADF;
+    }
+    if (path >= emu->memory_size || !memchr(emu->memory + path, '\0', emu->memory_size - path)) {
+        return -EFAULT;
+    }
+    int fd = openat(dirfd, (const char *)emu->memory + path, flags, mode);
+    if (fd < 0) {
+        return -errno;
+    }
+    if (fd >= USER_MAX_FDS) {
+        close(fd);
+        return -EMFILE;
+    }
+    emu->user->open_fds[fd] = true;
+    return fd;
+}
+
+static int64_t sys_close(Emulator *emu, int64_t fd) {
+    if (!guest_fd(emu, fd)) {
+        return -EBADF;
+    }
+    if (fd <= STDERR_FILENO) {
+        return 0; // The emulator still needs its own stdio
+    }
+    emu->user->open_fds[fd] = false;
+    return close(fd) < 0 ? -errno : 0;
+}
+
+static int64_t sys_lseek(Emulator *emu, int64_t fd, int64_t offset, int whence) {
+    if (!guest_fd(emu, fd)) {
+        return -EBADF;
+    }
+    off_t position = lseek(fd, offset, whence);
+    return position < 0 ? -errno : position;
+}
+
+static int64_t sys_fstat(Emulator *emu, int64_t fd, uint64_t buf) {
+    struct stat st;
+    if (!guest_fd(emu, fd)) {
+        return -EBADF;
+    }
+    if (!guest_range(emu, buf, LINUX_STAT_SIZE)) {
+        return -EFAULT;
+    }
+    if (fstat(fd, &st) < 0) {
+        return -errno;
+    }
+    // struct stat as laid out by asm-generic for 64-bit targets
+    uint8_t *out = emu->memory + buf;
+    memset(out, 0, LINUX_STAT_SIZE);
+    uint64_t dev = st.st_dev, ino = st.st_ino, rdev = st.st_rdev;
+    uint32_t mode = st.st_mode, nlink = st.st_nlink, uid = st.st_uid, gid = st.st_gid;
+    int64_t fsize = st.st_size, blocks = st.st_blocks;
+    int32_t blksize = st.st_blksize;
+    int64_t times[6] = { st.st_atim.tv_sec, st.st_atim.tv_nsec, st.st_mtim.tv_sec,
+                         st.st_mtim.tv_nsec, st.st_ctim.tv_sec, st.st_ctim.tv_nsec };
+    memcpy(out + 0, &dev, 8);
+    memcpy(out + 8, &ino, 8);
+    memcpy(out + 16, &mode, 4);
+    memcpy(out + 20, &nlink, 4);
+    memcpy(out + 24, &uid, 4);
+    memcpy(out + 28, &gid, 4);
+    memcpy(out + 32, &rdev, 8);
+    memcpy(out + 48, &fsize, 8);
+    memcpy(out + 56, &blksize, 4);
+    memcpy(out + 64, &blocks, 8);
+    memcpy(out + 72, times, sizeof(times));
+    mark_dirty(emu, buf, LINUX_STAT_SIZE);
+    return 0;
+}
+
+// Guest time comes from mtime so --record/--replay cover it; a timespec counts in ns, a timeval in us
+static int64_t sys_time(Emulator *emu, uint64_t addr, uint64_t units_per_second) {
+    if (!guest_range(emu, addr, 16)) {
+        return -EFAULT;
+    }
+    uint64_t ns = device_mtime(emu) * (1000000000ull / MTIME_HZ);
+    int64_t time[2] = { ns / 1000000000ull, ns % 1000000000ull / (1000000000ull / units_per_second) };
+    memcpy(emu->memory + addr, time, sizeof(time));
+    mark_dirty(emu, addr, sizeof(time));
+    return 0;
+}
+
+static int64_t sys_brk(Emulator *emu, uint64_t addr) {
+    UserMode *user = emu->user;
+    if (addr >= user->brk_start && addr <= user->mmap_bottom) {
+        if (addr > user->brk) {
+            memset(emu->memory + user->brk, 0, addr - user->brk);
+            mark_dirty(emu, user->brk, addr - user->brk);
+        }
+        user->brk = addr;
+    }
+    return user->brk;
+}
+
+static int64_t sys_mmap(Emulator *emu, uint64_t addr, uint64_t len, uint64_t flags, int64_t fd, uint64_t offset) {
+    UserMode *user = emu->user;
+    len = page_align(len);
+    if (len == 0) {
+        return -EINVAL;
+    }
+    if (flags & LINUX_MAP_FIXED) {
+        if (!guest_range(emu, addr, len) || (addr & (USER_PAGE_SIZE - 1))) {
+            return -ENOMEM;
+        }
+    } else {
+        if (len > user->mmap_bottom - user->brk) {
+            return -ENOMEM;
+        }
+        user->mmap_bottom -= len;
+        addr = user->mmap_bottom;
+    }
+
+    if (!(flags & LINUX_MAP_ANONYMOUS) && !guest_fd(emu, fd)) {
+        return -EBADF;
+    }
+    memset(emu->memory + addr, 0, len);
+    if (!(flags & LINUX_MAP_ANONYMOUS) && pread(fd, emu->memory + addr, len, offset) < 0) {
+        return -errno;
+    }
+    mark_dirty(emu, addr, len);
+    return addr;
+}
+
+void user_syscall(Emulator *emu) {
+    uint64_t *regs = emu->state.regs;
+    uint64_t *args = &regs[REG_A0];
+    int64_t ret;
+
+    // Nothing is mapped in the guard gap, so a stack pointer there means the stack overflowed
+    if (regs[REG_SP] < emu->user->stack_bottom && regs[REG_SP] >= emu->memory_size - stack_reserve(emu)) {
+        fprintf(stderr, "Guest stack overflow: sp 0x%lx is below the %lu byte stack\n", regs[REG_SP], stack_size(emu));
+        emu->user->exited = true;
+        emu->user->exit_status = USER_STACK_OVERFLOW_STATUS;
+        emu->stop_reason = STOP_EXIT;
+        return;
+    }
+
+    switch (regs[REG_A7]) {
+        case LINUX_SYS_READ:
+            ret = sys_read(emu, args[0], args[1], args[2]);
+            break;
+        case LINUX_SYS_WRITE:
+            ret = sys_write(emu, args[0], args[1], args[2]);
+            break;
+        case LINUX_SYS_WRITEV:
+            ret = sys_writev(emu, args[0], args[1], args[2]);
+            break;
+        case LINUX_SYS_OPENAT:
+            ret = sys_openat(emu, args[0], args[1], args[2], args[3]);
+            break;
+        case LINUX_SYS_CLOSE:
+            ret = sys_close(emu, args[0]);
+            break;
+        case LINUX_SYS_LSEEK:
+            ret = sys_lseek(emu, args[0], args[1], args[2]);
+            break;
+        case LINUX_SYS_FSTAT:
+            ret = sys_fstat(emu, args[0], args[1]);
+            break;
+        case LINUX_SYS_IOCTL:
+            ret = guest_fd(emu, args[0]) ? -ENOTTY : -EBADF; // No terminals, so stdio stays fully buffered
+            break;
+        case LINUX_SYS_CLOCK_GETTIME:
+            ret = sys_time(emu, args[1], 1000000000);
+            break;
+        case LINUX_SYS_GETTIMEOFDAY:
+            ret = args[0] ? sys_time(emu, args[0], 1000000) : 0;
+            break;
+        case LINUX_SYS_BRK:
+            ret = sys_brk(emu, args[0]);
+            break;
+        case LINUX_SYS_MMAP:
+            ret = sys_mmap(emu, args[0], args[1], args[3], args[4], args[5]);
+            break;
+        case LINUX_SYS_MUNMAP:
+            ret = 0; // Guest memory is never handed back
+            break;
+        case LINUX_SYS_MPROTECT:
+        case LINUX_SYS_RT_SIGACTION:
+        case LINUX_SYS_RT_SIGPROCMASK:
+            ret = 0; // All guest memory is accessible and no signal is ever delivered
+            break;
+        case LINUX_SYS_SET_TID_ADDRESS:
+        case LINUX_SYS_GETPID:
+        case LINUX_SYS_GETTID:
+            ret = USER_PID;
+            break;
+        case LINUX_SYS_EXIT:
+        case LINUX_SYS_EXIT_GROUP:
+            emu->user->exited = true;
+            emu->user->exit_status = args[0] & 0xFF;
+            emu->stop_reason = STOP_EXIT;
+            return;
+        default:
+            fprintf(stderr, "Unsupported syscall %lu at PC: 0x%016lx\n", regs[REG_A7], emu->state.pc);
+            ret = -ENOSYS;
+            break;
+    }
+    regs[REG_A0] = ret;
+}
@@ -0,0 +1,61 @@
+#ifndef USERMODE_H
+#define USERMODE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define USER_STACK_SIZE (8u << 20) // At the top of guest memory, capped at a quarter of smaller RAM
+#define USER_STACK_OVERFLOW_STATUS 139 // Exit status of a guest that ran its stack into the guard gap
+#define USER_PAGE_SIZE 4096
+#define USER_MEMORY_SIZE (64u << 20) // Guest RAM under --user without --memory, room for the usual 0x10000 link address
+#define USER_MAX_FDS 1024
+#define USER_PID 1 // The only thread of the only process
+#define USER_RESULT_REG 10 // a0, which every syscall overwrites with its result
+
+// RV64 Linux syscall numbers (asm-generic)
+#define LINUX_SYS_IOCTL 29
+#define LINUX_SYS_OPENAT 56
+#define LINUX_SYS_CLOSE 57
+#define LINUX_SYS_LSEEK 62
+#define LINUX_SYS_READ 63
+#define LINUX_SYS_WRITE 64
+#define LINUX_SYS_WRITEV 66
+#define LINUX_SYS_FSTAT 80
+#define LINUX_SYS_EXIT 93
+#define LINUX_SYS_EXIT_GROUP 94
+#define LINUX_SYS_SET_TID_ADDRESS 96
+#define LINUX_SYS_CLOCK_GETTIME 113
+#define LINUX_SYS_RT_SIGACTION 134
+#define LINUX_SYS_RT_SIGPROCMASK 135
+#define LINUX_SYS_GETTIMEOFDAY 169
+#define LINUX_SYS_GETPID 172
+#define LINUX_SYS_GETTID 178
+#define LINUX_SYS_BRK 214
+#define LINUX_SYS_MUNMAP 215
+#define LINUX_SYS_MMAP 222
+#define LINUX_SYS_MPROTECT 226
+
+#define LINUX_MAP_FIXED 0x10
+#define LINUX_MAP_ANONYMOUS 0x20
+#define LINUX_STAT_SIZE 128
+#define LINUX_IOV_MAX 1024
+
+typedef struct {
+    uint64_t brk_start;   // End of the loaded image
+    uint64_t brk;
+    uint64_t stack_bottom; // The stack grows down to here
+    uint64_t mmap_bottom; // Lowest address handed out by mmap so far; starts a guard gap below the stack
+    bool open_fds[USER_MAX_FDS]; // Host fds the guest opened; it never sees the emulator's own files
+    bool exited;
+    int exit_status;
+} UserMode;
+
+struct Emulator;
+
+// Makes ecall a Linux syscall; brk starts at the end of the program image
+void init_user_mode(struct Emulator *emu, UserMode *user, uint64_t brk);
+// Loads a static RV64 ELF executable and builds the initial stack (argv, an empty envp, auxv)
+bool load_user_program(struct Emulator *emu, UserMode *user, int argc, char **argv);
+void user_syscall(struct Emulator *emu);
+
+#endif // USERMODE_H
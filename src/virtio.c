@@ -0,0 +1,365 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "virtio.h"
+#include "emulator.h"
+
+// One guest buffer of a descriptor chain
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    bool write; // Device-writable
+} Segment;
+
+bool open_virtio(Virtio *virtio, const char *disk_path, bool console) {
+    memset(virtio, 0, sizeof(Virtio));
+    if (disk_path) {
+        int fd = open(disk_path, O_RDWR);
+        if (fd < 0 && (errno == EACCES || errno == EROFS)) {
+            fd = open(disk_path, O_RDONLY);
+            virtio->read_only = true;
+        }
+        if (fd < 0) {
+            perror("Failed to open disk image");
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < VIRTIO_BLK_SECTOR_SIZE) {
+            fprintf(stderr, "Disk image is smaller than one sector: %s\n", disk_path);
+            close(fd);
+            return false;
+        }
+        // A partial last sector is not addressable, so it is not mapped either
+        virtio->disk_size = st.st_size / VIRTIO_BLK_SECTOR_SIZE * VIRTIO_BLK_SECTOR_SIZE;
+        void *disk = mmap(NULL, virtio->disk_size, PROT_READ | (virtio->read_only ? 0 : PROT_WRITE), MAP_SHARED, fd, 0);
+        close(fd);
+        if (disk == MAP_FAILED) {
+            perror("Failed to map disk image");
+            return false;
+        }
+        virtio->disk = disk;
+        VirtioDevice *blk = &virtio->devices[VIRTIO_BLK];
+        blk->device_id = VIRTIO_ID_BLOCK;
+        blk->num_queues = 1;
+        blk->features = VIRTIO_F_VERSION_1 | VIRTIO_BLK_F_FLUSH | (virtio->read_only ? VIRTIO_BLK_F_RO : 0);
+    }
+    if (console) {
+        VirtioDevice *cons = &virtio->devices[VIRTIO_CONSOLE];
+        cons->device_id = VIRTIO_ID_CONSOLE;
+        cons->num_queues = 2; // receiveq, transmitq
+        cons->features = VIRTIO_F_VERSION_1;
+    }
+    return true;
+}
+
+void close_virtio(Virtio *virtio) {
+    fflush(stdout);
+    if (virtio->disk) {
+        munmap(virtio->disk, virtio->disk_size);
+    }
+    virtio->disk = NULL;
+}
+
+// Host pointer to [addr, addr + len) of guest RAM, NULL when any of it is outside
+static uint8_t *guest_range(Emulator *emu, uint64_t addr, uint64_t len) {
+    if (len > emu->memory_size || addr > emu->memory_size - len) {
+        return NULL;
+    }
+    return &emu->memory[addr];
+}
+
+static uint16_t read16(const uint8_t *p) {
+    uint16_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// Follows the chain from head, checking every buffer against RAM; 0 when it is malformed
+static uint32_t read_chain(Emulator *emu, const VirtQueue *queue, uint16_t head, Segment *segs) {
+    uint16_t index = head;
+    for (uint32_t count = 0; count < queue->num; count++) {
+        if (index >= queue->num) {
+            return 0;
+        }
+        const uint8_t *desc = &emu->memory[queue->desc + index * 16ull];
+        uint16_t flags = read16(desc + 12);
+        memcpy(&segs[count].addr, desc, sizeof(uint64_t));
+        memcpy(&segs[count].len, desc + 8, sizeof(uint32_t));
+        segs[count].write = flags & VIRTQ_DESC_F_WRITE;
+        if (!guest_range(emu, segs[count].addr, segs[count].len)) {
+            return 0;
+        }
+        if (!(flags & VIRTQ_DESC_F_NEXT)) {
+            return count + 1;
+        }
+        index = read16(desc + 14);
+    }
+    return 0; // Longer than the queue, so it loops
+}
+
+// Header {type, reserved, sector} in the first buffer, the status byte at the end of the last
+// one and the data in between; returns how many bytes went into device-writable buffers
+static uint32_t serve_block(Emulator *emu, Virtio *virtio, const Segment *segs, uint32_t count) {
+    const Segment *status = &segs[count - 1];
+    if (count < 2 || segs[0].write || segs[0].len < 16 || !status->write || status->len == 0) {
+        return 0;
+    }
+    uint32_t type;
+    uint64_t sector;
+    memcpy(&type, &emu->memory[segs[0].addr], sizeof(type));
+    memcpy(&sector, &emu->memory[segs[0].addr + 8], sizeof(sector));
+
+    static const char id[VIRTIO_BLK_ID_BYTES] = "rvemu-disk";
+    uint8_t result = VIRTIO_BLK_S_OK;
+    uint32_t written = 0;
+    if (type == VIRTIO_BLK_T_IN || type == VIRTIO_BLK_T_OUT || type == VIRTIO_BLK_T_GET_ID) {
+        bool to_guest = type != VIRTIO_BLK_T_OUT;
+        uint64_t offset = sector * VIRTIO_BLK_SECTOR_SIZE;
+        const uint8_t *source = virtio->disk;
+        uint64_t source_size = virtio->disk_size;
+        if (type == VIRTIO_BLK_T_GET_ID) {
+            source = (const uint8_t *)id;
+            source_size = sizeof(id);
+            offset = 0;
+        } else if (sector > virtio->disk_size / VIRTIO_BLK_SECTOR_SIZE || (!to_guest && virtio->read_only)) {
+            result = VIRTIO_BLK_S_IOERR;
+        }
+        // Straight between the disk mapping and guest RAM, one memcpy per buffer
+        for (uint32_t i = 1; i < count && result == VIRTIO_BLK_S_OK; i++) {
+            uint64_t len = segs[i].len - (i == count - 1);
+            if (type == VIRTIO_BLK_T_GET_ID && len > source_size - offset) {
+                len = source_size - offset;
+            }
+            if (len == 0) {
+                continue; // The status byte on its own
+            }
+            if (segs[i].write != to_guest || len > source_size - offset) {
+                result = VIRTIO_BLK_S_IOERR;
+                break;
+            }
+            if (to_guest) {
+                memcpy(&emu->memory[segs[i].addr], source + offset, len);
+                mark_dirty(emu, segs[i].addr, len);
+                written += len;
+            } else {
+                memcpy(virtio->disk + offset, &emu->memory[segs[i].addr], len);
+            }
+            offset += len;
+        }
+    } else if (type == VIRTIO_BLK_T_FLUSH) {
+        if (msync(virtio->disk, virtio->disk_size, MS_SYNC) != 0) {
+            result = VIRTIO_BLK_S_IOERR;
+        }
+    } else {
+        result = VIRTIO_BLK_S_UNSUPP;
+    }
+    uint64_t status_addr = status->addr + status->len - 1;
+    emu->memory[status_addr] = result;
+    mark_dirty(emu, status_addr, 1);
+    return written + 1;
+}
+
+// Output goes into the stdio buffer a whole guest buffer at a time
+static uint32_t serve_console(Emulator *emu, const Segment *segs, uint32_t count) {
+    for (uint32_t i = 0; i < count; i++) {
+        if (!segs[i].write) {
+            fwrite(&emu->memory[segs[i].addr], 1, segs[i].len, stdout);
+        }
+    }
+    return 0;
+}
+
+// Serves every chain made available since the last notify, then publishes them in one used index update
+static void notify(Emulator *emu, VirtioDevice *dev, uint32_t index) {
+    Virtio *virtio = emu->virtio;
+    if (index >= dev->num_queues || !(dev->status & VIRTIO_STATUS_DRIVER_OK)) {
+        return;
+    }
+    VirtQueue *queue = &dev->queues[index];
+    if (!queue->ready || (dev->device_id == VIRTIO_ID_CONSOLE && index == 0)) {
+        return; // Receive buffers stay with the device: there is no console input
+    }
+    const uint8_t *avail = guest_range(emu, queue->driver, 4 + 2ull * queue->num);
+    uint8_t *used = guest_range(emu, queue->device, 4 + 8ull * queue->num);
+    uint16_t avail_idx = avail ? read16(avail + 2) : 0;
+    if (!guest_range(emu, queue->desc, 16ull * queue->num) || !avail || !used ||
+        (uint16_t)(avail_idx - queue->last_avail) > queue->num) {
+        dev->status |= VIRTIO_STATUS_NEEDS_RESET;
+        return;
+    }
+
+    uint16_t used_idx = read16(used + 2);
+    uint32_t served = 0;
+    Segment segs[VIRTIO_QUEUE_SIZE];
+    while (queue->last_avail != avail_idx) {
+        uint16_t head = read16(avail + 4 + 2 * (queue->last_avail % queue->num));
+        uint32_t count = read_chain(emu, queue, head, segs);
+        if (count == 0) {
+            dev->status |= VIRTIO_STATUS_NEEDS_RESET;
+            break;
+        }
+        uint32_t written = dev->device_id == VIRTIO_ID_BLOCK ? serve_block(emu, virtio, segs, count) : serve_console(emu, segs, count);
+        uint32_t elem[2] = { head, written };
+        memcpy(used + 4 + 8 * (used_idx % queue->num), elem, sizeof(elem));
+        used_idx++;
+        queue->last_avail++;
+        served++;
+    }
+    if (served == 0) {
+        return;
+    }
+    memcpy(used + 2, &used_idx, sizeof(used_idx));
+    mark_dirty(emu, queue->device, 4 + 8ull * queue->num);
+    dev->requests += served;
+    dev->interrupt_status |= VIRTIO_INT_USED_BUFFER;
+    if (dev->device_id == VIRTIO_ID_CONSOLE) {
+        fflush(stdout); // Once per batch instead of once per character
+    }
+}
+
+static void reset_device(VirtioDevice *dev) {
+    VirtioDevice fresh = {
+        .device_id = dev->device_id,
+        .num_queues = dev->num_queues,
+        .features = dev->features,
+        .requests = dev->requests
+    };
+    *dev = fresh;
+}
+
+static void set_half(uint64_t *field, bool high, uint32_t value) {
+    uint32_t shift = high ? 32 : 0;
+    *field = (*field & ~(0xFFFFFFFFull << shift)) | (uint64_t)value << shift;
+}
+
+static VirtQueue *selected_queue(VirtioDevice *dev) {
+    return dev->queue_sel < dev->num_queues ? &dev->queues[dev->queue_sel] : NULL;
+}
+
+static uint64_t read_config(const Virtio *virtio, const VirtioDevice *dev, uint32_t offset, uint32_t size) {
+    uint8_t config[8] = { 0 };
+    if (dev->device_id == VIRTIO_ID_BLOCK) {
+        uint64_t capacity = virtio->disk_size / VIRTIO_BLK_SECTOR_SIZE; // In sectors
+        memcpy(config, &capacity, sizeof(capacity));
+    }
+    uint64_t value = 0;
+    if (offset < sizeof(config) && size <= sizeof(config) - offset) {
+        memcpy(&value, &config[offset], size);
+    }
+    return value;
+}
+
+uint64_t virtio_load(Emulator *emu, uint64_t addr, uint32_t size) {
+    VirtioDevice *dev = &emu->virtio->devices[(addr - VIRTIO_BASE) / VIRTIO_MMIO_SIZE];
+    uint32_t offset = (addr - VIRTIO_BASE) % VIRTIO_MMIO_SIZE;
+    if (offset >= VIRTIO_MMIO_CONFIG) {
+        return read_config(emu->virtio, dev, offset - VIRTIO_MMIO_CONFIG, size);
+    }
+    if (size != 4) {
+        return 0;
+    }
+    VirtQueue *queue = selected_queue(dev);
+    switch (offset) {
+    case VIRTIO_MMIO_MAGIC:
+        return VIRTIO_MAGIC;
+    case VIRTIO_MMIO_VERSION:
+        return 2;
+    case VIRTIO_MMIO_DEVICE_ID:
+        return dev->device_id;
+    case VIRTIO_MMIO_VENDOR_ID:
+        return VIRTIO_VENDOR_ID;
+    case VIRTIO_MMIO_DEVICE_FEATURES:
+        return dev->features_sel < 2 ? (uint32_t)(dev->features >> (dev->features_sel * 32)) : 0;
+    case VIRTIO_MMIO_QUEUE_NUM_MAX:
+        return queue ? VIRTIO_QUEUE_SIZE : 0;
+    case VIRTIO_MMIO_QUEUE_READY:
+        return queue && queue->ready;
+    case VIRTIO_MMIO_INTERRUPT_STATUS:
+        return dev->interrupt_status;
+    case VIRTIO_MMIO_STATUS:
+        return dev->status;
+    default:
+        return 0; // Write-only registers and ConfigGeneration, which never changes
+    }
+}
+
+void virtio_store(Emulator *emu, uint64_t addr, uint32_t size, uint64_t value) {
+    VirtioDevice *dev = &emu->virtio->devices[(addr - VIRTIO_BASE) / VIRTIO_MMIO_SIZE];
+    uint32_t offset = (addr - VIRTIO_BASE) % VIRTIO_MMIO_SIZE;
+    if (dev->device_id == 0 || size != 4 || offset >= VIRTIO_MMIO_CONFIG) {
+        return; // Nothing is there, or the write-only config space of these devices
+    }
+    VirtQueue *queue = selected_queue(dev);
+    uint32_t data = value;
+    switch (offset) {
+    case VIRTIO_MMIO_DEVICE_FEATURES_SEL:
+        dev->features_sel = data;
+        break;
+    case VIRTIO_MMIO_DRIVER_FEATURES:
+        if (dev->driver_features_sel < 2) {
+            set_half(&dev->driver_features, dev->driver_features_sel, data);
+        }
+        break;
+    case VIRTIO_MMIO_DRIVER_FEATURES_SEL:
+        dev->driver_features_sel = data;
+        break;
+    case VIRTIO_MMIO_QUEUE_SEL:
+        dev->queue_sel = data;
+        break;
+    case VIRTIO_MMIO_QUEUE_NUM:
+        // Split rings are a power of two long
+        if (queue && !queue->ready && data && data <= VIRTIO_QUEUE_SIZE && (data & (data - 1)) == 0) {
+            queue->num = data;
+        }
+        break;
+    case VIRTIO_MMIO_QUEUE_READY:
+        if (queue) {
+            queue->ready = (data & 1) && queue->num;
+        }
+        break;
+    case VIRTIO_MMIO_QUEUE_NOTIFY:
+        notify(emu, dev, data);
+        break;
+    case VIRTIO_MMIO_INTERRUPT_ACK:
+        dev->interrupt_status &= ~data;
+        break;
+    case VIRTIO_MMIO_STATUS:
+        if (data == 0) {
+            reset_device(dev);
+        } else {
+            // Features the device never offered are refused by leaving FEATURES_OK clear
+            if (dev->driver_features & ~dev->features) {
+                data &= ~VIRTIO_STATUS_FEATURES_OK;
+            }
+            dev->status = data;
+        }
+        break;
+    case VIRTIO_MMIO_QUEUE_DESC_LOW:
+    case VIRTIO_MMIO_QUEUE_DESC_HIGH:
+        if (queue) {
+            set_half(&queue->desc, offset == VIRTIO_MMIO_QUEUE_DESC_HIGH, data);
+        }
+        break;
+    case VIRTIO_MMIO_QUEUE_DRIVER_LOW:
+    case VIRTIO_MMIO_QUEUE_DRIVER_HIGH:
+        if (queue) {
+            set_half(&queue->driver, offset == VIRTIO_MMIO_QUEUE_DRIVER_HIGH, data);
+        }
+        break;
+    case VIRTIO_MMIO_QUEUE_DEVICE_LOW:
+    case VIRTIO_MMIO_QUEUE_DEVICE_HIGH:
+        if (queue) {
+            set_half(&queue->device, offset == VIRTIO_MMIO_QUEUE_DEVICE_HIGH, data);
+        }
+        break;
+    default:
+        break;
+    }
+}
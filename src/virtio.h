@@ -0,0 +1,110 @@
+#ifndef VIRTIO_H
+#define VIRTIO_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// virtio-mmio (version 2) devices, one 4 KiB window each after the UART
+#define VIRTIO_BASE 0x10001000
+#define VIRTIO_MMIO_SIZE 0x1000
+#define VIRTIO_BLK 0     // Window 0: block device backed by --disk
+#define VIRTIO_CONSOLE 1 // Window 1: console, transmit only
+#define VIRTIO_NUM_DEVICES 2
+
+// Register offsets; everything below the config space is a 32-bit register
+#define VIRTIO_MMIO_MAGIC 0x000
+#define VIRTIO_MMIO_VERSION 0x004
+#define VIRTIO_MMIO_DEVICE_ID 0x008
+#define VIRTIO_MMIO_VENDOR_ID 0x00c
+#define VIRTIO_MMIO_DEVICE_FEATURES 0x010
+#define VIRTIO_MMIO_DEVICE_FEATURES_SEL 0x014
+#define VIRTIO_MMIO_DRIVER_FEATURES 0x020
+#define VIRTIO_MMIO_DRIVER_FEATURES_SEL 0x024
+#define VIRTIO_MMIO_QUEUE_SEL 0x030
+#define VIRTIO_MMIO_QUEUE_NUM_MAX 0x034
+#define VIRTIO_MMIO_QUEUE_NUM 0x038
+#define VIRTIO_MMIO_QUEUE_READY 0x044
+#define VIRTIO_MMIO_QUEUE_NOTIFY 0x050
+#define VIRTIO_MMIO_INTERRUPT_STATUS 0x060
+#define VIRTIO_MMIO_INTERRUPT_ACK 0x064
+#define VIRTIO_MMIO_STATUS 0x070
+#define VIRTIO_MMIO_QUEUE_DESC_LOW 0x080
+#define VIRTIO_MMIO_QUEUE_DESC_HIGH 0x084
+#define VIRTIO_MMIO_QUEUE_DRIVER_LOW 0x090
+#define VIRTIO_MMIO_QUEUE_DRIVER_HIGH 0x094
+#define VIRTIO_MMIO_QUEUE_DEVICE_LOW 0x0a0
+#define VIRTIO_MMIO_QUEUE_DEVICE_HIGH 0x0a4
+#define VIRTIO_MMIO_CONFIG_GENERATION 0x0fc
+#define VIRTIO_MMIO_CONFIG 0x100
+
+#define VIRTIO_MAGIC 0x74726976 // "virt"
+#define VIRTIO_VENDOR_ID 0x4d455652 // "RVEM"
+#define VIRTIO_ID_BLOCK 2
+#define VIRTIO_ID_CONSOLE 3
+
+#define VIRTIO_STATUS_DRIVER_OK 0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+#define VIRTIO_STATUS_NEEDS_RESET 0x40
+#define VIRTIO_INT_USED_BUFFER 0x1
+
+#define VIRTIO_F_VERSION_1 (1ull << 32)
+#define VIRTIO_BLK_F_RO (1ull << 5)
+#define VIRTIO_BLK_F_FLUSH (1ull << 9)
+
+#define VIRTQ_DESC_F_NEXT 0x1
+#define VIRTQ_DESC_F_WRITE 0x2
+
+#define VIRTIO_BLK_T_IN 0
+#define VIRTIO_BLK_T_OUT 1
+#define VIRTIO_BLK_T_FLUSH 4
+#define VIRTIO_BLK_T_GET_ID 8
+#define VIRTIO_BLK_S_OK 0
+#define VIRTIO_BLK_S_IOERR 1
+#define VIRTIO_BLK_S_UNSUPP 2
+#define VIRTIO_BLK_SECTOR_SIZE 512
+#define VIRTIO_BLK_ID_BYTES 20
+
+#define VIRTIO_QUEUE_SIZE 256 // QueueNumMax, and the longest descriptor chain accepted
+#define VIRTIO_MAX_QUEUES 2
+
+typedef struct {
+    uint32_t num;
+    bool ready;
+    uint64_t desc;       // Descriptor table
+    uint64_t driver;     // Available ring
+    uint64_t device;     // Used ring
+    uint16_t last_avail; // Next available entry the device has not consumed
+} VirtQueue;
+
+typedef struct {
+    uint32_t device_id; // 0 leaves the window empty, which drivers skip
+    uint32_t num_queues;
+    uint64_t features;
+    uint64_t driver_features;
+    uint32_t features_sel;
+    uint32_t driver_features_sel;
+    uint32_t queue_sel;
+    uint32_t status;
+    uint32_t interrupt_status;
+    VirtQueue queues[VIRTIO_MAX_QUEUES];
+    uint64_t requests; // Descriptor chains completed
+} VirtioDevice;
+
+typedef struct Virtio {
+    VirtioDevice devices[VIRTIO_NUM_DEVICES];
+    uint8_t *disk;      // Shared mapping of the disk image, NULL without --disk
+    uint64_t disk_size;
+    bool read_only;     // The image could only be opened for reading
+} Virtio;
+
+struct Emulator;
+
+// Maps disk_path (NULL for none) and enables the console when asked; fails only on the image
+bool open_virtio(Virtio *virtio, const char *disk_path, bool console);
+void close_virtio(Virtio *virtio);
+uint64_t virtio_load(struct Emulator *emu, uint64_t addr, uint32_t size);
+// A QueueNotify store serves every chain the driver has made available before returning
+void virtio_store(struct Emulator *emu, uint64_t addr, uint32_t size, uint64_t value);
+
+#endif // VIRTIO_H
@@ -0,0 +1,582 @@
+#!/usr/bin/env python3
+# Generates the self-checking conformance tests in this directory: python3 tests/isa/gen.py tests/isa
+#
+# Each test is a list of cases. A case loads its test number into x3, runs the instruction under
+# test and compares the result against the value Python computed, branching to the shared fail
+# sequence on a mismatch. The expected values come from the definitions below, not from the
+# emulator, so a wrong handler fails here instead of being copied into the test.
+import os
+import sys
+
+MASK = (1 << 64) - 1
+TOHOST = 0x8000
+DATA = 0x9000
+CLINT_MTIMECMP = 0x02004000
+
+
+def sx(value, bits=64):
+    value &= (1 << bits) - 1
+    return value - (1 << bits) if value >> (bits - 1) else value
+
+
+def u64(value):
+    return value & MASK
+
+
+# Encoders
+def r_type(funct7, rs2, rs1, funct3, rd, opcode):
+    return (funct7 << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode
+
+
+def i_type(imm, rs1, funct3, rd, opcode):
+    return ((imm & 0xFFF) << 20) | (rs1 << 15) | (funct3 << 12) | (rd << 7) | opcode
+
+
+def s_type(imm, rs2, rs1, funct3, opcode=0x23):
+    imm &= 0xFFF
+    return ((imm >> 5) << 25) | (rs2 << 20) | (rs1 << 15) | (funct3 << 12) | ((imm & 0x1F) << 7) | opcode
+
+
+def b_type(imm, rs2, rs1, funct3, opcode=0x63):
+    imm &= 0x1FFF
+    return (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3F) << 25) | (rs2 << 20) | (rs1 << 15) | \
+        (funct3 << 12) | (((imm >> 1) & 0xF) << 8) | (((imm >> 11) & 1) << 7) | opcode
+
+
+def u_type(imm, rd, opcode):
+    return ((imm & 0xFFFFF) << 12) | (rd << 7) | opcode
+
+
+def j_type(imm, rd, opcode=0x6F):
+    imm &= 0x1FFFFF
+    return (((imm >> 20) & 1) << 31) | (((imm >> 1) & 0x3FF) << 21) | (((imm >> 11) & 1) << 20) | \
+        (((imm >> 12) & 0xFF) << 12) | (rd << 7) | opcode
+
+
+def addi(rd, rs1, imm): return i_type(imm, rs1, 0, rd, 0x13)
+def slli(rd, rs1, shamt): return i_type(shamt, rs1, 1, rd, 0x13)
+def ori(rd, rs1, imm): return i_type(imm, rs1, 6, rd, 0x13)
+def lw(rd, rs1, imm): return i_type(imm, rs1, 2, rd, 0x03)
+def ld(rd, rs1, imm): return i_type(imm, rs1, 3, rd, 0x03)
+def sw(rs2, rs1, imm): return s_type(imm, rs2, rs1, 2)
+def sd(rs2, rs1, imm): return s_type(imm, rs2, rs1, 3)
+def bne(rs1, rs2, imm): return b_type(imm, rs2, rs1, 1)
+def lui(rd, imm): return u_type(imm, rd, 0x37)
+def auipc(rd, imm): return u_type(imm, rd, 0x17)
+def jal(rd, imm): return j_type(imm, rd)
+def jalr(rd, rs1, imm): return i_type(imm, rs1, 0, rd, 0x67)
+def sub(rd, rs1, rs2): return r_type(0x20, rs2, rs1, 0, rd, 0x33)
+def csr(funct3, rd, number, rs1): return i_type(number, rs1, funct3, rd, 0x73)
+
+
+ECALL = 0x00000073
+EBREAK = 0x00100073
+MRET = 0x30200073
+
+
+class Test:
+    def __init__(self, name, title):
+        self.name, self.title, self.items, self.number = name, title, [], 1
+
+    def emit(self, word, text):
+        self.items.append((word, text))
+
+    def pc(self):
+        return 4 * len(self.items)
+
+    # Loads any 64-bit constant with lui/addi/slli
+    def li(self, rd, value):
+        value = sx(value)
+        if -2048 <= value < 2048:
+            self.emit(addi(rd, 0, value), 'addi x%d, x0, %d' % (rd, value))
+            return
+        if -0x80000000 <= value < 0x7FFFF800:
+            hi = (value + 0x800) >> 12
+            lo = value - (hi << 12)
+            self.emit(lui(rd, hi & 0xFFFFF), 'lui x%d, 0x%x' % (rd, hi & 0xFFFFF))
+            if lo:
+                self.emit(addi(rd, rd, lo), 'addi x%d, x%d, %d' % (rd, rd, lo))
+            return
+        lo = sx(value & 0xFFF, 12)
+        self.li(rd, (value - lo) >> 12)
+        self.emit(slli(rd, rd, 12), 'slli x%d, x%d, 12' % (rd, rd))
+        if lo:
+            self.emit(addi(rd, rd, lo), 'addi x%d, x%d, %d' % (rd, rd, lo))
+
+    def case(self):
+        self.number += 1
+        self.li(3, self.number)
+
+    def fail_if_ne(self, a, b):
+        self.items.append(('bne_fail', a, b))
+
+    def jump_fail(self):
+        self.items.append(('jal_fail',))
+
+    def render(self):
+        fail = 4 * (len(self.items) + 4)  # After the pass sequence
+        out = ['# %s: %s' % (self.name, self.title),
+               '# Self-checking: writes 1 to tohost (0x%x) on success, (test << 1) | 1 on failure' % TOHOST]
+        for index, item in enumerate(self.items):
+            offset = fail - 4 * index
+            if item[0] == 'bne_fail':
+                assert offset < 4096, '%s: fail sequence out of branch range' % self.name
+                out.append('%08x # bne x%d, x%d, fail' % (bne(item[1], item[2], offset), item[1], item[2]))
+            elif item[0] == 'jal_fail':
+                out.append('%08x # jal x0, fail' % jal(0, offset))
+            else:
+                out.append('%08x # %s' % item)
+        out += ['# pass',
+                '%08x # addi x1, x0, 1' % addi(1, 0, 1),
+                '%08x # lui x5, 0x%x' % (lui(5, TOHOST >> 12), TOHOST >> 12),
+                '%08x # sd x1, 0(x5)' % sd(1, 5, 0),
+                'ffffffff # exit',
+                '# fail',
+                '%08x # slli x3, x3, 1' % slli(3, 3, 1),
+                '%08x # ori x3, x3, 1' % ori(3, 3, 1),
+                '%08x # lui x5, 0x%x' % (lui(5, TOHOST >> 12), TOHOST >> 12),
+                '%08x # sd x3, 0(x5)' % sd(3, 5, 0),
+                'ffffffff # exit']
+        return '\n'.join(out) + '\n'
+
+
+tests = []
+
+
+def new(name, title):
+    test = Test(name, title)
+    tests.append(test)
+    return test
+
+
+VALUES = [0, 1, 2, 3, 7, 0x7FF, 0xFFFFFFFFFFFFF800, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF80000000,
+          0x7FFFFFFFFFFFFFFF, 0x8000000000000000, MASK, 0x123456789ABCDEF0, 0x0F0F0F0F0F0F0F0F]
+PAIRS = [(VALUES[a], VALUES[b]) for a in range(len(VALUES)) for b in range(len(VALUES))
+         if (a * 7 + b * 3) % 5 == 0][:24]
+# Operand pairs for multiply and divide: signs, zero divisors and the overflowing INT_MIN / -1
+MD_PAIRS = [(7, 2), (u64(-7), 2), (7, u64(-2)), (u64(-7), u64(-2)), (42, 0), (0, 0),
+            (0x8000000000000000, MASK), (0x8000000000000000, 1), (MASK, MASK), (0x7FFFFFFFFFFFFFFF, 2),
+            (0x80000000, MASK), (0xFFFFFFFF80000000, 0xFFFFFFFF), (0x123456789ABCDEF0, 0x0F0F0F0F0F0F0F0F),
+            (0x00000000FFFFFFFF, 0x0000000100000000)]
+
+
+def register_tests(opcode, ops, pairs, title):
+    for name, (funct3, funct7, compute) in ops.items():
+        t = new(name, title % name.upper())
+        for a, b in pairs:
+            t.case()
+            t.li(1, a)
+            t.li(2, b)
+            t.emit(r_type(funct7, 2, 1, funct3, 14, opcode), '%s x14, x1, x2' % name)
+            t.li(7, compute(a, b))
+            t.fail_if_ne(14, 7)
+        yield t
+
+
+R = {
+    'add': (0, 0x00, lambda a, b: a + b), 'sub': (0, 0x20, lambda a, b: a - b),
+    'sll': (1, 0x00, lambda a, b: a << (b & 63)), 'slt': (2, 0x00, lambda a, b: int(sx(a) < sx(b))),
+    'sltu': (3, 0x00, lambda a, b: int(a < b)), 'xor': (4, 0x00, lambda a, b: a ^ b),
+    'srl': (5, 0x00, lambda a, b: a >> (b & 63)), 'sra': (5, 0x20, lambda a, b: sx(a) >> (b & 63)),
+    'or': (6, 0x00, lambda a, b: a | b), 'and': (7, 0x00, lambda a, b: a & b),
+}
+shift_pairs = [(a, s) for a in (MASK, 0x8000000000000001) for s in (0, 1, 31, 32, 63, 64 + 5)]
+for t in register_tests(0x33, R, PAIRS + shift_pairs, '%s register-register'):
+    funct3, funct7, compute = R[t.name]
+    # rd == rs1 and an x0 destination
+    t.case()
+    t.li(1, 13)
+    t.li(2, 11)
+    t.emit(r_type(funct7, 2, 1, funct3, 1, 0x33), '%s x1, x1, x2' % t.name)
+    t.li(7, compute(13, 11))
+    t.fail_if_ne(1, 7)
+    t.case()
+    t.emit(r_type(funct7, 2, 1, funct3, 0, 0x33), '%s x0, x1, x2' % t.name)
+    t.fail_if_ne(0, 0)
+
+IMMEDIATES = [0, 1, -1, 0x7FF, -0x800, 0x555, -0x2AB]
+I = {
+    'addi': (0, lambda a, m: a + m), 'slti': (2, lambda a, m: int(sx(a) < m)),
+    'sltiu': (3, lambda a, m: int(a < u64(m))), 'xori': (4, lambda a, m: a ^ u64(m)),
+    'ori': (6, lambda a, m: a | u64(m)), 'andi': (7, lambda a, m: a & u64(m)),
+}
+for name, (funct3, compute) in I.items():
+    t = new(name, name.upper() + ' register-immediate')
+    for a_index, a in enumerate(VALUES[::2]):
+        for m_index, m in enumerate(IMMEDIATES):
+            if (a_index + m_index) % 2 and m not in (0, -1):
+                continue
+            t.case()
+            t.li(1, a)
+            t.emit(i_type(m, 1, funct3, 14, 0x13), '%s x14, x1, %d' % (name, m))
+            t.li(7, compute(a, m))
+            t.fail_if_ne(14, 7)
+
+
+def shift_immediate_tests(opcode, ops, values, amounts, title):
+    for name, (funct3, top, compute) in ops.items():
+        t = new(name, name.upper() + title)
+        for a in values:
+            for shamt in amounts:
+                t.case()
+                t.li(1, a)
+                t.emit(i_type(top | shamt, 1, funct3, 14, opcode), '%s x14, x1, %d' % (name, shamt))
+                t.li(7, compute(a, shamt))
+                t.fail_if_ne(14, 7)
+
+
+shift_immediate_tests(0x13, {
+    'slli': (1, 0, lambda a, s: a << s), 'srli': (5, 0, lambda a, s: a >> s),
+    'srai': (5, 0x400, lambda a, s: sx(a) >> s),
+}, (1, MASK, 0x8000000000000001, 0x123456789ABCDEF0), (0, 1, 7, 31, 32, 63), ' shift by immediate')
+
+# RV64 word operations work on the low 32 bits and sign-extend the result
+W = {
+    'addw': (0, 0x00, lambda a, b: sx(a + b, 32)), 'subw': (0, 0x20, lambda a, b: sx(a - b, 32)),
+    'sllw': (1, 0x00, lambda a, b: sx(a << (b & 31), 32)),
+    'srlw': (5, 0x00, lambda a, b: sx((a & 0xFFFFFFFF) >> (b & 31), 32)),
+    'sraw': (5, 0x20, lambda a, b: sx(a, 32) >> (b & 31)),
+}
+for name in ('addw', 'subw'):
+    list(register_tests(0x3B, {name: W[name]}, PAIRS, '%s 32-bit with sign extension'))
+for name in ('sllw', 'srlw', 'sraw'):
+    word_shifts = [(a, s) for a in (0xFFFFFFFF00000001, 0x80000000, 0x123456789ABCDEF0) for s in (0, 1, 31, 32, 33, 63)]
+    list(register_tests(0x3B, {name: W[name]}, word_shifts, '%s 32-bit shift by register'))
+
+t = new('addiw', 'ADDIW 32-bit add immediate with sign extension')
+for a in (0, 0x7FFFFFFF, 0x80000000, 0xFFFFFFFF, 0x123456789ABCDEF0, MASK):
+    for m in (0, 1, -1, 0x7FF, -0x800):
+        t.case()
+        t.li(1, a)
+        t.emit(i_type(m, 1, 0, 14, 0x1B), 'addiw x14, x1, %d' % m)
+        t.li(7, sx(a + m, 32))
+        t.fail_if_ne(14, 7)
+shift_immediate_tests(0x1B, {
+    'slliw': (1, 0, lambda a, s: sx(a << s, 32)),
+    'srliw': (5, 0, lambda a, s: sx((a & 0xFFFFFFFF) >> s, 32)),
+    'sraiw': (5, 0x400, lambda a, s: sx(a, 32) >> s),
+}, (1, 0xFFFFFFFF80000001, 0x123456789ABCDEF0), (0, 1, 7, 31), ' 32-bit shift by immediate')
+
+
+# M extension: division by zero and overflow have defined results instead of trapping
+def div(a, b, bits=64):
+    a, b = sx(a, bits), sx(b, bits)
+    if b == 0:
+        return -1
+    if a == -(1 << (bits - 1)) and b == -1:
+        return a
+    quotient = abs(a) // abs(b)
+    return quotient if (a < 0) == (b < 0) else -quotient
+
+
+def rem(a, b, bits=64):
+    a, b = sx(a, bits), sx(b, bits)
+    if b == 0:
+        return a
+    if a == -(1 << (bits - 1)) and b == -1:
+        return 0
+    return a - b * div(a, b, bits)
+
+
+def divu(a, b, bits=64):
+    a, b = a & ((1 << bits) - 1), b & ((1 << bits) - 1)
+    return (1 << bits) - 1 if b == 0 else a // b
+
+
+def remu(a, b, bits=64):
+    a, b = a & ((1 << bits) - 1), b & ((1 << bits) - 1)
+    return a if b == 0 else a % b
+
+
+MUL = {
+    'mul': (0, 1, lambda a, b: a * b),
+    'mulh': (1, 1, lambda a, b: (sx(a) * sx(b)) >> 64),
+    'mulhsu': (2, 1, lambda a, b: (sx(a) * b) >> 64),
+    'mulhu': (3, 1, lambda a, b: (a * b) >> 64),
+    'div': (4, 1, div), 'divu': (5, 1, divu), 'rem': (6, 1, rem), 'remu': (7, 1, remu),
+}
+list(register_tests(0x33, MUL, MD_PAIRS, '%s from the M extension'))
+MULW = {
+    'mulw': (0, 1, lambda a, b: sx(a * b, 32)),
+    'divw': (4, 1, lambda a, b: sx(div(a, b, 32), 32)), 'divuw': (5, 1, lambda a, b: sx(divu(a, b, 32), 32)),
+    'remw': (6, 1, lambda a, b: sx(rem(a, b, 32), 32)), 'remuw': (7, 1, lambda a, b: sx(remu(a, b, 32), 32)),
+}
+list(register_tests(0x3B, MULW, MD_PAIRS, '%s 32-bit from the M extension'))
+
+t = new('lui', 'LUI')
+for imm in (0, 1, 0x7FFFF, 0x80000, 0xFFFFF, 0x12345):
+    t.case()
+    t.emit(lui(14, imm), 'lui x14, 0x%x' % imm)
+    t.li(7, sx(imm << 12, 32))
+    t.fail_if_ne(14, 7)
+t = new('auipc', 'AUIPC')
+for imm in (0, 1, 0xFFFFF, 0x80000):
+    t.case()
+    pc = t.pc()
+    t.emit(auipc(14, imm), 'auipc x14, 0x%x' % imm)
+    t.li(7, pc + sx(imm << 12, 32))
+    t.fail_if_ne(14, 7)
+
+t = new('jal', 'JAL links and jumps forward and backward')
+t.case()
+pc = t.pc()
+t.emit(jal(1, 8), 'jal x1, +8')
+t.jump_fail()
+t.li(7, pc + 4)
+t.fail_if_ne(1, 7)
+t.case()
+t.emit(jal(0, 12), 'jal x0, +12 (to forward)')
+back = t.pc()
+t.emit(jal(0, 12), 'jal x0, +12 (past the fail jump)')
+t.jump_fail()
+t.emit(jal(0, back - t.pc()), 'jal x0, back')  # The forward target jumps backwards
+
+t = new('jalr', 'JALR with offsets and rd == rs1')
+t.case()
+t.li(5, 0)
+patch = len(t.items) - 1
+pc = t.pc()
+t.emit(jalr(1, 5, 0), 'jalr x1, 0(x5)')
+t.jump_fail()
+target = t.pc()
+t.items[patch] = (addi(5, 0, target), 'addi x5, x0, %d' % target)
+t.li(7, pc + 4)
+t.fail_if_ne(1, 7)
+t.case()
+here = t.pc()
+t.emit(addi(5, 0, here + 16 - 4), 'addi x5, x0, target-4')
+t.emit(jalr(5, 5, 4), 'jalr x5, 4(x5)')
+t.jump_fail()
+t.jump_fail()
+t.li(7, here + 8)
+t.fail_if_ne(5, 7)
+
+B = {'beq': (0, lambda a, b: a == b), 'bne': (1, lambda a, b: a != b),
+     'blt': (4, lambda a, b: sx(a) < sx(b)), 'bge': (5, lambda a, b: sx(a) >= sx(b)),
+     'bltu': (6, lambda a, b: a < b), 'bgeu': (7, lambda a, b: a >= b)}
+for name, (funct3, taken) in B.items():
+    t = new(name, name.upper() + ' taken and not taken')
+    for a, b in [(0, 0), (1, 1), (MASK, MASK), (0, 1), (1, 0), (MASK, 1), (1, MASK),
+                 (0x8000000000000000, 0x7FFFFFFFFFFFFFFF)]:
+        t.case()
+        t.li(1, a)
+        t.li(2, b)
+        t.emit(b_type(8, 2, 1, funct3), '%s x1, x2, +8' % name)
+        if not taken(a, b):
+            t.emit(jal(0, 8), 'jal x0, +8')
+        t.jump_fail()
+    # A backward branch closing a loop
+    t.case()
+    t.li(1, 0)
+    t.li(2, 3)
+    if name == 'bne':
+        t.emit(addi(1, 1, 1), 'addi x1, x1, 1')
+        t.emit(b_type(-4, 2, 1, funct3), 'bne x1, x2, -4')
+        t.li(7, 3)
+        t.fail_if_ne(1, 7)
+
+LOADS = {'lb': (0, 1, True), 'lh': (1, 2, True), 'lw': (2, 4, True), 'ld': (3, 8, True),
+         'lbu': (4, 1, False), 'lhu': (5, 2, False), 'lwu': (6, 4, False)}
+PATTERN = 0xF00FF00FF00F807F
+for name, (funct3, size, signed) in LOADS.items():
+    t = new(name, name.upper() + ' with sign or zero extension')
+    t.li(10, DATA)
+    t.li(11, PATTERN)
+    t.emit(sd(11, 10, 0), 'sd x11, 0(x10)')
+    t.li(11, 0x0123456789ABCDEF)
+    t.emit(sd(11, 10, 8), 'sd x11, 8(x10)')
+    memory = PATTERN.to_bytes(8, 'little') + (0x0123456789ABCDEF).to_bytes(8, 'little')
+
+    def expected(offset):
+        value = int.from_bytes(memory[offset:offset + size], 'little')
+        return sx(value, size * 8) if signed else value
+    for offset in range(0, 16, size):
+        t.case()
+        t.emit(i_type(offset, 10, funct3, 14, 0x03), '%s x14, %d(x10)' % (name, offset))
+        t.li(7, expected(offset))
+        t.fail_if_ne(14, 7)
+    t.case()
+    t.li(12, DATA + 16)
+    t.emit(i_type(-16, 12, funct3, 14, 0x03), '%s x14, -16(x12)' % name)
+    t.li(7, expected(0))
+    t.fail_if_ne(14, 7)
+
+for name, funct3, size in (('sb', 0, 1), ('sh', 1, 2), ('sw', 2, 4), ('sd', 3, 8)):
+    t = new(name, name.upper() + ' stores only its bytes')
+    low = (1 << (size * 8)) - 1
+    t.li(10, DATA)
+    t.li(11, MASK)
+    t.emit(sd(11, 10, 0), 'sd x11, 0(x10)')
+    t.emit(sd(11, 10, 8), 'sd x11, 8(x10)')
+    t.case()
+    t.li(12, 0x1122334455667788)
+    t.emit(s_type(8, 12, 10, funct3), '%s x12, 8(x10)' % name)
+    t.emit(ld(14, 10, 8), 'ld x14, 8(x10)')
+    t.li(7, (MASK ^ low) | (0x1122334455667788 & low))
+    t.fail_if_ne(14, 7)
+    t.emit(ld(14, 10, 0), 'ld x14, 0(x10)')
+    t.li(7, MASK)
+    t.fail_if_ne(14, 7)
+    t.case()
+    t.li(12, DATA + 32)
+    t.emit(s_type(-16, 12, 12, funct3), '%s x12, -16(x12)' % name)
+    t.emit(ld(14, 10, 16), 'ld x14, 16(x10)')
+    t.li(7, (DATA + 32) & low)
+    t.fail_if_ne(14, 7)
+
+MSCRATCH = 0x340
+t = new('csr', 'CSR read-modify-write on mscratch')
+t.case()
+t.li(1, 0x0F)
+t.emit(csr(1, 0, MSCRATCH, 1), 'csrrw x0, mscratch, x1')
+t.li(2, 0xF0)
+t.emit(csr(2, 14, MSCRATCH, 2), 'csrrs x14, mscratch, x2')
+t.li(7, 0x0F)
+t.fail_if_ne(14, 7)
+t.case()
+t.emit(csr(3, 14, MSCRATCH, 1), 'csrrc x14, mscratch, x1')
+t.li(7, 0xFF)
+t.fail_if_ne(14, 7)
+t.case()
+t.emit(csr(2, 14, MSCRATCH, 0), 'csrr x14, mscratch')
+t.li(7, 0xF0)
+t.fail_if_ne(14, 7)
+t.case()
+t.emit(csr(5, 14, MSCRATCH, 5), 'csrrwi x14, mscratch, 5')
+t.li(7, 0xF0)
+t.fail_if_ne(14, 7)
+t.case()
+t.emit(csr(6, 0, MSCRATCH, 0x1A), 'csrrsi x0, mscratch, 0x1a')
+t.emit(csr(7, 14, MSCRATCH, 1), 'csrrci x14, mscratch, 1')
+t.li(7, 0x1F)
+t.fail_if_ne(14, 7)
+t.case()
+t.emit(csr(2, 14, MSCRATCH, 0), 'csrr x14, mscratch')
+t.li(7, 0x1E)
+t.fail_if_ne(14, 7)
+t.case()
+t.emit(csr(2, 14, 0xC02, 0), 'csrr x14, instret')
+t.emit(csr(2, 15, 0xC02, 0), 'csrr x15, instret')
+t.emit(sub(15, 15, 14), 'sub x15, x15, x14')
+t.li(7, 1)
+t.fail_if_ne(15, 7)
+
+# Counters: every instruction retires one and takes one cycle, and reads do not disturb them
+MCYCLE, MINSTRET, CYCLE, INSTRET = 0xB00, 0xB02, 0xC00, 0xC02
+t = new('counters', 'mcycle/minstret count every instruction and take writes')
+for number, text in ((MINSTRET, 'minstret'), (MCYCLE, 'mcycle'), (INSTRET, 'instret'), (CYCLE, 'cycle')):
+    t.case()
+    t.emit(csr(2, 14, number, 0), 'csrr x14, %s' % text)
+    t.emit(csr(6, 15, number, 0), 'csrrsi x15, %s, 0' % text)
+    t.emit(csr(3, 16, number, 0), 'csrrc x16, %s, x0' % text)
+    t.emit(addi(0, 0, 0), 'nop')
+    t.emit(csr(2, 17, number, 0), 'csrr x17, %s' % text)
+    t.emit(sub(15, 15, 14), 'sub x15, x15, x14')
+    t.emit(sub(16, 16, 14), 'sub x16, x16, x14')
+    t.emit(sub(17, 17, 14), 'sub x17, x17, x14')
+    for register, distance in ((15, 1), (16, 2), (17, 4)):
+        t.li(7, distance)
+        t.fail_if_ne(register, 7)
+for number, text, user in ((MINSTRET, 'minstret', INSTRET), (MCYCLE, 'mcycle', CYCLE)):
+    # The next instruction reads exactly what was written, and the user alias follows
+    t.case()
+    t.li(1, 1000)
+    t.emit(csr(1, 0, number, 1), 'csrw %s, x1' % text)
+    t.emit(csr(2, 14, number, 0), 'csrr x14, %s' % text)
+    t.emit(csr(2, 15, user, 0), 'csrr x15, %s' % ('instret' if user == INSTRET else 'cycle'))
+    t.li(7, 1000)
+    t.fail_if_ne(14, 7)
+    t.li(7, 1001)
+    t.fail_if_ne(15, 7)
+
+# Traps: ecall and ebreak enter mtvec with mepc and mcause set, and mret returns to mepc. The handler
+# counts traps in x20, checks mcause against x21 and leaves the mepc it saw in x24.
+t = new('traps', 'ECALL, EBREAK, mret and a timer interrupt')
+set_handler = len(t.items)
+t.emit(None, None)  # Patched with the handler address below
+t.emit(csr(1, 0, 0x305, 1), 'csrw mtvec, x1')
+for word, text, cause in ((ECALL, 'ecall', 11), (EBREAK, 'ebreak', 3)):
+    t.case()
+    t.li(21, cause)
+    t.li(20, 0)
+    trap_pc = t.pc()
+    t.emit(word, text)
+    t.li(7, 1)
+    t.fail_if_ne(20, 7)
+    t.li(7, trap_pc)
+    t.fail_if_ne(24, 7)
+# mtime is already past mtimecmp = 0, so the timer fires as soon as MIE and MTIE are both set
+t.case()
+t.li(21, (1 << 63) | 7)
+t.li(20, 0)
+t.li(5, CLINT_MTIMECMP)
+t.emit(sd(0, 5, 0), 'sd x0, 0(x5) (mtimecmp = 0)')
+t.li(1, 0x80)
+t.emit(csr(1, 0, 0x304, 1), 'csrw mie, x1 (MTIE)')
+t.emit(csr(6, 0, 0x300, 8), 'csrrsi x0, mstatus, 8 (MIE)')
+t.li(22, 0)
+t.li(23, 100000)
+spin = t.pc()
+t.emit(addi(22, 22, 1), 'addi x22, x22, 1')
+t.emit(bne(20, 0, 12), 'bne x20, x0, +12 (taken)')
+t.emit(bne(22, 23, spin - t.pc()), 'bne x22, x23, spin')
+t.jump_fail()
+t.case()
+t.li(7, 1)
+t.fail_if_ne(20, 7)
+t.emit(csr(2, 14, 0x300, 0), 'csrr x14, mstatus')
+t.emit(i_type(8, 14, 7, 14, 0x13), 'andi x14, x14, 8')
+t.li(7, 8)
+t.fail_if_ne(14, 7)  # mret turned MIE back on
+done_jump = len(t.items)
+t.emit(None, None)  # Patched with the jump over the handler below
+handler = t.pc()
+t.items[set_handler] = (addi(1, 0, handler), 'addi x1, x0, handler')
+t.emit(addi(20, 20, 1), 'handler: addi x20, x20, 1')
+t.emit(csr(2, 14, 0x342, 0), 'csrr x14, mcause')
+t.emit(bne(14, 21, 32), 'bne x14, x21, bad_cause')
+t.emit(csr(2, 24, 0x341, 0), 'csrr x24, mepc')
+t.emit(b_type(16, 0, 14, 4), 'blt x14, x0, interrupt')
+t.emit(addi(15, 24, 4), 'addi x15, x24, 4')
+t.emit(csr(1, 0, 0x341, 15), 'csrw mepc, x15 (exceptions resume after the instruction)')
+t.emit(MRET, 'mret')
+t.emit(csr(1, 0, 0x304, 0), 'interrupt: csrw mie, x0')
+t.emit(MRET, 'mret')
+t.jump_fail()  # bad_cause
+t.items[done_jump] = (jal(0, t.pc() - 4 * done_jump), 'jal x0, done')
+
+t = new('x0', 'Writes to x0 are discarded')
+t.case()
+t.emit(addi(0, 0, 5), 'addi x0, x0, 5')
+t.fail_if_ne(0, 0)
+t.emit(lui(0, 1), 'lui x0, 1')
+t.emit(addi(0, 0, 1), 'addi x0, x0, 1')
+t.li(10, DATA)
+t.li(11, 99)
+t.emit(sd(11, 10, 0), 'sd x11, 0(x10)')
+t.emit(ld(0, 10, 0), 'ld x0, 0(x10)')
+t.emit(addi(14, 0, 0), 'addi x14, x0, 0')
+t.li(7, 0)
+t.fail_if_ne(14, 7)
+
+t = new('smc', 'Self-modifying code runs the rewritten instruction')
+t.case()
+t.li(1, 0)
+t.li(2, 2)
+loop = t.pc()
+t.emit(addi(14, 0, 1), 'addi x14, x0, 1 (patched to addi x14, x0, 42)')
+t.emit(addi(1, 1, 1), 'addi x1, x1, 1')
+t.li(5, addi(14, 0, 42))
+t.emit(sw(5, 0, loop), 'sw x5, patch(x0)')
+t.emit(b_type(loop - t.pc(), 2, 1, 1), 'bne x1, x2, loop')
+t.li(7, 42)
+t.fail_if_ne(14, 7)
+
+if __name__ == '__main__':
+    if len(sys.argv) != 2:
+        sys.exit('Usage: %s OUTDIR' % sys.argv[0])
+    os.makedirs(sys.argv[1], exist_ok=True)
+    for test in tests:
+        with open(os.path.join(sys.argv[1], test.name + '.hex'), 'w') as out:
+            out.write(test.render())
+    print(len(tests), 'tests')